@@ -80,6 +80,9 @@ typedef struct spd_audio_plugin {
 	/* Clean up audio after playback. Needs to drain the audio if this
 	   wasn't done already. */
 	int (*end)  (AudioID *id);
+	/* Number of frames fed since begin() which the device has not played
+	   yet, or a negative value if it can't tell */
+	long (*delay) (AudioID *id);
 } spd_audio_plugin_t;
 
 /* *INDENT-OFF* */
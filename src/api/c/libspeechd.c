@@ -64,7 +64,11 @@
 static FILE *spd_debug = NULL;
 #endif
 
+static const char *spd_priority_name(SPDPriority priority);
 static int spd_set_priority(SPDConnection * connection, SPDPriority priority);
+static int spd_send_pipelined_wo_mutex(SPDConnection * connection,
+				       const char *message, int nreplies,
+				       char **replies);
 static char *escape_dot(const char *text);
 static int isanum(char *str);
 static char *get_reply(SPDConnection * connection);
@@ -627,93 +631,73 @@ void spd_close(SPDConnection * connection)
 	free(connection);
 }
 
-/* Helper functions for spd_say. */
-static inline int
-spd_say_prepare(SPDConnection * connection, SPDPriority priority,
-		const char *text, char **escaped_text)
+/* Say TEXT with priority PRIORITY.
+ *
+ * The priority, the SPEAK command, the escaped text and the end of data
+ * marker are all sent in one write and the three replies are collected
+ * afterwards, so that saying something costs a single round trip to the
+ * server.
+ *
+ * Returns msg_uid on success, -1 otherwise. */
+int spd_say(SPDConnection * connection, SPDPriority priority, const char *text)
 {
-	int ret = 0;
+	const char *p_name;
+	char *escaped_text;
+	char *message;
+	char *replies[3] = { NULL, NULL, NULL };
+	int msg_id = -1;
+	int err;
+	int i;
+
+	if (text == NULL) {
+		SPD_DBG("spd_say called with a NULL argument for <text>");
+		return -1;
+	}
 
 	SPD_DBG("Text to say is: %s", text);
 
+	p_name = spd_priority_name(priority);
+	if (p_name == NULL) {
+		SPD_DBG("Error: Can't set priority! Incorrect value.");
+		return -1;
+	}
+
 	/* Insure that there is no escape sequence in the text */
-	*escaped_text = escape_dot(text);
-	/* Caller is now responsible for escaped_text. */
-	if (*escaped_text == NULL) {	/* Out of memory. */
+	escaped_text = escape_dot(text);
+	if (escaped_text == NULL) {	/* Out of memory. */
 		SPD_DBG("spd_say could not allocate memory.");
-		ret = -1;
-	} else {
-		/* Set priority */
-		SPD_DBG("Setting priority");
-		ret = spd_set_priority(connection, priority);
-		if (!ret) {
-			/* Start the data flow */
-			SPD_DBG("Sending SPEAK");
-			ret = spd_execute_command_wo_mutex(connection, "speak");
-			if (ret) {
-				SPD_DBG("Error: Can't start data flow!");
-			}
-		}
+		return -1;
 	}
 
-	return ret;
-}
+	message = g_strdup_printf("SET SELF PRIORITY %s\r\nSPEAK\r\n%s\r\n.\r\n",
+				  p_name, escaped_text);
+	free(escaped_text);
 
-static inline int spd_say_sending(SPDConnection * connection, const char *text)
-{
-	int msg_id = -1;
-	int err = 0;
-	char *reply = NULL;
-	char *pret = NULL;
+	pthread_mutex_lock(&connection->ssip_mutex);
 
-	/* Send data */
-	SPD_DBG("Sending data");
-	pret = spd_send_data_wo_mutex(connection, text, SPD_NO_REPLY);
-	if (pret == NULL) {
+	SPD_DBG("Sending priority, SPEAK and data");
+	if (spd_send_pipelined_wo_mutex(connection, message, 3, replies)) {
 		SPD_DBG("Can't send data wo mutex");
+	} else if (ret_ok(replies[0]) != 1) {
+		SPD_DBG("Error: Can't set priority!");
+	} else if (ret_ok(replies[1]) != 1) {
+		SPD_DBG("Error: Can't start data flow!");
+	} else if (ret_ok(replies[2]) != 1) {
+		SPD_DBG("Can't terminate data flow");
 	} else {
-		/* Terminate data flow */
-		SPD_DBG("Terminating data flow");
-		err =
-		    spd_execute_command_with_reply(connection, "\r\n.", &reply);
-		if (err) {
-			SPD_DBG("Can't terminate data flow");
-		} else {
-			msg_id = get_param_int(reply, 1, &err);
-			if (err < 0) {
-				SPD_DBG
-				    ("Can't determine SSIP message unique ID parameter.");
-				msg_id = -1;
-			}
+		msg_id = get_param_int(replies[2], 1, &err);
+		if (err < 0) {
+			SPD_DBG
+			    ("Can't determine SSIP message unique ID parameter.");
+			msg_id = -1;
 		}
 	}
 
-	free(reply);
-	free(pret);
-	return msg_id;
-}
-
-/* Say TEXT with priority PRIORITY.
- * Returns msg_uid on success, -1 otherwise. */
-int spd_say(SPDConnection * connection, SPDPriority priority, const char *text)
-{
-	char *escaped_text = NULL;
-	int msg_id = -1;
-	int prepare_failed = 0;
-
-	if (text != NULL) {
-		pthread_mutex_lock(&connection->ssip_mutex);
-
-		prepare_failed =
-		    spd_say_prepare(connection, priority, text, &escaped_text);
-		if (!prepare_failed)
-			msg_id = spd_say_sending(connection, escaped_text);
+	pthread_mutex_unlock(&connection->ssip_mutex);
 
-		free(escaped_text);
-		pthread_mutex_unlock(&connection->ssip_mutex);
-	} else {
-		SPD_DBG("spd_say called with a NULL argument for <text>");
-	}
+	for (i = 0; i < 3; i++)
+		free(replies[i]);
+	g_free(message);
 
 	SPD_DBG("Returning from spd_say");
 	return msg_id;
@@ -1736,28 +1720,31 @@ char *spd_send_data_wo_mutex(SPDConnection * connection, const char *message,
 
 /* --------------------- Internal functions ------------------------- */
 
-static int spd_set_priority(SPDConnection * connection, SPDPriority priority)
+static const char *spd_priority_name(SPDPriority priority)
 {
-	static char p_name[16];
-	static char command[64];
-
 	switch (priority) {
 	case SPD_IMPORTANT:
-		strcpy(p_name, "IMPORTANT");
-		break;
+		return "IMPORTANT";
 	case SPD_MESSAGE:
-		strcpy(p_name, "MESSAGE");
-		break;
+		return "MESSAGE";
 	case SPD_TEXT:
-		strcpy(p_name, "TEXT");
-		break;
+		return "TEXT";
 	case SPD_NOTIFICATION:
-		strcpy(p_name, "NOTIFICATION");
-		break;
+		return "NOTIFICATION";
 	case SPD_PROGRESS:
-		strcpy(p_name, "PROGRESS");
-		break;
+		return "PROGRESS";
 	default:
+		return NULL;
+	}
+}
+
+static int spd_set_priority(SPDConnection * connection, SPDPriority priority)
+{
+	static char command[64];
+	const char *p_name;
+
+	p_name = spd_priority_name(priority);
+	if (p_name == NULL) {
 		SPD_DBG("Error: Can't set priority! Incorrect value.");
 		return -1;
 	}
@@ -1766,6 +1753,89 @@ static int spd_set_priority(SPDConnection * connection, SPDPriority priority)
 	return spd_execute_command_wo_mutex(connection, command);
 }
 
+/* Write MESSAGE, which may hold several commands and data, to the socket
+ * at once and then read NREPLIES protocol replies into REPLIES, in the
+ * order the server sent them. The replies are allocated with malloc and
+ * must be freed by the caller, also on failure. Returns 0 if all the
+ * replies were read, -1 otherwise. */
+static int spd_send_pipelined_wo_mutex(SPDConnection * connection,
+				       const char *message, int nreplies,
+				       char **replies)
+{
+	size_t len, written;
+	ssize_t ret;
+	char *reply;
+	int i;
+
+	SPD_DBG("Inside spd_send_pipelined_wo_mutex");
+
+	if (connection->stream == NULL)
+		return -1;
+
+	if (connection->mode == SPD_MODE_THREADED) {
+		/* Make sure we don't get the cond_reply_ready signal before we are in
+		   cond_wait() */
+		pthread_mutex_lock(&connection->td->mutex_reply_ready);
+	}
+
+	/* write message to the socket */
+	SPD_DBG("Writing to socket");
+	len = strlen(message);
+	written = 0;
+	while (written < len) {
+		ret = write(connection->socket, message + written,
+			    len - written);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			SPD_DBG("Can't write to socket: %s", strerror(errno));
+			if (connection->mode == SPD_MODE_THREADED)
+				pthread_mutex_unlock(&connection->
+						     td->mutex_reply_ready);
+			return -1;
+		}
+		written += ret;
+	}
+	SPD_DBG("Written to socket");
+	SPD_DBG(">> : |%s|", message);
+
+	for (i = 0; i < nreplies; i++) {
+		if (connection->mode == SPD_MODE_THREADED) {
+			/* Wait until the reply is ready */
+			pthread_cond_wait(&connection->td->cond_reply_ready,
+					  &connection->td->mutex_reply_ready);
+			reply = connection->reply;
+			connection->reply = NULL;
+			/* Keep mutex_reply_ready until we are back in
+			   cond_wait() for the next reply, so that its
+			   signal can't get lost */
+			if (reply == NULL || i == nreplies - 1)
+				pthread_mutex_unlock(&connection->
+						     td->mutex_reply_ready);
+			if (reply == NULL) {
+				SPD_DBG
+				    ("Error: Can't read reply, broken socket in spd_send_pipelined.");
+				return -1;
+			}
+			/* Signal the reply has been read */
+			pthread_mutex_lock(&connection->td->mutex_reply_ack);
+			pthread_cond_signal(&connection->td->cond_reply_ack);
+			pthread_mutex_unlock(&connection->td->mutex_reply_ack);
+		} else {
+			reply = get_reply(connection);
+			if (reply == NULL) {
+				SPD_DBG
+				    ("Error: Can't read reply, broken socket in spd_send_pipelined.");
+				return -1;
+			}
+		}
+		SPD_DBG("<< : |%s|\n", reply);
+		replies[i] = reply;
+	}
+
+	return 0;
+}
+
 static char *get_reply(SPDConnection * connection)
 {
 	GString *str;
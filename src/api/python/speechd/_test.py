@@ -18,7 +18,8 @@
 import unittest
 import time
 
-from .client import PunctuationMode, CallbackType, SSIPClient, Scope, Speaker
+from .client import PunctuationMode, CallbackType, SSIPClient, Scope, Speaker, \
+     Priority
 
 
 class _SSIPClientTest(unittest.TestCase):
@@ -75,7 +76,32 @@ class AutomaticTest(_SSIPClientTest):
                 "code of this test method if you want to investigate "
                 "further.")
 
-    
+    def test_pipelined_speak(self):
+        # Measure utterances per second with and without sending the
+        # priority, SPEAK and the data in a single write.
+        c = self._client
+        c.set_output_module('dummy')
+        count = 200
+        start = time.time()
+        for i in range(count):
+            c.set_priority(Priority.PROGRESS)
+            c._conn.send_command('SPEAK')
+            c._conn.send_data("Message %d" % i)
+        sequential = count / (time.time() - start)
+        c.cancel()
+        ids = []
+        start = time.time()
+        for i in range(count):
+            code, msg, data = c.speak("Message %d" % i,
+                                      priority=Priority.PROGRESS)
+            assert code == 225, (code, msg)
+            ids.append(int(data[0]))
+        pipelined = count / (time.time() - start)
+        c.cancel()
+        assert ids == sorted(ids) and len(set(ids)) == count, ids
+        print("\nutterances per second: %.0f sequential, %.0f pipelined"
+              % (sequential, pipelined))
+
 
 class VoiceTest(_SSIPClientTest):
     """This set of tests requires a user to listen to it.
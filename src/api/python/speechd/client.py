@@ -298,6 +298,27 @@ class _SSIP_Connection(object):
         del self._com_buffer[0]
         return response
 
+    def _format_command(self, command, *args):
+        if __debug__:
+            if command in ('SET', 'CANCEL', 'STOP',):
+                assert args[0] in (Scope.SELF, Scope.ALL) \
+                       or isinstance(args[0], int)
+        return ' '.join((command,) + tuple(map(str, args)))
+
+    def _escape_data(self, data):
+        data = data.encode('utf-8')
+        # Escape the end-of-data marker even if present at the beginning
+        # The start of the string is also the start of a line.
+        if data.startswith(self._END_OF_DATA_MARKER):
+            l = len(self._END_OF_DATA_MARKER)
+            data = self._END_OF_DATA_MARKER_ESCAPED + data[l:]
+
+        # Escape the end of data marker at the start of each subsequent
+        # line.  We can do that by simply replacing \r\n. with \r\n..,
+        # since the start of a line is immediately preceded by \r\n,
+        # when the line is not the beginning of the string.
+        return data.replace(self._RAW_DOTLINE, self._ESCAPED_DOTLINE)
+
     def send_command(self, command, *args):
         """Send SSIP command with given arguments and read server response.
 
@@ -315,11 +336,7 @@ class _SSIP_Connection(object):
         'IOError' is raised when the socket was closed by the remote side.
         
         """
-        if __debug__:
-            if command in ('SET', 'CANCEL', 'STOP',):
-                assert args[0] in (Scope.SELF, Scope.ALL) \
-                       or isinstance(args[0], int)
-        cmd = ' '.join((command,) + tuple(map(str, args)))
+        cmd = self._format_command(command, *args)
         try:
             self._socket.send(cmd.encode('utf-8') + self._NEWLINE)
         except socket.error:
@@ -340,19 +357,7 @@ class _SSIP_Connection(object):
         'IOError' is raised when the socket was closed by the remote side.
         
         """
-        data = data.encode('utf-8')
-        # Escape the end-of-data marker even if present at the beginning
-        # The start of the string is also the start of a line.
-        if data.startswith(self._END_OF_DATA_MARKER):
-            l = len(self._END_OF_DATA_MARKER)
-            data = self._END_OF_DATA_MARKER_ESCAPED + data[l:]
-
-        # Escape the end of data marker at the start of each subsequent
-        # line.  We can do that by simply replacing \r\n. with \r\n..,
-        # since the start of a line is immediately preceded by \r\n,
-        # when the line is not the beginning of the string.
-        data = data.replace(self._RAW_DOTLINE, self._ESCAPED_DOTLINE)
-
+        data = self._escape_data(data)
         try:
             self._socket.send(data + self._END_OF_DATA)
         except socket.error:
@@ -362,6 +367,45 @@ class _SSIP_Connection(object):
             raise SSIPDataError(code, msg, data)
         return code, msg, response_data
 
+    def send_pipelined(self, commands, data=None):
+        """Send several SSIP commands and optional data in a single write.
+
+        Arguments:
+          commands -- a sequence of tuples (command, arg1, arg2, ...), each
+            of them as would be passed to 'send_command()'.
+          data -- multiline data to send after the commands, as would be
+            passed to 'send_data()'.  The last command must be the one
+            which switches the server to data mode (i.e. 'SPEAK').
+
+        All the commands and the data go to the server at once and the
+        replies are collected afterwards, in order.  This saves a round trip
+        through the server for each command.
+
+        Returns a list of triplets (code, msg, data), one per command plus
+        one for the data, if given.
+
+        All the replies are always read so that the connection stays in
+        sync.  Then 'SSIPCommandError' or 'SSIPDataError' is raised for the
+        first one with a non 2xx return code.
+
+        """
+        cmds = [self._format_command(*c) for c in commands]
+        payload = b''.join(cmd.encode('utf-8') + self._NEWLINE for cmd in cmds)
+        if data is not None:
+            data = self._escape_data(data)
+            payload += data + self._END_OF_DATA
+        try:
+            self._socket.sendall(payload)
+        except socket.error:
+            raise SSIPCommunicationError("Speech Dispatcher connection lost.")
+        responses = [self._recv_response() for i in range(len(cmds) + (data is not None))]
+        for i, (code, msg, response_data) in enumerate(responses):
+            if code//100 != 2:
+                if i < len(cmds):
+                    raise SSIPCommandError(code, msg, cmds[i])
+                raise SSIPDataError(code, msg, data)
+        return responses
+
     def set_callback(self, callback):
         """Register a callback function for handling asynchronous events.
 
@@ -713,7 +757,7 @@ class SSIPClient(object):
                     value)
         self._conn.send_command('SET', Scope.SELF, 'SSML_MODE', ssip_val)
 
-    def speak(self, text, callback=None, event_types=None):
+    def speak(self, text, callback=None, event_types=None, priority=None):
         """Say given message.
 
         Arguments:
@@ -727,6 +771,9 @@ class SSIPClient(object):
             be called.  Each item must be one of `CallbackType' constants.
             None (the default value) means to handle all event types.  This
             argument is irrelevant when `callback' is not used.
+          priority -- one of the 'Priority' constants.  When given, the
+            priority is set for this and the following messages, as with
+            'set_priority()', but without an extra round trip to the server.
 
         The callback function will be called whenever one of the events occurs.
         The event type will be passed as argument.  Its value is one of the
@@ -742,8 +789,14 @@ class SSIPClient(object):
         message is queued on the server and the method returns immediately.
 
         """
-        self._conn.send_command('SPEAK')
-        result = self._conn.send_data(text)
+        commands = []
+        if priority is not None:
+            assert priority in (Priority.IMPORTANT, Priority.MESSAGE,
+                                Priority.TEXT, Priority.NOTIFICATION,
+                                Priority.PROGRESS), priority
+            commands.append(('SET', Scope.SELF, 'PRIORITY', priority))
+        commands.append(('SPEAK',))
+        result = self._conn.send_pipelined(commands, text)[-1]
         if callback:
             msg_id = int(result[2][0])
             # TODO: Here we risk, that the callback arrives earlier, than we
@@ -1135,8 +1188,7 @@ class Client(SSIPClient):
         super(Client, self).__init__(name, **kwargs)
         
     def say(self, text, priority=Priority.MESSAGE):
-        self.set_priority(priority)
-        self.speak(text)
+        self.speak(text, priority=priority)
 
     def char(self, char, priority=Priority.TEXT):
         self.set_priority(priority)
@@ -55,6 +55,10 @@ typedef struct {
 	struct pollfd *alsa_poll_fds;	/* Descriptors to poll */
 	int alsa_opened;	/* 1 between snd_pcm_open and _close, 0 otherwise */
 	char *alsa_device_name;	/* the name of the device to open */
+	signed short *volume_samples;	/* the track with its volume adjusted */
+	size_t volume_samples_size;	/* bytes allocated for volume_samples */
+	unsigned xruns;		/* underruns since the device was opened */
+	unsigned stream_xruns;	/* underruns since the last begin */
 } spd_alsa_id_t;
 
 static int _alsa_close(spd_alsa_id_t * id);
@@ -138,7 +142,9 @@ static int xrun(spd_alsa_id_t * id)
 		gettimeofday(&now, 0);
 		snd_pcm_status_get_trigger_tstamp(status, &tstamp);
 		timersub(&now, &tstamp, &diff);
-		MSG(1, "underrun!!! (at least %.3f ms long)",
+		id->xruns++;
+		id->stream_xruns++;
+		MSG(1, "underrun %u (at least %.3f ms long)", id->xruns,
 		    diff.tv_sec * 1000 + diff.tv_usec / 1000.0);
 		if ((res = snd_pcm_prepare(id->alsa_pcm)) < 0) {
 			ERR("xrun: prepare error: %s", snd_strerror(res));
@@ -269,6 +275,10 @@ static AudioID *alsa_open(void **pars)
 	pthread_cond_init(&alsa_id->alsa_pipe_cond, NULL);
 
 	alsa_id->alsa_opened = 0;
+	alsa_id->volume_samples = NULL;
+	alsa_id->volume_samples_size = 0;
+	alsa_id->xruns = 0;
+	alsa_id->stream_xruns = 0;
 
 	MSG(1, "Opening ALSA sound output");
 
@@ -302,6 +312,7 @@ static int alsa_close(AudioID * id)
 	MSG(1, "ALSA closed.");
 
 	g_free(alsa_id->alsa_device_name);
+	g_free(alsa_id->volume_samples);
 	g_free(alsa_id);
 	id = NULL;
 
@@ -380,7 +391,6 @@ int wait_for_poll(spd_alsa_id_t * id, struct pollfd *alsa_poll_fds,
 }
 
 #define ERROR_EXIT() do {\
-	g_free(track_volume.samples); \
 	ERR("alsa_play() abnormal exit"); \
 	_alsa_close(alsa_id); \
 	return -1; \
@@ -476,6 +486,7 @@ static int alsa_begin(AudioID * id, AudioTrack track)
 	alsa_id->alsa_fd_count++;
 
 	alsa_id->alsa_opened = 1;
+	alsa_id->stream_xruns = 0;
 	pthread_mutex_unlock(&alsa_id->alsa_pipe_mutex);
 
 	/* Report current state */
@@ -603,7 +614,6 @@ static int alsa_feed(AudioID * id, AudioTrack track)
 	int num_bytes;
 	spd_alsa_id_t *alsa_id = (spd_alsa_id_t *) id;
 
-	AudioTrack track_volume;
 	float real_volume;
 	int i;
 
@@ -623,16 +633,20 @@ static int alsa_feed(AudioID * id, AudioTrack track)
 	volume_size = bytes_per_sample * track.num_samples;
 	MSG(4, "volume size = %i", (int)volume_size);
 
-	/* Create a copy of track with adjusted volume. */
+	/* Create a copy of track with adjusted volume, in a buffer kept
+	   from one track to the next so that playing does not allocate */
 	MSG(4, "Making copy of track and adjusting volume");
-	track_volume = track;
-	track_volume.samples = (short *)g_malloc(volume_size);
+	if (alsa_id->volume_samples_size < volume_size) {
+		g_free(alsa_id->volume_samples);
+		alsa_id->volume_samples = (signed short *)g_malloc(volume_size);
+		alsa_id->volume_samples_size = volume_size;
+	}
 	real_volume = ((float)alsa_id->id.volume + 100) / (float)200;
 	for (i = 0; i <= track.num_samples - 1; i++)
-		track_volume.samples[i] = track.samples[i] * real_volume;
+		alsa_id->volume_samples[i] = track.samples[i] * real_volume;
 
 	/* Loop until all samples are played on the device. */
-	output_samples = track_volume.samples;
+	output_samples = alsa_id->volume_samples;
 	num_bytes = volume_size;
 	MSG(4, "%d bytes to be played", num_bytes);
 	while (num_bytes > 0) {
@@ -718,9 +732,6 @@ static int alsa_feed(AudioID * id, AudioTrack track)
 	}
 
 terminate:
-	if (track_volume.samples != NULL)
-		g_free(track_volume.samples);
-
 	return 0;
 }
 
@@ -901,6 +912,11 @@ static int alsa_end(AudioID * id)
 	if (!alsa_id->stop_requested)
 		alsa_drain(id);
 
+	if (alsa_id->stream_xruns)
+		MSG(1, "%u underruns during this playback, %u since the "
+		    "device was opened", alsa_id->stream_xruns,
+		    alsa_id->xruns);
+
 	err = snd_pcm_drop(alsa_id->alsa_pcm);
 	if (err < 0) {
 		ERR("snd_pcm_drop() failed: %s", snd_strerror(err));
@@ -923,6 +939,29 @@ static int alsa_end(AudioID * id)
 	return 0;
 }
 
+/* Frames written which the device has not played yet */
+static long alsa_delay(AudioID * id)
+{
+	spd_alsa_id_t *alsa_id = (spd_alsa_id_t *) id;
+	snd_pcm_sframes_t frames;
+	int err;
+
+	if (alsa_id == NULL || !alsa_id->alsa_opened)
+		return 0;
+
+	err = snd_pcm_delay(alsa_id->alsa_pcm, &frames);
+	if (err == -EPIPE) {
+		/* Underrun, everything was played */
+		return 0;
+	}
+	if (err < 0) {
+		MSG(4, "snd_pcm_delay() failed: %s", snd_strerror(err));
+		return -1;
+	}
+
+	return frames > 0 ? frames : 0;
+}
+
 /* Play the track _track_ (see spd_audio.h) using the id->alsa_pcm device and
  id-hw_params parameters. This is a blocking function, however, it's possible
  to interrupt playing from a different thread with alsa_stop(). alsa_play
@@ -1022,6 +1061,7 @@ static spd_audio_plugin_t alsa_functions = {
 	alsa_feed_sync,
 	alsa_feed_sync_overlap,
 	alsa_end,
+	alsa_delay,
 };
 
 spd_audio_plugin_t *alsa_plugin_get(void)
@@ -29,6 +29,7 @@
 #include <sys/time.h>
 #include <time.h>
 #include <string.h>
+#include <pthread.h>
 #include <glib.h>
 #include <ao/ao.h>
 
@@ -37,6 +38,8 @@
 
 /* send a packet of XXX bytes to the sound device */
 #define AO_SEND_BYTES 256
+/* number of devices kept open, each for a given sample format */
+#define AO_CACHE_SIZE 4
 /* Put a message into the logfile (stderr) */
 #define MSG(level, arg...) \
 	if(level <= libao_log_level){ \
@@ -79,45 +82,195 @@
    This is the most portable way to initialize a stack-allocated struct to
    zero. */
 static ao_sample_format AO_FORMAT_INITIALIZER;
-static ao_sample_format current_ao_parameters;
 
 static volatile int ao_stop_playback = 0;
 
 static int default_driver;
 static int libao_log_level;
 
-ao_device *device = NULL;
+/* Devices are kept open between tracks, so that alternating between sample
+   formats (e.g. a synthesizer and sound icons) does not pay a device open
+   each time.  The least recently used one is closed when room is needed. */
+typedef struct {
+	ao_sample_format format;
+	ao_device *device;
+	unsigned long last_used;
+} libao_cached_device;
+
+static libao_cached_device device_cache[AO_CACHE_SIZE];
+static unsigned long device_cache_clock;
+static pthread_mutex_t device_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Reopening a device after an error is done in the background */
+static pthread_t reopen_thread;
+static int reopen_running;
+static ao_sample_format reopen_format;
+
+static inline int libao_format_equal(const ao_sample_format * a,
+				     const ao_sample_format * b)
+{
+	return a->channels == b->channels && a->rate == b->rate
+	    && a->bits == b->bits;
+}
 
-static inline void libao_open_handle(int rate, int channels, int bits)
+static inline ao_device *libao_open_handle(const ao_sample_format * format)
 {
-	ao_sample_format format = AO_FORMAT_INITIALIZER;
+	ao_sample_format f = *format;
 
-	format.channels = channels;
-	format.rate = rate;
-	format.bits = bits;
-	format.byte_format = AO_FMT_NATIVE;
-	device = ao_open_live(default_driver, &format, NULL);
+	return ao_open_live(default_driver, &f, NULL);
+}
+
+/* Must be called with device_cache_mutex held */
+static void libao_cache_close_entry(libao_cached_device * entry)
+{
+	if (entry->device != NULL) {
+		MSG(3, "Closing device for %d Hz, %d channels, %d bits",
+		    entry->format.rate, entry->format.channels,
+		    entry->format.bits);
+		ao_close(entry->device);
+		entry->device = NULL;
+	}
+}
+
+/* Must be called with device_cache_mutex held */
+static libao_cached_device *libao_cache_find(const ao_sample_format * format)
+{
+	int i;
+
+	for (i = 0; i < AO_CACHE_SIZE; i++)
+		if (device_cache[i].device != NULL
+		    && libao_format_equal(&device_cache[i].format, format))
+			return &device_cache[i];
+	return NULL;
+}
+
+/* Must be called with device_cache_mutex held.  Returns a free slot,
+   or the least recently used one if evict is true. */
+static libao_cached_device *libao_cache_slot(int evict)
+{
+	libao_cached_device *lru = NULL;
+	int i;
+
+	for (i = 0; i < AO_CACHE_SIZE; i++) {
+		if (device_cache[i].device == NULL)
+			return &device_cache[i];
+		if (lru == NULL || device_cache[i].last_used < lru->last_used)
+			lru = &device_cache[i];
+	}
+	if (!evict)
+		return NULL;
+	libao_cache_close_entry(lru);
+	return lru;
+}
+
+/* Must be called with device_cache_mutex held */
+static void libao_cache_clear(void)
+{
+	int i;
+
+	for (i = 0; i < AO_CACHE_SIZE; i++)
+		libao_cache_close_entry(&device_cache[i]);
+}
+
+/* Get an open device for the given format, opening it if needed */
+static ao_device *libao_get_device(const ao_sample_format * format)
+{
+	libao_cached_device *entry;
+	ao_device *device;
+
+	pthread_mutex_lock(&device_cache_mutex);
+	entry = libao_cache_find(format);
+	if (entry == NULL) {
+		MSG(3, "Opening device for %d Hz, %d channels, %d bits",
+		    format->rate, format->channels, format->bits);
+		device = libao_open_handle(format);
+		if (device == NULL) {
+			/* The driver may not support several devices being
+			   open at the same time, so retry alone. */
+			libao_cache_clear();
+			device = libao_open_handle(format);
+		}
+		if (device == NULL) {
+			pthread_mutex_unlock(&device_cache_mutex);
+			return NULL;
+		}
+		entry = libao_cache_slot(TRUE);
+		entry->format = *format;
+		entry->device = device;
+	}
+	entry->last_used = ++device_cache_clock;
+	device = entry->device;
+	pthread_mutex_unlock(&device_cache_mutex);
 
-	if (device != NULL)
-		current_ao_parameters = format;
+	return device;
 }
 
-static inline void libao_close_handle(void)
+static void *libao_reopen(void *data)
 {
-	if (device != NULL) {
+	libao_cached_device *entry;
+	ao_device *device;
+
+	device = libao_open_handle(&reopen_format);
+
+	pthread_mutex_lock(&device_cache_mutex);
+	if (device == NULL) {
+		ERR("Audio: could not reopen device, will retry in next run\n");
+	} else if (libao_cache_find(&reopen_format) != NULL
+		   || (entry = libao_cache_slot(FALSE)) == NULL) {
+		/* Meanwhile the next run opened it by itself */
 		ao_close(device);
-		device = NULL;
+	} else {
+		entry->format = reopen_format;
+		entry->device = device;
+		entry->last_used = ++device_cache_clock;
+	}
+	pthread_mutex_unlock(&device_cache_mutex);
+
+	return NULL;
+}
+
+/* Close a device which failed, and reopen it in the background */
+static void libao_drop_device(ao_device * device)
+{
+	ao_sample_format format = AO_FORMAT_INITIALIZER;
+	int i;
+
+	pthread_mutex_lock(&device_cache_mutex);
+	for (i = 0; i < AO_CACHE_SIZE; i++) {
+		if (device_cache[i].device == device) {
+			format = device_cache[i].format;
+			libao_cache_close_entry(&device_cache[i]);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&device_cache_mutex);
+
+	if (reopen_running) {
+		pthread_join(reopen_thread, NULL);
+		reopen_running = 0;
 	}
+	if (i == AO_CACHE_SIZE)
+		return;
+	reopen_format = format;
+	if (pthread_create(&reopen_thread, NULL, libao_reopen, NULL) == 0)
+		reopen_running = 1;
 }
 
 static AudioID *libao_open(void **pars)
 {
 	AudioID *id;
 
-	id = (AudioID *) g_malloc(sizeof(AudioID));
-
 	ao_initialize();
 	default_driver = ao_default_driver_id();
+	if (default_driver < 0) {
+		/* Let the next output method be tried instead of failing on
+		   each track */
+		ERR("No usable libao driver");
+		ao_shutdown();
+		return NULL;
+	}
+
+	id = (AudioID *) g_malloc(sizeof(AudioID));
 	return id;
 }
 
@@ -133,6 +286,9 @@ static int libao_play(AudioID * id, AudioTrack track)
 
 	int i;
 
+	ao_sample_format format = AO_FORMAT_INITIALIZER;
+	ao_device *device;
+
 	if (id == NULL)
 		return -1;
 	if (track.samples == NULL || track.num_samples <= 0)
@@ -151,14 +307,11 @@ static int libao_play(AudioID * id, AudioTrack track)
 	output_samples = track.samples;
 	num_bytes = track.num_samples * bytes_per_sample;
 
-	if ((device == NULL)
-	    || (track.num_channels != current_ao_parameters.channels)
-	    || (track.sample_rate != current_ao_parameters.rate)
-	    || (track.bits != current_ao_parameters.bits)) {
-		libao_close_handle();
-		libao_open_handle(track.sample_rate, track.num_channels,
-				  track.bits);
-	}
+	format.channels = track.num_channels;
+	format.rate = track.sample_rate;
+	format.bits = track.bits;
+	format.byte_format = AO_FMT_NATIVE;
+	device = libao_get_device(&format);
 
 	if (device == NULL) {
 		ERR("error opening libao dev");
@@ -178,8 +331,8 @@ static int libao_play(AudioID * id, AudioTrack track)
 			i = (num_bytes - outcnt);
 
 		if (!ao_play(device, (char *)output_samples + outcnt, i)) {
-			libao_close_handle();
-			ERR("Audio: ao_play() - closing device - re-open it in next run\n");
+			ERR("Audio: ao_play() - closing device - reopening it in the background\n");
+			libao_drop_device(device);
 			return -1;
 		}
 		outcnt += i;
@@ -199,7 +352,13 @@ static int libao_stop(AudioID * id)
 
 static int libao_close(AudioID * id)
 {
-	libao_close_handle();
+	if (reopen_running) {
+		pthread_join(reopen_thread, NULL);
+		reopen_running = 0;
+	}
+	pthread_mutex_lock(&device_cache_mutex);
+	libao_cache_clear();
+	pthread_mutex_unlock(&device_cache_mutex);
 	ao_shutdown();
 
 	g_free(id);
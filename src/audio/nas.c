@@ -25,42 +25,49 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
 #include <sys/time.h>
 #include <glib.h>
 #include <audio/audiolib.h>
-#include <audio/soundlib.h>
 
 #include <pthread.h>
 
 #define SPD_AUDIO_PLUGIN_ENTRY spd_nas_LTX_spd_audio_plugin_get
 #include <spd_audio_plugin.h>
 
+/* How long nas_play() still waits for a stopped flow to report it is
+   over, in ms */
+#define NAS_STOP_TIMEOUT 500
+
 typedef struct {
 	AudioID id;
 	AuServer *aud;
-	AuFlowID flow;
 	pthread_mutex_t flow_mutex;
-	pthread_t nas_event_handler;
-	pthread_cond_t pt_cond;
-	pthread_mutex_t pt_mutex;
+	int playing;		/* Whether nas_play is waiting for a flow */
+	int stop_pipe[2];	/* Pipe for communication about stop requests */
+
+	/* The flow is kept across tracks of the same format and volume, and
+	   only started again for each of them */
+	AuFlowID flow;
+	AuEventHandlerRec *flow_handler;
+	int flow_rate, flow_channels, flow_volume;
+
+	/* The rest of the track being played, written to the flow as the
+	   server asks for it */
+	char *data;
+	AuUint32 remaining;
+	int done;
 } spd_nas_id_t;
 
 static int nas_log_level;
 
-/* Internal event handler */
-static void *_nas_handle_events(void *par)
-{
-	spd_nas_id_t *nas_id = (spd_nas_id_t *) par;
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-
-	while (1)
-		AuHandleEvents(nas_id->aud);
-
-}
-
 /* NAS Server error handler */
 /* Unfortunatelly we can't return these errors to the caller
-   since this handler gets called in the event handler thread. */
+   since this handler gets called while handling events. */
 static AuBool _nas_handle_server_error(AuServer * server, AuErrorEvent * event)
 {
 	fprintf(stderr, "ERROR: Non-fatal server error in NAS\n");
@@ -84,17 +91,132 @@ static AuBool _nas_handle_server_error(AuServer * server, AuErrorEvent * event)
 	return 0;
 }
 
+/* Internal function. Write up to _num_bytes_ of the track to the flow,
+   marking the last ones as the end of the data. */
+static void _nas_write(spd_nas_id_t * nas_id, AuUint32 num_bytes)
+{
+	AuUint32 n = MIN(num_bytes, nas_id->remaining);
+
+	if (n == 0)
+		return;
+	AuWriteElement(nas_id->aud, nas_id->flow, 0, n, nas_id->data,
+		       n == nas_id->remaining, NULL);
+	nas_id->data += n;
+	nas_id->remaining -= n;
+}
+
+/* Called by AuHandleEvents for the events of the flow */
+static AuBool _nas_flow_event(AuServer * server, AuEvent * event,
+			      AuEventHandlerRec * handler)
+{
+	spd_nas_id_t *nas_id = (spd_nas_id_t *) handler->data;
+	AuElementNotifyEvent *notify = &event->auelementnotify;
+
+	if (event->type != AuEventTypeElementNotify)
+		return AuTrue;
+
+	switch (notify->kind) {
+	case AuElementNotifyKindLowWater:
+		_nas_write(nas_id, notify->num_bytes);
+		break;
+	case AuElementNotifyKindState:
+		if (notify->cur_state == AuStateStop)
+			nas_id->done = 1;
+		else if (notify->cur_state == AuStatePause
+			 && notify->reason != AuReasonUser)
+			_nas_write(nas_id, notify->num_bytes);
+		break;
+	}
+	return AuTrue;
+}
+
+/* Internal function. Forget the flow, so that the next track creates a
+   new one. */
+static void _nas_destroy_flow(spd_nas_id_t * nas_id)
+{
+	if (nas_id->flow == 0)
+		return;
+	if (nas_id->flow_handler != NULL)
+		AuUnregisterEventHandler(nas_id->aud, nas_id->flow_handler);
+	AuDestroyFlow(nas_id->aud, nas_id->flow, NULL);
+	nas_id->flow = 0;
+	nas_id->flow_handler = NULL;
+}
+
+/* Internal function. Make sure there is a flow from the client to an
+   output device for _track_, return 0 on success. */
+static int _nas_setup_flow(spd_nas_id_t * nas_id, AudioTrack * track)
+{
+	AuElement elements[3];
+	AuDeviceID device = AuNone;
+	int i;
+
+	if (nas_id->flow != 0 && nas_id->flow_rate == track->sample_rate
+	    && nas_id->flow_channels == track->num_channels
+	    && nas_id->flow_volume == nas_id->id.volume)
+		return 0;
+
+	_nas_destroy_flow(nas_id);
+
+	for (i = 0; i < AuServerNumDevices(nas_id->aud); i++)
+		if (AuDeviceKind(AuServerDevice(nas_id->aud, i)) ==
+		    AuComponentKindPhysicalOutput
+		    && AuDeviceNumTracks(AuServerDevice(nas_id->aud, i)) ==
+		    track->num_channels) {
+			device =
+			    AuDeviceIdentifier(AuServerDevice(nas_id->aud, i));
+			break;
+		}
+	if (device == AuNone) {
+		fprintf(stderr, "NAS: No output device for %d channels\n",
+			track->num_channels);
+		return -1;
+	}
+
+	nas_id->flow = AuCreateFlow(nas_id->aud, NULL);
+	if (nas_id->flow == 0) {
+		fprintf(stderr, "NAS: Couldn't create data flow\n");
+		return -1;
+	}
+
+	/* Buffer half a second, ask for more when half of it is left */
+	AuMakeElementImportClient(&elements[0], track->sample_rate,
+				  AuFormatLinearSigned16LSB,
+				  track->num_channels, AuTrue,
+				  track->sample_rate / 2,
+				  track->sample_rate / 4, 0, NULL);
+	AuMakeElementMultiplyConstant(&elements[1], 0,
+				      ((nas_id->id.volume + 100) / 2) * 1500);
+	AuMakeElementExportDevice(&elements[2], 1, device, track->sample_rate,
+				  AuUnlimitedSamples, 0, NULL);
+	AuSetElements(nas_id->aud, nas_id->flow, AuTrue, 3, elements, NULL);
+
+	nas_id->flow_handler =
+	    AuRegisterEventHandler(nas_id->aud, AuEventHandlerIDMask, 0,
+				   nas_id->flow, _nas_flow_event,
+				   (AuPointer) nas_id);
+	if (nas_id->flow_handler == NULL) {
+		fprintf(stderr, "NAS: Couldn't handle the data flow events\n");
+		_nas_destroy_flow(nas_id);
+		return -1;
+	}
+
+	nas_id->flow_rate = track->sample_rate;
+	nas_id->flow_channels = track->num_channels;
+	nas_id->flow_volume = nas_id->id.volume;
+	return 0;
+}
+
 static AudioID *nas_open(void **pars)
 {
 	spd_nas_id_t *nas_id;
-	int ret;
-	AuBool r;
 
 	nas_id = (spd_nas_id_t *) g_malloc(sizeof(spd_nas_id_t));
 
 	nas_id->aud = AuOpenServer(pars[2], 0, NULL, 0, NULL, NULL);
 	if (!nas_id->aud) {
 		fprintf(stderr, "Can't connect to NAS audio server\n");
+		g_free(nas_id);
 		return NULL;
 	}
 
@@ -105,78 +227,101 @@ static AudioID *nas_open(void **pars)
 	   return -1;
 	   } */
 
-	nas_id->flow = 0;
-
-	pthread_cond_init(&nas_id->pt_cond, NULL);
-	pthread_mutex_init(&nas_id->pt_mutex, NULL);
-	pthread_mutex_init(&nas_id->flow_mutex, NULL);
-
-	ret =
-	    pthread_create(&nas_id->nas_event_handler, NULL, _nas_handle_events,
-			   (void *)nas_id);
-	if (ret != 0) {
-		fprintf(stderr,
-			"ERROR: NAS Audio module: thread creation failed\n");
+	/* nas_stop() writes to this pipe to interrupt nas_play() */
+	if (pipe(nas_id->stop_pipe)) {
+		fprintf(stderr, "ERROR: NAS Audio module: can't open pipe\n");
+		AuCloseServer(nas_id->aud);
+		g_free(nas_id);
 		return NULL;
 	}
+	fcntl(nas_id->stop_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(nas_id->stop_pipe[1], F_SETFL, O_NONBLOCK);
+
+	nas_id->playing = 0;
+	nas_id->flow = 0;
+	nas_id->flow_handler = NULL;
+	pthread_mutex_init(&nas_id->flow_mutex, NULL);
 
 	return (AudioID *) nas_id;
 }
 
+/* Internal function. Drop stop requests which arrived while not playing. */
+static void _nas_clear_stop(spd_nas_id_t * nas_id)
+{
+	char buf[16];
+
+	while (read(nas_id->stop_pipe[0], buf, sizeof(buf)) > 0) ;
+}
+
 static int nas_play(AudioID * id, AudioTrack track)
 {
-	char *buf;
-	Sound s;
-	AuEventHandlerRec *event_handler;
-	float lenght;
-	struct timeval now;
-	struct timespec timeout;
+	struct pollfd fds[2];
+	int stopped = 0;
+	int ret;
 	spd_nas_id_t *nas_id = (spd_nas_id_t *) id;
 
 	if (nas_id == NULL)
 		return -2;
 
-	s = SoundCreate(SoundFileFormatNone,
-			AuFormatLinearSigned16LSB,
-			track.num_channels,
-			track.sample_rate, track.num_samples, NULL);
-
-	buf = (char *)track.samples;
-
 	pthread_mutex_lock(&nas_id->flow_mutex);
+	_nas_clear_stop(nas_id);
 
-	event_handler = AuSoundPlayFromData(nas_id->aud,
-					    s,
-					    buf,
-					    AuNone,
-					    ((nas_id->id.volume +
-					      100) / 2) * 1500, NULL, NULL,
-					    &nas_id->flow, NULL, NULL, NULL);
-
-	if (event_handler == NULL) {
+	if (_nas_setup_flow(nas_id, &track) != 0) {
 		pthread_mutex_unlock(&nas_id->flow_mutex);
-		fprintf(stderr,
-			"AuSoundPlayFromData failed for unknown resons.\n");
 		return -1;
 	}
 
-	if (nas_id->flow == 0) {
-		fprintf(stderr, "Couldn't start data flow");
-	}
+	nas_id->data = (char *)track.samples;
+	nas_id->remaining = track.num_samples * track.num_channels * 2;
+	nas_id->done = 0;
+	AuStartFlow(nas_id->aud, nas_id->flow, NULL);
+
+	nas_id->playing = 1;
 	pthread_mutex_unlock(&nas_id->flow_mutex);
 
-	/* Another timing magic */
-	pthread_mutex_lock(&nas_id->pt_mutex);
-	lenght = (((float)track.num_samples) / (float)track.sample_rate);
-	gettimeofday(&now, NULL);
-	timeout.tv_sec = now.tv_sec + (int)lenght;
-	timeout.tv_nsec =
-	    now.tv_usec * 1000 + (lenght - (int)lenght) * 1000000000;
-	pthread_cond_timedwait(&nas_id->pt_cond, &nas_id->pt_mutex, &timeout);
-	pthread_mutex_unlock(&nas_id->pt_mutex);
+	/* Handle the server events from this thread until the flow is over,
+	   waking up only when the server talks to us or when nas_stop()
+	   is called. */
+	fds[0].fd = AuServerConnectionNumber(nas_id->aud);
+	fds[0].events = POLLIN;
+	fds[1].fd = nas_id->stop_pipe[0];
+	fds[1].events = POLLIN;
+
+	while (!nas_id->done) {
+		AuFlush(nas_id->aud);
+		if (!AuEventsQueued(nas_id->aud, AuEventsQueuedAlready)) {
+			fds[0].revents = fds[1].revents = 0;
+			ret = poll(fds, stopped ? 1 : 2,
+				   stopped ? NAS_STOP_TIMEOUT : -1);
+			if (ret == -1) {
+				if (errno == EINTR)
+					continue;
+				perror("NAS ERROR: poll");
+				break;
+			}
+			if (ret == 0) {
+				/* The stopped flow never reported it is
+				   over, don't trust it for the next track */
+				fprintf(stderr,
+					"NAS: Data flow didn't stop, dropping it\n");
+				_nas_destroy_flow(nas_id);
+				break;
+			}
+			if (fds[1].revents & POLLIN) {
+				_nas_clear_stop(nas_id);
+				nas_id->remaining = 0;
+				AuStopFlow(nas_id->aud, nas_id->flow, NULL);
+				/* Still wait for the flow to report it is
+				   over, so that it can be started again */
+				stopped = 1;
+				continue;
+			}
+		}
+		AuHandleEvents(nas_id->aud);
+	}
 
 	pthread_mutex_lock(&nas_id->flow_mutex);
-	nas_id->flow = 0;
+	nas_id->playing = 0;
 	pthread_mutex_unlock(&nas_id->flow_mutex);
 
 	return 0;
@@ -189,15 +334,17 @@ static int nas_stop(AudioID * id)
 	if (nas_id == NULL)
 		return -2;
 
+	/* Only the playing thread talks to the server, just wake it up */
 	pthread_mutex_lock(&nas_id->flow_mutex);
-	if (nas_id->flow != 0)
-		AuStopFlow(nas_id->aud, nas_id->flow, NULL);
-	nas_id->flow = 0;
-	pthread_mutex_unlock(&nas_id->flow_mutex);
+	if (nas_id->playing) {
+		char buf = 42;
 
-	pthread_mutex_lock(&nas_id->pt_mutex);
-	pthread_cond_signal(&nas_id->pt_cond);
-	pthread_mutex_unlock(&nas_id->pt_mutex);
+		if (write(nas_id->stop_pipe[1], &buf, 1) <= 0)
+			fprintf(stderr,
+				"NAS: Can't write stop request to pipe: %s\n",
+				strerror(errno));
+	}
+	pthread_mutex_unlock(&nas_id->flow_mutex);
 
 	return 0;
 }
@@ -209,11 +356,10 @@ static int nas_close(AudioID * id)
 	if (nas_id == NULL)
 		return -2;
 
-	pthread_cancel(nas_id->nas_event_handler);
-	pthread_join(nas_id->nas_event_handler, NULL);
-
-	pthread_mutex_destroy(&nas_id->pt_mutex);
+	_nas_destroy_flow(nas_id);
 	pthread_mutex_destroy(&nas_id->flow_mutex);
+	close(nas_id->stop_pipe[0]);
+	close(nas_id->stop_pipe[1]);
 
 	AuCloseServer(nas_id->aud);
 
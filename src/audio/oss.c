@@ -34,6 +34,7 @@
 #include <errno.h>
 #include <unistd.h>		/* for open, close */
 #include <sys/ioctl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <glib.h>
 
@@ -47,13 +48,15 @@ typedef struct {
 	int fd;
 	char *device_name;
 	pthread_mutex_t fd_mutex;
-	pthread_cond_t pt_cond;
-	pthread_mutex_t pt_mutex;
+	int stop_pipe[2];	/* Pipe for communication about stop requests */
+	short *volume_samples;	/* The track with its volume adjusted */
+	size_t volume_samples_size;	/* Bytes allocated for volume_samples */
 } spd_oss_id_t;
 
 static int _oss_open(spd_oss_id_t * id);
 static int _oss_close(spd_oss_id_t * id);
 static int _oss_sync(spd_oss_id_t * id);
+static void _oss_free(spd_oss_id_t * id);
 
 /* Put a message into the logfile (stderr) */
 #define MSG(level, arg...) \
@@ -143,29 +146,87 @@ static AudioID *oss_open(void **pars)
 	oss_id = (spd_oss_id_t *) g_malloc(sizeof(spd_oss_id_t));
 
 	oss_id->device_name = g_strdup((char *)pars[0]);
+	oss_id->volume_samples = NULL;
+	oss_id->volume_samples_size = 0;
 
 	pthread_mutex_init(&oss_id->fd_mutex, NULL);
 
-	pthread_cond_init(&oss_id->pt_cond, NULL);
-	pthread_mutex_init(&oss_id->pt_mutex, NULL);
+	/* oss_stop() writes to this pipe to interrupt oss_play() */
+	if (pipe(oss_id->stop_pipe)) {
+		ERR("Can't open pipe for stop requests: %s", strerror(errno));
+		g_free(oss_id->device_name);
+		g_free(oss_id);
+		return NULL;
+	}
+	fcntl(oss_id->stop_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(oss_id->stop_pipe[1], F_SETFL, O_NONBLOCK);
 
 	/* Test if it's possible to access the device */
 	ret = _oss_open(oss_id);
 	if (ret) {
-		g_free(oss_id->device_name);
-		g_free(oss_id);
+		_oss_free(oss_id);
 		return NULL;
 	}
 	ret = _oss_close(oss_id);
 	if (ret) {
-		g_free(oss_id->device_name);
-		g_free(oss_id);
+		_oss_free(oss_id);
 		return NULL;
 	}
 
 	return (AudioID *) oss_id;
 }
 
+/* Internal function. */
+static void _oss_free(spd_oss_id_t * id)
+{
+	close(id->stop_pipe[0]);
+	close(id->stop_pipe[1]);
+	pthread_mutex_destroy(&id->fd_mutex);
+	g_free(id->device_name);
+	g_free(id->volume_samples);
+	g_free(id);
+}
+
+/* Internal function. Drop stop requests which arrived while not playing. */
+static void _oss_clear_stop(spd_oss_id_t * id)
+{
+	char buf[16];
+
+	while (read(id->stop_pipe[0], buf, sizeof(buf)) > 0) ;
+}
+
+/* Internal function. Wait until the device accepts more data or the playback
+   is stopped. Returns 1 on stop, 0 when data may be written, -1 on error. */
+static int _oss_wait(spd_oss_id_t * id, short events, int timeout)
+{
+	struct pollfd fds[2];
+	int ret;
+
+	fds[0].fd = id->stop_pipe[0];
+	fds[0].events = POLLIN;
+	fds[1].fd = id->fd;
+	fds[1].events = events;
+
+	do {
+		fds[0].revents = fds[1].revents = 0;
+		ret = poll(fds, events ? 2 : 1, timeout);
+	} while (ret == -1 && errno == EINTR);
+
+	if (ret == -1) {
+		perror("OSS ERROR: poll");
+		return -1;
+	}
+	if (fds[0].revents & POLLIN) {
+		MSG(4, "Stop requested");
+		return 1;
+	}
+	if (fds[1].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+		ERR("Device reported an error while waiting for it");
+		return -1;
+	}
+	return 0;
+}
+
 /* Internal function. */
 static int _oss_sync(spd_oss_id_t * id)
 {
@@ -181,29 +242,24 @@ static int _oss_sync(spd_oss_id_t * id)
 
 static int oss_play(AudioID * id, AudioTrack track)
 {
-	int ret, ret2;
-	struct timeval now;
-	struct timespec timeout;
-	float lenght;
-	int r = 0;
+	int ret;
 	int format, oformat, channels, speed;
 	int bytes_per_sample;
 	int num_bytes;
-	signed short *output_samples;
-	float delay = 0;
-	float DELAY = 0.1;	/* in seconds */
+	char *output_samples;
 	audio_buf_info info;
 	int bytes;
+	int odelay;
+	int stopped = 0;
 	float real_volume;
 	int i;
-	int re;
 	spd_oss_id_t *oss_id = (spd_oss_id_t *) id;
 
-	AudioTrack track_volume;
-
 	if (oss_id == NULL)
 		return -1;
 
+	_oss_clear_stop(oss_id);
+
 	/* Open the sound device. This is necessary for OSS so that the
 	   application doesn't prevent others from accessing /dev/dsp when
 	   it doesn't play anything. */
@@ -211,14 +267,6 @@ static int oss_play(AudioID * id, AudioTrack track)
 	if (ret)
 		return -2;
 
-	/* Create a copy of track with the adjusted volume */
-	track_volume = track;
-	track_volume.samples =
-	    (short *)g_malloc(sizeof(short) * track.num_samples);
-	real_volume = ((float)id->volume + 100) / (float)200;
-	for (i = 0; i <= track.num_samples - 1; i++)
-		track_volume.samples[i] = track.samples[i] * real_volume;
-
 	/* Choose the correct format */
 	if (track.bits == 16) {
 		format = AFMT_S16_NE;
@@ -279,44 +327,58 @@ static int oss_play(AudioID * id, AudioTrack track)
 		return 0;
 	}
 
-	/* Loop until all samples are played on the device.
-	   In the meantime, wait in pthread_cond_timedwait for more data
-	   or for interruption. */
+	/* Create a copy of track with the adjusted volume, in a buffer kept
+	   from one track to the next so that playing does not allocate */
+	if (oss_id->volume_samples_size < sizeof(short) * track.num_samples) {
+		g_free(oss_id->volume_samples);
+		oss_id->volume_samples_size = sizeof(short) * track.num_samples;
+		oss_id->volume_samples =
+		    (short *)g_malloc(oss_id->volume_samples_size);
+	}
+	real_volume = ((float)id->volume + 100) / (float)200;
+	for (i = 0; i <= track.num_samples - 1; i++)
+		oss_id->volume_samples[i] = track.samples[i] * real_volume;
+
+	/* Loop until all samples are written to the device. poll() tells
+	   us when there is room for at least one more fragment, and also
+	   wakes us up immediately when oss_stop() is called. */
 	MSG(4, "Starting playback");
-	output_samples = track_volume.samples;
+	output_samples = (char *)oss_id->volume_samples;
 	num_bytes = track.num_samples * bytes_per_sample;
 	MSG(4, "bytes to play: %d, (%f secs)", num_bytes,
 	    (((float)(num_bytes) / 2) / (float)track.sample_rate));
 	while (num_bytes > 0) {
-
-		/* OSS doesn't support non-blocking write, so lets check how much data
-		   can we write so that write() returns immediatelly */
-		re = ioctl(oss_id->fd, SNDCTL_DSP_GETOSPACE, &info);
-		if (re == -1) {
-			perror("OSS ERROR: GETOSPACE");
+		ret = _oss_wait(oss_id, POLLOUT, -1);
+		if (ret == 1) {
+			stopped = 1;
+			break;
+		}
+		if (ret == -1) {
 			_oss_close(oss_id);
 			return -5;
 		}
 
-		/* If there is not enough space for a single fragment, try later.
-		   (This shouldn't happen, it has very bad effect on synchronization!) */
-		if (info.fragments == 0) {
-			MSG(4,
-			    "WARNING: There is not enough space for a single fragment, looping");
-			usleep(100);
-			continue;
+		/* Only write what fits so that write() returns immediately
+		   and we get back to poll() */
+		ret = ioctl(oss_id->fd, SNDCTL_DSP_GETOSPACE, &info);
+		if (ret == -1) {
+			perror("OSS ERROR: GETOSPACE");
+			_oss_close(oss_id);
+			return -5;
 		}
+		bytes = info.bytes;
+		if (bytes <= 0)
+			bytes = info.fragsize;
 
-		MSG(4,
-		    "There is space for %d more fragments, fragment size is %d bytes",
-		    info.fragments, info.fragsize);
+		MSG(4, "There is space for %d more bytes, fragment size is %d bytes",
+		    bytes, info.fragsize);
 
-		bytes = info.fragments * info.fragsize;
-		ret =
-		    write(oss_id->fd, output_samples,
-			  num_bytes > bytes ? bytes : num_bytes);
+		ret = write(oss_id->fd, output_samples,
+			    num_bytes > bytes ? bytes : num_bytes);
 
 		/* Handle write() errors */
+		if (ret < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
 		if (ret <= 0) {
 			perror("audio");
 			_oss_close(oss_id);
@@ -324,104 +386,27 @@ static int oss_play(AudioID * id, AudioTrack track)
 		}
 
 		num_bytes -= ret;
-		output_samples += ret / 2;
+		output_samples += ret;
 
 		MSG(4, "%d bytes written to OSS, %d remaining", ret, num_bytes);
-
-		/* If there is some more data that is less than a
-		   full fragment, we need to write it immediatelly so
-		   that it doesn't cause buffer underruns later. */
-		if ((num_bytes > 0)
-		    && (num_bytes < info.fragsize)
-		    && (bytes + num_bytes < info.bytes)) {
-
-			MSG(4,
-			    "Writing the rest of the data (%d bytes) to OSS, not a full fragment",
-			    num_bytes);
-
-			ret2 = write(oss_id->fd, output_samples, num_bytes);
-			num_bytes -= ret2;
-			output_samples += ret2 / 2;
-			ret += ret2;
-		}
-
-		/* Handle write() errors */
-		if (ret <= 0) {
-			perror("audio");
-			_oss_close(oss_id);
-			return -6;
-		}
-
-		/* Some timing magic...
-		   We need to wait for the time computed from the number of
-		   samples written. But this wait needs to be interruptible
-		   by oss_stop(). Furthermore, there need to be no buffer
-		   underrruns, so we actually wait a bit (DELAY) less
-		   in the first pass through the while() loop. Then our timer
-		   will be DELAY nsecs backwards.
-		 */
-		MSG(4, "Now we will try to wait");
-		pthread_mutex_lock(&oss_id->pt_mutex);
-		lenght = (((float)(ret) / 2) / (float)track.sample_rate);
-		if (!delay) {
-			delay = lenght > DELAY ? DELAY : lenght;
-			lenght -= delay;
-		}
-		MSG(4, "Wait for %f secs (begin: %f, delay: %f)", lenght,
-		    lenght + delay, delay)
-		    gettimeofday(&now, NULL);
-		timeout.tv_sec = now.tv_sec + (int)lenght;
-		timeout.tv_nsec =
-		    now.tv_usec * 1000 + (lenght - (int)lenght) * 1000000000;
-		//MSG("5, waiting till %d:%d (%d:%d | %d:%d)", timeout.tv_sec, timeout.tv_nsec,
-		//    now.tv_sec, now.tv_usec*1000, timeout.tv_sec - now.tv_sec, timeout.tv_nsec-now.tv_usec*1000);
-
-		timeout.tv_sec += timeout.tv_nsec / 1000000000;
-		timeout.tv_nsec = timeout.tv_nsec % 1000000000;
-		//      MSG("6, waiting till %d:%d (%d:%d | %d:%d)", timeout.tv_sec, timeout.tv_nsec,
-		//  now.tv_sec, now.tv_usec*1000, timeout.tv_sec - now.tv_sec, timeout.tv_nsec-now.tv_usec*1000);
-		r = pthread_cond_timedwait(&oss_id->pt_cond, &oss_id->pt_mutex,
-					   &timeout);
-		pthread_mutex_unlock(&oss_id->pt_mutex);
-		MSG(4, "End of wait");
-
-		/* The pthread_cond_timedwait was interrupted by change in the
-		   condition variable? if so, terminate. */
-		if (r != ETIMEDOUT) {
-			MSG(4, "Playback stopped, %d", r);
-			break;
-		}
 	}
 
-	/* ...one more excersise in timing magic.
-	   Wait for the resting delay secs. */
-
-	/* Ugly hack: correct for the time we spend outside timing segments */
-	delay -= 0.05;
-
-	MSG(4, "Wait for the resting delay = %f secs", delay)
-	    if ((delay > 0) && (r == ETIMEDOUT)) {
-		pthread_mutex_lock(&oss_id->pt_mutex);
-		gettimeofday(&now, NULL);
-		timeout.tv_sec = now.tv_sec;
-		timeout.tv_nsec = now.tv_usec * 1000 + delay * 1000000000;
-		// MSG("6, waiting till %d:%d (%d:%d | %d:%d)", timeout.tv_sec, timeout.tv_nsec,
-		//          now.tv_sec, now.tv_usec*1000, timeout.tv_sec - now.tv_sec, timeout.tv_nsec-now.tv_usec*1000);
-		timeout.tv_sec += timeout.tv_nsec / 1000000000;
-		timeout.tv_nsec = timeout.tv_nsec % 1000000000;
-		// MSG("6, waiting till %d:%d (%d:%d | %d:%d)", timeout.tv_sec, timeout.tv_nsec,
-		//          now.tv_sec, now.tv_usec*1000, timeout.tv_sec - now.tv_sec, timeout.tv_nsec-now.tv_usec*1000);
-		r = pthread_cond_timedwait(&oss_id->pt_cond, &oss_id->pt_mutex,
-					   &timeout);
-		pthread_mutex_unlock(&oss_id->pt_mutex);
+	if (!stopped) {
+		/* Flush all the buffers */
+		_oss_sync(oss_id);
+
+		/* Wait for the device to actually play what was written,
+		   still listening for stop requests. */
+		while (ioctl(oss_id->fd, SNDCTL_DSP_GETODELAY, &odelay) != -1
+		       && odelay > 0) {
+			int ms = (long long)odelay * 1000 /
+			    (bytes_per_sample * channels * speed) + 1;
+			MSG(4, "Waiting %d ms for %d bytes to be played", ms,
+			    odelay);
+			if (_oss_wait(oss_id, 0, ms) != 0)
+				break;
+		}
 	}
-	MSG(4, "End of wait");
-
-	if (track_volume.samples != NULL)
-		g_free(track_volume.samples);
-
-	/* Flush all the buffers */
-	_oss_sync(oss_id);
 
 	/* Close the device so that we don't block other apps trying to
 	   access the device. */
@@ -453,10 +438,16 @@ static int oss_stop(AudioID * id)
 		return -1;
 	}
 
-	/* Interrupt oss_play by setting the condition variable */
-	pthread_mutex_lock(&oss_id->pt_mutex);
-	pthread_cond_signal(&oss_id->pt_cond);
-	pthread_mutex_unlock(&oss_id->pt_mutex);
+	/* Interrupt oss_play, which polls on this pipe */
+	pthread_mutex_lock(&oss_id->fd_mutex);
+	if (oss_id->fd >= 0) {
+		char buf = 42;
+
+		if (write(oss_id->stop_pipe[1], &buf, 1) <= 0)
+			ERR("Can't write stop request to pipe, err %d: %s",
+			    errno, strerror(errno));
+	}
+	pthread_mutex_unlock(&oss_id->fd_mutex);
 	return 0;
 }
 
@@ -468,8 +459,7 @@ static int oss_close(AudioID * id)
 	/* Does nothing because the device is being automatically openned and
 	   closed in oss_play before and after playing each sample. */
 
-	g_free(oss_id->device_name);
-	g_free(oss_id);
+	_oss_free(oss_id);
 	id = NULL;
 
 	return 0;
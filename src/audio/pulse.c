@@ -286,8 +286,12 @@ static int pulse_play(AudioID * id, AudioTrack track)
 		     &error) < 0) {
 			pa_simple_drain(pulse_id->pa_simple, NULL);
 			pulse_connection_close(pulse_id);
+			/* Make the next run open a new connection */
+			pulse_id->pa_current_rate = -1;
+			pulse_id->pa_current_bps = -1;
+			pulse_id->pa_current_channels = -1;
 			MSG(4, "ERROR: Audio: pulse_play(): %s - closing device - re-open it in next run\n", pa_strerror(error));
-			break;
+			return -1;
 		} else {
 			MSG(5, "Pulse: wrote %u bytes\n", i);
 		}
@@ -327,6 +331,26 @@ static void pulse_set_loglevel(int level)
 	}
 }
 
+/* Frames written which the server has not played yet */
+static long pulse_delay(AudioID * id)
+{
+	spd_pulse_id_t *pulse_id = (spd_pulse_id_t *) id;
+	pa_usec_t latency;
+	int error;
+
+	if (pulse_id == NULL || pulse_id->pa_simple == NULL
+	    || pulse_id->pa_current_rate <= 0)
+		return 0;
+
+	latency = pa_simple_get_latency(pulse_id->pa_simple, &error);
+	if (latency == (pa_usec_t) -1) {
+		MSG(4, "pa_simple_get_latency() failed: %s", pa_strerror(error));
+		return -1;
+	}
+
+	return latency * pulse_id->pa_current_rate / 1000000;
+}
+
 static char const *pulse_get_playcmd(void)
 {
 	return pulse_play_cmd;
@@ -341,7 +365,12 @@ static spd_audio_plugin_t pulse_functions = {
 	pulse_close,
 	pulse_set_volume,
 	pulse_set_loglevel,
-	pulse_get_playcmd
+	pulse_get_playcmd,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	pulse_delay,
 };
 
 spd_audio_plugin_t *pulse_plugin_get(void)
@@ -26,17 +26,12 @@
 
 #include "spdsend.h"
 
-#ifndef USE_THREADS
-#define USE_THREADS 1
-#endif
-
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
-#if USE_THREADS
-#include <pthread.h>
-#endif
+#include <poll.h>
 #include <pwd.h>
 #include <signal.h>
 #include <stdio.h>
@@ -47,13 +42,11 @@
 #include <sys/un.h>
 #include <unistd.h>
 
-#ifndef HAVE_GETLINE
-/*
- * Added by Willie Walker - getline was a GNU libc extension, later adopted
- * in the POSIX.1-2008 standard, but not yet found on all systems.
- */
-ssize_t getline(char **lineptr, size_t * n, FILE * f);
-#endif
+/* The server serves all the requests in a single poll() loop.  All the
+   sockets are non-blocking and each direction of data has its own buffer,
+   so a slow client or Speech Dispatcher never blocks the others.  Data
+   Speech Dispatcher sends beyond the end of an answer is kept in the
+   buffer of its connection for the next request. */
 
 /* Utilities */
 
@@ -63,50 +56,102 @@ static void system_error(const char *message)
 	exit(1);
 }
 
-/* Connection management */
+static void set_nonblocking(Stream s)
+{
+	int flags = fcntl(s, F_GETFL);
+	if (flags < 0 || fcntl(s, F_SETFL, flags | O_NONBLOCK) < 0)
+		system_error("fcntl");
+}
 
-Stream *connections;
-#if USE_THREADS
-pthread_mutex_t connections_mutex = PTHREAD_MUTEX_INITIALIZER;
-#endif
+/* Buffers */
 
-static Stream get_connection(Connection_Id id)
+typedef struct {
+	char *data;
+	size_t len;
+	size_t size;
+} Buffer;
+
+static void buffer_append(Buffer * b, const void *data, size_t len)
 {
-	if (id < CONNECTION_ID_MIN || id >= CONNECTION_ID_MAX)
-		return NONE;
-	return connections[id];
+	if (b->len + len > b->size) {
+		b->size = (b->len + len) * 2;
+		b->data = realloc(b->data, b->size);
+		if (b->data == NULL)
+			system_error("memory allocation");
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
 }
 
-static void set_connection(Connection_Id id, Stream s)
+static void buffer_consume(Buffer * b, size_t len)
 {
-#if USE_THREADS
-	pthread_mutex_lock(&connections_mutex);
-#endif
-	connections[id] = s;
-#if USE_THREADS
-	pthread_mutex_unlock(&connections_mutex);
-#endif
+	memmove(b->data, b->data + len, b->len - len);
+	b->len -= len;
+}
+
+static void buffer_free(Buffer * b)
+{
+	free(b->data);
+	b->data = NULL;
+	b->len = b->size = 0;
+}
+
+/* Read whatever is available from s into b.  Return the number of bytes
+   read, 0 on end of file and NONE on error. */
+static int buffer_fill(Buffer * b, Stream s)
+{
+	char data[4096];
+	ssize_t n = read(s, data, sizeof(data));
+
+	if (n < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 1 : NONE;
+	buffer_append(b, data, n);
+	return n;
+}
+
+/* Write as much of b to s as possible */
+static Success buffer_flush(Buffer * b, Stream s)
+{
+	ssize_t n;
+
+	while (b->len > 0) {
+		n = write(s, b->data, b->len);
+		if (n < 0)
+			return (errno == EAGAIN || errno == EINTR) ? OK : ERROR;
+		buffer_consume(b, n);
+	}
+	return OK;
+}
+
+/* Connection management */
+
+struct request;
+
+typedef struct {
+	Stream sock;		/* To Speech Dispatcher, or NONE */
+	Buffer in;		/* Answer data not forwarded yet */
+	Buffer out;		/* Command data not sent yet */
+	struct request *owner;	/* Request being served on it */
+} Connection;
+
+Connection *connections;
+
+static Connection *get_connection(Connection_Id id)
+{
+	if (id < CONNECTION_ID_MIN || id >= CONNECTION_ID_MAX
+	    || connections[id].sock == NONE)
+		return NULL;
+	return &connections[id];
 }
 
 static Connection_Id new_connection(Stream s)
 {
-#if USE_THREADS
-	pthread_mutex_lock(&connections_mutex);
-#endif
 	int id;
 	for (id = CONNECTION_ID_MIN;
-	     id < CONNECTION_ID_MAX && connections[id] != NONE; id++) ;
+	     id < CONNECTION_ID_MAX && connections[id].sock != NONE; id++) ;
 	if (id >= CONNECTION_ID_MAX)
-	{
-#if USE_THREADS
-		pthread_mutex_unlock(&connections_mutex);
-#endif
 		return NONE;
-	}
-	connections[id] = s;
-#if USE_THREADS
-	pthread_mutex_unlock(&connections_mutex);
-#endif
+	connections[id].sock = s;
 	return id;
 }
 
@@ -140,6 +185,7 @@ static Connection_Id do_open_connection(const char *host, int port)
 				   sizeof(int));
 		}
 	}
+	set_nonblocking(sock);
 
 	{
 		Connection_Id id = new_connection(sock);
@@ -149,34 +195,6 @@ static Connection_Id do_open_connection(const char *host, int port)
 	}
 }
 
-static Success do_close_connection(Connection_Id id)
-{
-	Stream c = get_connection(id);
-	if (c == NONE)
-		return ERROR;
-	close(c);
-	set_connection(id, NONE);
-	return OK;
-}
-
-static Success do_send_data(Connection_Id id, Stream from, Stream to,
-			    Success(*forwarder) (Stream, Stream, bool))
-{
-	int sock = get_connection(id);
-	if (sock == NONE)
-		return ERROR;
-	if (from == NONE)
-		from = sock;
-	else if (to == NONE)
-		to = sock;
-	{
-		Success result = ((*forwarder) (from, to, FALSE));
-		if (result != OK)
-			do_close_connection(id);
-		return result;
-	}
-}
-
 /* Processing requests */
 
 /* Protocol:
@@ -195,140 +213,218 @@ static Success do_send_data(Connection_Id id, Stream from, Stream to,
      Additionally, if Action is A_DATA, SSIP reply follows.
 */
 
-static Success report(Stream s, Result code)
+typedef enum {
+	R_HEADER,		/* Reading the action and its arguments */
+	R_WAIT,			/* Waiting for the connection to get free */
+	R_COMMAND,		/* Forwarding the SSIP command */
+	R_ANSWER,		/* Forwarding the SSIP answer */
+	R_FLUSH			/* Writing the rest of the reply, then closing */
+} Request_State;
+
+typedef struct request {
+	Stream s;
+	Request_State state;
+	Connection_Id id;
+	Buffer in;		/* From the client */
+	Buffer out;		/* To the client */
+	struct request *next;
+} Request;
+
+static Request *requests;
+
+static void report(Request * r, Result code)
 {
-	return write_data(s, &code, sizeof(Result));
+	buffer_append(&r->out, &code, sizeof(Result));
 }
 
-static Success report_ok(Stream s, Connection_Id id)
+static void report_ok(Request * r, Connection_Id id)
 {
-	if (report(s, OK_CODE) == OK &&
-	    write_data(s, &id, sizeof(Connection_Id)) == OK)
-		return OK;
-	else
-		return ERROR;
+	report(r, OK_CODE);
+	buffer_append(&r->out, &id, sizeof(Connection_Id));
 }
 
-static Success report_error(Stream s)
+static void report_error(Request * r)
 {
-	return report(s, ER_CODE);
+	report(r, ER_CODE);
+	r->state = R_FLUSH;
 }
 
-static Connection_Id read_id(Stream s)
+static void do_close_connection(Connection_Id id)
 {
-	Connection_Id id;
-	if (read_data(s, &id, sizeof(Connection_Id)) == ERROR)
-		return NONE;
-	return id;
+	Connection *c = get_connection(id);
+
+	close(c->sock);
+	c->sock = NONE;
+	buffer_free(&c->in);
+	buffer_free(&c->out);
+	if (c->owner != NULL) {
+		c->owner->state = R_FLUSH;
+		c->owner = NULL;
+	}
 }
 
-static Success forward_ssip_answer(Stream from, Stream to, bool _closep)
+/* Move the answer lines from the connection to the client, up to the
+   final one, whose code is followed by a space */
+static void forward_ssip_answer(Request * r, Connection * c)
 {
-	int result = OK;
-	FILE *f = fdopen(from, "r");
-	size_t line_size = 256;
-	char *line = malloc(line_size);
-	if (line == NULL)
-		system_error("memory allocation");
-
-	while (1) {
-		int n = getline(&line, &line_size, f);
-		if (n < 0 || write_data(to, line, n) == ERROR) {
-			result = ERROR;
-			break;
+	char *end;
+	size_t n;
+
+	while ((end = memchr(c->in.data, '\n', c->in.len)) != NULL) {
+		n = end - c->in.data + 1;
+		buffer_append(&r->out, c->in.data, n);
+		buffer_consume(&c->in, n);
+		if (n > 3 && r->out.data[r->out.len - n + 3] == ' ') {
+			r->state = R_FLUSH;
+			c->owner = NULL;
+			return;
 		}
-		if (n > 3 && line[3] == ' ')
-			break;
 	}
+}
 
-	free(line);
-	return result;
+static void start_command(Request * r, Connection * c)
+{
+	c->owner = r;
+	report_ok(r, r->id);
+	r->state = R_COMMAND;
+	/* The beginning of the command may have come with the header */
+	buffer_append(&c->out, r->in.data, r->in.len);
+	buffer_consume(&r->in, r->in.len);
 }
 
-static void process_open(Stream s)
+static void process_open(Request * r)
 {
-	Connection_Id id;
-	int port;
-	int hostlen;
+	const size_t args = sizeof(Action) + 2 * sizeof(int);
+	int port, hostlen;
 
-	if (read_data(s, &port, sizeof(int)) != sizeof(int)) {
-		report_error(s);
+	if (r->in.len < args)
 		return;
-	}
-	if (read_data(s, &hostlen, sizeof(int)) != sizeof(int)) {
-		report_error(s);
+	memcpy(&port, r->in.data + sizeof(Action), sizeof(int));
+	memcpy(&hostlen, r->in.data + sizeof(Action) + sizeof(int),
+	       sizeof(int));
+	if (hostlen < 0 || hostlen > 1024) {
+		report_error(r);
 		return;
 	}
+	if (r->in.len < args + hostlen)
+		return;
 	{
 		char *host = malloc(hostlen + 1);
 		if (host == NULL)
 			system_error("memory allocation");
-		if (read_data(s, host, hostlen) != hostlen) {
-			free(host);
-			report_error(s);
-			return;
-		}
+		memcpy(host, r->in.data + args, hostlen);
 		host[hostlen] = '\0';
-		id = do_open_connection(host, port);
+		r->id = do_open_connection(host, port);
 		free(host);
 	}
 
-	if (id == NONE)
-		report_error(s);
-	else
-		report_ok(s, id);
+	if (r->id == NONE) {
+		report_error(r);
+	} else {
+		report_ok(r, r->id);
+		r->state = R_FLUSH;
+	}
 }
 
-static void process_close(Stream s)
+/* Act on the request header once it is complete */
+static void process_header(Request * r)
 {
-	Connection_Id id = read_id(s);
-	if (id != NONE && do_close_connection(id) == OK)
-		report_ok(s, id);
-	else
-		report_error(s);
+	Action action;
+
+	if (r->in.len < sizeof(Action))
+		return;
+	memcpy(&action, r->in.data, sizeof(Action));
+
+	if (action == A_OPEN) {
+		process_open(r);
+		return;
+	}
+	if (action != A_CLOSE && action != A_DATA) {
+		report_error(r);
+		return;
+	}
+
+	if (r->in.len < sizeof(Action) + sizeof(Connection_Id))
+		return;
+	memcpy(&r->id, r->in.data + sizeof(Action), sizeof(Connection_Id));
+	buffer_consume(&r->in, sizeof(Action) + sizeof(Connection_Id));
+
+	if (get_connection(r->id) == NULL) {
+		report_error(r);
+	} else if (action == A_CLOSE) {
+		do_close_connection(r->id);
+		report_ok(r, r->id);
+		r->state = R_FLUSH;
+	} else {
+		r->state = R_WAIT;
+	}
 }
 
-static void process_data(Stream s)
+static void new_request(Stream s)
 {
-	Connection_Id id = read_id(s);
-	if (id != NONE)
-		report_ok(s, id);
-	else
-		report_error(s);
-
-	if (do_send_data(id, s, NONE, forward_data) == OK)
-		do_send_data(id, NONE, s, forward_ssip_answer);
+	Request *r = calloc(1, sizeof(Request));
+	if (r == NULL)
+		system_error("memory allocation");
+	set_nonblocking(s);
+	r->s = s;
+	r->state = R_HEADER;
+	r->id = NONE;
+	r->next = requests;
+	requests = r;
 }
 
-static void process_request(Stream s)
+static void free_request(Request * r)
 {
-	Action action;
+	Request **p;
+	Connection *c = get_connection(r->id);
 
-	if (read_data(s, &action, sizeof(Action)) == NONE)
-		return;
+	/* Answer lines of an unfinished command would go to the next one */
+	if (c != NULL && c->owner == r) {
+		c->owner = NULL;
+		do_close_connection(r->id);
+	}
+	for (p = &requests; *p != r; p = &(*p)->next) ;
+	*p = r->next;
+	close(r->s);
+	buffer_free(&r->in);
+	buffer_free(&r->out);
+	free(r);
+}
 
-	if (action == A_OPEN)
-		process_open(s);
-	else if (action == A_CLOSE)
-		process_close(s);
-	else if (action == A_DATA)
-		process_data(s);
-	else
-		report_error(s);
+static void request_readable(Request * r)
+{
+	Connection *c;
+	int n = buffer_fill(&r->in, r->s);
 
-	close(s);
+	if (n == NONE || (n == 0 && r->state == R_HEADER)) {
+		r->state = R_FLUSH;
+		return;
+	}
+	if (r->state == R_HEADER) {
+		process_header(r);
+	} else if (r->state == R_COMMAND) {
+		c = get_connection(r->id);
+		buffer_append(&c->out, r->in.data, r->in.len);
+		buffer_consume(&r->in, r->in.len);
+		if (n == 0) {
+			r->state = R_ANSWER;
+			forward_ssip_answer(r, c);
+		}
+	}
 }
 
-#if USE_THREADS
-static void *process_request_thread(void *s)
+static void connection_readable(Connection_Id id)
 {
-	Stream s_deref = *((Stream *) s);
-	free(s);
-	pthread_detach(pthread_self());
-	process_request(s_deref);
-	return NULL;
+	Connection *c = &connections[id];
+	int n = buffer_fill(&c->in, c->sock);
+
+	if (n <= 0) {
+		do_close_connection(id);
+		return;
+	}
+	if (c->owner != NULL && c->owner->state == R_ANSWER)
+		forward_ssip_answer(c->owner, c);
 }
-#endif
 
 /* Starting the server */
 
@@ -351,6 +447,9 @@ static void serve()
 	int sock;
 	size_t size;
 	const char *filename = server_socket_name();
+	struct pollfd *fds = NULL;
+	Connection_Id *fd_ids = NULL;
+	size_t fds_size = 0;
 
 	sock = socket(PF_LOCAL, SOCK_STREAM, 0);
 	if (sock < 0)
@@ -367,28 +466,109 @@ static void serve()
 		system_error("listen");
 
 	while (1) {
-		struct sockaddr_un client_address;
-		socklen_t client_address_len = sizeof(client_address);
-		Stream *s = malloc(sizeof(Stream));
-		if (s == NULL)
-			system_error("memory allocation");
-		*s = accept(sock, (struct sockaddr *)&client_address,
-			    &client_address_len);
-		if (*s < 0) {
-			free(s);
-			break;
+		Request *r, *next;
+		Connection *c;
+		Connection_Id id;
+		size_t n = 1, i;
+
+		/* Requests which got their connection free, replies sent */
+		for (r = requests; r != NULL; r = next) {
+			next = r->next;
+			if (r->state == R_WAIT) {
+				c = get_connection(r->id);
+				if (c == NULL)
+					report_error(r);
+				else if (c->owner == NULL)
+					start_command(r, c);
+			}
+			if (r->state == R_FLUSH && r->out.len == 0)
+				free_request(r);
 		}
-		{
-#if USE_THREADS
-			pthread_t tid;
-			if (pthread_create(&tid, NULL, &process_request_thread, s))
-#endif
-			{
-				process_request(*s);
-				free(s);
+
+		for (r = requests; r != NULL; r = r->next)
+			n++;
+		for (id = CONNECTION_ID_MIN; id < CONNECTION_ID_MAX; id++)
+			if (connections[id].sock != NONE)
+				n++;
+		if (n > fds_size) {
+			fds_size = n * 2;
+			fds = realloc(fds, fds_size * sizeof(struct pollfd));
+			fd_ids = realloc(fd_ids, fds_size * sizeof(Connection_Id));
+			if (fds == NULL || fd_ids == NULL)
+				system_error("memory allocation");
+		}
+
+		/* The order must match the dispatching below */
+		n = 0;
+		fds[n].fd = sock;
+		fds[n++].events = POLLIN;
+		for (r = requests; r != NULL; r = r->next) {
+			fds[n].fd = r->s;
+			fds[n].events = 0;
+			if (r->state == R_HEADER || r->state == R_COMMAND)
+				fds[n].events |= POLLIN;
+			if (r->out.len > 0)
+				fds[n].events |= POLLOUT;
+			n++;
+		}
+		for (id = CONNECTION_ID_MIN; id < CONNECTION_ID_MAX; id++) {
+			c = &connections[id];
+			if (c->sock == NONE)
+				continue;
+			fd_ids[n] = id;
+			fds[n].fd = c->sock;
+			fds[n].events = POLLIN;
+			if (c->out.len > 0)
+				fds[n].events |= POLLOUT;
+			n++;
+		}
+
+		if (poll(fds, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			system_error("poll");
+		}
+
+		i = 1;
+		for (r = requests; r != NULL; r = r->next, i++) {
+			if (fds[i].revents & POLLOUT
+			    && buffer_flush(&r->out, r->s) == ERROR) {
+				buffer_free(&r->out);
+				r->state = R_FLUSH;
 			}
+			if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)
+			    && (r->state == R_HEADER || r->state == R_COMMAND))
+				request_readable(r);
+			else if (fds[i].revents & POLLERR)
+				r->state = R_FLUSH;
+		}
+		/* Connections may have been closed and reopened meanwhile */
+		for (; i < n; i++) {
+			id = fd_ids[i];
+			c = &connections[id];
+			if (c->sock != fds[i].fd)
+				continue;
+			if (fds[i].revents & POLLOUT
+			    && buffer_flush(&c->out, c->sock) == ERROR)
+				do_close_connection(id);
+			else if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+				connection_readable(id);
+		}
+
+		if (fds[0].revents & POLLIN) {
+			struct sockaddr_un client_address;
+			socklen_t client_address_len = sizeof(client_address);
+			Stream s = accept(sock,
+					  (struct sockaddr *)&client_address,
+					  &client_address_len);
+			if (s >= 0)
+				new_request(s);
+			else if (errno != EINTR && errno != ECONNABORTED)
+				break;
 		}
 	}
+	free(fds);
+	free(fd_ids);
 	close(sock);
 }
 
@@ -401,10 +581,12 @@ static void daemonize()
 	signal(SIGHUP, SIG_IGN);
 	if (fork() != 0)
 		exit(0);
-	if ((ret = chdir("/")) != 0)
+	if ((ret = chdir("/")) != 0) {
 		fputs("server.c:daemonize: could not chdir", stderr);
-	exit(1);
+		exit(1);
+	}
 	umask(0);
+	signal(SIGPIPE, SIG_IGN);
 	{
 		int i;
 		for (i = 0; i < 4; i++)
@@ -414,17 +596,14 @@ static void daemonize()
 
 static void init_connections()
 {
-	connections = malloc(CONNECTION_ID_MAX * sizeof(Connection_Id));
+	connections = calloc(CONNECTION_ID_MAX, sizeof(Connection));
 	if (connections == NULL)
 		system_error("memory allocation");
 	{
 		int i;
 		for (i = CONNECTION_ID_MIN; i < CONNECTION_ID_MAX; i++)
-			connections[i] = NONE;
+			connections[i].sock = NONE;
 	}
-#if USE_THREADS
-	pthread_mutex_init(&connections_mutex, NULL);
-#endif
 }
 
 static void start_server()
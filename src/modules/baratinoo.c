@@ -554,16 +554,13 @@ int module_close(void)
 
 	module_speak_queue_terminate();
 
-	/* Politely ask the thread to terminate */
+	/* Ask the thread to terminate, it checks for it between each
+	   BCprocessLoop() round */
 	engine->close_requested = TRUE;
 	sem_post(&engine->semaphore);
-	/* ...and give it a chance to actually quit. */
-	g_usleep(25000);
 
-	/* Make sure the thread has really exited */
-	pthread_cancel(engine->thread);
 	DBG(DBG_MODNAME "Joining threads.");
-	if (pthread_join(engine->thread, NULL) != 0)
+	if (module_terminate_thread(engine->thread) != 0)
 		DBG(DBG_MODNAME "Failed to join threads.");
 
 	sem_destroy(&engine->semaphore);
@@ -44,6 +44,7 @@ static int initialized = 0;
 
 /* Thread and process control */
 static int cicero_speaking = 0;
+static int cicero_close_requested = 0;
 
 static pthread_t cicero_speaking_thread;
 static sem_t cicero_semaphore;
@@ -75,6 +76,13 @@ MOD_OPTION_1_STR(CiceroExecutable)
 */
 static int fd1[2], fd2[2];
 
+/*
+** Pipe waking the speaking thread up on stop requests, along with the
+** tracking data from cicero
+*/
+static int cicero_stop_pipe[2] = { -1, -1 };
+static struct timeval cicero_stop_time;
+
 /*
 ** Some internal functions
 */
@@ -210,6 +218,13 @@ int module_init(char **status_info)
 
 	cicero_message = NULL;
 
+	if (pipe(cicero_stop_pipe) < 0
+	    || fcntl(cicero_stop_pipe[0], F_SETFL, O_NONBLOCK) < 0
+	    || fcntl(cicero_stop_pipe[1], F_SETFL, O_NONBLOCK) < 0) {
+		DBG("Error creating the stop pipe\n");
+		return -1;
+	}
+
 	sem_init(&cicero_semaphore, 0, 0);
 
 	DBG("Cicero: creating new thread for cicero_tracking\n");
@@ -276,8 +291,11 @@ int module_stop(void)
 	unsigned char c = 1;
 
 	DBG("cicero: stop()\n");
+	gettimeofday(&cicero_stop_time, NULL);
 	cicero_stop = 1;
 	mywrite(fd2[1], &c, 1);
+	if (write(cicero_stop_pipe[1], &c, 1) < 0 && errno != EAGAIN)
+		DBG("Can't wake the speaking thread up: %s", strerror(errno));
 	return 0;
 }
 
@@ -297,6 +315,7 @@ size_t module_pause(void)
 int module_close(void)
 {
 	DBG("cicero: close()\n");
+	cicero_close_requested = 1;
 	if (cicero_speaking) {
 		module_stop();
 	}
@@ -304,10 +323,13 @@ int module_close(void)
 	if (!initialized)
 		return 0;
 
+	sem_post(&cicero_semaphore);
 	if (module_terminate_thread(cicero_speaking_thread) != 0)
 		return -1;
 
 	sem_destroy(&cicero_semaphore);
+	close(cicero_stop_pipe[0]);
+	close(cicero_stop_pipe[1]);
 
 	initialized = 0;
 	return 0;
@@ -323,16 +345,21 @@ void *_cicero_speak(void *nothing)
 	int bytes;
 	int ret;
 	char buf[CiceroMaxChunkLength], l[5], b[2];
-	struct pollfd ufds = { fd1[0], POLLIN | POLLPRI, 0 };
+	char drain[16];
+	struct pollfd ufds[2];
 
 	DBG("cicero: speaking thread starting.......\n");
 	set_speaking_thread_parameters();
 	while (1) {
 		sem_wait(&cicero_semaphore);
+		if (cicero_close_requested)
+			break;
 		DBG("Semaphore on\n");
 		len = strlen(cicero_message);
 		cicero_stop = 0;
 		cicero_speaking = 1;
+		/* Forget about stops of previous messages */
+		while (read(cicero_stop_pipe[0], drain, sizeof(drain)) > 0) ;
 		cicero_position = 0;
 		pos = 0;
 		module_report_event_begin();
@@ -378,9 +405,17 @@ void *_cicero_speak(void *nothing)
 				mywrite(fd2[1], buf, bytes);
 				cicero_position = 0;
 				while (1) {
-					ret = poll(&ufds, 1, 60);
-					if (ret)
-						DBG("poll() system call returned %d, events=%d\n", ret, ufds.events);
+					/* Sleep until cicero reports progress or
+					 * we are asked to stop */
+					ufds[0].fd = fd1[0];
+					ufds[0].events = POLLIN | POLLPRI;
+					ufds[0].revents = 0;
+					ufds[1].fd = cicero_stop_pipe[0];
+					ufds[1].events = POLLIN;
+					ufds[1].revents = 0;
+					ret = poll(ufds, 2, -1);
+					if (ret < 0 && errno == EINTR)
+						continue;
 					if (ret < 0) {
 						perror("poll");
 						module_report_event_stop();
@@ -388,16 +423,22 @@ void *_cicero_speak(void *nothing)
 						cicero_speaking = 0;
 						break;
 					}
-					if (ret > 0)
-						safe_read(fd1[0], b, 2);
-					if (cicero_stop) {
+					if (cicero_stop || ufds[1].revents) {
+						DBG("Stop handled %ld ms after the request\n",
+						    millisecondsSince(&cicero_stop_time));
+						cicero_speaking = 0;
+						module_report_event_stop();
+						flag = 1;
+						break;
+					}
+					if (!(ufds[0].revents & (POLLIN | POLLPRI))
+					    || safe_read(fd1[0], b, 2) != 2) {
+						DBG("Lost the connection to cicero\n");
 						cicero_speaking = 0;
 						module_report_event_stop();
 						flag = 1;
 						break;
 					}
-					if (ret == 0)
-						continue;
 					inx = (b[0] << 8 | b[1]);
 					DBG("Tracking: index=%u, bytes=%d\n",
 					    inx, bytes);
@@ -41,6 +41,7 @@
 
 /* Thread and process control */
 static int dummy_speaking = 0;
+static int dummy_close_requested = 0;
 
 static pthread_t dummy_speak_thread;
 static pid_t dummy_pid;
@@ -58,6 +59,9 @@ int module_load(void)
 
 	INIT_SETTINGS_TABLES();
 
+	/* module_init() only starts the speaking thread */
+	module_zygote_preload = 1;
+
 	return 0;
 }
 
@@ -71,7 +75,7 @@ int module_init(char **status_info)
 
 	DBG("Dummy: creating new thread for dummy_speak\n");
 	dummy_speaking = 0;
-	ret = pthread_create(&dummy_speak_thread, NULL, _dummy_speak, NULL);
+	ret = module_thread_create(&dummy_speak_thread, _dummy_speak, NULL);
 	if (ret != 0) {
 		DBG("Dummy: thread failed\n");
 		*status_info = g_strdup("The module couldn't initialize threads"
@@ -146,10 +150,12 @@ int module_close(void)
 {
 	DBG("dummy: close()\n");
 
+	dummy_close_requested = 1;
 	if (dummy_speaking) {
 		module_stop();
 	}
 
+	sem_post(&dummy_semaphore);
 	if (module_terminate_thread(dummy_speak_thread) != 0)
 		return -1;
 
@@ -170,6 +176,8 @@ void *_dummy_speak(void *nothing)
 
 	while (1) {
 		sem_wait(&dummy_semaphore);
+		if (dummy_close_requested)
+			break;
 		DBG("Semaphore on\n");
 		module_report_event_begin();
 
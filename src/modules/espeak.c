@@ -114,10 +114,8 @@ static void espeak_set_punctuation_mode(SPDPunctuation punct_mode);
 static void espeak_set_cap_let_recogn(SPDCapitalLetters cap_mode);
 
 /* Voices and languages */
-static void espeak_set_language(char *lang);
-static void espeak_set_voice(SPDVoiceType voice);
 static void espeak_set_language_and_voice(char *lang, SPDVoiceType voice);
-static void espeak_set_synthesis_voice(char *);
+static gboolean espeak_set_synthesis_voice(char *);
 
 /* > */
 /* < Module configuration options*/
@@ -142,6 +140,10 @@ int module_load(void)
 
 	REGISTER_DEBUG();
 
+	/* The engine only loads its data in memory, it can be shared by the
+	   modules a zygote forks */
+	module_zygote_preload = 1;
+
 	/* Options */
 	MOD_OPTION_1_INT_REG(EspeakAudioChunkSize, 2000);
 	MOD_OPTION_1_INT_REG(EspeakAudioQueueMaxSize, 20 * 22050);
@@ -226,6 +228,8 @@ int module_speak(gchar * data, size_t bytes, SPDMessageType msgtype)
 {
 	espeak_ERROR result = EE_INTERNAL_ERROR;
 	int flags = espeakSSML | espeakCHARS_UTF8;
+	int voice_changed;
+	gboolean voice_set = FALSE;
 
 	DBG(DBG_MODNAME " module_speak().");
 
@@ -235,10 +239,18 @@ int module_speak(gchar * data, size_t bytes, SPDMessageType msgtype)
 	DBG(DBG_MODNAME " Requested data: |%s| %d %lu", data, msgtype,
 	    (unsigned long)bytes);
 
-	/* Setting speech parameters. */
-	UPDATE_STRING_PARAMETER(voice.language, espeak_set_language);
-	UPDATE_PARAMETER(voice_type, espeak_set_voice);
-	UPDATE_STRING_PARAMETER(voice.name, espeak_set_synthesis_voice);
+	/* Setting speech parameters. Each voice selection loads a voice, so
+	   do it once for the language, voice type and synthesis voice. A
+	   synthesis voice takes precedence over the language and voice type
+	   it was changed together with. */
+	voice_changed = module_update_voice_settings();
+	if ((voice_changed & MODULE_VOICE_NAME) && msg_settings.voice.name)
+		voice_set = espeak_set_synthesis_voice(msg_settings.voice.name);
+	if (!voice_set
+	    && (voice_changed & (MODULE_VOICE_LANGUAGE | MODULE_VOICE_TYPE))
+	    && msg_settings.voice.language)
+		espeak_set_language_and_voice(msg_settings.voice.language,
+					      msg_settings.voice_type);
 
 	UPDATE_PARAMETER(rate, espeak_set_rate);
 	UPDATE_PARAMETER(volume, espeak_set_volume);
@@ -553,19 +565,11 @@ static void espeak_set_language_and_voice(char *lang, SPDVoiceType voice_code)
 	g_free(name);
 }
 
-static void espeak_set_voice(SPDVoiceType voice)
-{
-	assert(msg_settings.voice.language);
-	espeak_set_language_and_voice(msg_settings.voice.language, voice);
-}
-
-static void espeak_set_language(char *lang)
+/* Returns whether the voice could be set */
+static gboolean espeak_set_synthesis_voice(char *synthesis_voice)
 {
-	espeak_set_language_and_voice(lang, msg_settings.voice_type);
-}
+	espeak_ERROR ret = EE_INTERNAL_ERROR;
 
-static void espeak_set_synthesis_voice(char *synthesis_voice)
-{
 	if (synthesis_voice != NULL) {
 #ifdef ESPEAK_NG_INCLUDE
 		gchar *voice_name = NULL;
@@ -613,7 +617,7 @@ static void espeak_set_synthesis_voice(char *synthesis_voice)
 		}
 #endif
 
-		espeak_ERROR ret = espeak_SetVoiceByName(synthesis_voice);
+		ret = espeak_SetVoiceByName(synthesis_voice);
 		if (ret != EE_OK) {
 			DBG(DBG_MODNAME " Failed to set synthesis voice to %s.",
 			    synthesis_voice);
@@ -623,6 +627,7 @@ static void espeak_set_synthesis_voice(char *synthesis_voice)
 		g_free(voice);
 #endif
 	}
+	return ret == EE_OK;
 }
 
 /* Callbacks */
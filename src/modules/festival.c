@@ -25,12 +25,14 @@
 
 #include <stdio.h>
 #include <semaphore.h>
+#include <fcntl.h>
 
 #include <speechd_types.h>
 #include "fdsetconv.h"
 
 #include "festival_client.h"
 #include "module_utils.h"
+#include "module_utils_pcm.h"
 
 #define MODULE_NAME     "festival"
 #define MODULE_VERSION  "0.5"
@@ -41,6 +43,7 @@ DECLARE_DEBUG()
 static pthread_t festival_speak_thread;
 static sem_t festival_semaphore;
 static int festival_speaking = 0;
+static int festival_close_requested = 0;
 static int festival_pause_requested = 0;
 
 static char *festival_message;
@@ -166,6 +169,7 @@ MOD_OPTION_1_INT(FestivalComunicationType)
     MOD_OPTION_1_INT(FestivalCacheDistinguishVoices)
     MOD_OPTION_1_INT(FestivalCacheDistinguishRate)
     MOD_OPTION_1_INT(FestivalCacheDistinguishPitch)
+    MOD_OPTION_1_STR(FestivalCacheCodec)
 
     MOD_OPTION_1_INT(FestivalReopenSocket)
 
@@ -173,6 +177,8 @@ typedef struct {
 	size_t size;
 	GHashTable *caches;
 	GList *cache_counter;
+	EPcmCodec codec;
+	TPcmCacheStats stats;
 } TCache;
 
 typedef struct {
@@ -185,7 +191,7 @@ typedef struct {
 
 typedef struct {
 	TCounterEntry *p_counter_entry;
-	FT_Wave *fwave;
+	TPcmPacked *packed;
 } TCacheEntry;
 
 TCache FestivalCache;
@@ -220,6 +226,7 @@ int module_load(void)
 	MOD_OPTION_1_INT_REG(FestivalCacheDistinguishVoices, 0);
 	MOD_OPTION_1_INT_REG(FestivalCacheDistinguishRate, 0);
 	MOD_OPTION_1_INT_REG(FestivalCacheDistinguishPitch, 0);
+	MOD_OPTION_1_STR_REG(FestivalCacheCodec, "lossless");
 
 	/* TODO: Maybe switch this option to 1 when the bug with the 40ms delay
 	   in Festival is fixed */
@@ -429,7 +436,7 @@ int module_stop(void)
 			pthread_mutex_lock(&sound_output_mutex);
 			festival_stop = 1;
 			if (festival_speaking && module_audio_id) {
-				spd_audio_stop(module_audio_id);
+				module_audio_stop();
 			}
 			pthread_mutex_unlock(&sound_output_mutex);
 		}
@@ -457,17 +464,17 @@ int module_close(void)
 	DBG("festival: close()\n");
 
 	DBG("Stopping the module");
-	while (festival_speaking) {
-		module_stop();
-		usleep(50);
-	}
+	festival_close_requested = 1;
+	module_stop();
 
 	// DBG("festivalClose()");
 	// festivalClose(festival_info);
 
 	DBG("Terminating threads");
-	if (festival_speak_thread)
+	if (festival_speak_thread) {
+		sem_post(&festival_semaphore);
 		module_terminate_thread(festival_speak_thread);
+	}
 
 	if (festival_info)
 		delete_FT_Info(festival_info);
@@ -617,6 +624,8 @@ void *_festival_speak(void *nothing)
 	while (1) {
 sem_wait:
 		sem_wait(&festival_semaphore);
+		if (festival_close_requested)
+			break;
 		DBG("Semaphore on, speaking\n");
 
 		festival_stop = 0;
@@ -638,7 +647,8 @@ sem_wait:
 				    cache_lookup(festival_message,
 						 festival_message_type, 1);
 				if (fwave != NULL) {
-					wave_cached = 1;
+					/* Unpacked for us, CLEAN_UP frees it */
+					wave_cached = 0;
 					if (fwave->num_samples != 0) {
 						if (FestivalDebugSaveOutput) {
 							char filename_debug
@@ -770,10 +780,9 @@ sem_wait:
 				DBG("Storing record for %s in cache\n",
 				    festival_message);
 				/* cache_insert takes care of not inserting the same
-				   message again */
+				   message again, it keeps a packed copy of fwave */
 				cache_insert(g_strdup(festival_message),
 					     festival_message_type, fwave);
-				wave_cached = 1;
 			}
 
 			if (festival_stop) {
@@ -893,7 +902,8 @@ void festival_set_cap_let_recogn(SPDCapitalLetters recogn)
 void cache_destroy_entry(gpointer data)
 {
 	TCacheEntry *entry = data;
-	g_free(entry->fwave);
+	module_pcm_stats_remove(&FestivalCache.stats, entry->packed);
+	module_pcm_free(entry->packed);
 	g_free(entry);
 }
 
@@ -915,6 +925,13 @@ int cache_init()
 		return 0;
 
 	FestivalCache.size = 0;
+	FestivalCache.codec = module_pcm_codec_from_name(FestivalCacheCodec);
+	if ((int)FestivalCache.codec == -1) {
+		DBG("Cache: unknown FestivalCacheCodec %s, storing raw sound",
+		    FestivalCacheCodec);
+		FestivalCache.codec = PCM_CODEC_RAW;
+	}
+	memset(&FestivalCache.stats, 0, sizeof(FestivalCache.stats));
 	FestivalCache.caches =
 	    g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
 				  cache_destroy_table_entry);
@@ -983,6 +1000,7 @@ int cache_clean(size_t new_element_size)
 
 	DBG("Cache: cleaning, cache size %lu kbytes (>max %d).",
 	    (unsigned long)(FestivalCache.size / 1024), FestivalCacheMaxKBytes);
+	module_pcm_stats_report("Festival", &FestivalCache.stats);
 
 	req_size = 2 * FestivalCache.size / 3;
 
@@ -1055,12 +1073,30 @@ char *cache_gen_key(SPDMessageType type)
 	return key;
 }
 
-/* Insert one entry into the cache */
+/* Find the entry of _key_ in the cache, or NULL */
+static TCacheEntry *cache_find(const char *key, SPDMessageType msgtype)
+{
+	GHashTable *cache;
+	char *key_table;
+
+	key_table = cache_gen_key(msgtype);
+	if (key_table == NULL)
+		return NULL;
+	cache = g_hash_table_lookup(FestivalCache.caches, key_table);
+	g_free(key_table);
+	if (cache == NULL)
+		return NULL;
+
+	return g_hash_table_lookup(cache, key);
+}
+
+/* Insert one entry into the cache, fwave stays owned by the caller */
 int cache_insert(char *key, SPDMessageType msgtype, FT_Wave * fwave)
 {
 	GHashTable *cache;
 	TCacheEntry *entry;
 	TCounterEntry *centry;
+	TPcmPacked *packed;
 	char *key_table;
 
 	if (FestivalCacheOn == 0)
@@ -1072,7 +1108,7 @@ int cache_insert(char *key, SPDMessageType msgtype, FT_Wave * fwave)
 		return -1;
 
 	/* Check if the entry isn't present already */
-	if (cache_lookup(key, msgtype, 0) != NULL)
+	if (cache_find(key, msgtype) != NULL)
 		return 0;
 
 	key_table = cache_gen_key(msgtype);
@@ -1080,16 +1116,23 @@ int cache_insert(char *key, SPDMessageType msgtype, FT_Wave * fwave)
 	DBG("Cache: Inserting wave with key:'%s' into table '%s'", key,
 	    key_table);
 
+	packed = module_pcm_pack(fwave->samples, fwave->num_samples,
+				 fwave->sample_rate, FestivalCache.codec);
+
 	/* Clean less used cache entries if the size would exceed max. size */
-	if ((FestivalCache.size + fwave->num_samples * sizeof(short))
+	if ((FestivalCache.size + packed->size)
 	    > (FestivalCacheMaxKBytes * 1024))
-		if (cache_clean(fwave->num_samples * sizeof(short)) != 0)
+		if (cache_clean(packed->size) != 0) {
+			module_pcm_free(packed);
+			g_free(key_table);
 			return -1;
+		}
 
 	/* Select the right table according to language, voice, etc. or create a new one */
 	cache = g_hash_table_lookup(FestivalCache.caches, key_table);
 	if (cache == NULL) {
-		cache = g_hash_table_new(g_str_hash, g_str_equal);
+		cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					      cache_destroy_entry);
 		g_hash_table_insert(FestivalCache.caches, key_table, cache);
 	} else {
 		g_free(key_table);
@@ -1100,7 +1143,7 @@ int cache_insert(char *key, SPDMessageType msgtype, FT_Wave * fwave)
 	centry = (TCounterEntry *) g_malloc(sizeof(TCounterEntry));
 	centry->start = time(NULL);
 	centry->count = 1;
-	centry->size = fwave->num_samples * sizeof(short);
+	centry->size = packed->size;
 	centry->p_caches = cache;
 	centry->key = g_strdup(key);
 	FestivalCache.cache_counter =
@@ -1108,53 +1151,56 @@ int cache_insert(char *key, SPDMessageType msgtype, FT_Wave * fwave)
 
 	entry = (TCacheEntry *) g_malloc(sizeof(TCacheEntry));
 	entry->p_counter_entry = centry;
-	entry->fwave = fwave;
+	entry->packed = packed;
 
 	FestivalCache.size += centry->size;
+	module_pcm_stats_add(&FestivalCache.stats, packed);
 	g_hash_table_insert(cache, g_strdup(key), entry);
 
 	return 0;
 }
 
-/* Retrieve wave from the cache */
+/* Retrieve wave from the cache, to be freed with delete_FT_Wave() */
 FT_Wave *cache_lookup(const char *key, SPDMessageType msgtype, int add_counter)
 {
-	GHashTable *cache;
 	TCacheEntry *entry;
-	char *key_table;
+	FT_Wave *fwave;
 
 	if (FestivalCacheOn == 0)
 		return NULL;
 	if (key == NULL)
 		return NULL;
 
-	key_table = cache_gen_key(msgtype);
-
-	if (add_counter)
-		DBG("Cache: looking up a wave with key '%s' in '%s'", key,
-		    key_table);
-
-	if (key_table == NULL)
-		return NULL;
-	cache = g_hash_table_lookup(FestivalCache.caches, key_table);
-	g_free(key_table);
-	if (cache == NULL)
-		return NULL;
+	if (add_counter) {
+		DBG("Cache: looking up a wave with key '%s'", key);
+		FestivalCache.stats.lookups++;
+	}
 
-	entry = g_hash_table_lookup(cache, key);
+	entry = cache_find(key, msgtype);
 	if (entry == NULL)
 		return NULL;
 	entry->p_counter_entry->count++;
+	if (add_counter)
+		FestivalCache.stats.hits++;
 
 	DBG("Cache: corresponding wave found: %s", key);
 
-	return entry->fwave;
+	fwave = g_malloc(sizeof(FT_Wave));
+	fwave->num_samples = entry->packed->num_samples;
+	fwave->sample_rate = entry->packed->sample_rate;
+	fwave->samples = module_pcm_unpack(entry->packed, &FestivalCache.stats);
+	if (FestivalCache.stats.hits % 100 == 0)
+		module_pcm_stats_report("Festival", &FestivalCache.stats);
+
+	return fwave;
 }
 
 int init_festival_standalone()
 {
 	int ret;
 	int fr;
+	int exec_status[2];
+	int exec_errno;
 
 	if ((pipe(module_p.pipe_in) != 0)
 	    || (pipe(module_p.pipe_out) != 0)) {
@@ -1162,12 +1208,21 @@ int init_festival_standalone()
 		return -1;
 	}
 
+	/* Closed on successful exec, or carries errno if exec fails */
+	if (pipe(exec_status) != 0
+	    || fcntl(exec_status[1], F_SETFD, FD_CLOEXEC) != 0) {
+		DBG("Can't open pipe! Module not loaded.");
+		return -1;
+	}
+
 	DBG("Starting Festival as a child process");
 
 	fr = fork();
 	switch (fr) {
 	case -1:
 		DBG("ERROR: Can't fork! Module not loaded.");
+		close(exec_status[0]);
+		close(exec_status[1]);
 		return -1;
 	case 0:
 		ret = dup2(module_p.pipe_in[0], 0);
@@ -1178,20 +1233,30 @@ int init_festival_standalone()
 		close(module_p.pipe_out[1]);
 		close(module_p.pipe_out[0]);
 
+		close(exec_status[0]);
+
 		/* TODO: fix festival hardcoded path */
-		if (execlp("festival", "", (char *)0) == -1)
-			exit(1);
+		execlp("festival", "", (char *)0);
+		exec_errno = errno;
+		ret = write(exec_status[1], &exec_errno, sizeof(exec_errno));
+		exit(1);
 
 	default:
 		festival_process_pid = fr;
 		close(module_p.pipe_in[0]);
 		close(module_p.pipe_out[1]);
 
-		usleep(100);	/* So that the other child has at least time to fail
-				   with the execlp */
-		ret = waitpid(module_p.pid, NULL, WNOHANG);
-		if (ret != 0) {
-			DBG("Can't execute festival. Bad filename in configuration?");
+		/* Wait for the child to either exec or fail to */
+		close(exec_status[1]);
+		do {
+			ret = read(exec_status[0], &exec_errno,
+				   sizeof(exec_errno));
+		} while (ret < 0 && errno == EINTR);
+		close(exec_status[0]);
+		if (ret > 0) {
+			DBG("Can't execute festival: %s. Bad filename in configuration?",
+			    strerror(exec_errno));
+			waitpid(fr, NULL, 0);
 			return -1;
 		}
 
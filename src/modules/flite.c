@@ -41,6 +41,7 @@ DECLARE_DEBUG();
 
 /* Thread and process control */
 static int flite_speaking = 0;
+static int flite_close_requested = 0;
 
 static pthread_t flite_speak_thread;
 static sem_t flite_semaphore;
@@ -77,6 +78,10 @@ int module_load(void)
 
 	REGISTER_DEBUG();
 
+	/* The voice is registered in memory, it can be shared by the modules
+	   a zygote forks */
+	module_zygote_preload = 1;
+
 	MOD_OPTION_1_INT_REG(FliteMaxChunkLength, 300);
 	MOD_OPTION_1_STR_REG(FliteDelimiters, ".");
 
@@ -126,7 +131,7 @@ int module_init(char **status_info)
 
 	DBG("Flite: creating new thread for flite_speak\n");
 	flite_speaking = 0;
-	ret = pthread_create(&flite_speak_thread, NULL, _flite_speak, NULL);
+	ret = module_thread_create(&flite_speak_thread, _flite_speak, NULL);
 	if (ret != 0) {
 		DBG("Flite: thread failed\n");
 		*status_info =
@@ -189,7 +194,7 @@ int module_stop(void)
 	flite_stop = 1;
 	if (module_audio_id) {
 		DBG("Stopping audio");
-		ret = spd_audio_stop(module_audio_id);
+		ret = module_audio_stop();
 		if (ret != 0)
 			DBG("WARNING: Non 0 value from spd_audio_stop: %d",
 			    ret);
@@ -218,11 +223,13 @@ int module_close(void)
 	DBG("flite: close()\n");
 
 	DBG("Stopping speech");
+	flite_close_requested = 1;
 	if (flite_speaking) {
 		module_stop();
 	}
 
 	DBG("Terminating threads");
+	sem_post(&flite_semaphore);
 	if (module_terminate_thread(flite_speak_thread) != 0)
 		return -1;
 
@@ -281,6 +288,8 @@ void *_flite_speak(void *nothing)
 
 	while (1) {
 		sem_wait(&flite_semaphore);
+		if (flite_close_requested)
+			break;
 		DBG("Semaphore on\n");
 
 		flite_stop = 0;
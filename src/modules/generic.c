@@ -26,10 +26,13 @@
 
 #include <glib.h>
 #include <semaphore.h>
+#include <errno.h>
+#include <poll.h>
 
 #include <speechd_types.h>
 
 #include "module_utils.h"
+#include "module_utils_speak_queue.h"
 
 #define MODULE_NAME     "generic"
 #define MODULE_VERSION  "0.2"
@@ -38,6 +41,7 @@ DECLARE_DEBUG()
 
 /* Thread and process control */
 static int generic_speaking = 0;
+static int generic_close_requested = 0;
 
 static pthread_t generic_speak_thread;
 static pid_t generic_pid;
@@ -52,11 +56,64 @@ static int generic_pause_requested = 0;
 static char *execute_synth_str1;
 static char *execute_synth_str2;
 
+/* Where the sound of GenericExecuteSynth goes, see GenericAudioCapture */
+typedef enum {
+	GENERIC_CAPTURE_NONE,	/* The command plays it itself */
+	GENERIC_CAPTURE_WAV,
+	GENERIC_CAPTURE_AU,
+	GENERIC_CAPTURE_RAW
+} EGenericCapture;
+
+static EGenericCapture generic_capture = GENERIC_CAPTURE_NONE;
+
+/* A piece of the message being captured */
+typedef struct {
+	char *mark;		/* An index mark, or */
+	char *text;		/* text to synthesize */
+
+	gboolean started;
+	gboolean failed;	/* The command could not be run */
+	gboolean done;		/* All its sound is queued */
+	pid_t pid;		/* Of the command, until it is reaped */
+	int fd;			/* Its standard output, until the end of file */
+	gint64 start_time;
+
+	GByteArray *sound;	/* Read from the command, from _consumed_ on
+				   not queued yet */
+	size_t consumed;
+	gboolean parsed;	/* The header is */
+	AudioTrack track;
+	AudioFormat format;
+	gboolean limited;	/* By the data size of the header */
+	guint32 left;		/* Bytes of it still to queue */
+} TGenericPiece;
+
+/* The pieces of the message being captured, their commands are run ahead
+   of playback, see GenericLookahead */
+static GQueue *generic_pieces;
+
+/* Protects generic_pieces, their pid and generic_speaking when capturing */
+static pthread_mutex_t generic_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Signaled when the speaking thread is done with a message */
+static pthread_cond_t generic_idle_cond = PTHREAD_COND_INITIALIZER;
+/* Gain applied to captured sound, 1.0 unless the command sets $VOLUME */
+static float generic_capture_gain = 1.0;
+
+#define SD_MARK_HEAD_ONLY "<mark name=\""
+#define SD_MARK_TAIL "\"/>"
+
+/* Bytes read from the command at once, a multiple of 4 */
+#define CAPTURE_BUF_SIZE 8192
+
 /* Internal functions prototypes */
 static void *get_ht_option(GHashTable * hash_table, const char *key);
 static void *_generic_speak(void *);
 static void _generic_child(TModuleDoublePipe dpipe, const size_t maxlen);
 static void generic_child_close(TModuleDoublePipe dpipe);
+static int generic_prepare_command(const char *play_command);
+static char *generic_command(const char *text, int bytes);
+static void generic_speak_captured(void);
+static void generic_kill_pieces(void);
 
 void generic_set_rate(signed int rate);
 void generic_set_pitch(signed int pitch);
@@ -81,6 +138,11 @@ MOD_OPTION_1_STR(GenericExecuteSynth)
     MOD_OPTION_1_STR(GenericPunctAll)
     MOD_OPTION_1_STR(GenericStripPunctChars)
     MOD_OPTION_1_STR(GenericRecodeFallback)
+    MOD_OPTION_1_STR(GenericAudioCapture)
+    MOD_OPTION_1_INT(GenericRawSampleRate)
+    MOD_OPTION_1_INT(GenericRawChannels)
+    MOD_OPTION_1_INT(GenericAudioQueueMaxSize)
+    MOD_OPTION_1_INT(GenericLookahead)
 
     MOD_OPTION_1_INT(GenericRateAdd)
     MOD_OPTION_1_FLOAT(GenericRateMultiply)
@@ -121,6 +183,12 @@ int module_load(void)
 	MOD_OPTION_1_STR_REG(GenericStripPunctChars, "");
 	MOD_OPTION_1_STR_REG(GenericRecodeFallback, "?");
 
+	MOD_OPTION_1_STR_REG(GenericAudioCapture, "none");
+	MOD_OPTION_1_INT_REG(GenericRawSampleRate, 22050);
+	MOD_OPTION_1_INT_REG(GenericRawChannels, 1);
+	MOD_OPTION_1_INT_REG(GenericAudioQueueMaxSize, 20 * 22050);
+	MOD_OPTION_1_INT_REG(GenericLookahead, 1);
+
 	MOD_OPTION_1_INT_REG(GenericRateAdd, 0);
 	MOD_OPTION_1_FLOAT_REG(GenericRateMultiply, 1);
 	MOD_OPTION_1_INT_REG(GenericRateForceInteger, 0);
@@ -160,6 +228,47 @@ int module_init(char **status_info)
 	DBG("GenericDelimiters = %s\n", GenericDelimiters);
 	DBG("GenericExecuteSynth = %s\n", GenericExecuteSynth);
 	DBG("GenericCmdDependency = %s\n", GenericCmdDependency);
+	DBG("GenericAudioCapture = %s\n", GenericAudioCapture);
+	DBG("GenericLookahead = %d\n", GenericLookahead);
+
+	if (GenericAudioCapture == NULL
+	    || !strcasecmp(GenericAudioCapture, "none"))
+		generic_capture = GENERIC_CAPTURE_NONE;
+	else if (!strcasecmp(GenericAudioCapture, "wav"))
+		generic_capture = GENERIC_CAPTURE_WAV;
+	else if (!strcasecmp(GenericAudioCapture, "au"))
+		generic_capture = GENERIC_CAPTURE_AU;
+	else if (!strcasecmp(GenericAudioCapture, "raw"))
+		generic_capture = GENERIC_CAPTURE_RAW;
+	else {
+		DBG("Generic: unknown GenericAudioCapture %s\n",
+		    GenericAudioCapture);
+		*status_info = g_strdup_printf("Unknown GenericAudioCapture "
+					       "\"%s\", use none, wav, au or raw",
+					       GenericAudioCapture);
+		return -1;
+	}
+
+	if (generic_capture == GENERIC_CAPTURE_RAW
+	    && (GenericRawSampleRate <= 0 || GenericRawChannels <= 0)) {
+		*status_info = g_strdup("GenericRawSampleRate and "
+					"GenericRawChannels must be positive");
+		return -1;
+	}
+
+	if (GenericLookahead < 0)
+		GenericLookahead = 0;
+
+	if (generic_capture != GENERIC_CAPTURE_NONE) {
+		generic_pieces = g_queue_new();
+
+		DBG("Generic: creating playback queue\n");
+		if (module_speak_queue_init(GenericAudioQueueMaxSize,
+					    status_info)) {
+			DBG("Generic: playback queue initialization failed\n");
+			return -1;
+		}
+	}
 
 	generic_msg_language =
 	    (TGenericLanguage *) g_malloc(sizeof(TGenericLanguage));
@@ -198,7 +307,14 @@ int module_speak(gchar * data, size_t bytes, SPDMessageType msgtype)
 
 	DBG("speak()\n");
 
-	if (generic_speaking) {
+	if (generic_capture != GENERIC_CAPTURE_NONE) {
+		/* The sound of the previous message is queued by now, the
+		   speaking thread can only be finishing up with it */
+		pthread_mutex_lock(&generic_mutex);
+		while (generic_speaking)
+			pthread_cond_wait(&generic_idle_cond, &generic_mutex);
+		pthread_mutex_unlock(&generic_mutex);
+	} else if (generic_speaking) {
 		DBG("Speaking when requested to write");
 		return 0;
 	}
@@ -235,13 +351,20 @@ int module_speak(gchar * data, size_t bytes, SPDMessageType msgtype)
 		return -1;
 
 	/* TODO: use a generic engine for SPELL, CHAR, KEY */
-	if (msgtype == SPD_MSGTYPE_TEXT)
+	if (msgtype == SPD_MSGTYPE_TEXT
+	    && generic_capture != GENERIC_CAPTURE_NONE) {
+		/* Index marks are kept, they are queued between the pieces */
+		generic_message = g_strdup(tmp);
+	} else if (msgtype == SPD_MSGTYPE_TEXT)
 		generic_message = module_strip_ssml(tmp);
 	else
 		generic_message = g_strdup(tmp);
 	g_free(tmp);
 
-	module_strip_punctuation_some(generic_message, GenericStripPunctChars);
+	if (msgtype != SPD_MSGTYPE_TEXT
+	    || generic_capture == GENERIC_CAPTURE_NONE)
+		module_strip_punctuation_some(generic_message,
+					      GenericStripPunctChars);
 
 	generic_message_type = msgtype;
 
@@ -259,6 +382,11 @@ int module_stop(void)
 {
 	DBG("generic: stop()\n");
 
+	if (generic_capture != GENERIC_CAPTURE_NONE) {
+		module_speak_queue_stop();
+		return 0;
+	}
+
 	if (generic_speaking && generic_pid != 0) {
 		DBG("generic: stopping process group pid %d\n", generic_pid);
 		kill(-generic_pid, SIGKILL);
@@ -269,6 +397,10 @@ int module_stop(void)
 size_t module_pause(void)
 {
 	DBG("pause requested\n");
+	if (generic_capture != GENERIC_CAPTURE_NONE) {
+		module_speak_queue_pause();
+		return 0;
+	}
 	if (generic_speaking) {
 		DBG("Sending request to pause to child\n");
 		generic_pause_requested = 1;
@@ -289,18 +421,56 @@ int module_close(void)
 {
 	DBG("generic: close()\n");
 
-	if (generic_speaking) {
+	generic_close_requested = 1;
+	if (generic_capture != GENERIC_CAPTURE_NONE) {
+		module_speak_queue_terminate();
+		generic_kill_pieces();
+	} else if (generic_speaking) {
 		module_stop();
 	}
 
+	sem_post(&generic_semaphore);
 	if (module_terminate_thread(generic_speak_thread) != 0)
 		return -1;
 
 	sem_destroy(&generic_semaphore);
 
+	if (generic_capture != GENERIC_CAPTURE_NONE)
+		module_speak_queue_free();
+
 	return 0;
 }
 
+/* Kill the commands of all the pieces being captured */
+static void generic_kill_pieces(void)
+{
+	GList *l;
+	TGenericPiece *piece;
+
+	pthread_mutex_lock(&generic_mutex);
+	for (l = generic_pieces->head; l != NULL; l = l->next) {
+		piece = l->data;
+		if (piece->pid > 0) {
+			DBG("generic: stopping process group pid %d\n",
+			    piece->pid);
+			kill(-piece->pid, SIGKILL);
+		}
+	}
+	pthread_mutex_unlock(&generic_mutex);
+}
+
+void module_speak_queue_cancel(void)
+{
+	/* Kill the commands being read, the speaking thread then notices the
+	   stop request and gives up the rest of the message */
+	generic_kill_pieces();
+
+	pthread_mutex_lock(&generic_mutex);
+	while (generic_speaking)
+		pthread_cond_wait(&generic_idle_cond, &generic_mutex);
+	pthread_mutex_unlock(&generic_mutex);
+}
+
 /* Internal functions */
 
 static void *get_ht_option(GHashTable * hash_table, const char *key)
@@ -345,6 +515,613 @@ char *string_replace(char *string, const char *token, const char *data)
 
 }
 
+/* Substitute the current settings into GenericExecuteSynth and cut it at
+   $DATA into execute_synth_str1 and execute_synth_str2 */
+static int generic_prepare_command(const char *play_command)
+{
+	char *e_string;
+	char *p;
+	char *tmpdir, *homedir;
+	const char *helper;
+
+	helper = getenv("TMPDIR");
+	if (helper)
+		tmpdir = g_strdup(helper);
+	else
+		tmpdir = g_strdup("/tmp");
+
+	helper = g_get_home_dir();
+	if (helper)
+		homedir = g_strdup(helper);
+	else
+		homedir = g_strdup("UNKNOWN_HOME_DIRECTORY");
+
+	e_string = g_strdup(GenericExecuteSynth);
+
+	e_string = string_replace(e_string, "$PLAY_COMMAND", play_command);
+	e_string = string_replace(e_string, "$TMPDIR", tmpdir);
+	g_free(tmpdir);
+	e_string = string_replace(e_string, "$HOMEDIR", homedir);
+	g_free(homedir);
+	e_string = string_replace(e_string, "$PITCH", generic_msg_pitch_str);
+	e_string =
+	    string_replace(e_string, "$PITCH_RANGE",
+			   generic_msg_pitch_range_str);
+	e_string = string_replace(e_string, "$RATE", generic_msg_rate_str);
+	e_string = string_replace(e_string, "$VOLUME", generic_msg_volume_str);
+	e_string =
+	    string_replace(e_string, "$LANGUAGE", generic_msg_language->name);
+	e_string = string_replace(e_string, "$PUNCT", generic_msg_punct_str);
+	if (generic_msg_voice_str != NULL)
+		e_string =
+		    string_replace(e_string, "$VOICE", generic_msg_voice_str);
+	else
+		e_string = string_replace(e_string, "$VOICE", "no_voice");
+
+	/* Cut it into two strings */
+	p = strstr(e_string, "$DATA");
+	if (p == NULL) {
+		g_free(e_string);
+		return -1;
+	}
+	*p = 0;
+	g_free(execute_synth_str1);
+	g_free(execute_synth_str2);
+	execute_synth_str1 = g_strdup(e_string);
+	execute_synth_str2 = g_strdup(p + (strlen("$DATA")));
+
+	g_free(e_string);
+	return 0;
+}
+
+/* Build the command saying the _bytes_ bytes of _text_ */
+static char *generic_command(const char *text, int bytes)
+{
+	GString *command;
+	int i;
+
+	command = g_string_new(execute_synth_str1);
+
+	/* Escape any quotes */
+	for (i = 0; i <= bytes - 1; i++) {
+		if (text[i] == '\'')
+			g_string_append(command, "'\\''");
+		else
+			g_string_append_c(command, text[i]);
+	}
+
+	g_string_append(command, execute_synth_str2);
+	return g_string_free(command, FALSE);
+}
+
+static guint32 get_le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (guint32) p[3] << 24;
+}
+
+static guint16 get_le16(const unsigned char *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static guint32 get_be32(const unsigned char *p)
+{
+	return (guint32) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/* Parse the header of the sound at the start of _data_, fill the format in
+   _track_, the byte order in _format_ and the length of the samples in
+   _data_size_, 0 when it is unknown.  Only 16-bit linear PCM is supported.
+   Returns 1 and the length of the header in _header_len_ on success, 0 if
+   more data is needed and -1 if the sound is not supported. */
+static int generic_parse_header(const unsigned char *data, size_t len,
+				AudioTrack * track, AudioFormat * format,
+				guint32 * data_size, size_t * header_len)
+{
+	const unsigned char *fmt;
+	guint32 size, offset;
+	size_t pos = 0;
+	int has_fmt = 0;
+
+	track->bits = 16;
+	*data_size = 0;
+
+	switch (generic_capture) {
+	case GENERIC_CAPTURE_WAV:
+		*format = SPD_AUDIO_LE;
+		if (len < 12)
+			return 0;
+		if (memcmp(data, "RIFF", 4) || memcmp(data + 8, "WAVE", 4)) {
+			DBG("Generic: the command did not write a WAV file\n");
+			return -1;
+		}
+		pos = 12;
+		while (1) {
+			if (len < pos + 8)
+				return 0;
+			size = get_le32(data + pos + 4);
+			if (!memcmp(data + pos, "data", 4))
+				break;
+			if (size > 65536) {
+				DBG("Generic: WAV chunk of %u bytes before the data\n", size);
+				return -1;
+			}
+			/* Chunks are padded to an even size */
+			if (len < pos + 8 + size + (size & 1))
+				return 0;
+			if (!memcmp(data + pos, "fmt ", 4) && size >= 16) {
+				fmt = data + pos + 8;
+				/* PCM or WAVE_FORMAT_EXTENSIBLE */
+				if ((get_le16(fmt) != 1 && get_le16(fmt) != 0xfffe)
+				    || get_le16(fmt + 14) != 16) {
+					DBG("Generic: WAV format %d with %d bits is not supported\n", get_le16(fmt), get_le16(fmt + 14));
+					return -1;
+				}
+				track->num_channels = get_le16(fmt + 2);
+				track->sample_rate = get_le32(fmt + 4);
+				has_fmt = 1;
+			}
+			pos += 8 + size + (size & 1);
+		}
+		if (!has_fmt) {
+			DBG("Generic: WAV file without format\n");
+			return -1;
+		}
+		/* Streaming writers can't know it and put 0 or a huge value,
+		   reading then goes on to the end of file anyway */
+		*data_size = size;
+		pos += 8;
+		break;
+
+	case GENERIC_CAPTURE_AU:
+		*format = SPD_AUDIO_BE;
+		if (len < 24)
+			return 0;
+		if (memcmp(data, ".snd", 4)) {
+			DBG("Generic: the command did not write an AU file\n");
+			return -1;
+		}
+		offset = get_be32(data + 4);
+		size = get_be32(data + 8);
+		/* 3 is 16-bit linear PCM */
+		if (get_be32(data + 12) != 3 || offset < 24 || offset > 65536) {
+			DBG("Generic: AU encoding %u is not supported\n",
+			    get_be32(data + 12));
+			return -1;
+		}
+		if (len < offset)
+			return 0;
+		track->sample_rate = get_be32(data + 16);
+		track->num_channels = get_be32(data + 20);
+		*data_size = size == 0xffffffff ? 0 : size;
+		pos = offset;
+		break;
+
+	default:
+		*format = SPD_AUDIO_LE;
+		track->sample_rate = GenericRawSampleRate;
+		track->num_channels = GenericRawChannels;
+	}
+
+	if (track->num_channels <= 0 || track->num_channels > 8
+	    || track->sample_rate <= 0) {
+		DBG("Generic: bad sound format, %d channels at %d Hz\n",
+		    track->num_channels, track->sample_rate);
+		return -1;
+	}
+	*header_len = pos;
+	return 1;
+}
+
+/* Split generic_message into the pieces to synthesize and the index marks
+   between them */
+static void generic_split_message(GQueue * pieces)
+{
+	const char *p, *mark, *name, *end;
+	char *segment, *buf;
+	unsigned int pos;
+	int bytes;
+	TGenericPiece *piece;
+
+	buf = g_malloc(GenericMaxChunkLength + 1);
+	p = generic_message;
+	while (p != NULL) {
+		mark = NULL;
+		if (generic_message_type == SPD_MSGTYPE_TEXT)
+			mark = strstr(p, SD_MARK_HEAD_ONLY);
+		if (mark != NULL) {
+			name = mark + strlen(SD_MARK_HEAD_ONLY);
+			end = strstr(name, SD_MARK_TAIL);
+			if (end == NULL)
+				mark = NULL;
+		}
+
+		if (mark != NULL)
+			segment = g_strndup(p, mark - p);
+		else
+			segment = g_strdup(p);
+		if (generic_message_type == SPD_MSGTYPE_TEXT) {
+			char *stripped = module_strip_ssml(segment);
+			g_free(segment);
+			segment = stripped;
+			module_strip_punctuation_some(segment,
+						      GenericStripPunctChars);
+		}
+
+		pos = 0;
+		while ((bytes = module_get_message_part(segment, buf, &pos,
+							GenericMaxChunkLength,
+							GenericDelimiters)) > 0) {
+			buf[bytes] = 0;
+			if (strspn(buf, " \t\r\n") == bytes)
+				continue;
+			piece = g_new0(TGenericPiece, 1);
+			piece->text = g_strdup(buf);
+			piece->fd = -1;
+			g_queue_push_tail(pieces, piece);
+		}
+		g_free(segment);
+
+		if (mark == NULL)
+			break;
+
+		piece = g_new0(TGenericPiece, 1);
+		piece->mark = g_strndup(name, end - name);
+		piece->fd = -1;
+		g_queue_push_tail(pieces, piece);
+		p = end + strlen(SD_MARK_TAIL);
+	}
+	g_free(buf);
+}
+
+/* Start the command synthesizing _piece_, reading its standard output.
+   Returns -1 if stopped. */
+static int generic_piece_start(TGenericPiece * piece)
+{
+	int fd[2];
+	pid_t pid;
+	sigset_t all_signals;
+	char *command;
+
+	piece->started = TRUE;
+	piece->sound = g_byte_array_new();
+	piece->start_time = g_get_monotonic_time();
+
+	if (pipe(fd) != 0) {
+		DBG("Can't create pipe\n");
+		piece->failed = TRUE;
+		return 0;
+	}
+
+	command = generic_command(piece->text, strlen(piece->text));
+	DBG("Generic: starting command |%s|\n", command);
+
+	pthread_mutex_lock(&generic_mutex);
+	if (module_speak_queue_stop_requested()) {
+		pthread_mutex_unlock(&generic_mutex);
+		g_free(command);
+		close(fd[0]);
+		close(fd[1]);
+		return -1;
+	}
+
+	pid = fork();
+	if (pid == 0) {
+		/* Its own process group, so that stopping also kills
+		   whatever the shell starts */
+		setpgid(0, 0);
+		sigemptyset(&all_signals);
+		sigprocmask(SIG_SETMASK, &all_signals, NULL);
+		dup2(fd[1], 1);
+		close(fd[0]);
+		close(fd[1]);
+		execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+		_exit(127);
+	}
+	if (pid > 0) {
+		/* Don't let a stop come before the child did it itself */
+		setpgid(pid, pid);
+		piece->pid = pid;
+	}
+	pthread_mutex_unlock(&generic_mutex);
+
+	g_free(command);
+	close(fd[1]);
+	if (pid == -1) {
+		DBG("Can't say the message. fork() failed!\n");
+		close(fd[0]);
+		piece->failed = TRUE;
+		return 0;
+	}
+	piece->fd = fd[0];
+	return 0;
+}
+
+/* Read what the command of _piece_ wrote, up to CAPTURE_BUF_SIZE bytes */
+static void generic_piece_read(TGenericPiece * piece)
+{
+	guint len = piece->sound->len;
+	ssize_t n;
+
+	g_byte_array_set_size(piece->sound, len + CAPTURE_BUF_SIZE);
+	n = read(piece->fd, piece->sound->data + len, CAPTURE_BUF_SIZE);
+	if (n < 0 && (errno == EINTR || errno == EAGAIN))
+		n = 0;
+	else if (n <= 0) {
+		close(piece->fd);
+		piece->fd = -1;
+		n = 0;
+	}
+	g_byte_array_set_size(piece->sound, len + n);
+}
+
+/* Queue for playback what the command of _piece_ wrote so far, and tell
+   whether it is all played in piece->done.  Returns -1 if stopped. */
+static int generic_piece_queue(TGenericPiece * piece)
+{
+	AudioTrack track;
+	size_t header_len, frame, usable;
+	gint16 *samples;
+	int i, ret;
+
+	if (piece->failed) {
+		piece->done = TRUE;
+		return 0;
+	}
+
+	if (!piece->parsed) {
+		ret = generic_parse_header(piece->sound->data,
+					   piece->sound->len, &piece->track,
+					   &piece->format, &piece->left,
+					   &header_len);
+		if (ret == 0 && piece->fd >= 0)
+			return 0;
+		if (ret <= 0) {
+			DBG("Generic: no sound for |%s|\n", piece->text);
+			piece->done = TRUE;
+			return 0;
+		}
+		DBG("Generic: capturing %d channels at %d Hz, %.3f s after the command started\n", piece->track.num_channels, piece->track.sample_rate, (g_get_monotonic_time() - piece->start_time) / 1000000.0);
+		piece->parsed = TRUE;
+		piece->limited = piece->left > 0;
+		piece->consumed = header_len;
+	}
+
+	frame = 2 * piece->track.num_channels;
+	while (1) {
+		usable = MIN(piece->sound->len - piece->consumed,
+			     CAPTURE_BUF_SIZE);
+		if (piece->limited && usable > piece->left)
+			usable = piece->left;
+		/* Only whole frames are queued */
+		usable -= usable % frame;
+		if (usable == 0)
+			break;
+
+		track = piece->track;
+		samples = (gint16 *) (piece->sound->data + piece->consumed);
+		track.samples = samples;
+		track.num_samples = usable / 2;
+		for (i = 0; i < track.num_samples; i++) {
+			gint16 sample = piece->format == SPD_AUDIO_BE
+			    ? GINT16_FROM_BE(samples[i])
+			    : GINT16_FROM_LE(samples[i]);
+			if (generic_capture_gain != 1.0)
+				sample = sample * generic_capture_gain;
+			samples[i] = sample;
+		}
+
+		if (!module_speak_queue_add_audio(&track,
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+						  SPD_AUDIO_LE
+#else
+						  SPD_AUDIO_BE
+#endif
+		    ))
+			return -1;
+
+		piece->consumed += usable;
+		if (piece->limited)
+			piece->left -= usable;
+	}
+
+	/* Don't keep what is queued already */
+	if (piece->consumed == piece->sound->len) {
+		g_byte_array_set_size(piece->sound, 0);
+		piece->consumed = 0;
+	}
+
+	if (piece->fd < 0 || (piece->limited && piece->left == 0))
+		piece->done = TRUE;
+	return 0;
+}
+
+/* Free _piece_, killing its command unless it finished writing */
+static void generic_piece_free(TGenericPiece * piece)
+{
+	pid_t pid;
+	int status;
+
+	pthread_mutex_lock(&generic_mutex);
+	pid = piece->pid;
+	piece->pid = 0;
+	pthread_mutex_unlock(&generic_mutex);
+
+	if (piece->fd >= 0) {
+		close(piece->fd);
+		if (pid > 0)
+			kill(-pid, SIGKILL);
+	}
+	if (pid > 0) {
+		waitpid(pid, &status, 0);
+		DBG("Generic: command terminated, status:%d signal?:%d\n",
+		    WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+		    WIFSIGNALED(status));
+	}
+
+	if (piece->sound != NULL)
+		g_byte_array_free(piece->sound, TRUE);
+	g_free(piece->text);
+	g_free(piece->mark);
+	g_free(piece);
+}
+
+/* Say the pieces in order, running the commands of up to GenericLookahead
+   pieces ahead of the one being played.  Returns -1 if stopped. */
+static int generic_capture_pieces(GQueue * pieces)
+{
+	struct pollfd *fds;
+	TGenericPiece **owners;
+	TGenericPiece *head, *piece;
+	GList *l;
+	gint64 gap_start = 0;
+	int running, nfds, i;
+	int ret = 0;
+
+	fds = g_new(struct pollfd, GenericLookahead + 1);
+	owners = g_new(TGenericPiece *, GenericLookahead + 1);
+
+	while (ret == 0 && (head = g_queue_peek_head(pieces)) != NULL) {
+		if (module_speak_queue_stop_requested()) {
+			ret = -1;
+			break;
+		}
+		if (head->mark != NULL) {
+			module_speak_queue_add_mark(head->mark);
+		} else {
+			/* Keep the head and the following ones running */
+			running = 0;
+			for (l = pieces->head;
+			     l != NULL && running <= GenericLookahead && ret == 0;
+			     l = l->next) {
+				piece = l->data;
+				if (piece->mark != NULL)
+					continue;
+				if (!piece->started)
+					ret = generic_piece_start(piece);
+				running++;
+			}
+			if (ret == 0)
+				ret = generic_piece_queue(head);
+			if (ret != 0)
+				break;
+
+			if (!head->done) {
+				if (gap_start == 0 && head->sound->len == 0)
+					gap_start = g_get_monotonic_time();
+
+				/* Wait for any of them to write more */
+				nfds = 0;
+				for (l = pieces->head;
+				     l != NULL && nfds <= GenericLookahead;
+				     l = l->next) {
+					piece = l->data;
+					if (piece->fd < 0)
+						continue;
+					fds[nfds].fd = piece->fd;
+					fds[nfds].events = POLLIN;
+					owners[nfds++] = piece;
+				}
+				if (poll(fds, nfds, -1) < 0 && errno != EINTR) {
+					DBG("Generic: poll() failed: %s\n",
+					    strerror(errno));
+					ret = -1;
+					break;
+				}
+				for (i = 0; i < nfds; i++)
+					if (fds[i].revents)
+						generic_piece_read(owners[i]);
+
+				if (gap_start != 0 && head->sound->len > 0) {
+					DBG("Generic: waited %.3f s for the next piece\n", (g_get_monotonic_time() - gap_start) / 1000000.0);
+					gap_start = 0;
+				}
+				continue;
+			}
+		}
+
+		pthread_mutex_lock(&generic_mutex);
+		g_queue_pop_head(pieces);
+		pthread_mutex_unlock(&generic_mutex);
+		generic_piece_free(head);
+	}
+
+	g_free(fds);
+	g_free(owners);
+
+	if (module_speak_queue_stop_requested())
+		ret = -1;
+	return ret;
+}
+
+/* Say generic_message through the speak queue, from the speaking thread */
+static void generic_speak_captured(void)
+{
+	const char *play_command;
+	char *icon;
+	TGenericPiece *piece;
+	int ret;
+
+	if (!module_speak_queue_wait_idle())
+		goto out;
+	if (!module_speak_queue_before_synth())
+		goto out;
+
+	play_command = spd_audio_get_playcmd(module_audio_id);
+	if (play_command == NULL)
+		play_command = "play";
+
+	if (generic_message_type == SPD_MSGTYPE_SOUND_ICON) {
+		icon = g_strdup_printf("%s/%s", GenericSoundIconFolder,
+				       generic_message);
+		module_speak_queue_before_play();
+		module_speak_queue_add_sound_icon(icon);
+		module_speak_queue_add_end();
+		g_free(icon);
+		goto out;
+	}
+
+	if (generic_prepare_command(play_command) != 0) {
+		DBG("Generic: no $DATA in GenericExecuteSynth\n");
+		module_speak_queue_before_play();
+		module_speak_queue_add_end();
+		goto out;
+	}
+
+	/* $VOLUME already tells the command, otherwise the gain does. As
+	   for native modules, volume 0 is the normal loudness, the sound
+	   can't be made louder without clipping. */
+	if (strstr(GenericExecuteSynth, "$VOLUME") || msg_settings.volume >= 0)
+		generic_capture_gain = 1.0;
+	else
+		generic_capture_gain = (msg_settings.volume + 100) / 100.0;
+
+	pthread_mutex_lock(&generic_mutex);
+	generic_split_message(generic_pieces);
+	pthread_mutex_unlock(&generic_mutex);
+
+	module_speak_queue_before_play();
+	ret = generic_capture_pieces(generic_pieces);
+	if (ret == 0)
+		module_speak_queue_add_end();
+
+	/* Kill whatever is still running after a stop */
+	while (1) {
+		pthread_mutex_lock(&generic_mutex);
+		piece = g_queue_pop_head(generic_pieces);
+		pthread_mutex_unlock(&generic_mutex);
+		if (piece == NULL)
+			break;
+		generic_piece_free(piece);
+	}
+
+out:
+	pthread_mutex_lock(&generic_mutex);
+	generic_speaking = 0;
+	pthread_cond_broadcast(&generic_idle_cond);
+	pthread_mutex_unlock(&generic_mutex);
+}
+
 void *_generic_speak(void *nothing)
 {
 	TModuleDoublePipe module_pipe;
@@ -357,8 +1134,15 @@ void *_generic_speak(void *nothing)
 
 	while (1) {
 		sem_wait(&generic_semaphore);
+		if (generic_close_requested)
+			break;
 		DBG("Semaphore on\n");
 
+		if (generic_capture != GENERIC_CAPTURE_NONE) {
+			generic_speak_captured();
+			continue;
+		}
+
 		const char *play_command = NULL;
 		play_command = spd_audio_get_playcmd(module_audio_id);
 
@@ -413,78 +1197,13 @@ void *_generic_speak(void *nothing)
 			continue;
 
 		case 0:{
-				char *e_string;
-				char *p;
-				char *tmpdir, *homedir;
-				const char *helper;
-
-				helper = getenv("TMPDIR");
-				if (helper)
-					tmpdir = g_strdup(helper);
-				else
-					tmpdir = g_strdup("/tmp");
-
-				helper = g_get_home_dir();
-				if (helper)
-					homedir = g_strdup(helper);
-				else
-					homedir =
-					    g_strdup("UNKNOWN_HOME_DIRECTORY");
-
 				/* Set this process as a process group leader (so that SIGKILL
 				   is also delivered to the child processes created by system()) */
 				if (setpgid(0, 0) == -1)
 					DBG("Can't set myself as project group leader!");
 
-				e_string = g_strdup(GenericExecuteSynth);
-
-				e_string =
-				    string_replace(e_string, "$PLAY_COMMAND",
-						   play_command);
-				e_string =
-				    string_replace(e_string, "$TMPDIR", tmpdir);
-				g_free(tmpdir);
-				e_string =
-				    string_replace(e_string, "$HOMEDIR",
-						   homedir);
-				g_free(homedir);
-				e_string =
-				    string_replace(e_string, "$PITCH",
-						   generic_msg_pitch_str);
-				e_string =
-				    string_replace(e_string, "$PITCH_RANGE",
-						   generic_msg_pitch_range_str);
-				e_string =
-				    string_replace(e_string, "$RATE",
-						   generic_msg_rate_str);
-				e_string =
-				    string_replace(e_string, "$VOLUME",
-						   generic_msg_volume_str);
-				e_string =
-				    string_replace(e_string, "$LANGUAGE",
-						   generic_msg_language->name);
-				e_string =
-				    string_replace(e_string, "$PUNCT",
-						   generic_msg_punct_str);
-				if (generic_msg_voice_str != NULL)
-					e_string =
-					    string_replace(e_string, "$VOICE",
-							   generic_msg_voice_str);
-				else
-					e_string =
-					    string_replace(e_string, "$VOICE",
-							   "no_voice");
-
-				/* Cut it into two strings */
-				p = strstr(e_string, "$DATA");
-				if (p == NULL)
+				if (generic_prepare_command(play_command) != 0)
 					exit(1);
-				*p = 0;
-				execute_synth_str1 = g_strdup(e_string);
-				execute_synth_str2 =
-				    g_strdup(p + (strlen("$DATA")));
-
-				g_free(e_string);
 
 				/* execute_synth_str1 se sem musi nejak dostat */
 				DBG("Starting child...\n");
@@ -531,8 +1250,6 @@ void _generic_child(TModuleDoublePipe dpipe, const size_t maxlen)
 	sigset_t some_signals;
 	int bytes;
 	char *command;
-	GString *message;
-	int i;
 	int ret;
 
 	sigfillset(&some_signals);
@@ -554,27 +1271,9 @@ void _generic_child(TModuleDoublePipe dpipe, const size_t maxlen)
 		text[bytes] = 0;
 		DBG("text read is: |%s|\n", text);
 
-		/* Escape any quotes */
-		message = g_string_new("");
-		for (i = 0; i <= bytes - 1; i++) {
-			if (text[i] == '\'')
-				message = g_string_append(message, "'\\''");
-			else {
-				g_string_append_printf(message, "%c", text[i]);
-			}
-		}
-
-		DBG("child: escaped text is |%s|", message->str);
-
-		command =
-		    g_malloc((strlen(message->str) +
-			      strlen(execute_synth_str1) +
-			      strlen(execute_synth_str2) + 8) * sizeof(char));
-
-		if (strlen(message->str) != 0) {
-			sprintf(command, "%s%s%s", execute_synth_str1,
-				message->str, execute_synth_str2);
+		command = generic_command(text, bytes);
 
+		if (bytes != 0) {
 			DBG("child: synth command = |%s|", command);
 
 			DBG("Speaking in child...");
@@ -589,7 +1288,6 @@ void _generic_child(TModuleDoublePipe dpipe, const size_t maxlen)
 
 		g_free(command);
 		g_free(text);
-		g_string_free(message, 1);
 
 		DBG("child->parent: ok, send more data");
 		module_child_dp_write(dpipe, "C", 1);
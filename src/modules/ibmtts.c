@@ -180,6 +180,35 @@ static SPDMessageType message_type;
 static ECIHand eciHandle = NULL_ECI_HAND;
 static int eci_sample_rate = 0;
 
+/* Switching the dialect of an ECI instance makes it load the language
+   data again, and the voice parameters and dictionaries have to be set
+   up again on top of that. So we keep up to IbmttsLanguagePoolSize
+   instances, each set up for its own dialect, and make the one matching
+   the message language current. When all are taken, the least recently
+   used one is switched to the new dialect. */
+#define ECI_SETTING_UNKNOWN (-1000)
+
+typedef struct {
+	ECIHand handle;
+	int index;		/* in voices or eciLocales, -1 if not set yet */
+	int dict_index;		/* dictionaries loaded for, -1 if none */
+	int voice_type;		/* voice parameters set for, -1 if none */
+	int pitch_baseline;
+	int speed;
+	/* The settings last applied, ECI_SETTING_UNKNOWN if not known */
+	int rate;
+	int pitch;
+	int volume;
+	int punctuation_mode;
+	int cap_mode;
+} TEciEngine;
+
+/* The most recently used first, the head is the current one */
+static GQueue *eci_engines = NULL;
+static TEciEngine *eci_engine = NULL;
+static unsigned long eci_engine_switches;
+static unsigned long eci_engine_loads;
+
 /* ECI sends audio back in chunks to this buffer.
    The smaller the buffer, the higher the overhead, but the better
    the index mark resolution. */
@@ -223,16 +252,18 @@ static int *speechd_voice_index = NULL;
 
 /* Internal function prototypes for main thread. */
 static void update_sample_rate();
-static void set_language(char *lang);
-static void set_voice_type(SPDVoiceType voice_type);
 static char *voice_enum_to_str(SPDVoiceType voice);
 static void set_language_and_voice(char *lang, SPDVoiceType voice_type, char *name);
-static void set_synthesis_voice(char *);
 static void set_rate(signed int rate);
 static void set_pitch(signed int pitch);
 static void set_punctuation_mode(SPDPunctuation punct_mode);
 static void set_volume(signed int pitch);
 static void set_capital_mode(SPDCapitalLetters cap_mode);
+static int set_voice_param(enum ECIVoiceParam param, int value);
+static TEciEngine *eci_engine_new(void);
+static void eci_engine_free(TEciEngine * engine);
+static TEciEngine *eci_engine_get(int index);
+static void eci_engine_sync_settings(TEciEngine * engine);
 
 /* locale_index_atomic stores the current index of the voices or eciLocales array.
    The main thread writes this information, the synthesis thread reads it.
@@ -275,6 +306,7 @@ MOD_OPTION_1_INT(IbmttsUseAbbreviation);
 MOD_OPTION_1_STR(IbmttsDictionaryFolder);
 MOD_OPTION_1_INT(IbmttsAudioChunkSize);
 MOD_OPTION_1_STR(IbmttsSoundIconFolder);
+MOD_OPTION_1_INT(IbmttsLanguagePoolSize);
 MOD_OPTION_6_INT_HT(IbmttsVoiceParameters,
 		    gender, breathiness, head_size, pitch_baseline,
 		    pitch_fluctuation, roughness, speed);
@@ -366,6 +398,7 @@ int module_load(void)
 	MOD_OPTION_1_INT_REG(IbmttsAudioChunkSize, 20000);
 	MOD_OPTION_1_STR_REG(IbmttsSoundIconFolder,
 			     "/usr/share/sounds/sound-icons/");
+	MOD_OPTION_1_INT_REG(IbmttsLanguagePoolSize, 2);
 
 	/* Register voices. */
 	module_register_settings_voices();
@@ -397,43 +430,27 @@ int module_init(char **status_info)
 	/* TODO: according to version, enable SSML and punct by default or not
 	 */
 
-	/* Setup TTS engine. */
-	DBG(DBG_MODNAME "Creating an engine instance.");
-	eciHandle = eciNew();
-	if (NULL_ECI_HAND == eciHandle) {
-		DBG(DBG_MODNAME "Could not create an engine instance.\n");
-		*status_info = g_strdup("Could not create an engine instance. "
-					"Is the TTS engine installed?");
-		return MODULE_FATAL_ERROR;
-	}
-
-	update_sample_rate();
+	if (IbmttsLanguagePoolSize < 1)
+		IbmttsLanguagePoolSize = 1;
+	DBG(DBG_MODNAME "IbmttsLanguagePoolSize = %d", IbmttsLanguagePoolSize);
 
 	/* Allocate a chunk for ECI to return audio. */
 	audio_chunk =
 	    (TEciAudioSamples *) g_malloc((IbmttsAudioChunkSize) *
 					  sizeof(TEciAudioSamples));
 
-	DBG(DBG_MODNAME "Registering ECI callback.");
-	eciRegisterCallback(eciHandle, eciCallback, NULL);
-
-	DBG(DBG_MODNAME "Registering an ECI audio buffer.");
-	if (!eciSetOutputBuffer(eciHandle, IbmttsAudioChunkSize, audio_chunk)) {
-		DBG(DBG_MODNAME "Error registering ECI audio buffer.");
-		log_eci_error();
+	/* Setup TTS engine. */
+	eci_engines = g_queue_new();
+	eci_engine = eci_engine_new();
+	if (eci_engine == NULL) {
+		*status_info = g_strdup("Could not create an engine instance. "
+					"Is the TTS engine installed?");
+		return MODULE_FATAL_ERROR;
 	}
+	g_queue_push_head(eci_engines, eci_engine);
+	eciHandle = eci_engine->handle;
 
-	eciSetParam(eciHandle, eciDictionary, !IbmttsUseAbbreviation);
-
-	/* enable annotations */
-	eciSetParam(eciHandle, eciInputType, 1);
-
-	/* load possibly the ssml filter */
-	if (IbmttsUseSSML)
-		eciAddText(eciHandle, " `gfa1 ");
-
-	/* load possibly the punctuation filter */
-	eciAddText(eciHandle, " `gfa2 ");
+	update_sample_rate();
 
 	set_punctuation_mode(msg_settings.punctuation_mode);
 
@@ -482,6 +499,8 @@ SPDVoice **module_list_voices(void)
 
 int module_speak(gchar * data, size_t bytes, SPDMessageType msgtype)
 {
+	int voice_changed;
+
 	DBG(DBG_MODNAME "module_speak().");
 
 	DBG(DBG_MODNAME "Type: %d, bytes: %lu, requested data: |%s|\n", msgtype,
@@ -509,15 +528,18 @@ int module_speak(gchar * data, size_t bytes, SPDMessageType msgtype)
 	    && (msg_settings.spelling_mode == SPD_SPELL_ON))
 		message_type = SPD_MSGTYPE_SPELL;
 
-	/* Setting speech parameters. */
-	UPDATE_STRING_PARAMETER(voice.language, set_language);
-	UPDATE_PARAMETER(voice_type, set_voice_type);
-	UPDATE_STRING_PARAMETER(voice.name, set_synthesis_voice);
-	UPDATE_PARAMETER(rate, set_rate);
-	UPDATE_PARAMETER(volume, set_volume);
-	UPDATE_PARAMETER(pitch, set_pitch);
-	UPDATE_PARAMETER(punctuation_mode, set_punctuation_mode);
-	UPDATE_PARAMETER(cap_let_recogn, set_capital_mode);
+	/* Setting speech parameters. The language, voice type and synthesis
+	   voice all go to set_language_and_voice(), which may switch or
+	   re-dialect an engine instance, so call it once for all of them.
+	   The engine remembers what it was set to, set only what differs. */
+	voice_changed = module_update_voice_settings();
+	if (((voice_changed & (MODULE_VOICE_LANGUAGE | MODULE_VOICE_TYPE))
+	     && msg_settings.voice.language)
+	    || ((voice_changed & MODULE_VOICE_NAME) && msg_settings.voice.name))
+		set_language_and_voice(msg_settings.voice.language,
+				       msg_settings.voice_type,
+				       msg_settings.voice.name);
+	eci_engine_sync_settings(eci_engine);
 	
 	if (!IbmttsUseSSML) {
 		/* Strip all SSML */
@@ -578,11 +600,14 @@ int module_close(void)
 	DBG(DBG_MODNAME "Stopping speech");
 	module_stop();
 
-	DBG(DBG_MODNAME "De-registering ECI callback.");
-	eciRegisterCallback(eciHandle, NULL, NULL);
-
-	DBG(DBG_MODNAME "Destroying ECI instance.");
-	eciDelete(eciHandle);
+	DBG(DBG_MODNAME "Destroying ECI instances after %lu language switches "
+	    "of which %lu needed loading a language.", eci_engine_switches,
+	    eci_engine_loads);
+	if (eci_engines) {
+		g_queue_free_full(eci_engines, (GDestroyNotify) eci_engine_free);
+		eci_engines = NULL;
+	}
+	eci_engine = NULL;
 	eciHandle = NULL_ECI_HAND;
 
 	/* Free buffer for ECI audio. */
@@ -627,6 +652,10 @@ static void update_sample_rate()
 	case 2:
 		eci_sample_rate = 22050;
 		break;
+	case 3:
+		/* Not in eci.h, used by the fake library of the tests */
+		eci_sample_rate = 16000;
+		break;
 	default:
 		DBG(DBG_MODNAME "Invalid audio sample rate returned by ECI = %i",
 		    sample_rate);
@@ -888,6 +917,18 @@ static void *_synth(void *nothing)
 	pthread_exit(NULL);
 }
 
+/* Like eciSetVoiceParam() on the current voice, but does not set what
+   the voice already has: a new voice comes with its own speed and pitch,
+   which rate and pitch 0 map to */
+static int set_voice_param(enum ECIVoiceParam param, int value)
+{
+	int old = eciGetVoiceParam(eciHandle, 0, param);
+
+	if (old == value)
+		return old;
+	return eciSetVoiceParam(eciHandle, 0, param, value);
+}
+
 static void set_rate(signed int rate)
 {
 	DBG(DBG_MODNAME "ENTER %s", __func__);
@@ -906,12 +947,14 @@ static void set_rate(signed int rate)
 		    (((float)rate * (140 - voice_speed)) / (float)100)
 		    + voice_speed;
 	assert(speed >= 0 && speed <= 140);
-	int ret = eciSetVoiceParam(eciHandle, 0, eciSpeed, speed);
+	int ret = set_voice_param(eciSpeed, speed);
 	if (-1 == ret) {
 		DBG(DBG_MODNAME "Error setting rate %i.", speed);
 		log_eci_error();
-	} else
+	} else {
 		DBG(DBG_MODNAME "Rate set to %i.", speed);
+		eci_engine->rate = rate;
+	}
 }
 
 static void set_volume(signed int volume)
@@ -931,12 +974,14 @@ static void set_volume(signed int volume)
 		/* Map 0 to 100 onto 90 to 100 */
 		vol = ((float)(volume * 10) / (float)100) + 90;
 	assert(vol >= 0 && vol <= 100);
-	int ret = eciSetVoiceParam(eciHandle, 0, eciVolume, vol);
+	int ret = set_voice_param(eciVolume, vol);
 	if (-1 == ret) {
 		DBG(DBG_MODNAME "Error setting volume %i.", vol);
 		log_eci_error();
-	} else
+	} else {
 		DBG(DBG_MODNAME "Volume set to %i.", vol);
+		eci_engine->volume = volume;
+	}
 }
 
 static void set_pitch(signed int pitch)
@@ -960,13 +1005,14 @@ static void set_pitch(signed int pitch)
 		     (float)100)
 		    + voice_pitch_baseline;
 	assert(pitchBaseline >= 0 && pitchBaseline <= 100);
-	int ret =
-	    eciSetVoiceParam(eciHandle, 0, eciPitchBaseline, pitchBaseline);
+	int ret = set_voice_param(eciPitchBaseline, pitchBaseline);
 	if (-1 == ret) {
 		DBG(DBG_MODNAME "Error setting pitch %i.", pitchBaseline);
 		log_eci_error();
-	} else
+	} else {
 		DBG(DBG_MODNAME "Pitch set to %i.", pitchBaseline);
+		eci_engine->pitch = pitch;
+	}
 }
 
 static void set_punctuation_mode(SPDPunctuation punct_mode)
@@ -995,6 +1041,7 @@ static void set_punctuation_mode(SPDPunctuation punct_mode)
 	msg = g_strdup_printf(fmt, real_punct_mode, IbmttsPunctuationList);
 	eciAddText(eciHandle, msg);
 	g_free(msg);
+	eci_engine->punctuation_mode = punct_mode;
 }
 
 #ifdef VOXIN
@@ -1016,6 +1063,7 @@ static void set_capital_mode(SPDCapitalLetters cap_mode)
 	}
 
 	voxSetParam(eciHandle, VOX_CAPITALS, mode);
+	eci_engine->cap_mode = cap_mode;
 }
 #else
 static void set_capital_mode(SPDCapitalLetters cap_mode){}
@@ -1102,31 +1150,31 @@ static void set_voice_parameters(SPDVoiceType voice_type)
 	} else {
 		DBG(DBG_MODNAME "Setting custom VoiceParameters for voice %s", voicename);
 
-		ret = eciSetVoiceParam(eciHandle, 0, eciGender, params->gender);
+		ret = set_voice_param(eciGender, params->gender);
 		if (-1 == ret)
 			DBG(DBG_MODNAME "ERROR: Setting gender %i", params->gender);
 
-		ret = eciSetVoiceParam(eciHandle, 0, eciBreathiness, params->breathiness);
+		ret = set_voice_param(eciBreathiness, params->breathiness);
 		if (-1 == ret)
 			DBG(DBG_MODNAME "ERROR: Setting breathiness %i", params->breathiness);
 
-		ret = eciSetVoiceParam(eciHandle, 0, eciHeadSize, params->head_size);
+		ret = set_voice_param(eciHeadSize, params->head_size);
 		if (-1 == ret)
 			DBG(DBG_MODNAME "ERROR: Setting head size %i", params->head_size);
 
-		ret = eciSetVoiceParam(eciHandle, 0, eciPitchBaseline, params->pitch_baseline);
+		ret = set_voice_param(eciPitchBaseline, params->pitch_baseline);
 		if (-1 == ret)
 			DBG(DBG_MODNAME "ERROR: Setting pitch baseline %i", params->pitch_baseline);
 
-		ret = eciSetVoiceParam(eciHandle, 0, eciPitchFluctuation, params->pitch_fluctuation);
+		ret = set_voice_param(eciPitchFluctuation, params->pitch_fluctuation);
 		if (-1 == ret)
 			DBG(DBG_MODNAME "ERROR: Setting pitch fluctuation %i", params->pitch_fluctuation);
 
-		ret = eciSetVoiceParam(eciHandle, 0, eciRoughness, params->roughness);
+		ret = set_voice_param(eciRoughness, params->roughness);
 		if (-1 == ret)
 			DBG(DBG_MODNAME "ERROR: Setting roughness %i", params->roughness);
 
-		ret = eciSetVoiceParam(eciHandle, 0, eciSpeed, params->speed);
+		ret = set_voice_param(eciSpeed, params->speed);
 		if (-1 == ret)
 			DBG(DBG_MODNAME "ERROR: Setting speed %i", params->speed);
 	}
@@ -1173,7 +1221,7 @@ static void set_voice_parameters(SPDVoiceType voice_type)
 static void set_language_and_voice(char *lang, SPDVoiceType voice_type, char *name)
 {
 	DBG(DBG_MODNAME "ENTER %s", __func__);
-	int ret = -1;
+	TEciEngine *engine;
 	int i = 0, index = -1;
 
 	DBG(DBG_MODNAME "%s, lang=%s, voice_type=%d, name=%s",
@@ -1223,71 +1271,190 @@ static void set_language_and_voice(char *lang, SPDVoiceType voice_type, char *na
 		index = 0;
 	}
 
-#ifdef VOXIN
-	ret = eciSetParam(eciHandle, eciLanguageDialect, voices[index].id);
-#else
-	ret = eciSetParam(eciHandle, eciLanguageDialect, eciLocales[index].langID);
-#endif
-	if (ret == -1) {
-		DBG(DBG_MODNAME "Unable to set language");
-		log_eci_error();
+	engine = eci_engine_get(index);
+	if (engine == NULL)
 		return;
-	}
+	eci_engine = engine;
+	eciHandle = engine->handle;
 
 #ifdef VOXIN
-	DBG(DBG_MODNAME "select speechd_voice[%d]: id=0x%x, name=%s (ret=%d)",
-	    index, voices[index].id, voices[index].name, ret);
+	DBG(DBG_MODNAME "select speechd_voice[%d]: id=0x%x, name=%s",
+	    index, voices[index].id, voices[index].name);
 
 	input_encoding = voices[index].charset;
 #else
-	DBG(DBG_MODNAME "set langID=0x%x (ret=%d)",
-	    eciLocales[index].langID, ret);
+	DBG(DBG_MODNAME "set langID=0x%x", eciLocales[index].langID);
 
 	input_encoding = eciLocales[index].charset;
 #endif
 	update_sample_rate();		  	
 	g_atomic_int_set(&locale_index_atomic, index);
 
-	set_voice_parameters(voice_type);
+	if (engine->voice_type != voice_type) {
+		set_voice_parameters(voice_type);
+		engine->voice_type = voice_type;
+
+		/* Retrieve the baseline pitch and speed of the voice. */
+		engine->pitch_baseline =
+		    eciGetVoiceParam(eciHandle, 0, eciPitchBaseline);
+		if (-1 == engine->pitch_baseline)
+			DBG(DBG_MODNAME "Cannot get pitch baseline of voice.");
 
-	/* Retrieve the baseline pitch and speed of the voice. */
-	voice_pitch_baseline = eciGetVoiceParam(eciHandle, 0, eciPitchBaseline);
-	if (-1 == voice_pitch_baseline)
-		DBG(DBG_MODNAME "Cannot get pitch baseline of voice.");
+		engine->speed = eciGetVoiceParam(eciHandle, 0, eciSpeed);
+		if (-1 == engine->speed)
+			DBG(DBG_MODNAME "Cannot get speed of voice.");
 
-	voice_speed = eciGetVoiceParam(eciHandle, 0, eciSpeed);
-	if (-1 == voice_speed)
-		DBG(DBG_MODNAME "Cannot get speed of voice.");
+		/* The voice came with its own pitch and speed */
+		engine->rate = ECI_SETTING_UNKNOWN;
+		engine->pitch = ECI_SETTING_UNKNOWN;
+	}
+	voice_pitch_baseline = engine->pitch_baseline;
+	voice_speed = engine->speed;
+
+	eci_engine_sync_settings(engine);
 }
 
-static void set_voice_type(SPDVoiceType voice_type)
+/* Create an ECI instance, not set up for any dialect yet */
+static TEciEngine *eci_engine_new(void)
 {
-	DBG(DBG_MODNAME "ENTER %s", __func__);
-	if (msg_settings.voice.language) {
-		set_language_and_voice(msg_settings.voice.language, voice_type, msg_settings.voice.name);
+	TEciEngine *engine;
+	ECIHand handle;
+
+	DBG(DBG_MODNAME "Creating an engine instance.");
+	handle = eciNew();
+	if (NULL_ECI_HAND == handle) {
+		DBG(DBG_MODNAME "Could not create an engine instance.");
+		return NULL;
 	}
+
+	engine = g_malloc0(sizeof(TEciEngine));
+	engine->handle = handle;
+	engine->index = -1;
+	engine->dict_index = -1;
+	engine->voice_type = -1;
+	engine->rate = ECI_SETTING_UNKNOWN;
+	engine->pitch = ECI_SETTING_UNKNOWN;
+	engine->volume = ECI_SETTING_UNKNOWN;
+	engine->punctuation_mode = ECI_SETTING_UNKNOWN;
+	engine->cap_mode = ECI_SETTING_UNKNOWN;
+
+	DBG(DBG_MODNAME "Registering ECI callback.");
+	eciRegisterCallback(handle, eciCallback, NULL);
+
+	/* All instances share the buffer, only one synthesizes at a time */
+	DBG(DBG_MODNAME "Registering an ECI audio buffer.");
+	if (!eciSetOutputBuffer(handle, IbmttsAudioChunkSize, audio_chunk))
+		DBG(DBG_MODNAME "Error registering ECI audio buffer.");
+
+	eciSetParam(handle, eciDictionary, !IbmttsUseAbbreviation);
+
+	/* enable annotations */
+	eciSetParam(handle, eciInputType, 1);
+
+	/* load possibly the ssml filter */
+	if (IbmttsUseSSML)
+		eciAddText(handle, " `gfa1 ");
+
+	/* load possibly the punctuation filter */
+	eciAddText(handle, " `gfa2 ");
+
+	return engine;
 }
 
-static void set_language(char *lang)
+static void eci_engine_free(TEciEngine * engine)
 {
-	DBG(DBG_MODNAME "ENTER %s", __func__);
-	set_language_and_voice(lang, msg_settings.voice_type, msg_settings.voice.name);
-}
+	DBG(DBG_MODNAME "De-registering ECI callback.");
+	eciRegisterCallback(engine->handle, NULL, NULL);
 
-/* sets the voice according to its name. 
+	DBG(DBG_MODNAME "Destroying ECI instance.");
+	eciDelete(engine->handle);
+	g_free(engine);
+}
 
-   If the voice name is not found, try to select the first available
-   voice for the current language.
-*/
-static void set_synthesis_voice(char *synthesis_voice)
+/* Return the instance set up for the dialect of voices or eciLocales
+   entry _index_ and make it the most recently used one. If there is
+   none, take a fresh instance or the least recently used one and switch
+   it to that dialect. Returns NULL if the dialect can't be set. */
+static TEciEngine *eci_engine_get(int index)
 {
-	if (synthesis_voice == NULL) {
-		return;
+	TEciEngine *engine = NULL;
+	gint64 start = g_get_monotonic_time();
+	GList *l;
+	int ret;
+
+	for (l = eci_engines->head; l != NULL; l = l->next)
+		if (((TEciEngine *) l->data)->index == index) {
+			engine = l->data;
+			break;
+		}
+
+	if (engine != NULL && engine == g_queue_peek_head(eci_engines))
+		return engine;
+
+	if (engine == NULL) {
+		for (l = eci_engines->head; l != NULL; l = l->next)
+			if (((TEciEngine *) l->data)->index == -1) {
+				engine = l->data;
+				break;
+			}
+		if (engine == NULL
+		    && g_queue_get_length(eci_engines) < IbmttsLanguagePoolSize) {
+			engine = eci_engine_new();
+			if (engine != NULL)
+				g_queue_push_tail(eci_engines, engine);
+		}
+		if (engine == NULL)
+			engine = g_queue_peek_tail(eci_engines);
+
+#ifdef VOXIN
+		ret = eciSetParam(engine->handle, eciLanguageDialect,
+				  voices[index].id);
+#else
+		ret = eciSetParam(engine->handle, eciLanguageDialect,
+				  eciLocales[index].langID);
+#endif
+		/* Whatever was set up on the instance is gone now */
+		engine->index = -1;
+		engine->dict_index = -1;
+		engine->voice_type = -1;
+		engine->rate = ECI_SETTING_UNKNOWN;
+		engine->pitch = ECI_SETTING_UNKNOWN;
+		engine->volume = ECI_SETTING_UNKNOWN;
+		engine->punctuation_mode = ECI_SETTING_UNKNOWN;
+		engine->cap_mode = ECI_SETTING_UNKNOWN;
+		if (ret == -1) {
+			DBG(DBG_MODNAME "Unable to set language");
+			return NULL;
+		}
+		engine->index = index;
+		eci_engine_loads++;
 	}
 
-	DBG(DBG_MODNAME "ENTER %s(%s)", __FUNCTION__, synthesis_voice);
+	g_queue_remove(eci_engines, engine);
+	g_queue_push_head(eci_engines, engine);
+	eci_engine_switches++;
 
-	set_language_and_voice(msg_settings.voice.language, msg_settings.voice_type, synthesis_voice);
+	DBG(DBG_MODNAME "Switched to language %d in %.1f ms, %lu of %lu "
+	    "switches loaded a language", index,
+	    (g_get_monotonic_time() - start) / 1000.0, eci_engine_loads,
+	    eci_engine_switches);
+	return engine;
+}
+
+/* Apply to the current instance the settings of the message which differ
+   from what it was last set to */
+static void eci_engine_sync_settings(TEciEngine * engine)
+{
+	if (engine->rate != msg_settings.rate)
+		set_rate(msg_settings.rate);
+	if (engine->pitch != msg_settings.pitch)
+		set_pitch(msg_settings.pitch);
+	if (engine->volume != msg_settings.volume)
+		set_volume(msg_settings.volume);
+	if (engine->punctuation_mode != msg_settings.punctuation_mode)
+		set_punctuation_mode(msg_settings.punctuation_mode);
+	if (engine->cap_mode != msg_settings.cap_let_recogn)
+		set_capital_mode(msg_settings.cap_let_recogn);
 }
 
 static void log_eci_error()
@@ -1673,7 +1840,7 @@ static void load_user_dictionary()
 	GString *filename = NULL;
 	int i = 0;
 	int dictionary_is_present = 0;
-	static guint old_index = G_MAXUINT;
+	TEciEngine *engine = eci_engine;
 	guint new_index;
 	char *language = NULL;
 #ifdef VOXIN
@@ -1690,7 +1857,7 @@ static void load_user_dictionary()
 		return;
 	}
 
-	if (old_index == new_index) {
+	if (engine->dict_index == new_index) {
 		DBG(DBG_MODNAME "LEAVE %s, no change", __FUNCTION__);
 		return;
 	}
@@ -1711,9 +1878,9 @@ static void load_user_dictionary()
 	}
 	eciDict = eciNewDict(eciHandle);
 	if (eciDict) {
-		old_index = new_index;
+		engine->dict_index = new_index;
 	} else {
-		old_index = MAX_NB_OF_LANGUAGES;
+		engine->dict_index = -1;
 		DBG(DBG_MODNAME "can't create new dictionary");
 		g_free(language);
 		return;
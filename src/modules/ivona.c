@@ -46,6 +46,7 @@ DECLARE_DEBUG();
 
 /* Thread and process control */
 static int ivona_speaking = 0;
+static int ivona_close_requested = 0;
 
 static pthread_t ivona_speak_thread;
 static sem_t ivona_semaphore;
@@ -80,6 +81,7 @@ MOD_OPTION_1_INT(IvonaSampleFreq);
 
 MOD_OPTION_1_STR(IvonaSpeakerLanguage);
 MOD_OPTION_1_STR(IvonaSpeakerName);
+MOD_OPTION_1_STR(IvonaCacheCodec);
 
 static struct dumbtts_conf *ivona_conf;
 
@@ -104,6 +106,7 @@ int module_load(void)
 	MOD_OPTION_1_STR_REG(IvonaSpeakerName, "Jacek");
 
 	MOD_OPTION_1_STR_REG(IvonaPunctuationSome, "()");
+	MOD_OPTION_1_STR_REG(IvonaCacheCodec, "lossless");
 	ivona_init_cache();
 
 	return 0;
@@ -133,6 +136,7 @@ int module_init(char **status_info)
 		return -1;
 	}
 	ivona_conf = dumbtts_TTSInit(IvonaSpeakerLanguage);
+	ivona_set_cache_codec(IvonaCacheCodec, IvonaSampleFreq);
 
 	DBG("IvonaDelimiters = %s\n", IvonaDelimiters);
 
@@ -212,7 +216,7 @@ int module_stop(void)
 	ivona_stop = 1;
 	if (module_audio_id) {
 		DBG("Stopping audio");
-		ret = spd_audio_stop(module_audio_id);
+		ret = module_audio_stop();
 		if (ret != 0)
 			DBG("WARNING: Non 0 value from spd_audio_stop: %d",
 			    ret);
@@ -241,11 +245,13 @@ int module_close(void)
 	DBG("ivona: close()\n");
 
 	DBG("Stopping speech");
+	ivona_close_requested = 1;
 	if (ivona_speaking) {
 		module_stop();
 	}
 
 	DBG("Terminating threads");
+	sem_post(&ivona_semaphore);
 	if (module_terminate_thread(ivona_speak_thread) != 0)
 		return -1;
 
@@ -425,6 +431,8 @@ void *_ivona_speak(void *nothing)
 
 	while (1) {
 		sem_wait(&ivona_semaphore);
+		if (ivona_close_requested)
+			break;
 		DBG("Semaphore on\n");
 
 		ivona_stop = 0;
@@ -38,6 +38,7 @@
 #include <libdumbtts.h>
 
 #include "module_utils.h"
+#include "module_utils_pcm.h"
 #include "ivona_client.h"
 
 static struct sockaddr_in sinadr;
@@ -158,13 +159,16 @@ void play_icon(char *path, char *name)
 #define IVONA_CACHE_MAX_SAMPLES 65536
 
 static int ivona_cache_count;
+static EPcmCodec ivona_cache_codec = PCM_CODEC_LOSSLESS;
+static int ivona_cache_sample_rate;
+static TPcmCacheStats ivona_cache_stats;
 
 static struct ivona_cache {
 	struct ivona_cache *succ, *pred;
 	int count;
 	char str[16];
 	int samples;
-	char *wave;
+	TPcmPacked *wave;
 } ica_head, ica_tail, icas[IVONA_CACHE_SIZE];
 
 void ivona_init_cache(void)
@@ -173,6 +177,18 @@ void ivona_init_cache(void)
 	ica_tail.succ = &ica_head;
 }
 
+void ivona_set_cache_codec(const char *name, int sample_rate)
+{
+	int codec = module_pcm_codec_from_name(name);
+
+	if (codec == -1) {
+		DBG("Unknown IvonaCacheCodec %s, storing raw sound", name);
+		codec = PCM_CODEC_RAW;
+	}
+	ivona_cache_codec = codec;
+	ivona_cache_sample_rate = sample_rate;
+}
+
 void ica_tohead(struct ivona_cache *ica)
 {
 	if (ica->pred)
@@ -219,11 +235,13 @@ void ivona_store_wave_in_cache(char *str, char *wave, int samples)
 		ica = find_min_count();
 		if (!ica)
 			return;
-		g_free(ica->wave);
+		module_pcm_stats_remove(&ivona_cache_stats, ica->wave);
+		module_pcm_free(ica->wave);
 	}
 	ica->count = 1;
-	ica->wave = g_malloc(samples * 2);
-	memcpy(ica->wave, wave, samples * 2);
+	ica->wave = module_pcm_pack((short *)wave, samples,
+				    ivona_cache_sample_rate, ivona_cache_codec);
+	module_pcm_stats_add(&ivona_cache_stats, ica->wave);
 	ica->samples = samples;
 	strcpy(ica->str, str);
 	ica_tohead(ica);
@@ -235,14 +253,18 @@ char *ivona_get_wave_from_cache(char *to_say, int *samples)
 	struct ivona_cache *ica;
 	if (strlen(to_say) > IVONA_CACHE_MAX_STRLEN)
 		return NULL;
+	ivona_cache_stats.lookups++;
 	for (ica = ica_tail.succ; ica && ica->samples; ica = ica->succ) {
 		DBG("Cache cmp '%s'='%s'", ica->str, to_say);
 		if (!strcmp(ica->str, to_say)) {
-			char *wave = g_malloc(ica->samples * 2);
-			memcpy(wave, ica->wave, ica->samples * 2);
+			char *wave = (char *)module_pcm_unpack(ica->wave,
+							       &ivona_cache_stats);
 			*samples = ica->samples;
 			ica->count++;
 			ica_tohead(ica);
+			if (++ivona_cache_stats.hits % 100 == 0)
+				module_pcm_stats_report("Ivona",
+							&ivona_cache_stats);
 			return wave;
 		}
 	}
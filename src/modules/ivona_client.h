@@ -29,6 +29,7 @@ char *ivona_get_wave_fd(int fd, int *nsamples, int *offset);
 char *ivona_get_wave(char *to_say, int *nsamples, int *offset);
 void play_icon(char *path, char *name);
 void ivona_init_cache(void);
+void ivona_set_cache_codec(const char *name, int sample_rate);
 void ivona_store_wave_in_cache(char *to_say, char *wave, int nsamples);
 char *ivona_get_wave_from_cache(char *to_say, int *nsamples);
 #endif
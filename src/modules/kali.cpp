@@ -35,25 +35,36 @@ extern "C" {
 #include <speechd_types.h>
 
 #include "module_utils.h"
+#include "module_utils_speak_queue.h"
 }
 #define MODULE_NAME     "kali"
 #define MODULE_VERSION  "0.0"
 #define DEBUG_MODULE 1
 DECLARE_DEBUG();
 
-/* Thread and process control */
-static int kali_speaking = 0;
+/* A message waiting for synthesis, along with the settings it was sent with */
+typedef struct {
+	char *text;
+	signed int rate;
+	signed int volume;
+	signed int pitch;
+	SPDPunctuation punctuation_mode;
+	char *voice;
+} KaliMessage;
 
-static pthread_t kali_speak_thread;
+/* Thread and process control */
+static pthread_t kali_synth_thread;
 static sem_t kali_semaphore;
 
-static char **kali_message;
-static SPDMessageType kali_message_type;
-
-static int kali_position = 0;
-static int kali_pause_requested = 0;
+/* Protects kali_pending and kali_synthesizing */
+static pthread_mutex_t kali_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Signaled when the synthesis thread is done with a message */
+static pthread_cond_t kali_synth_cond = PTHREAD_COND_INITIALIZER;
+/* Messages accepted by module_speak but not yet synthesized */
+static GQueue *kali_pending = NULL;
+static int kali_synthesizing = 0;
+static int kali_close_requested = 0;
 
-signed int kali_volume = 0;
 SPDVoice **kali_voice_list = NULL;
 
 /* Internal functions prototypes */
@@ -64,9 +75,8 @@ static void kali_set_punctuation_mode(SPDPunctuation punct);
 static void kali_set_voice(char *voice);
 
 static SPDVoice **kali_get_voices();
-static void *_kali_speak(void *);
-
-int kali_stop = 0;
+static void *_kali_synth(void *);
+static void kali_message_free(gpointer data);
 
 MOD_OPTION_1_INT(KaliMaxChunkLength);
 MOD_OPTION_1_STR(KaliDelimiters);
@@ -75,6 +85,7 @@ MOD_OPTION_1_INT(KaliNormalVolume);
 MOD_OPTION_1_INT(KaliNormalPitch);
 MOD_OPTION_1_STR(KaliVoiceParameters);
 MOD_OPTION_1_INT(KaliExpandAbbreviations);
+MOD_OPTION_1_INT(KaliAudioQueueMaxSize);
 
 /* Public functions */
 
@@ -91,6 +102,7 @@ int module_load(void)
 	MOD_OPTION_1_INT_REG(KaliNormalPitch, 6);
 	MOD_OPTION_1_STR_REG(KaliVoiceParameters, "Patrick");
 	MOD_OPTION_1_INT_REG(KaliExpandAbbreviations, 1);
+	MOD_OPTION_1_INT_REG(KaliAudioQueueMaxSize, 20 * 22050);
 
 	return 0;
 }
@@ -129,15 +141,22 @@ int module_init(char **status_info)
 	DBG("KaliMaxChunkLength = %d\n", KaliMaxChunkLength);
 	DBG("KaliDelimiters = %s\n", KaliDelimiters);
 	DBG("KaliExpandAbbreviations = %d\n", KaliExpandAbbreviations);
+	DBG("KaliAudioQueueMaxSize = %d\n", KaliAudioQueueMaxSize);
+
+	kali_pending = g_queue_new();
+	kali_close_requested = 0;
+	kali_synthesizing = 0;
 
-	kali_message = (char **)g_malloc(sizeof(char *));
-	*kali_message = NULL;
+	DBG("Kali: creating playback queue\n");
+	if (module_speak_queue_init(KaliAudioQueueMaxSize, status_info)) {
+		DBG("Kali: playback queue initialization failed\n");
+		return -1;
+	}
 
 	sem_init(&kali_semaphore, 0, 0);
 
-	DBG("Kali: creating new thread for kali_speak\n");
-	kali_speaking = 0;
-	ret = pthread_create(&kali_speak_thread, NULL, _kali_speak, NULL);
+	DBG("Kali: creating new thread for kali_synth\n");
+	ret = pthread_create(&kali_synth_thread, NULL, _kali_synth, NULL);
 	if (ret != 0) {
 		DBG("Kali: thread failed\n");
 		*status_info =
@@ -162,32 +181,27 @@ SPDVoice **module_list_voices(void)
 
 int module_speak(gchar * data, size_t bytes, SPDMessageType msgtype)
 {
-	DBG("write()\n");
-
-	if (kali_speaking) {
-		DBG("Speaking when requested to write");
-		return 0;
-	}
+	KaliMessage *msg;
 
+	DBG("write()\n");
 	DBG("Requested data: |%s|\n", data);
 
-	if (*kali_message != NULL) {
-		g_free(*kali_message);
-		*kali_message = NULL;
-	}
-	*kali_message = module_strip_ssml(data);
-	kali_message_type = SPD_MSGTYPE_TEXT;
-
-	/* Setting voice */
-	UPDATE_PARAMETER(rate, kali_set_rate);
-	UPDATE_PARAMETER(volume, kali_set_volume);
-	UPDATE_PARAMETER(pitch, kali_set_pitch);
-	UPDATE_PARAMETER(punctuation_mode, kali_set_punctuation_mode);
-	UPDATE_STRING_PARAMETER(voice.name, kali_set_voice);
-	kali_set_voice(msg_settings.voice.name);
-
-	/* Send semaphore signal to the speaking thread */
-	kali_speaking = 1;
+	/* Never reject a message: the synthesis thread picks it up as soon as
+	   the previous one is over.  The settings are recorded along with it
+	   since the engine may still be busy with the previous message. */
+	msg = g_new0(KaliMessage, 1);
+	msg->text = module_strip_ssml(data);
+	msg->rate = msg_settings.rate;
+	msg->volume = msg_settings.volume;
+	msg->pitch = msg_settings.pitch;
+	msg->punctuation_mode = msg_settings.punctuation_mode;
+	msg->voice = g_strdup(msg_settings.voice.name);
+
+	pthread_mutex_lock(&kali_mutex);
+	g_queue_push_tail(kali_pending, msg);
+	pthread_mutex_unlock(&kali_mutex);
+
+	/* Send semaphore signal to the synthesis thread */
 	sem_post(&kali_semaphore);
 
 	DBG("Kali: leaving write() normally\n\r");
@@ -196,17 +210,22 @@ int module_speak(gchar * data, size_t bytes, SPDMessageType msgtype)
 
 int module_stop(void)
 {
-	int ret;
+	int dropped = 0;
+	KaliMessage *msg;
+
 	DBG("kali: stop()\n");
 
-	kali_stop = 1;
-	if (module_audio_id) {
-		DBG("Stopping audio");
-		ret = spd_audio_stop(module_audio_id);
-		if (ret != 0)
-			DBG("WARNING: Non 0 value from spd_audio_stop: %d",
-			    ret);
+	pthread_mutex_lock(&kali_mutex);
+	while ((msg = (KaliMessage *) g_queue_pop_head(kali_pending))) {
+		kali_message_free(msg);
+		dropped++;
 	}
+	module_speak_queue_stop();
+	pthread_mutex_unlock(&kali_mutex);
+
+	/* Messages which did not even start still get their end event */
+	while (dropped--)
+		module_report_event_stop();
 
 	return 0;
 }
@@ -214,15 +233,21 @@ int module_stop(void)
 size_t module_pause(void)
 {
 	DBG("pause requested\n");
-	if (kali_speaking) {
-		DBG("Kali doesn't support pause, stopping\n");
+	DBG("Kali doesn't support pause, stopping\n");
 
-		module_stop();
+	module_stop();
 
-		return -1;
-	} else {
-		return 0;
-	}
+	return -1;
+}
+
+void module_speak_queue_cancel(void)
+{
+	/* Let the synthesis thread finish the chunk it is working on, it will
+	   then notice the stop request and give up the message. */
+	pthread_mutex_lock(&kali_mutex);
+	while (kali_synthesizing)
+		pthread_cond_wait(&kali_synth_cond, &kali_mutex);
+	pthread_mutex_unlock(&kali_mutex);
 }
 
 int module_close(void)
@@ -231,19 +256,23 @@ int module_close(void)
 	DBG("kali: close()\n");
 
 	DBG("Stopping speech");
-	if (kali_speaking) {
-		module_stop();
-	}
+	module_speak_queue_terminate();
+
+	DBG("Terminating threads");
+	kali_close_requested = 1;
+	sem_post(&kali_semaphore);
+	if (pthread_join(kali_synth_thread, NULL) != 0)
+		return -1;
+
+	module_speak_queue_free();
 
 	quitteAnalyse();
 	quitteTrans();
 	quitteParle();
 	quitteGlobal();
 
-	DBG("Terminating threads");
-	if (module_terminate_thread(kali_speak_thread) != 0)
-		return -1;
-
+	g_queue_free_full(kali_pending, kali_message_free);
+	kali_pending = NULL;
 	sem_destroy(&kali_semaphore);
 
 	return 0;
@@ -251,7 +280,16 @@ int module_close(void)
 
 /* Internal functions */
 
-void *_kali_speak(void *nothing)
+static void kali_message_free(gpointer data)
+{
+	KaliMessage *msg = (KaliMessage *) data;
+
+	g_free(msg->text);
+	g_free(msg->voice);
+	g_free(msg);
+}
+
+static void kali_synth_message(KaliMessage *msg)
 {
 	AudioTrack track;
 #if defined(BYTE_ORDER) && (BYTE_ORDER == BIG_ENDIAN)
@@ -263,122 +301,107 @@ void *_kali_speak(void *nothing)
 	unsigned int pos;
 	char *buf;
 	int bytes;
-	int ret;
 
-	DBG("kali: speaking thread starting.......\n");
+	kali_set_rate(msg->rate);
+	kali_set_volume(msg->volume);
+	kali_set_pitch(msg->pitch);
+	kali_set_punctuation_mode(msg->punctuation_mode);
+	kali_set_voice(msg->voice);
+
+	buf = (char *)g_malloc((KaliMaxChunkLength + 1) * sizeof(char));
+	pos = 0;
+	module_speak_queue_before_play();
+	while (1) {
+		if (module_speak_queue_stop_requested()) {
+			DBG("Stop in synthesis thread, terminating");
+			break;
+		}
+
+		bytes =
+		    module_get_message_part(msg->text, buf, &pos,
+					    KaliMaxChunkLength, KaliDelimiters);
+		if (bytes < 0) {
+			DBG("End of message");
+			module_speak_queue_add_end();
+			break;
+		}
+		if (bytes == 0)
+			continue;
+
+		buf[bytes] = 0;
+		DBG("Returned %d bytes from get_part\n", bytes);
+		DBG("Text to synthesize is '%s'\n", buf);
+
+		MessageKali((unsigned char *)buf);
+		while (QueryIndexKali() > 0)
+			;
+		wav = (const AudioTrackKali *)GetBufMultiKaliStd(0);
+		if (wav == NULL) {
+			DBG("No audio from Kali, terminating");
+			module_speak_queue_add_end();
+			break;
+		}
+
+		track.num_samples = wav->num_samples;
+		track.num_channels = wav->num_channels;
+		track.sample_rate = wav->sample_rate;
+		track.bits = wav->bits;
+		track.samples = (signed short *)wav->samples;
+
+		DBG("Got %d samples", track.num_samples);
+		if (track.samples == NULL)
+			continue;
+
+		/* The playback thread plays this while we synthesize the
+		   next chunk */
+		if (!module_speak_queue_add_audio(&track, format)) {
+			DBG("Stop in synthesis thread, terminating");
+			break;
+		}
+	}
+	g_free(buf);
+}
+
+static void *_kali_synth(void *nothing)
+{
+	KaliMessage *msg;
+
+	DBG("kali: synthesis thread starting.......\n");
 
 	set_speaking_thread_parameters();
 
 	while (1) {
 		sem_wait(&kali_semaphore);
+		if (kali_close_requested)
+			break;
 		DBG("Semaphore on\n");
 
-		kali_stop = 0;
-		kali_speaking = 1;
-
-		/* TODO: free(buf) */
-		buf = (char *)g_malloc((KaliMaxChunkLength + 1) * sizeof(char));
-		pos = 0;
-		module_report_event_begin();
-		while (1) {
-			if (kali_stop) {
-				DBG("Stop in child, terminating");
-				kali_speaking = 0;
-				module_report_event_stop();
-				break;
-			}
-			bytes =
-			    module_get_message_part(*kali_message, buf, &pos,
-						    KaliMaxChunkLength,
-						    KaliDelimiters);
-
-			if (bytes < 0) {
-				DBG("End of message");
-				kali_speaking = 0;
-				module_report_event_end();
-				break;
-			}
-
-			buf[bytes] = 0;
-			DBG("Returned %d bytes from get_part\n", bytes);
-			DBG("Text to synthesize is '%s'\n", buf);
-
-			if (kali_pause_requested && (current_index_mark != -1)) {
-				DBG("Pause requested in parent, position %d\n",
-				    current_index_mark);
-				kali_pause_requested = 0;
-				kali_position = current_index_mark;
-				break;
-			}
-
-			if (bytes > 0) {
-				DBG("Speaking in child...");
-
-				DBG("Trying to synthesize text");
-				MessageKali((unsigned char *)buf);
-				while (QueryIndexKali() > 0)
-					;
-				wav =
-				    (const AudioTrackKali *)
-				    GetBufMultiKaliStd(0);
-
-				if (wav == NULL) {
-					DBG("Stop in child, terminating");
-					kali_speaking = 0;
-					module_report_event_stop();
-					break;
-				}
-
-				track.num_samples = wav->num_samples;
-				track.num_channels = wav->num_channels;
-				track.sample_rate = wav->sample_rate;
-				track.bits = wav->bits;
-				track.samples = (signed short *)wav->samples;
-
-				DBG("Got %d samples", track.num_samples);
-				if (track.samples != NULL) {
-					if (kali_stop) {
-						DBG("Stop in child, terminating");
-						kali_speaking = 0;
-						module_report_event_stop();
-						break;
-					}
-					DBG("Playing part of the message");
-					ret = module_tts_output(track, format);
-					if (ret < 0)
-						DBG("ERROR: failed to play the track");
-					if (kali_stop) {
-						DBG("Stop in child, terminating (s)");
-						kali_speaking = 0;
-						module_report_event_stop();
-						break;
-					}
-				}
-			} else if (bytes == -1) {
-				DBG("End of data in speaking thread");
-				kali_speaking = 0;
-				module_report_event_end();
-				break;
-			} else {
-				kali_speaking = 0;
-				module_report_event_end();
-				break;
-			}
-
-			if (kali_stop) {
-				DBG("Stop in child, terminating");
-				kali_speaking = 0;
-				module_report_event_stop();
-				break;
-			}
+		/* Wait for the previous message to be over */
+		if (!module_speak_queue_wait_idle())
+			break;
+
+		pthread_mutex_lock(&kali_mutex);
+		msg = (KaliMessage *) g_queue_pop_head(kali_pending);
+		if (msg == NULL) {
+			/* Dropped by module_stop */
+			pthread_mutex_unlock(&kali_mutex);
+			continue;
 		}
-		kali_stop = 0;
-		g_free(buf);
+		/* Nobody else starts messages, so this can not fail */
+		module_speak_queue_before_synth();
+		kali_synthesizing = 1;
+		pthread_mutex_unlock(&kali_mutex);
+
+		kali_synth_message(msg);
+		kali_message_free(msg);
+
+		pthread_mutex_lock(&kali_mutex);
+		kali_synthesizing = 0;
+		pthread_cond_broadcast(&kali_synth_cond);
+		pthread_mutex_unlock(&kali_mutex);
 	}
 
-	kali_speaking = 0;
-
-	DBG("kali: speaking thread ended.......\n");
+	DBG("kali: synthesis thread ended.......\n");
 
 	pthread_exit(NULL);
 }
@@ -474,7 +497,7 @@ static SPDVoice **kali_get_voices()
 	DBG("Kali: %d voices total.", num_voices);
 	voice = (char *)g_malloc(12);
 	language = (char *)g_malloc(9);
-	result = g_new0(SPDVoice *, num_voices);
+	result = g_new0(SPDVoice *, num_voices + 1);
 
 	for (i = 0; i < num_voices; i++) {
 		result[i] = g_new0(SPDVoice, 1);
@@ -0,0 +1,158 @@
+/*
+ * module_input.c - Buffered reading of server commands in output modules
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The server talks to us on stdin.  Instead of going through stdio one
+ * character at a time, we read it in blocks into a single buffer and frame
+ * lines with memchr(), so that the text of a SPEAK command is found in one
+ * piece in the buffer and can be handed to module_speak() from there.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include "module_utils.h"
+
+#define MODULE_INPUT_BLOCK 65536
+
+static char *input_buf;
+static size_t input_size;	/* Allocated size */
+static size_t input_start;	/* Start of the data not consumed yet */
+static size_t input_end;	/* End of the data read so far */
+
+/* Reads another block from the server, making room if needed. Data before
+   input_start is dropped, so pointers into the buffer become invalid. */
+static int module_input_fill(void)
+{
+	ssize_t ret;
+
+	if (input_start > 0) {
+		memmove(input_buf, input_buf + input_start,
+			input_end - input_start);
+		input_end -= input_start;
+		input_start = 0;
+	}
+	/* Keep one byte for terminating data in place */
+	if (input_size - input_end < MODULE_INPUT_BLOCK + 1) {
+		input_size = MAX(input_size * 2, input_end + MODULE_INPUT_BLOCK + 1);
+		input_buf = g_realloc(input_buf, input_size);
+	}
+
+	do {
+		ret = read(0, input_buf + input_end, input_size - input_end - 1);
+	} while (ret < 0 && errno == EINTR);
+	if (ret <= 0)
+		return -1;
+
+	input_end += ret;
+	return 0;
+}
+
+/* Looks for the end of a line in the data at offset _from_ */
+static char *module_input_eol(size_t from)
+{
+	if (input_start + from >= input_end)
+		return NULL;
+	return memchr(input_buf + input_start + from, '\n',
+		      input_end - input_start - from);
+}
+
+ssize_t module_getline(char **lineptr)
+{
+	char *nl;
+	size_t scanned = 0;
+	size_t len;
+
+	while (1) {
+		nl = module_input_eol(scanned);
+		if (nl != NULL)
+			break;
+		scanned = input_end - input_start;
+		if (module_input_fill() == -1)
+			return -1;
+	}
+
+	len = nl + 1 - (input_buf + input_start);
+	*lineptr = g_strndup(input_buf + input_start, len);
+	input_start += len;
+	return len;
+}
+
+char *module_get_data(size_t *bytes, int *nlines)
+{
+	size_t pos = 0;		/* Start of the current line, from input_start */
+	size_t out;		/* End of the unescaped data */
+	int escaped = 0;
+	char *data, *line, *nl;
+
+	*nlines = 0;
+	/* Find the terminating ".\n" line */
+	while (1) {
+		nl = module_input_eol(pos);
+		if (nl == NULL) {
+			if (module_input_fill() == -1)
+				return NULL;
+			continue;
+		}
+		line = input_buf + input_start + pos;
+		if (nl == line + 1 && line[0] == '.')
+			break;
+		if (nl == line + 2 && line[0] == '.' && line[1] == '.')
+			escaped = 1;
+		(*nlines)++;
+		pos = nl + 1 - (input_buf + input_start);
+	}
+
+	data = input_buf + input_start;
+	if (!escaped) {
+		out = pos;
+	} else {
+		/* Unescape "..\n" lines in place */
+		size_t in = 0;
+		out = 0;
+		while (in < pos) {
+			line = data + in;
+			nl = memchr(line, '\n', pos - in);
+			if (nl == line + 2 && line[0] == '.' && line[1] == '.') {
+				data[out++] = '.';
+				data[out++] = '\n';
+			} else {
+				memmove(data + out, line, nl + 1 - line);
+				out += nl + 1 - line;
+			}
+			in = nl + 1 - data;
+		}
+	}
+
+	/* Strip the trailing \n, this overwrites at most the terminator */
+	if (out > 0)
+		out--;
+	data[out] = '\0';
+	*bytes = out;
+
+	input_start += pos + 2;
+	return data;
+}
@@ -38,6 +38,7 @@
 	if (!strcmp(cmd_buf, #command"\n")){ \
 		char *msg; \
 		pthread_mutex_lock(&module_stdout_mutex); \
+		module_flush_events_locked(); \
 		if (printf("%s\n", msg = (char*) function()) < 0){ \
 			DBG("Broken pipe, exiting...\n"); \
 			ret = 2; \
@@ -52,6 +53,7 @@
 	if (!strncmp(cmd_buf, #command, strlen(#command))){	\
 		char *msg; \
 		pthread_mutex_lock(&module_stdout_mutex); \
+		module_flush_events_locked(); \
 		if (printf("%s\n", msg = (char*) function(cmd_buf)) < 0){ \
 			DBG("Broken pipe, exiting...\n"); \
 			ret = 2; \
@@ -71,16 +73,21 @@ int main(int argc, char *argv[])
 {
 	char *cmd_buf;
 	int ret;
-	size_t n;
 	char *configfilename = NULL;
+	char *zygote_path = NULL;
 	char *status_info = NULL;
+	int preloaded = 0, init_ret = 0;
 
 	/* Initialize ltdl's list of preloaded audio backends. */
 	LTDL_SET_PRELOADED_SYMBOLS();
 	module_num_dc_options = 0;
 	module_audio_id = 0;
 
-	if (argc >= 2) {
+	if (argc >= 3 && !strcmp(argv[1], "--zygote")) {
+		zygote_path = argv[2];
+		if (argc >= 4)
+			configfilename = g_strdup(argv[3]);
+	} else if (argc >= 2) {
 		configfilename = g_strdup(argv[1]);
 	}
 
@@ -90,6 +97,8 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
+	module_register_common_options();
+
 	if (configfilename != NULL) {
 		/* Add the LAST option */
 		module_dc_options = module_add_config_option(module_dc_options,
@@ -118,9 +127,24 @@ int main(int argc, char *argv[])
 		DBG("No config file specified, using defaults...\n");
 	}
 
+	/* A zygote initializes the engine once for all the modules it forks,
+	   if the module allows it */
+	if (zygote_path != NULL && module_zygote_preload) {
+		init_ret = module_zygote_init(&status_info);
+		preloaded = 1;
+	}
+
+	/* In zygote mode, only the forked modules get past this. If it
+	   failed, the threads a preloaded module_init() asked for may not
+	   have been started, so module_close() can't join them. */
+	if (zygote_path != NULL && module_zygote_serve(zygote_path) != 0) {
+		if (!preloaded)
+			module_close();
+		exit(1);
+	}
+
 	cmd_buf = NULL;
-	n = 0;
-	ret = spd_getline(&cmd_buf, &n, stdin);
+	ret = module_getline(&cmd_buf);
 	if (ret == -1) {
 		DBG("Broken pipe when reading INIT, exiting... \n");
 		module_close();
@@ -133,13 +157,14 @@ int main(int argc, char *argv[])
 		exit(3);
 	}
 
-	ret = module_init(&status_info);
+	if (!preloaded)
+		init_ret = module_init(&status_info);
 
 	if (status_info == NULL) {
 		status_info = g_strdup("unknown, was not set by module");
 	}
 
-	if (ret != 0) {
+	if (init_ret != 0) {
 		printf("399-%s\n", status_info);
 		printf("%s\n", "399 ERR CANT INIT MODULE");
 		g_free(status_info);
@@ -162,8 +187,7 @@ int main(int argc, char *argv[])
 
 	while (1) {
 		cmd_buf = NULL;
-		n = 0;
-		ret = spd_getline(&cmd_buf, &n, stdin);
+		ret = module_getline(&cmd_buf);
 		if (ret == -1) {
 			DBG("Broken pipe, exiting... \n");
 			ret = 2;
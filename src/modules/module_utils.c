@@ -23,6 +23,7 @@
 #include <config.h>
 #endif
 
+#include <time.h>
 #include <sndfile.h>
 
 #include <fdsetconv.h>
@@ -39,6 +40,26 @@ int log_level;
 
 AudioID *module_audio_id;
 
+/* Writes to the audio output which failed in a row before it is reopened */
+#define AUDIO_FAILURES_BEFORE_REOPEN 2
+/* Shortest time between two attempts at reopening the audio output, in us */
+#define AUDIO_REOPEN_INTERVAL (500 * 1000)
+
+/* Protects module_audio_id from being replaced while the threads which
+   don't play use it */
+static pthread_mutex_t module_audio_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* AudioOutputMethod split into its entries, and the one in use */
+static gchar **module_audio_outputs;
+static int module_audio_current;
+static int module_audio_failures;
+/* Whether writes failed since the output was last reopened */
+static gboolean module_audio_reopened;
+static gint64 module_audio_last_reopen;
+/* Counts calls to module_audio_stop(), which wake up
+   module_audio_write_failed() while it waits to reopen the output */
+static guint module_audio_stops;
+static pthread_cond_t module_audio_stop_cond = PTHREAD_COND_INITIALIZER;
+
 SPDMsgSettings msg_settings;
 SPDMsgSettings msg_settings_old;
 
@@ -47,6 +68,9 @@ int current_index_mark;
 int Debug;
 FILE *CustomDebugFile;
 
+int module_lock_audio_memory;
+int module_gapless_timeout;
+
 configfile_t *configfile;
 configoption_t *module_dc_options;
 int module_num_dc_options;
@@ -58,50 +82,31 @@ char *module_index_mark;
 char *do_message(SPDMessageType msgtype)
 {
 	int ret;
-	char *cur_line;
-	GString *msg;
-	size_t n;
-	int nlines = 0;
-
-	msg = g_string_new("");
+	char *msg;
+	size_t bytes;
+	int nlines;
 
 	printf("202 OK RECEIVING MESSAGE\n");
 	fflush(stdout);
 
-	while (1) {
-		cur_line = NULL;
-		n = 0;
-		ret = spd_getline(&cur_line, &n, stdin);
-		nlines++;
-		if (ret == -1)
-			return g_strdup("401 ERROR INTERNAL");
-
-		if (!strcmp(cur_line, "..\n")) {
-			g_free(cur_line);
-			cur_line = g_strdup(".\n");
-		} else if (!strcmp(cur_line, ".\n")) {
-			/* Strip the trailing \n */
-			msg->str[strlen(msg->str) - 1] = 0;
-			g_free(cur_line);
-			break;
-		}
-		g_string_append(msg, cur_line);
-		g_free(cur_line);
-	}
+	/* The text is used right from the input buffer */
+	msg = module_get_data(&bytes, &nlines);
+	if (msg == NULL)
+		return g_strdup("401 ERROR INTERNAL");
 
-	if ((msgtype != SPD_MSGTYPE_TEXT) && (nlines > 2)) {
+	if ((msgtype != SPD_MSGTYPE_TEXT) && (nlines > 1)) {
 		return g_strdup("305 DATA MORE THAN ONE LINE");
 	}
 
-	if ((msgtype == SPD_MSGTYPE_CHAR) && (!strcmp(msg->str, "space"))) {
-		g_string_free(msg, 1);
-		msg = g_string_new(" ");
+	if ((msgtype == SPD_MSGTYPE_CHAR) && (!strcmp(msg, "space"))) {
+		msg[0] = ' ';
+		msg[1] = '\0';
+		bytes = 1;
 	}
 
 	/* no sure we need this check here at all */
-	if (msg->str == NULL || msg->str[0] == 0) {
+	if (bytes == 0) {
 		DBG("requested data NULL or empty\n");
-		g_string_free(msg, TRUE);
 		return g_strdup("301 ERROR CANT SPEAK");
 	}
 
@@ -114,13 +119,14 @@ char *do_message(SPDMessageType msgtype)
 	}
 
 	/* Volume is controlled by the synthesizer. Always play at normal on audio device. */
+	pthread_mutex_lock(&module_audio_mutex);
 	if (spd_audio_set_volume(module_audio_id, 85) < 0) {
 		DBG("Can't set volume. audio not initialized?");
 	}
+	pthread_mutex_unlock(&module_audio_mutex);
 
-	ret = module_speak(msg->str, strlen(msg->str), msgtype);
+	ret = module_speak(msg, bytes, msgtype);
 
-	g_string_free(msg, 1);
 	if (ret <= 0)
 		return g_strdup("301 ERROR CANT SPEAK");
 
@@ -166,25 +172,52 @@ void do_pause(void)
 	return;
 }
 
+int module_update_voice_settings(void)
+{
+	int changed = 0;
+
+	if (g_strcmp0(msg_settings_old.voice.language,
+		      msg_settings.voice.language)) {
+		changed |= MODULE_VOICE_LANGUAGE;
+		g_free(msg_settings_old.voice.language);
+		msg_settings_old.voice.language =
+		    g_strdup(msg_settings.voice.language);
+	}
+	if (msg_settings_old.voice_type != msg_settings.voice_type) {
+		changed |= MODULE_VOICE_TYPE;
+		msg_settings_old.voice_type = msg_settings.voice_type;
+	}
+	if (g_strcmp0(msg_settings_old.voice.name, msg_settings.voice.name)) {
+		changed |= MODULE_VOICE_NAME;
+		g_free(msg_settings_old.voice.name);
+		msg_settings_old.voice.name = g_strdup(msg_settings.voice.name);
+	}
+
+	return changed;
+}
+
+/* Items of a SET go to _settings_ and only once all of them are known
+   to be valid to msg_settings, so that the module never applies half of
+   a change */
 #define SET_PARAM_NUM(name, cond) \
 	if(!strcmp(cur_item, #name)){ \
 		number = strtol(cur_value, &tptr, 10); \
 		if(!(cond)){ err = 2; continue; } \
 		if (tptr == cur_value){ err = 2; continue; } \
-		msg_settings.name = number; \
+		settings.name = number; \
 	}
 
 #define SET_PARAM_STR(name) \
 	if(!strcmp(cur_item, #name)){ \
-		g_free(msg_settings.name); \
-		if(!strcmp(cur_value, "NULL")) msg_settings.name = NULL; \
-		else msg_settings.name = g_strdup(cur_value); \
+		g_free(settings.name); \
+		if(!strcmp(cur_value, "NULL")) settings.name = NULL; \
+		else settings.name = g_strdup(cur_value); \
 	}
 
 #define SET_PARAM_STR_C(name, fconv) \
 	if(!strcmp(cur_item, #name)){ \
 		ret = fconv(cur_value); \
-		if (ret != -1) msg_settings.name = ret; \
+		if (ret != -1) settings.name = ret; \
 		else err = 2; \
 	}
 
@@ -194,18 +227,20 @@ char *do_set(void)
 	char *cur_value = NULL;
 	char *line = NULL;
 	int ret;
-	size_t n;
 	int number;
 	char *tptr;
 	int err = 0;		/* Error status */
+	SPDMsgSettings settings = msg_settings;
+
+	settings.voice.name = g_strdup(msg_settings.voice.name);
+	settings.voice.language = g_strdup(msg_settings.voice.language);
 
 	printf("203 OK RECEIVING SETTINGS\n");
 	fflush(stdout);
 
 	while (1) {
 		line = NULL;
-		n = 0;
-		ret = spd_getline(&line, &n, stdin);
+		ret = module_getline(&line);
 		if (ret == -1) {
 			err = 1;
 			break;
@@ -252,22 +287,22 @@ char *do_set(void)
 			if (!strcmp(cur_item, "voice")) {
 				ret = str2EVoice(cur_value);
 				if (ret != -1)
-					msg_settings.voice_type = ret;
+					settings.voice_type = ret;
 				else
 					err = 2;
 			} else if (!strcmp(cur_item, "synthesis_voice")) {
-				g_free(msg_settings.voice.name);
+				g_free(settings.voice.name);
 				if (!strcmp(cur_value, "NULL"))
-					msg_settings.voice.name = NULL;
+					settings.voice.name = NULL;
 				else
-					msg_settings.voice.name =
+					settings.voice.name =
 					    g_strdup(cur_value);
 			} else if (!strcmp(cur_item, "language")) {
-				g_free(msg_settings.voice.language);
+				g_free(settings.voice.language);
 				if (!strcmp(cur_value, "NULL"))
-					msg_settings.voice.language = NULL;
+					settings.voice.language = NULL;
 				else
-					msg_settings.voice.language =
+					settings.voice.language =
 					    g_strdup(cur_value);
 			} else
 				err = 2;	/* Unknown parameter */
@@ -275,6 +310,15 @@ char *do_set(void)
 		g_free(line);
 	}
 
+	if (err != 0) {
+		g_free(settings.voice.name);
+		g_free(settings.voice.language);
+	} else {
+		g_free(msg_settings.voice.name);
+		g_free(msg_settings.voice.language);
+		msg_settings = settings;
+	}
+
 	if (err == 0)
 		return g_strdup("203 OK SETTINGS RECEIVED");
 	if (err == 1)
@@ -298,7 +342,6 @@ char *do_audio(void)
 	char *cur_value = NULL;
 	char *line = NULL;
 	int ret;
-	size_t n;
 	int err = 0;		/* Error status */
 	char *status = NULL;
 	char *msg;
@@ -308,8 +351,7 @@ char *do_audio(void)
 
 	while (1) {
 		line = NULL;
-		n = 0;
-		ret = spd_getline(&line, &n, stdin);
+		ret = module_getline(&line);
 		if (ret == -1) {
 			err = 1;
 			break;
@@ -374,7 +416,9 @@ char *do_audio(void)
 		if(!(cond)){ err = 2; continue; } \
 		if (tptr == cur_value){ err = 2; continue; } \
 		log_level = number; \
+		pthread_mutex_lock(&module_audio_mutex); \
 		spd_audio_set_loglevel(module_audio_id, number); \
+		pthread_mutex_unlock(&module_audio_mutex); \
 	}
 
 char *do_loglevel(void)
@@ -383,7 +427,6 @@ char *do_loglevel(void)
 	char *cur_value = NULL;
 	char *line = NULL;
 	int ret;
-	size_t n;
 	int number;
 	char *tptr;
 	int err = 0;		/* Error status */
@@ -394,8 +437,7 @@ char *do_loglevel(void)
 
 	while (1) {
 		line = NULL;
-		n = 0;
-		ret = spd_getline(&line, &n, stdin);
+		ret = module_getline(&line);
 		if (ret == -1) {
 			err = 1;
 			break;
@@ -895,9 +937,23 @@ void set_speaking_thread_parameters()
 	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
 }
 
+/* Wait for a thread which was asked to terminate.  The thread is only
+   cancelled as a last resort, when it did not exit within
+   MODULE_TERMINATE_TIMEOUT seconds, since it may then leak the resources it
+   holds (e.g. the audio device). */
 int module_terminate_thread(pthread_t thread)
 {
 	int ret;
+#ifdef HAVE_PTHREAD_TIMEDJOIN_NP
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += MODULE_TERMINATE_TIMEOUT;
+	ret = pthread_timedjoin_np(thread, NULL, &deadline);
+	if (ret == 0)
+		return 0;
+	DBG("Speak thread did not terminate in time, cancelling it");
+#endif
 
 	ret = pthread_cancel(thread);
 	if (ret != 0) {
@@ -937,13 +993,37 @@ char *module_recode_to_iso(char *data, int bytes, char *language,
 	return recoded;
 }
 
-void module_send_asynchronous(char *text)
+/* Events not sent yet, whether index marks are being held, and since
+   when the oldest one queued waits */
+static GString *module_pending_events;
+static int module_marks_held;
+static gint64 module_marks_held_since;
+
+void module_flush_events_locked(void)
 {
-	pthread_mutex_lock(&module_stdout_mutex);
-	DBG("Printing reply: %s", text);
-	fputs(text, stdout);
+	if (module_pending_events == NULL || module_pending_events->len == 0)
+		return;
+	DBG("Printing reply: %s", module_pending_events->str);
+	fwrite(module_pending_events->str, 1, module_pending_events->len,
+	       stdout);
 	fflush(stdout);
 	DBG("Printed");
+	g_string_truncate(module_pending_events, 0);
+	module_marks_held_since = 0;
+}
+
+static void module_queue_event_locked(const char *text)
+{
+	if (module_pending_events == NULL)
+		module_pending_events = g_string_sized_new(256);
+	g_string_append(module_pending_events, text);
+}
+
+void module_send_asynchronous(char *text)
+{
+	pthread_mutex_lock(&module_stdout_mutex);
+	module_queue_event_locked(text);
+	module_flush_events_locked();
 	pthread_mutex_unlock(&module_stdout_mutex);
 }
 
@@ -956,11 +1036,51 @@ void module_report_index_mark(char *mark)
 	else
 		return;
 
-	module_send_asynchronous(reply);
+	pthread_mutex_lock(&module_stdout_mutex);
+	module_queue_event_locked(reply);
+	if (!module_marks_held)
+		module_flush_events_locked();
+	else if (module_marks_held_since == 0)
+		module_marks_held_since = g_get_monotonic_time();
+	pthread_mutex_unlock(&module_stdout_mutex);
 
 	g_free(reply);
 }
 
+void module_report_hold_marks(void)
+{
+	pthread_mutex_lock(&module_stdout_mutex);
+	module_marks_held++;
+	pthread_mutex_unlock(&module_stdout_mutex);
+}
+
+void module_report_release_marks(void)
+{
+	pthread_mutex_lock(&module_stdout_mutex);
+	if (module_marks_held > 0)
+		module_marks_held--;
+	if (!module_marks_held)
+		module_flush_events_locked();
+	pthread_mutex_unlock(&module_stdout_mutex);
+}
+
+gint64 module_report_held_marks_since(void)
+{
+	gint64 since;
+
+	pthread_mutex_lock(&module_stdout_mutex);
+	since = module_marks_held_since;
+	pthread_mutex_unlock(&module_stdout_mutex);
+	return since;
+}
+
+void module_report_flush_marks(void)
+{
+	pthread_mutex_lock(&module_stdout_mutex);
+	module_flush_events_locked();
+	pthread_mutex_unlock(&module_stdout_mutex);
+}
+
 void module_report_event_begin(void)
 {
 	module_send_asynchronous("701 BEGIN\n");
@@ -1007,11 +1127,65 @@ configoption_t *module_add_config_option(configoption_t * options,
 	return opts;
 }
 
+DOTCONF_CB(LockAudioMemory_cb)
+{
+	module_lock_audio_memory = cmd->data.value;
+	return NULL;
+}
+
+DOTCONF_CB(GaplessTimeout_cb)
+{
+	module_gapless_timeout = MAX(cmd->data.value, 0);
+	return NULL;
+}
+
+void module_register_common_options(void)
+{
+	module_lock_audio_memory = 0;
+	module_dc_options = module_add_config_option(module_dc_options,
+						     &module_num_dc_options,
+						     "LockAudioMemory",
+						     ARG_TOGGLE,
+						     LockAudioMemory_cb, NULL,
+						     0);
+	module_gapless_timeout = 250;
+	module_dc_options = module_add_config_option(module_dc_options,
+						     &module_num_dc_options,
+						     "GaplessTimeout",
+						     ARG_INT,
+						     GaplessTimeout_cb, NULL,
+						     0);
+}
+
+/* Opens the first entry of AudioOutputMethod which works, starting with
+   entry _first_ and wrapping around. Call with module_audio_mutex held. */
+static AudioID *module_audio_open_output(int first, char **error)
+{
+	AudioID *id;
+	int n = g_strv_length(module_audio_outputs);
+	int i, output;
+
+	for (i = 0; i < n; i++) {
+		output = (first + i) % n;
+		g_free(*error);	/* g_malloc'ed, in spd_audio_open. */
+		*error = NULL;
+		id = spd_audio_open(module_audio_outputs[output],
+				    (void **)&module_audio_pars[1], error);
+		if (id) {
+			DBG("Using %s audio output method",
+			    module_audio_outputs[output]);
+			module_audio_current = output;
+			return id;
+		}
+		DBG("Can't open %s audio output method: %s",
+		    module_audio_outputs[output], *error);
+	}
+	return NULL;
+}
+
 int module_audio_init(char **status_info)
 {
 	char *error = 0;
-	gchar **outputs;
-	int i = 0;
 
 	DBG("Opening audio output system");
 	if (NULL == module_audio_pars[0]) {
@@ -1025,37 +1199,167 @@ int module_audio_init(char **status_info)
 	g_free(module_audio_pars[6]);
 	module_audio_pars[6] = strdup(module_name);
 
-	outputs = g_strsplit(module_audio_pars[0], ",", 0);
-	while (NULL != outputs[i]) {
-		module_audio_id =
-		    spd_audio_open(outputs[i], (void **)&module_audio_pars[1],
-				   &error);
-		if (module_audio_id) {
-			DBG("Using %s audio output method", outputs[i]);
-			g_strfreev(outputs);
-			*status_info =
-			    g_strdup("audio initialized successfully.");
-			return 0;
-		}
-		i++;
+	pthread_mutex_lock(&module_audio_mutex);
+	g_strfreev(module_audio_outputs);
+	module_audio_outputs = g_strsplit(module_audio_pars[0], ",", 0);
+	module_audio_id = module_audio_open_output(0, &error);
+	module_audio_failures = 0;
+	module_audio_reopened = FALSE;
+	pthread_mutex_unlock(&module_audio_mutex);
+
+	if (module_audio_id) {
+		*status_info = g_strdup("audio initialized successfully.");
+		return 0;
 	}
 
 	*status_info =
 	    g_strdup_printf("Opening sound device failed. Reason: %s. ", error);
 	g_free(error);		/* g_malloc'ed, in spd_audio_open. */
 
-	g_strfreev(outputs);
 	return -1;
 
 }
 
-int module_tts_output(AudioTrack track, AudioFormat format)
+/* Waits until AUDIO_REOPEN_INTERVAL passed since the output was last
+   reopened, returns FALSE if module_audio_stop() was called meanwhile,
+   i.e. the number of stops is not _stops_ any more. Call with
+   module_audio_mutex held. */
+static gboolean module_audio_reopen_wait(guint stops)
 {
+	gint64 remaining;
+	struct timespec deadline;
+
+	while (module_audio_stops == stops) {
+		remaining = module_audio_last_reopen + AUDIO_REOPEN_INTERVAL
+		    - g_get_monotonic_time();
+		if (remaining <= 0)
+			return TRUE;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += remaining / G_USEC_PER_SEC;
+		deadline.tv_nsec += (remaining % G_USEC_PER_SEC) * 1000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&module_audio_stop_cond,
+				       &module_audio_mutex, &deadline);
+	}
+	return FALSE;
+}
 
-	if (spd_audio_play(module_audio_id, track, format) < 0) {
-		DBG("Can't play track for unknown reason.");
+/* To be called from the thread which plays, when writing to the audio
+   output failed. A pulse server restarting or a USB headset going away
+   makes every following write fail, so once they failed
+   AUDIO_FAILURES_BEFORE_REOPEN times in a row the output is closed and
+   opened again, or the next entries of AudioOutputMethod are tried if it
+   does not come back, or if writes keep failing after reopening it.
+   Reopening is tried at most every AUDIO_REOPEN_INTERVAL, so this waits
+   until an output could be opened, the audio being written is not to be
+   lost.
+
+   Returns 0 if the write should just be tried again, 1 if the output was
+   reopened, in which case the stream has to be set up again with
+   spd_audio_begin() before trying again, and -1 if the audio is to be
+   dropped because module_audio_stop() was called while waiting, or no
+   output is configured at all. */
+int module_audio_write_failed(void)
+{
+	char *error = NULL;
+	gint64 start;
+	guint stops;
+	int volume = 0, first;
+
+	pthread_mutex_lock(&module_audio_mutex);
+	stops = module_audio_stops;
+	module_audio_failures++;
+	if (module_audio_id != NULL
+	    && module_audio_failures < AUDIO_FAILURES_BEFORE_REOPEN) {
+		pthread_mutex_unlock(&module_audio_mutex);
+		return 0;
+	}
+	if (module_audio_outputs == NULL) {
+		pthread_mutex_unlock(&module_audio_mutex);
 		return -1;
 	}
+
+	first = module_audio_current;
+	if (module_audio_id != NULL) {
+		DBG("Writing to the %s audio output failed %d times, reopening it",
+		    module_audio_outputs[first], module_audio_failures);
+		volume = module_audio_id->volume;
+		spd_audio_close(module_audio_id);
+		module_audio_id = NULL;
+		/* It was already reopened and did not work better */
+		if (module_audio_reopened)
+			first++;
+	}
+
+	start = g_get_monotonic_time();
+	while (1) {
+		if (!module_audio_reopen_wait(stops)) {
+			DBG("Stopped while waiting to reopen the audio output");
+			pthread_mutex_unlock(&module_audio_mutex);
+			return -1;
+		}
+		module_audio_last_reopen = g_get_monotonic_time();
+		module_audio_id = module_audio_open_output(first, &error);
+		if (module_audio_id != NULL)
+			break;
+		DBG("No audio output works: %s, trying again in %d ms", error,
+		    AUDIO_REOPEN_INTERVAL / 1000);
+		g_free(error);
+		error = NULL;
+		first = module_audio_current;
+	}
+	spd_audio_set_volume(module_audio_id, volume);
+	spd_audio_set_loglevel(module_audio_id, log_level);
+	module_audio_failures = 0;
+	module_audio_reopened = TRUE;
+	pthread_mutex_unlock(&module_audio_mutex);
+
+	DBG("Audio output %s reopened in %.1f ms",
+	    module_audio_outputs[module_audio_current],
+	    (g_get_monotonic_time() - start) / 1000.0);
+	return 1;
+}
+
+/* To be called from the thread which plays, when writing to the audio
+   output worked. */
+void module_audio_write_succeeded(void)
+{
+	module_audio_failures = 0;
+	module_audio_reopened = FALSE;
+}
+
+/* Interrupts the playback, safe against the audio output being reopened
+   meanwhile by module_audio_write_failed(), which is woken up if it is
+   waiting to reopen it */
+int module_audio_stop(void)
+{
+	int ret = -1;
+
+	pthread_mutex_lock(&module_audio_mutex);
+	module_audio_stops++;
+	pthread_cond_broadcast(&module_audio_stop_cond);
+	if (module_audio_id)
+		ret = spd_audio_stop(module_audio_id);
+	pthread_mutex_unlock(&module_audio_mutex);
+	return ret;
+}
+
+int module_tts_output(AudioTrack track, AudioFormat format)
+{
+	int ret;
+
+	while (spd_audio_play(module_audio_id, track, format) < 0) {
+		ret = module_audio_write_failed();
+		if (ret < 0) {
+			DBG("Stopped while the audio output was failing.");
+			return -1;
+		}
+		DBG("Playing the track again.");
+	}
+	module_audio_write_succeeded();
 	return 0;
 }
 
@@ -1205,7 +1509,9 @@ int module_tts_output_marks(AudioTrack track, AudioFormat format, SPDMarks *mark
 		delta = 1;
 	}
 
-	/* Alternate speaking and reporting mark */
+	/* Alternate speaking and reporting mark, marks at the same sample
+	 * are sent together */
+	module_report_hold_marks();
 	for (i = start; i != end; i += delta) {
 		unsigned end_sample = marks->samples[i];
 
@@ -1213,12 +1519,19 @@ int module_tts_output_marks(AudioTrack track, AudioFormat format, SPDMarks *mark
 		cur.num_samples = end_sample - current_sample;
 		current_sample = end_sample;
 
-		if (cur.num_samples && module_tts_output(cur, format))
-			return -1;
-		if (marks->stop)
+		if (cur.num_samples) {
+			module_report_release_marks();
+			if (module_tts_output(cur, format))
+				return -1;
+			module_report_hold_marks();
+		}
+		if (marks->stop) {
+			module_report_release_marks();
 			return 1;
+		}
 		module_report_index_mark(marks->names[i]);
 	}
+	module_report_release_marks();
 
 	/* Finish with remaining bits if any */
 	if (track.num_samples > current_sample) {
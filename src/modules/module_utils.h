@@ -61,6 +61,13 @@ extern int current_index_mark;
 extern int Debug;
 extern FILE *CustomDebugFile;
 
+/* Whether audio buffers should be kept in locked memory (LockAudioMemory) */
+extern int module_lock_audio_memory;
+
+/* How long in ms the speak queue keeps the audio stream open after a
+   message, waiting for the next one (GaplessTimeout) */
+extern int module_gapless_timeout;
+
 extern configfile_t *configfile;
 extern configoption_t *module_dc_options;
 extern int module_num_dc_options;
@@ -173,6 +180,16 @@ SPDVoice **module_list_registered_voices(void);
 	} \
 } while (0)
 
+/* What module_update_voice_settings() found changed */
+#define MODULE_VOICE_LANGUAGE 1
+#define MODULE_VOICE_TYPE 2
+#define MODULE_VOICE_NAME 4
+
+/* Mark the language, voice type and synthesis voice of msg_settings as
+   applied and return which of them changed since, so that a module can
+   select its voice once for all of them rather than once for each */
+int module_update_voice_settings(void);
+
 #define CHILD_SAMPLE_BUF_SIZE 16384
 
 typedef struct {
@@ -229,6 +246,11 @@ size_t module_parent_wfork(TModuleDoublePipe dpipe, const char *message,
 int module_parent_wait_continue(TModuleDoublePipe dpipe);
 
 void set_speaking_thread_parameters();
+
+/* How long module_close may wait for a speak thread to exit, in seconds */
+#define MODULE_TERMINATE_TIMEOUT 2
+
+/* To be called from module_close once the thread was asked to terminate */
 int module_terminate_thread(pthread_t thread);
 char *module_recode_to_iso(char *data, int bytes, char *language,
 			   char *fallback);
@@ -390,6 +412,9 @@ configoption_t *add_config_option(configoption_t * options,
 #define REGISTER_DEBUG() \
 	MOD_OPTION_1_INT_REG(Debug, 0); \
 
+/* Registers the options which are common to all modules */
+void module_register_common_options(void);
+
 	/* --- INDEX MARKING --- */
 
 #define INDEX_MARK_BODY_LEN 6
@@ -408,10 +433,53 @@ void module_report_event_end(void);
 void module_report_event_stop(void);
 void module_report_event_pause(void);
 
+/* Between these calls, index marks are queued instead of being sent one by
+   one, so that consecutive marks reach the server in a single write. Other
+   events and replies still flush them first. */
+void module_report_hold_marks(void);
+void module_report_release_marks(void);
+/* When the oldest index mark queued while held was reported, 0 if none
+   is queued */
+gint64 module_report_held_marks_since(void);
+/* Sends the index marks queued so far, they are still held afterwards */
+void module_report_flush_marks(void);
+
 extern pthread_mutex_t module_stdout_mutex;
+/* Sends the queued events, with module_stdout_mutex held */
+void module_flush_events_locked(void);
 
 int module_utils_init(void);
 int module_audio_init(char **status_info);
+/* Failover of the audio output, see module_utils.c */
+int module_audio_write_failed(void);
+void module_audio_write_succeeded(void);
+int module_audio_stop(void);
+
+	/* Prototypes from module_input.c */
+/* Reads a line from the server into a newly allocated string, like
+   spd_getline() on stdin */
+ssize_t module_getline(char **lineptr);
+/* Reads data up to the terminating dot line and unescapes it. Returns it
+   without the final newline, in the input buffer: it is only valid until
+   the next read. Returns NULL if the server went away. */
+char *module_get_data(size_t *bytes, int *nlines);
+
+	/* Prototypes from module_zygote.c */
+/* Set in module_load() by modules whose module_init() can run in the
+   zygote: it must only initialize memory, without opening descriptors or
+   processes the forked modules would share, and start its threads with
+   module_thread_create(). */
+extern int module_zygote_preload;
+/* Like pthread_create() with default attributes, but in a zygote the
+   thread is only started in each forked module */
+int module_thread_create(pthread_t * thread, void *(*start) (void *),
+			 void *arg);
+/* Runs module_init() in the zygote, for the modules to answer INIT with
+   its result */
+int module_zygote_init(char **status_info);
+/* Serves module spawn requests on the unix socket _path_. Only returns in
+   the forked modules, or on failure to listen. */
+int module_zygote_serve(const char *path);
 
 	/* Prototypes from module_utils_addvoice.c */
 void module_register_available_voices(void);
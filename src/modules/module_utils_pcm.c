@@ -0,0 +1,351 @@
+/*
+ * module_utils_pcm.c - Compact storage of cached PCM for Speech Dispatcher modules
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <strings.h>
+#include <glib.h>
+
+#include "module_utils_pcm.h"
+
+#define DBG_MODNAME "pcm"
+
+#include "module_utils.h"
+
+/* Lossless codec: every block of samples starts with its Rice parameter
+   k in 5 bits, followed by the Rice codes of the zigzag mapped residuals
+   of the prediction 2 * x[n-1] - x[n-2]. A residual whose quotient would
+   not fit RICE_ESCAPE ones is written as RICE_ESCAPE ones and its
+   RESIDUAL_BITS bits as they are. */
+#define BLOCK_SAMPLES 256
+#define RICE_ESCAPE 24
+#define RESIDUAL_BITS 18
+
+typedef struct {
+	unsigned char *data;
+	size_t size;
+	size_t len;
+	guint32 acc;
+	int bits;
+} TBitWriter;
+
+typedef struct {
+	const unsigned char *data;
+	size_t size;
+	size_t pos;
+	guint32 acc;
+	int bits;
+} TBitReader;
+
+/* _n_ is at most 24 */
+static void put_bits(TBitWriter * w, guint32 value, int n)
+{
+	w->acc = (w->acc << n) | (value & ((1u << n) - 1));
+	w->bits += n;
+	while (w->bits >= 8) {
+		if (w->len == w->size) {
+			w->size = w->size * 2 + 64;
+			w->data = g_realloc(w->data, w->size);
+		}
+		w->bits -= 8;
+		w->data[w->len++] = w->acc >> w->bits;
+	}
+}
+
+static guint32 get_bits(TBitReader * r, int n)
+{
+	while (r->bits < n) {
+		r->acc = (r->acc << 8)
+		    | (r->pos < r->size ? r->data[r->pos++] : 0);
+		r->bits += 8;
+	}
+	r->bits -= n;
+	return (r->acc >> r->bits) & ((1u << n) - 1);
+}
+
+static void pack_lossless(TBitWriter * w, const short *samples,
+			  int num_samples)
+{
+	guint32 u[BLOCK_SAMPLES];
+	guint64 sum;
+	int prev1 = 0, prev2 = 0;
+	int start, count, i, k, r;
+	guint32 q;
+
+	for (start = 0; start < num_samples; start += BLOCK_SAMPLES) {
+		count = MIN(BLOCK_SAMPLES, num_samples - start);
+		sum = 0;
+		for (i = 0; i < count; i++) {
+			r = samples[start + i] - (2 * prev1 - prev2);
+			u[i] = r >= 0 ? 2 * (guint32) r : 2 * (guint32) (-r) - 1;
+			sum += u[i];
+			prev2 = prev1;
+			prev1 = samples[start + i];
+		}
+
+		/* The best k is about log2 of the mean residual */
+		for (k = 0; k < RESIDUAL_BITS - 1 && ((guint64) count << k) < sum;
+		     k++) ;
+		put_bits(w, k, 5);
+
+		for (i = 0; i < count; i++) {
+			q = u[i] >> k;
+			if (q >= RICE_ESCAPE) {
+				put_bits(w, (1u << RICE_ESCAPE) - 1,
+					 RICE_ESCAPE);
+				put_bits(w, u[i], RESIDUAL_BITS);
+				continue;
+			}
+			/* q ones and a zero */
+			put_bits(w, ((1u << q) - 1) << 1, q + 1);
+			if (k > 0)
+				put_bits(w, u[i], k);
+		}
+	}
+	if (w->bits > 0)
+		put_bits(w, 0, 8 - w->bits);
+}
+
+static void unpack_lossless(const TPcmPacked * packed, short *samples)
+{
+	TBitReader r = { packed->data, packed->size, 0, 0, 0 };
+	int prev1 = 0, prev2 = 0;
+	int i, k = 0, q, x;
+	guint32 u;
+
+	for (i = 0; i < packed->num_samples; i++) {
+		if (i % BLOCK_SAMPLES == 0)
+			k = get_bits(&r, 5);
+		for (q = 0; q < RICE_ESCAPE && get_bits(&r, 1); q++) ;
+		if (q == RICE_ESCAPE)
+			u = get_bits(&r, RESIDUAL_BITS);
+		else
+			u = ((guint32) q << k) | (k > 0 ? get_bits(&r, k) : 0);
+
+		x = 2 * prev1 - prev2 + ((u & 1) ? -(int)((u + 1) >> 1)
+					 : (int)(u >> 1));
+		samples[i] = x;
+		prev2 = prev1;
+		prev1 = x;
+	}
+}
+
+/* IMA-ADPCM, two samples per byte, the first one in the low nibble */
+
+static const int ima_index_table[16] = {
+	-1, -1, -1, -1, 2, 4, 6, 8,
+	-1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static const int ima_step_table[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34,
+	37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143,
+	157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494,
+	544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552,
+	1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428,
+	4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+	12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086,
+	29794, 32767
+};
+
+static int ima_decode(int nibble, int *predictor, int *index)
+{
+	int step = ima_step_table[*index];
+	int diff = step >> 3;
+
+	if (nibble & 4)
+		diff += step;
+	if (nibble & 2)
+		diff += step >> 1;
+	if (nibble & 1)
+		diff += step >> 2;
+	if (nibble & 8)
+		*predictor -= diff;
+	else
+		*predictor += diff;
+	*predictor = CLAMP(*predictor, -32768, 32767);
+	*index = CLAMP(*index + ima_index_table[nibble], 0, 88);
+	return *predictor;
+}
+
+static int ima_encode(int sample, int *predictor, int *index)
+{
+	int step = ima_step_table[*index];
+	int diff = sample - *predictor;
+	int nibble = 0;
+
+	if (diff < 0) {
+		nibble = 8;
+		diff = -diff;
+	}
+	if (diff >= step) {
+		nibble |= 4;
+		diff -= step;
+	}
+	step >>= 1;
+	if (diff >= step) {
+		nibble |= 2;
+		diff -= step;
+	}
+	step >>= 1;
+	if (diff >= step)
+		nibble |= 1;
+
+	/* Follow what the decoder will do */
+	ima_decode(nibble, predictor, index);
+	return nibble;
+}
+
+static void pack_adpcm(TPcmPacked * packed, const short *samples)
+{
+	int predictor = 0, index = 0;
+	int i, nibble;
+
+	packed->size = (packed->num_samples + 1) / 2;
+	packed->data = g_malloc0(packed->size);
+	for (i = 0; i < packed->num_samples; i++) {
+		nibble = ima_encode(samples[i], &predictor, &index);
+		packed->data[i / 2] |= nibble << ((i % 2) * 4);
+	}
+}
+
+static void unpack_adpcm(const TPcmPacked * packed, short *samples)
+{
+	int predictor = 0, index = 0;
+	int i;
+
+	for (i = 0; i < packed->num_samples; i++)
+		samples[i] = ima_decode((packed->data[i / 2] >> ((i % 2) * 4))
+					& 0xf, &predictor, &index);
+}
+
+/* External functions */
+
+int module_pcm_codec_from_name(const char *name)
+{
+	if (name == NULL || !strcasecmp(name, "raw"))
+		return PCM_CODEC_RAW;
+	if (!strcasecmp(name, "lossless"))
+		return PCM_CODEC_LOSSLESS;
+	if (!strcasecmp(name, "adpcm"))
+		return PCM_CODEC_ADPCM;
+	return -1;
+}
+
+TPcmPacked *module_pcm_pack(const short *samples, int num_samples,
+			    int sample_rate, EPcmCodec codec)
+{
+	TPcmPacked *packed = g_malloc0(sizeof(TPcmPacked));
+	TBitWriter w = { NULL, 0, 0, 0, 0 };
+
+	packed->codec = codec;
+	packed->num_samples = num_samples;
+	packed->sample_rate = sample_rate;
+
+	switch (codec) {
+	case PCM_CODEC_ADPCM:
+		pack_adpcm(packed, samples);
+		break;
+	case PCM_CODEC_LOSSLESS:
+		pack_lossless(&w, samples, num_samples);
+		/* Sound the prediction can't follow, like noise, would take
+		   more than the samples themselves */
+		if (w.len < num_samples * sizeof(short)) {
+			packed->data = g_realloc(w.data, w.len);
+			packed->size = w.len;
+			break;
+		}
+		g_free(w.data);
+		/* fall through */
+	default:
+		packed->codec = PCM_CODEC_RAW;
+		packed->size = num_samples * sizeof(short);
+		packed->data = g_memdup(samples, packed->size);
+	}
+
+	DBG(DBG_MODNAME " Packed %d samples into %lu bytes (%d%%)",
+	    num_samples, (unsigned long)packed->size,
+	    num_samples ? (int)(packed->size * 50 / num_samples) : 100);
+	return packed;
+}
+
+short *module_pcm_unpack(const TPcmPacked * packed, TPcmCacheStats * stats)
+{
+	short *samples = g_malloc(packed->num_samples * sizeof(short) + 1);
+	gint64 start = g_get_monotonic_time();
+
+	switch (packed->codec) {
+	case PCM_CODEC_LOSSLESS:
+		unpack_lossless(packed, samples);
+		break;
+	case PCM_CODEC_ADPCM:
+		unpack_adpcm(packed, samples);
+		break;
+	default:
+		memcpy(samples, packed->data, packed->size);
+	}
+
+	if (stats != NULL) {
+		stats->decode_seconds +=
+		    (g_get_monotonic_time() - start) / 1000000.0;
+		if (packed->sample_rate > 0)
+			stats->audio_seconds += (double)packed->num_samples
+			    / packed->sample_rate;
+	}
+	return samples;
+}
+
+void module_pcm_free(TPcmPacked * packed)
+{
+	if (packed == NULL)
+		return;
+	g_free(packed->data);
+	g_free(packed);
+}
+
+void module_pcm_stats_add(TPcmCacheStats * stats, const TPcmPacked * packed)
+{
+	stats->raw_bytes += packed->num_samples * sizeof(short);
+	stats->packed_bytes += packed->size;
+}
+
+void module_pcm_stats_remove(TPcmCacheStats * stats,
+			     const TPcmPacked * packed)
+{
+	stats->raw_bytes -= packed->num_samples * sizeof(short);
+	stats->packed_bytes -= packed->size;
+}
+
+void module_pcm_stats_report(const char *name, const TPcmCacheStats * stats)
+{
+	double mb = stats->packed_bytes / (1024.0 * 1024.0);
+
+	DBG(DBG_MODNAME " %s cache: %lu of %lu lookups hit (%.1f%%) with "
+	    "%.2f MB stored (%.2f MB unpacked), %.1f%% hit ratio per MB, "
+	    "unpacking takes %.3f ms per second of audio", name, stats->hits, stats->lookups,
+	    stats->lookups ? 100.0 * stats->hits / stats->lookups : 0.0,
+	    mb, stats->raw_bytes / (1024.0 * 1024.0),
+	    stats->lookups && mb > 0
+	    ? 100.0 * stats->hits / stats->lookups / mb : 0.0,
+	    stats->audio_seconds > 0
+	    ? 1000.0 * stats->decode_seconds / stats->audio_seconds : 0.0);
+}
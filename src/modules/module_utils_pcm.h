@@ -0,0 +1,85 @@
+/*
+ * module_utils_pcm.h - Compact storage of cached PCM for Speech Dispatcher modules
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Modules which cache synthesized sound (short messages, characters,
+ * keys) can keep it packed with one of these codecs:
+ *
+ * raw       the 16-bit samples as they are
+ * lossless  second order prediction with Rice coded residuals, typically
+ *           50-65% of the raw size for speech, kept raw if it would not
+ *           be smaller
+ * adpcm     IMA-ADPCM, 4 bits per sample (25%), lossy
+ *
+ * Both unpack a second of 22 kHz sound in well under a millisecond,
+ * orders of magnitude cheaper than synthesizing it again.
+ */
+
+#ifndef __MODULE_UTILS_PCM_H
+#define __MODULE_UTILS_PCM_H
+
+#include <stddef.h>
+
+typedef enum {
+	PCM_CODEC_RAW,
+	PCM_CODEC_LOSSLESS,
+	PCM_CODEC_ADPCM
+} EPcmCodec;
+
+typedef struct {
+	EPcmCodec codec;
+	int num_samples;
+	int sample_rate;
+	size_t size;		/* of data, in bytes */
+	unsigned char *data;
+} TPcmPacked;
+
+/* What a cache costs and brings, see module_pcm_stats_report() */
+typedef struct {
+	unsigned long lookups;
+	unsigned long hits;
+	size_t raw_bytes;	/* Currently stored, unpacked */
+	size_t packed_bytes;	/* Currently stored, packed */
+	double decode_seconds;	/* Spent unpacking */
+	double audio_seconds;	/* Of the sound unpacked */
+} TPcmCacheStats;
+
+/* Parse a codec name from the configuration, -1 if unknown */
+int module_pcm_codec_from_name(const char *name);
+
+/* Pack _num_samples_ samples with _codec_, or raw if the lossless codec
+   would not make them smaller */
+TPcmPacked *module_pcm_pack(const short *samples, int num_samples,
+			    int sample_rate, EPcmCodec codec);
+
+/* Unpack into a newly allocated buffer of packed->num_samples samples,
+   accounting the time spent to _stats_ if not NULL */
+short *module_pcm_unpack(const TPcmPacked * packed, TPcmCacheStats * stats);
+
+void module_pcm_free(TPcmPacked * packed);
+
+/* Account a stored or dropped entry in _stats_ */
+void module_pcm_stats_add(TPcmCacheStats * stats, const TPcmPacked * packed);
+void module_pcm_stats_remove(TPcmCacheStats * stats,
+			     const TPcmPacked * packed);
+
+/* Log the hit ratio, memory used and unpacking cost of cache _name_ */
+void module_pcm_stats_report(const char *name, const TPcmCacheStats * stats);
+
+#endif /* #ifndef __MODULE_UTILS_PCM_H */
@@ -23,6 +23,11 @@
  * Based on ibmtts.c.
  */
 
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
 #include "module_utils_speak_queue.h"
 
 #define DBG_MODNAME "speak_queue"
@@ -49,6 +54,22 @@ static pthread_mutex_t speak_queue_mutex;
 static speak_queue_state_t speak_queue_state = IDLE;
 static gboolean speak_queue_configured = FALSE; /* Whether we have configured audio */
 
+/* After a message, the audio stream is kept open for GaplessTimeout ms, so
+ * that the next message can be appended to it without draining and setting
+ * the device up again.  These are the parameters it was configured with. */
+static AudioTrack speak_queue_configured_track;
+static AudioFormat speak_queue_configured_format;
+/* Monotonic time (us) at which the audio fed so far will have been played */
+static gint64 speak_queue_play_end;
+/* Whether the current message reuses the stream of the previous one */
+static gboolean speak_queue_reused = FALSE;
+/* While the stream is open with nothing to play, silence is fed in pieces
+ * of this many ms whenever the device has less than that left, so that it
+ * does not underrun */
+#define SPEAK_QUEUE_SILENCE_MS 20
+/* Enough for SPEAK_QUEUE_SILENCE_MS at 48 kHz in stereo */
+static short speak_queue_silence[SPEAK_QUEUE_SILENCE_MS * 48 * 2];
+
 static pthread_t speak_queue_play_thread;
 static pthread_t speak_queue_stop_or_pause_thread;
 
@@ -64,6 +85,9 @@ static pthread_cond_t speak_queue_play_cond;
 static pthread_cond_t speak_queue_play_sleeping_cond;
 static int speak_queue_play_sleeping;
 
+/* Used to wait for the queue to get back to idle */
+static pthread_cond_t speak_queue_idle_cond;
+
 static gboolean speak_queue_close_requested = FALSE;
 static speak_queue_pause_state_t speak_queue_pause_state = SPEAK_QUEUE_PAUSE_OFF;
 static gboolean speak_queue_stop_requested = FALSE;
@@ -99,6 +123,22 @@ typedef struct {
 static GSList *playback_queue = NULL;
 static int playback_queue_size = 0;	/* Number of audio frames currently in queue */
 
+/* With LockAudioMemory, audio is copied into a pool of fixed-size buffers
+ * which are allocated, locked and prefaulted once for all, so that the
+ * playback thread does not take page faults when the system is busy.  */
+#define SPEAK_QUEUE_POOL_BUFSIZE 8192
+/* How much of the playback thread stack to prefault and lock */
+#define SPEAK_QUEUE_STACK_PREFAULT (64 * 1024)
+/* Index marks are held and sent to the server together, but none is sent
+ * later than this after the point of the playback it marks, in us */
+#define SPEAK_QUEUE_MARKS_MAX_DELAY (40 * 1000)
+
+static pthread_mutex_t pcm_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *pcm_pool = NULL;
+static size_t pcm_pool_size;
+static void **pcm_pool_free;	/* Stack of free buffers */
+static int pcm_pool_nfree;
+
 /* Use to wait for queue room availability. Theoretically several threads might
  * be wanting to push, so use broadcast. */
 static pthread_cond_t playback_queue_room_condition;
@@ -114,6 +154,10 @@ static gboolean speak_queue_send_to_audio(speak_queue_entry *
 
 /* Miscellaneous internal function prototypes. */
 static void speak_queue_clear_playback_queue();
+static void speak_queue_pool_init(int maxsize);
+static void *speak_queue_pool_alloc(void);
+static void speak_queue_pool_release(void *buf);
+static void speak_queue_pool_free(void);
 
 /* The playback thread start routine. */
 static void *speak_queue_play(void *);
@@ -126,6 +170,9 @@ int module_speak_queue_init(int maxsize, char **status_info)
 
 	speak_queue_maxsize = maxsize;
 
+	if (module_lock_audio_memory)
+		speak_queue_pool_init(maxsize);
+
 	/* Reset global state */
 	module_speak_queue_reset();
 
@@ -134,6 +181,7 @@ int module_speak_queue_init(int maxsize, char **status_info)
 
 	pthread_cond_init(&playback_queue_room_condition, NULL);
 	pthread_cond_init(&playback_queue_data_condition, NULL);
+	pthread_cond_init(&speak_queue_idle_cond, NULL);
 
 	DBG(DBG_MODNAME " Creating new thread for stop or pause.");
 	pthread_cond_init(&speak_queue_stop_or_pause_cond, NULL);
@@ -141,8 +189,8 @@ int module_speak_queue_init(int maxsize, char **status_info)
 	speak_queue_stop_or_pause_sleeping = 0;
 
 	ret =
-	    pthread_create(&speak_queue_stop_or_pause_thread, NULL,
-			   speak_queue_stop_or_pause, NULL);
+	    module_thread_create(&speak_queue_stop_or_pause_thread,
+				 speak_queue_stop_or_pause, NULL);
 	if (0 != ret) {
 		DBG("Failed to create stop-or-pause thread.");
 		*status_info =
@@ -155,7 +203,8 @@ int module_speak_queue_init(int maxsize, char **status_info)
 	speak_queue_play_sleeping = 0;
 
 	DBG(DBG_MODNAME " Creating new thread for playback.");
-	ret = pthread_create(&speak_queue_play_thread, NULL, speak_queue_play, NULL);
+	ret = module_thread_create(&speak_queue_play_thread, speak_queue_play,
+				   NULL);
 	if (ret != 0) {
 		DBG("Failed to create playback thread.");
 		*status_info = g_strdup("Failed to create playback thread.");
@@ -187,6 +236,19 @@ int module_speak_queue_before_synth(void)
 	return TRUE;
 }
 
+int module_speak_queue_wait_idle(void)
+{
+	int ret;
+
+	pthread_mutex_lock(&speak_queue_mutex);
+	while ((speak_queue_state != IDLE || speak_queue_stop_requested)
+	       && !speak_queue_close_requested)
+		pthread_cond_wait(&speak_queue_idle_cond, &speak_queue_mutex);
+	ret = !speak_queue_close_requested;
+	pthread_mutex_unlock(&speak_queue_mutex);
+	return ret;
+}
+
 int module_speak_queue_before_play(void)
 {
 	int ret = 0;
@@ -210,10 +272,18 @@ gboolean module_speak_queue_add_end(void)
 	return ret;
 }
 
-static speak_queue_entry *playback_queue_pop()
+/* Pops the next entry.  Index marks held by the caller are sent before
+ * waiting for more entries, so that they are not delayed. */
+static speak_queue_entry *playback_queue_pop(gboolean *marks_held)
 {
 	speak_queue_entry *result = NULL;
 	pthread_mutex_lock(&speak_queue_mutex);
+	if (*marks_held && playback_queue == NULL) {
+		pthread_mutex_unlock(&speak_queue_mutex);
+		module_report_release_marks();
+		*marks_held = FALSE;
+		pthread_mutex_lock(&speak_queue_mutex);
+	}
 	while (!speak_queue_stop_requested && playback_queue == NULL) {
 		pthread_cond_wait(&playback_queue_data_condition,
 				  &speak_queue_mutex);
@@ -260,16 +330,40 @@ module_speak_queue_add_audio(const AudioTrack *track, AudioFormat format)
 		return FALSE;
 	}
 
-	speak_queue_entry *playback_queue_entry =
-	    g_new(speak_queue_entry, 1);
+	gint bytes_per_sample = track->bits / 8;
+	gint nbytes = bytes_per_sample * track->num_samples;
+	gint offset = 0;
 
-	playback_queue_entry->type = SPEAK_QUEUE_QET_AUDIO;
-	playback_queue_entry->data.audio.track = *track;
-	gint nbytes = track->bits / 8 * track->num_samples;
-	playback_queue_entry->data.audio.track.samples = g_memdup(track->samples, nbytes);
-	playback_queue_entry->data.audio.format = format;
+	do {
+		speak_queue_entry *playback_queue_entry =
+		    g_new(speak_queue_entry, 1);
+		/* With a pool, split the track into buffer-sized pieces */
+		gint piece = nbytes - offset;
+		void *samples = NULL;
+
+		if (pcm_pool != NULL
+		    && piece > SPEAK_QUEUE_POOL_BUFSIZE) {
+			piece = SPEAK_QUEUE_POOL_BUFSIZE -
+			    SPEAK_QUEUE_POOL_BUFSIZE % bytes_per_sample;
+		}
+		if (pcm_pool != NULL)
+			samples = speak_queue_pool_alloc();
+		if (samples != NULL)
+			memcpy(samples, (char *)track->samples + offset, piece);
+		else
+			samples = g_memdup((char *)track->samples + offset, piece);
+
+		playback_queue_entry->type = SPEAK_QUEUE_QET_AUDIO;
+		playback_queue_entry->data.audio.track = *track;
+		playback_queue_entry->data.audio.track.samples = samples;
+		playback_queue_entry->data.audio.track.num_samples =
+		    piece / bytes_per_sample;
+		playback_queue_entry->data.audio.format = format;
+
+		playback_queue_push(playback_queue_entry);
+		offset += piece;
+	} while (offset < nbytes);
 
-	playback_queue_push(playback_queue_entry);
 	pthread_mutex_unlock(&speak_queue_mutex);
 	return TRUE;
 }
@@ -318,7 +412,7 @@ speak_queue_delete_playback_queue_entry(speak_queue_entry * playback_queue_entry
 {
 	switch (playback_queue_entry->type) {
 	case SPEAK_QUEUE_QET_AUDIO:
-		g_free(playback_queue_entry->data.audio.track.samples);
+		speak_queue_pool_release(playback_queue_entry->data.audio.track.samples);
 		break;
 	case SPEAK_QUEUE_QET_INDEX_MARK:
 		g_free(playback_queue_entry->data.markId);
@@ -350,30 +444,290 @@ static void speak_queue_clear_playback_queue()
 	pthread_mutex_unlock(&speak_queue_mutex);
 }
 
+/* Allocates the buffer pool, the playback thread locks it. */
+static void speak_queue_pool_init(int maxsize)
+{
+	/* Enough for a full queue, plus the piece being played and the one
+	 * being pushed */
+	int nbufs = (maxsize * 2) / SPEAK_QUEUE_POOL_BUFSIZE + 3;
+	int i;
+
+	pcm_pool_size = (size_t) nbufs * SPEAK_QUEUE_POOL_BUFSIZE;
+	pcm_pool = g_malloc(pcm_pool_size);
+
+	pcm_pool_free = g_new(void *, nbufs);
+	for (i = 0; i < nbufs; i++)
+		pcm_pool_free[i] = pcm_pool + i * SPEAK_QUEUE_POOL_BUFSIZE;
+	pcm_pool_nfree = nbufs;
+
+	DBG(DBG_MODNAME " Allocated %d locked audio buffers.", nbufs);
+}
+
+/* Prefaults and locks the buffer pool, then the whole module, current and
+ * future mappings, so that the audio backend and its buffers do not fault
+ * either.  If the memory lock limit is too low for the whole module, only
+ * the pool and the playback stack stay locked.  This is done from the
+ * playback thread, which in a module forked from a zygote only starts in
+ * the child: memory locks are not inherited. */
+static void speak_queue_pool_lock(void)
+{
+	memset(pcm_pool, 0, pcm_pool_size);
+	if (mlock(pcm_pool, pcm_pool_size) != 0)
+		DBG(DBG_MODNAME " Could not lock %lu bytes of audio buffers: %s",
+		    (unsigned long)pcm_pool_size, strerror(errno));
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+		DBG(DBG_MODNAME " Could not lock all of the module memory: %s",
+		    strerror(errno));
+	else
+		DBG(DBG_MODNAME " Locked all of the module memory.");
+}
+
+/* Returns a free pool buffer, or NULL if they are all in use. */
+static void *speak_queue_pool_alloc(void)
+{
+	void *buf = NULL;
+
+	pthread_mutex_lock(&pcm_pool_mutex);
+	if (pcm_pool_nfree > 0)
+		buf = pcm_pool_free[--pcm_pool_nfree];
+	else
+		DBG(DBG_MODNAME " Audio buffer pool exhausted, allocating.");
+	pthread_mutex_unlock(&pcm_pool_mutex);
+	return buf;
+}
+
+static void speak_queue_pool_release(void *buf)
+{
+	if (pcm_pool == NULL
+	    || (char *)buf < pcm_pool
+	    || (char *)buf >= pcm_pool + pcm_pool_size) {
+		g_free(buf);
+		return;
+	}
+
+	pthread_mutex_lock(&pcm_pool_mutex);
+	pcm_pool_free[pcm_pool_nfree++] = buf;
+	pthread_mutex_unlock(&pcm_pool_mutex);
+}
+
+static void speak_queue_pool_free(void)
+{
+	if (pcm_pool == NULL)
+		return;
+
+	munlockall();
+	g_free(pcm_pool);
+	pcm_pool = NULL;
+	g_free(pcm_pool_free);
+	pcm_pool_free = NULL;
+	pcm_pool_nfree = 0;
+}
+
+/* Touches and locks the top of the playback thread stack, so that playing
+ * does not fault on it. */
+static void speak_queue_prefault_stack(void)
+{
+	volatile char stack[SPEAK_QUEUE_STACK_PREFAULT];
+	long page = sysconf(_SC_PAGESIZE);
+	char *start;
+
+	memset((char *)stack, 0, sizeof(stack));
+	start = (char *)((unsigned long)stack & ~(page - 1));
+	if (mlock(start, (char *)stack + sizeof(stack) - start) != 0)
+		DBG(DBG_MODNAME " Could not lock playback stack: %s",
+		    strerror(errno));
+}
+
+/* Reports the page faults the playback thread took so far. */
+static void speak_queue_report_faults(void)
+{
+#ifdef RUSAGE_THREAD
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_THREAD, &usage) == 0)
+		DBG(DBG_MODNAME " Playback thread page faults: %ld minor, %ld major",
+		    usage.ru_minflt, usage.ru_majflt);
+#endif
+}
+
+/* Sends the index marks held if they would be late once _track_ is fed:
+ * they were popped when the playback got to them, and feeding blocks
+ * for up to the duration of the track. */
+static void speak_queue_send_late_marks(AudioTrack * track)
+{
+	gint64 since = module_report_held_marks_since();
+	gint64 duration = 0;
+
+	if (since == 0)
+		return;
+	if (track->sample_rate > 0)
+		duration = (gint64) track->num_samples * G_USEC_PER_SEC
+		    / track->sample_rate;
+	if (track->sample_rate <= 0
+	    || g_get_monotonic_time() - since + duration >
+	    SPEAK_QUEUE_MARKS_MAX_DELAY)
+		module_report_flush_marks();
+}
+
 /* Sends a chunk of audio to the audio player and waits for completion or error. */
 static gboolean speak_queue_send_to_audio(speak_queue_entry * playback_queue_entry)
 {
 	int ret = 0;
-	DBG(DBG_MODNAME " Sending %i samples to audio.",
-	    playback_queue_entry->data.audio.track.num_samples);
+	AudioTrack *track = &playback_queue_entry->data.audio.track;
+	AudioFormat format = playback_queue_entry->data.audio.format;
+	gint64 start;
+
+	DBG(DBG_MODNAME " Sending %i samples to audio.", track->num_samples);
+	if (speak_queue_configured
+	    && (track->bits != speak_queue_configured_track.bits
+		|| track->num_channels !=
+		speak_queue_configured_track.num_channels
+		|| track->sample_rate !=
+		speak_queue_configured_track.sample_rate
+		|| format != speak_queue_configured_format)) {
+		DBG(DBG_MODNAME " Audio parameters changed, reopening.");
+		spd_audio_end(module_audio_id);
+		speak_queue_configured = FALSE;
+		speak_queue_reused = FALSE;
+	}
 	if (!speak_queue_configured)
 	{
-		spd_audio_begin(module_audio_id,
-				playback_queue_entry->data.audio.track,
-				playback_queue_entry->data.audio.format);
+		spd_audio_begin(module_audio_id, *track, format);
 		speak_queue_configured = TRUE;
+		speak_queue_configured_track = *track;
+		speak_queue_configured_format = format;
 	}
-	ret = spd_audio_feed_sync_overlap(module_audio_id,
-			     playback_queue_entry->data.audio.track,
-			     playback_queue_entry->data.audio.format);
-	if (ret < 0) {
-		DBG("ERROR: Can't play track for unknown reason.");
-		return FALSE;
+
+	start = g_get_monotonic_time();
+	if (speak_queue_reused) {
+		DBG(DBG_MODNAME " Gapless: %ld ms between the end of the previous message and this one.",
+		    (long)((start - speak_queue_play_end) / 1000));
+		speak_queue_reused = FALSE;
 	}
+	start = MAX(start, speak_queue_play_end);
+
+	while (spd_audio_feed_sync_overlap(module_audio_id, *track, format) < 0) {
+		if (speak_queue_stop_requested)
+			return FALSE;
+		ret = module_audio_write_failed();
+		if (ret < 0) {
+			DBG(DBG_MODNAME " Stopped while the audio output was failing.");
+			return FALSE;
+		}
+		if (ret > 0) {
+			/* A new output, set the stream up again */
+			spd_audio_begin(module_audio_id, *track, format);
+			start = g_get_monotonic_time();
+		}
+		DBG(DBG_MODNAME " Sending the audio again.");
+	}
+	module_audio_write_succeeded();
+	if (track->sample_rate > 0)
+		speak_queue_play_end = start + (gint64) track->num_samples
+		    * G_USEC_PER_SEC / track->sample_rate;
 	DBG(DBG_MODNAME " Sent to audio.");
 	return TRUE;
 }
 
+/* How long the device takes to play what it was fed, in us, or -1 if the
+ * audio output can't tell */
+static gint64 speak_queue_device_delay(void)
+{
+	long frames;
+
+	if (speak_queue_configured_track.sample_rate <= 0)
+		return -1;
+	frames = spd_audio_delay(module_audio_id);
+	if (frames < 0)
+		return -1;
+	return (gint64) frames * G_USEC_PER_SEC
+	    / speak_queue_configured_track.sample_rate;
+}
+
+/* Feeds SPEAK_QUEUE_SILENCE_MS of silence to the open stream, ends the
+ * stream if that fails */
+static void speak_queue_feed_silence(void)
+{
+	AudioTrack track = speak_queue_configured_track;
+	int channels = MAX(track.num_channels, 1);
+
+	track.num_samples = MIN(track.sample_rate * SPEAK_QUEUE_SILENCE_MS
+				/ 1000, G_N_ELEMENTS(speak_queue_silence)
+				/ channels) * channels;
+	track.samples = speak_queue_silence;
+	if (spd_audio_feed_sync_overlap(module_audio_id, track,
+					speak_queue_configured_format) < 0) {
+		DBG(DBG_MODNAME " Feeding silence failed, closing the stream.");
+		spd_audio_end(module_audio_id);
+		speak_queue_configured = FALSE;
+	}
+}
+
+/* With speak_queue_mutex held, waits on _cond_ until the monotonic time
+ * _until_, or until _done_ returns TRUE, keeping the device fed with
+ * silence meanwhile if it can tell how much it has left to play. */
+static void speak_queue_keep_playing(gint64 until, pthread_cond_t *cond,
+				     gboolean (*done) (void))
+{
+	gint64 now, wake, delay;
+	struct timespec deadline;
+
+	while (speak_queue_configured && !speak_queue_close_requested
+	       && !done()) {
+		now = g_get_monotonic_time();
+		if (now >= until)
+			break;
+		wake = until;
+		delay = speak_queue_device_delay();
+		if (delay >= 0) {
+			if (delay < SPEAK_QUEUE_SILENCE_MS * 1000) {
+				pthread_mutex_unlock(&speak_queue_mutex);
+				speak_queue_feed_silence();
+				pthread_mutex_lock(&speak_queue_mutex);
+				continue;
+			}
+			wake = MIN(wake, now + delay
+				   - SPEAK_QUEUE_SILENCE_MS * 1000);
+		}
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += (wake - now) / G_USEC_PER_SEC;
+		deadline.tv_nsec += ((wake - now) % G_USEC_PER_SEC) * 1000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(cond, &speak_queue_mutex, &deadline);
+	}
+}
+
+static gboolean speak_queue_stopping(void)
+{
+	return speak_queue_stop_requested;
+}
+
+static gboolean speak_queue_next_message(void)
+{
+	return speak_queue_state >= BEFORE_PLAY || speak_queue_stop_requested;
+}
+
+/* Instead of draining the device, waits until the audio fed so far has
+ * been played, or a stop is requested.  How much is left is asked to the
+ * device, and only estimated from when the audio was fed if it can't
+ * tell. */
+static void speak_queue_wait_played(void)
+{
+	gint64 delay;
+
+	pthread_mutex_lock(&speak_queue_mutex);
+	delay = speak_queue_device_delay();
+	if (delay >= 0)
+		speak_queue_play_end = g_get_monotonic_time() + delay;
+	speak_queue_keep_playing(speak_queue_play_end,
+				 &playback_queue_data_condition,
+				 speak_queue_stopping);
+	pthread_mutex_unlock(&speak_queue_mutex);
+}
+
 /* Playback thread. */
 static void *speak_queue_play(void *nothing)
 {
@@ -385,13 +739,32 @@ static void *speak_queue_play(void *nothing)
 	/* Block all signals to this thread. */
 	set_speaking_thread_parameters();
 
+	if (pcm_pool != NULL) {
+		speak_queue_pool_lock();
+		speak_queue_prefault_stack();
+	}
+
 	pthread_mutex_lock(&speak_queue_mutex);
 	while (!speak_queue_close_requested) {
 		speak_queue_play_sleeping = 1;
 		pthread_cond_signal(&speak_queue_play_sleeping_cond);
-		while (speak_queue_state < BEFORE_PLAY && !speak_queue_close_requested) {
-			pthread_cond_wait(&speak_queue_play_cond, &speak_queue_mutex);
+		/* The stream is still open from the previous message, give
+		 * the next one a chance to reuse it. */
+		speak_queue_keep_playing(g_get_monotonic_time()
+					 + module_gapless_timeout * 1000,
+					 &speak_queue_play_cond,
+					 speak_queue_next_message);
+		if (speak_queue_configured && speak_queue_state < BEFORE_PLAY
+		    && !speak_queue_close_requested) {
+			pthread_mutex_unlock(&speak_queue_mutex);
+			DBG(DBG_MODNAME " No further message, closing the stream.");
+			spd_audio_end(module_audio_id);
+			speak_queue_configured = FALSE;
+			pthread_mutex_lock(&speak_queue_mutex);
 		}
+		while (speak_queue_state < BEFORE_PLAY && !speak_queue_close_requested)
+			pthread_cond_wait(&speak_queue_play_cond, &speak_queue_mutex);
+		speak_queue_reused = speak_queue_configured;
 		speak_queue_play_sleeping = 0;
 		pthread_cond_signal(&speak_queue_play_sleeping_cond);
 		DBG(DBG_MODNAME " Playback.");
@@ -399,16 +772,30 @@ static void *speak_queue_play(void *nothing)
 			break;
 		pthread_mutex_unlock(&speak_queue_mutex);
 
+		gboolean ended = FALSE;
+		gboolean marks_held = FALSE;
 		while (1) {
 			gboolean finished = FALSE;
-			playback_queue_entry = playback_queue_pop();
+			playback_queue_entry = playback_queue_pop(&marks_held);
 			if (playback_queue_entry == NULL) {
 				DBG(DBG_MODNAME " playback thread detected stop.");
 				break;
 			}
 
+			/* Index marks are held across audio chunks, and sent
+			 * together before they get late or when the queue
+			 * goes idle.  Other events send them first. */
+			if (playback_queue_entry->type == SPEAK_QUEUE_QET_INDEX_MARK
+			    && !marks_held) {
+				module_report_hold_marks();
+				marks_held = TRUE;
+			}
+
 			switch (playback_queue_entry->type) {
 			case SPEAK_QUEUE_QET_AUDIO:
+				if (marks_held)
+					speak_queue_send_late_marks
+					    (&playback_queue_entry->data.audio.track);
 				speak_queue_send_to_audio(playback_queue_entry);
 				break;
 			case SPEAK_QUEUE_QET_INDEX_MARK:
@@ -434,6 +821,8 @@ static void *speak_queue_play(void *nothing)
 				pthread_mutex_unlock(&speak_queue_mutex);
 				break;
 			case SPEAK_QUEUE_QET_SOUND_ICON:
+				if (marks_held)
+					module_report_flush_marks();
 				if (speak_queue_configured) {
 					spd_audio_end(module_audio_id);
 					speak_queue_configured = FALSE;
@@ -456,8 +845,12 @@ static void *speak_queue_play(void *nothing)
 				}
 			case SPEAK_QUEUE_QET_END:
 				if (speak_queue_configured) {
-					spd_audio_end(module_audio_id);
-					speak_queue_configured = FALSE;
+					if (module_gapless_timeout > 0) {
+						speak_queue_wait_played();
+					} else {
+						spd_audio_end(module_audio_id);
+						speak_queue_configured = FALSE;
+					}
 				}
 				pthread_mutex_lock(&speak_queue_mutex);
 				DBG(DBG_MODNAME " playback thread got END from queue.");
@@ -467,12 +860,17 @@ static void *speak_queue_play(void *nothing)
 						speak_queue_state = IDLE;
 						speak_queue_pause_state =
 						    SPEAK_QUEUE_PAUSE_OFF;
+						pthread_cond_broadcast
+						    (&speak_queue_idle_cond);
+						ended = TRUE;
 					}
 					finished = TRUE;
 				}
 				pthread_mutex_unlock(&speak_queue_mutex);
 				if (finished)
 					module_report_event_end();
+				if (pcm_pool != NULL)
+					speak_queue_report_faults();
 				break;
 			}
 
@@ -481,7 +879,11 @@ static void *speak_queue_play(void *nothing)
 			if (finished)
 				break;
 		}
-		if (speak_queue_configured) {
+		if (marks_held)
+			module_report_release_marks();
+		/* Only a message which played until its end leaves the
+		 * stream open for the next one */
+		if (speak_queue_configured && !ended) {
 			spd_audio_end(module_audio_id);
 			speak_queue_configured = FALSE;
 		}
@@ -489,6 +891,10 @@ static void *speak_queue_play(void *nothing)
 	}
 	speak_queue_play_sleeping = 1;
 	pthread_mutex_unlock(&speak_queue_mutex);
+	if (speak_queue_configured) {
+		spd_audio_end(module_audio_id);
+		speak_queue_configured = FALSE;
+	}
 	DBG(DBG_MODNAME " Playback thread ended.......");
 	return 0;
 }
@@ -531,11 +937,15 @@ void module_speak_queue_terminate(void)
 
 	pthread_cond_broadcast(&playback_queue_room_condition);
 	pthread_cond_signal(&playback_queue_data_condition);
+	pthread_cond_broadcast(&speak_queue_idle_cond);
 
 	pthread_cond_signal(&speak_queue_play_cond);
 	pthread_cond_signal(&speak_queue_stop_or_pause_cond);
 	pthread_mutex_unlock(&speak_queue_mutex);
 
+	/* The playback thread may be waiting to reopen the audio output */
+	module_audio_stop();
+
 	DBG(DBG_MODNAME " Joining play thread.");
 	pthread_join(speak_queue_play_thread, NULL);
 	DBG(DBG_MODNAME " Joining stop thread.");
@@ -546,10 +956,12 @@ void module_speak_queue_free(void)
 {
 	DBG(DBG_MODNAME " Freeing resources.");
 	speak_queue_clear_playback_queue();
+	speak_queue_pool_free();
 
 	pthread_mutex_destroy(&speak_queue_mutex);
 	pthread_cond_destroy(&playback_queue_room_condition);
 	pthread_cond_destroy(&playback_queue_data_condition);
+	pthread_cond_destroy(&speak_queue_idle_cond);
 	pthread_cond_destroy(&speak_queue_play_cond);
 	pthread_cond_destroy(&speak_queue_play_sleeping_cond);
 	pthread_cond_destroy(&speak_queue_stop_or_pause_cond);
@@ -588,12 +1000,12 @@ static void *speak_queue_stop_or_pause(void *nothing)
 			speak_queue_state = IDLE;
 			pthread_mutex_unlock(&speak_queue_mutex);
 			DBG(DBG_MODNAME " Stopping audio.");
-			ret = spd_audio_stop(module_audio_id);
+			ret = module_audio_stop();
 			if (ret != 0)
 				DBG("spd_audio_stop returned non-zero value.");
 			pthread_mutex_lock(&speak_queue_mutex);
 			while (!speak_queue_play_sleeping) {
-				ret = spd_audio_stop(module_audio_id);
+				ret = module_audio_stop();
 				if (ret != 0)
 					DBG("spd_audio_stop returned non-zero value.");
 				pthread_mutex_unlock(&speak_queue_mutex);
@@ -618,6 +1030,7 @@ static void *speak_queue_stop_or_pause(void *nothing)
 		int save_pause_state = speak_queue_pause_state;
 		pthread_mutex_lock(&speak_queue_mutex);
 		module_speak_queue_reset();
+		pthread_cond_broadcast(&speak_queue_idle_cond);
 		pthread_mutex_unlock(&speak_queue_mutex);
 
 		if (save_pause_state == SPEAK_QUEUE_PAUSE_MARK_REPORTED) {
@@ -137,6 +137,12 @@ int module_speak_queue_init(int maxsize, char **status_info);
 /* To be called from module_speak before synthesizing the voice.  */
 int module_speak_queue_before_synth(void);
 
+/* To be called by modules which synthesize from their own thread, to wait
+ * until the previous message is completely over (ended or stopped) before
+ * calling module_speak_queue_before_synth.  Returns FALSE if the queue is
+ * being terminated.  */
+int module_speak_queue_wait_idle(void);
+
 
 /* To be called from the synth callback before looking through its events.  */
 int module_speak_queue_before_play(void);
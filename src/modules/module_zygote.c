@@ -0,0 +1,225 @@
+/*
+ * module_zygote.c - Pre-initialized output module process forking modules
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * With the ModuleZygote server option, a module binary is started once with
+ * --zygote, gets linked, loads its options and reads its configuration, and
+ * then waits on a unix socket.  For each module the server wants, it sends
+ * the module stdin, stdout and stderr descriptors; the zygote forks a child
+ * which takes them over and goes on with the usual INIT handshake, sharing
+ * the already initialized pages with the zygote.  The zygote replies with the
+ * pid of the child.
+ *
+ * Modules which set module_zygote_preload also get their engine and its
+ * data initialized by module_init() in the zygote, which then answers INIT
+ * the same way in each child.  Threads would not survive fork(), so the
+ * threads module_init() asks for through module_thread_create() are only
+ * started in the children.  Other modules run module_init() in each child.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+
+#include <glib.h>
+
+#include "module_utils.h"
+
+/* Exit when no module was requested for that long */
+#define MODULE_ZYGOTE_IDLE_TIMEOUT (10 * 60 * 1000)
+
+int module_zygote_preload = 0;
+
+/* Whether module_init() runs in the zygote, and the threads it asked for */
+static int zygote_initializing;
+
+typedef struct {
+	pthread_t *thread;
+	void *(*start) (void *);
+	void *arg;
+} TZygoteThread;
+
+static GSList *zygote_threads;
+
+int module_thread_create(pthread_t * thread, void *(*start) (void *),
+			 void *arg)
+{
+	TZygoteThread *t;
+
+	if (!zygote_initializing)
+		return pthread_create(thread, NULL, start, arg);
+
+	t = g_new(TZygoteThread, 1);
+	t->thread = thread;
+	t->start = start;
+	t->arg = arg;
+	zygote_threads = g_slist_append(zygote_threads, t);
+	return 0;
+}
+
+int module_zygote_init(char **status_info)
+{
+	int ret;
+
+	zygote_initializing = 1;
+	ret = module_init(status_info);
+	zygote_initializing = 0;
+	DBG("Zygote initialized the module: %d, %d threads to start", ret,
+	    g_slist_length(zygote_threads));
+	return ret;
+}
+
+/* Starts the threads module_init() asked for in the zygote */
+static int module_zygote_start_threads(void)
+{
+	GSList *l;
+	TZygoteThread *t;
+	int ret;
+
+	for (l = zygote_threads; l != NULL; l = l->next) {
+		t = l->data;
+		ret = pthread_create(t->thread, NULL, t->start, t->arg);
+		if (ret != 0) {
+			DBG("Can't start a module thread: %s", strerror(ret));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Receives the three standard descriptors of a new module */
+static int module_zygote_receive(int conn, int fds[3])
+{
+	char byte;
+	struct iovec iov = { &byte, 1 };
+	union {
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	if (recvmsg(conn, &msg, MSG_CMSG_CLOEXEC) != 1)
+		return -1;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET
+	    || cmsg->cmsg_type != SCM_RIGHTS
+	    || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+		return -1;
+
+	memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+	return 0;
+}
+
+int module_zygote_serve(const char *path)
+{
+	struct sockaddr_un addr;
+	struct pollfd pfd;
+	int sock, conn, fds[3], i;
+	pid_t pid;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		DBG("Zygote socket path %s is too long", path);
+		return -1;
+	}
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		DBG("Can't create the zygote socket: %s", strerror(errno));
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	    || listen(sock, 8) < 0) {
+		DBG("Can't listen on %s: %s", path, strerror(errno));
+		close(sock);
+		return -1;
+	}
+
+	/* Children are reaped by the system, the server watches them */
+	signal(SIGCHLD, SIG_IGN);
+	DBG("Zygote waiting for requests on %s", path);
+
+	while (1) {
+		pfd.fd = sock;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		i = poll(&pfd, 1, MODULE_ZYGOTE_IDLE_TIMEOUT);
+		if (i < 0 && errno == EINTR)
+			continue;
+		if (i <= 0)
+			break;
+
+		conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+		if (conn < 0)
+			continue;
+		if (module_zygote_receive(conn, fds) != 0) {
+			DBG("Bad zygote request");
+			close(conn);
+			continue;
+		}
+
+		pid = fork();
+		if (pid == 0) {
+			/* Become the module the server asked for */
+			close(sock);
+			close(conn);
+			signal(SIGCHLD, SIG_DFL);
+			for (i = 0; i < 3; i++) {
+				if (dup2(fds[i], i) < 0)
+					_exit(1);
+				close(fds[i]);
+			}
+			return module_zygote_start_threads();
+		}
+
+		if (pid < 0)
+			DBG("Zygote can't fork: %s", strerror(errno));
+		for (i = 0; i < 3; i++)
+			close(fds[i]);
+		if (write(conn, &pid, sizeof(pid)) != sizeof(pid))
+			DBG("Can't reply to the server: %s", strerror(errno));
+		close(conn);
+	}
+
+	DBG("Zygote idle, exiting");
+	unlink(path);
+	close(sock);
+	exit(0);
+}
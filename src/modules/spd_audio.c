@@ -313,6 +313,28 @@ int spd_audio_end(AudioID * id)
 	return id->function->end(id);
 }
 
+/* Tell how much of the audio fed to the device is still to be played.
+
+   Arguments:
+   id -- the AudioID* of the device returned by spd_audio_open
+
+   Return value:
+   The number of frames fed since spd_audio_begin() which were not played
+   yet, or a negative value if the backend can't tell.
+*/
+long spd_audio_delay(AudioID * id)
+{
+	if (!id) {
+		fprintf(stderr, "No audio open\n");
+		return -1;
+	}
+
+	if (!id->function->delay)
+		return -1;
+
+	return id->function->delay(id);
+}
+
 /* Play a track on the audio device (blocking).
 
    Arguments:
@@ -36,6 +36,7 @@ int spd_audio_begin(AudioID * id, AudioTrack track, AudioFormat format);
 int spd_audio_feed_sync(AudioID * id, AudioTrack track, AudioFormat format);
 int spd_audio_feed_sync_overlap(AudioID * id, AudioTrack track, AudioFormat format);
 int spd_audio_end(AudioID * id);
+long spd_audio_delay(AudioID * id);
 
 int spd_audio_stop(AudioID * id);
 
@@ -22,6 +22,7 @@
 #endif
 
 #include "alloc.h"
+#include "index_marking.h"
 
 TFDSetElement spd_fdset_copy(TFDSetElement *old)
 {
@@ -31,6 +32,8 @@ TFDSetElement spd_fdset_copy(TFDSetElement *old)
 	new.msg_settings.voice.language =
 	    g_strdup(old->msg_settings.voice.language);
 	new.msg_settings.voice.name = g_strdup(old->msg_settings.voice.name);
+	new.msg_settings.voice.variant =
+	    g_strdup(old->msg_settings.voice.variant);
 	new.client_name = g_strdup(old->client_name);
 	new.output_module = g_strdup(old->output_module);
 	new.index_mark = g_strdup(old->index_mark);
@@ -58,6 +61,8 @@ TSpeechDMessage *spd_message_copy(TSpeechDMessage * old)
 	new->buf = g_malloc((old->bytes + 1) * sizeof(char));
 	memcpy(new->buf, old->buf, old->bytes);
 	new->buf[new->bytes] = 0;
+	new->unmarked = NULL;
+	new->marks = NULL;
 	new->settings = spd_fdset_copy(&old->settings);
 
 	return new;
@@ -70,6 +75,7 @@ void mem_free_fdset(TFDSetElement * fdset)
 	g_free(fdset->client_name);
 	g_free(fdset->msg_settings.voice.language);
 	g_free(fdset->msg_settings.voice.name);
+	g_free(fdset->msg_settings.voice.variant);
 	g_free(fdset->output_module);
 	g_free(fdset->index_mark);
 	g_free(fdset->audio_output_method);
@@ -85,6 +91,7 @@ void mem_free_message(TSpeechDMessage * msg)
 	if (msg == NULL)
 		return;
 	g_free(msg->buf);
+	index_marks_free(msg);
 	mem_free_fdset(&(msg->settings));
 	g_free(msg);
 }
@@ -31,6 +31,7 @@
 #include "speechd.h"
 #include "configuration.h"
 #include "symbols.h"
+#include "placement.h"
 #include <fdsetconv.h>
 
 configoption_t *spd_options;
@@ -224,6 +225,13 @@ GLOBAL_FDSET_OPTION_CB_STR(DefaultModule, output_module)
     SPEECHD_OPTION_CB_INT(MaxHistoryMessages, max_history_messages, val >= 0,
 		      "Invalid parameter!")
     SPEECHD_OPTION_CB_INT_M(Timeout, server_timeout, val >= 0, "Invalid timeout value!")
+    SPEECHD_OPTION_CB_INT(ModuleZygote, module_zygote, 1, "")
+    SPEECHD_OPTION_CB_INT(ModuleCrashRetries, module_crash_retries, val >= 0,
+		      "Invalid number of retries!")
+    SPEECHD_OPTION_CB_INT(OverloadQueueLength, overload_queue_length, val >= 0,
+		      "Invalid queue length!")
+    SPEECHD_OPTION_CB_INT(OverloadQueueDelay, overload_queue_delay, val >= 0,
+		      "Invalid queue delay!")
 
     DOTCONF_CB(cb_LanguageDefaultModule)
 {
@@ -333,6 +341,125 @@ DOTCONF_CB(cb_AddModule)
 	return NULL;
 }
 
+/* == MODULE AND SPEAK THREAD PLACEMENT == */
+
+/* Module placement options take an optional module name before the
+   value: without it they set the default for all modules. */
+static TPlacement *placement_option(command_t * cmd, const char **value)
+{
+	if (cl_spec_section)
+		FATAL("This command isn't allowed in a client specific section!");
+
+	if (cmd->arg_count == 1) {
+		*value = cmd->data.list[0];
+		return placement_get_module(NULL, 1);
+	}
+	if (cmd->arg_count == 2) {
+		*value = cmd->data.list[1];
+		return placement_get_module(cmd->data.list[0], 1);
+	}
+
+	MSG(2, "Configuration: %s takes an optional module name and a value",
+	    cmd->name);
+	return NULL;
+}
+
+DOTCONF_CB(cb_ModuleCPUAffinity)
+{
+	const char *value;
+	TPlacement *placement = placement_option(cmd, &value);
+	cpu_set_t set;
+
+	if (placement == NULL)
+		return NULL;
+	if (placement_parse_cpus(value, &set) != 0)
+		FATAL("Invalid CPU list in ModuleCPUAffinity!");
+	g_free(placement->cpus);
+	placement->cpus = g_strdup(value);
+	return NULL;
+}
+
+DOTCONF_CB(cb_ModuleNice)
+{
+	const char *value;
+	TPlacement *placement = placement_option(cmd, &value);
+	int val;
+
+	if (placement == NULL)
+		return NULL;
+	val = atoi(value);
+	if (val < -20 || val > 19)
+		FATAL("ModuleNice must be between -20 and 19!");
+	placement->nice = val;
+	placement->nice_set = 1;
+	return NULL;
+}
+
+DOTCONF_CB(cb_ModuleCgroup)
+{
+	const char *value;
+	TPlacement *placement = placement_option(cmd, &value);
+
+	if (placement == NULL)
+		return NULL;
+	g_free(placement->cgroup);
+	placement->cgroup = g_strdup(value);
+	return NULL;
+}
+
+DOTCONF_CB(cb_ModuleCgroupCPUWeight)
+{
+	const char *value;
+	TPlacement *placement = placement_option(cmd, &value);
+	int val;
+
+	if (placement == NULL)
+		return NULL;
+	val = atoi(value);
+	if (val < 1 || val > 10000)
+		FATAL("ModuleCgroupCPUWeight must be between 1 and 10000!");
+	placement->cpu_weight = val;
+	return NULL;
+}
+
+DOTCONF_CB(cb_ModuleCgroupMemoryMax)
+{
+	const char *value;
+	TPlacement *placement = placement_option(cmd, &value);
+
+	if (placement == NULL)
+		return NULL;
+	g_free(placement->memory_max);
+	placement->memory_max = g_strdup(value);
+	return NULL;
+}
+
+DOTCONF_CB(cb_SpeakThreadCPUAffinity)
+{
+	cpu_set_t set;
+
+	if (cl_spec_section)
+		FATAL("This command isn't allowed in a client specific section!");
+	if (placement_parse_cpus(cmd->data.str, &set) != 0)
+		FATAL("Invalid CPU list in SpeakThreadCPUAffinity!");
+	g_free(speak_thread_placement.cpus);
+	speak_thread_placement.cpus = g_strdup(cmd->data.str);
+	return NULL;
+}
+
+DOTCONF_CB(cb_SpeakThreadNice)
+{
+	int val = cmd->data.value;
+
+	if (cl_spec_section)
+		FATAL("This command isn't allowed in a client specific section!");
+	if (val < -20 || val > 19)
+		FATAL("SpeakThreadNice must be between -20 and 19!");
+	speak_thread_placement.nice = val;
+	speak_thread_placement.nice_set = 1;
+	return NULL;
+}
+
 /* == CLIENT SPECIFIC CONFIGURATION == */
 
 #define SET_PAR(name, value) cl_spec->val.name = value;
@@ -440,6 +567,10 @@ configoption_t *load_config_options(int *num_options)
 	ADD_CONFIG_OPTION(DefaultLanguage, ARG_STR);
 	ADD_CONFIG_OPTION(DefaultPriority, ARG_STR);
 	ADD_CONFIG_OPTION(MaxHistoryMessages, ARG_INT);
+	ADD_CONFIG_OPTION(ModuleZygote, ARG_TOGGLE);
+	ADD_CONFIG_OPTION(ModuleCrashRetries, ARG_INT);
+	ADD_CONFIG_OPTION(OverloadQueueLength, ARG_INT);
+	ADD_CONFIG_OPTION(OverloadQueueDelay, ARG_INT);
 	ADD_CONFIG_OPTION(DefaultPunctuationMode, ARG_STR);
 	ADD_CONFIG_OPTION(SymbolsPreproc, ARG_STR);
 	ADD_CONFIG_OPTION(SymbolsPreprocFile, ARG_STR);
@@ -450,6 +581,13 @@ configoption_t *load_config_options(int *num_options)
 	ADD_CONFIG_OPTION(DefaultPauseContext, ARG_INT);
 	ADD_CONFIG_OPTION(Timeout, ARG_INT);
 	ADD_CONFIG_OPTION(AddModule, ARG_LIST);
+	ADD_CONFIG_OPTION(ModuleCPUAffinity, ARG_LIST);
+	ADD_CONFIG_OPTION(ModuleNice, ARG_LIST);
+	ADD_CONFIG_OPTION(ModuleCgroup, ARG_LIST);
+	ADD_CONFIG_OPTION(ModuleCgroupCPUWeight, ARG_LIST);
+	ADD_CONFIG_OPTION(ModuleCgroupMemoryMax, ARG_LIST);
+	ADD_CONFIG_OPTION(SpeakThreadCPUAffinity, ARG_STR);
+	ADD_CONFIG_OPTION(SpeakThreadNice, ARG_INT);
 
 	ADD_CONFIG_OPTION(AudioOutputMethod, ARG_STR);
 	ADD_CONFIG_OPTION(AudioOSSDevice, ARG_STR);
@@ -496,6 +634,10 @@ void load_default_global_set_options()
 	GlobalFDSet.audio_pulse_min_length = 10;
 
 	SpeechdOptions.max_history_messages = 10000;
+	SpeechdOptions.module_zygote = 0;
+	SpeechdOptions.module_crash_retries = 2;
+	SpeechdOptions.overload_queue_length = 0;
+	SpeechdOptions.overload_queue_delay = 0;
 
 	/* Options which are accessible from command line must be handled
 	   specially to make sure we don't overwrite them */
@@ -0,0 +1,549 @@
+
+/*
+ * handover.c -- Restarting the server without dropping its clients
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * On SIGUSR2 the server executes its binary again in the same process.
+ * The listening socket and the client sockets are simply inherited, the
+ * rest of the state is written as a key file into an unlinked temporary
+ * file whose descriptor is passed in the SPEECHD_HANDOVER_FD environment
+ * variable:
+ *
+ *   [server]       listening socket, uid/gid/message id counters
+ *   [client N]     settings of client uid N, its socket and unparsed input
+ *   [message N]    queued message N, its queue and the settings it carries
+ *   [history N]    message N of the history
+ *
+ * The message being spoken is queued again first in its queue, from its
+ * last index mark, and its client gets RESUME instead of BEGIN for it.
+ * Binary data (message text, partial input) is base64 encoded.
+ *
+ * Nothing else survives the exec: log files, the pid file, pipes and the
+ * like are all opened again by the new instance.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <fcntl.h>
+#include <dirent.h>
+
+#include "speechd.h"
+#include "server.h"
+#include "set.h"
+#include "sem_functions.h"
+#include "history.h"
+#include "index_marking.h"
+#include "handover.h"
+
+#define HANDOVER_ENV "SPEECHD_HANDOVER_FD"
+
+static char **handover_argv;
+static char *handover_program;
+
+void handover_init(char **argv)
+{
+	handover_argv = argv;
+	/* Resolve it now, so that an upgraded binary is picked up later */
+	handover_program = g_file_read_link("/proc/self/exe", NULL);
+	if (handover_program == NULL)
+		handover_program = g_strdup(argv[0]);
+}
+
+int handover_inherited_fd(void)
+{
+	const char *env = g_getenv(HANDOVER_ENV);
+	int fd;
+
+	if (env == NULL)
+		return -1;
+	fd = atoi(env);
+	g_unsetenv(HANDOVER_ENV);
+	return fd > 2 ? fd : -1;
+}
+
+static int keep_on_exec(int fd)
+{
+	int flags = fcntl(fd, F_GETFD);
+
+	if (flags == -1)
+		return -1;
+	return fcntl(fd, F_SETFD, flags & ~FD_CLOEXEC);
+}
+
+/* Marks every descriptor but the standard ones close-on-exec, those to
+   be inherited are then kept with keep_on_exec() */
+static void close_all_on_exec(void)
+{
+	DIR *dir;
+	struct dirent *entry;
+	long fd, max;
+	int flags;
+
+	dir = opendir("/proc/self/fd");
+	if (dir != NULL) {
+		while ((entry = readdir(dir)) != NULL) {
+			fd = strtol(entry->d_name, NULL, 10);
+			if (fd <= 2 || fd == dirfd(dir))
+				continue;
+			flags = fcntl(fd, F_GETFD);
+			if (flags != -1)
+				fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+		}
+		closedir(dir);
+		return;
+	}
+
+	/* No /proc, try them all */
+	max = sysconf(_SC_OPEN_MAX);
+	if (max < 0 || max > 65536)
+		max = 65536;
+	for (fd = 3; fd < max; fd++) {
+		flags = fcntl(fd, F_GETFD);
+		if (flags != -1)
+			fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+	}
+}
+
+static void save_data(GKeyFile * kf, const char *group, const char *key,
+		      const char *data, gsize len)
+{
+	gchar *enc = g_base64_encode((const guchar *)data, len);
+	g_key_file_set_string(kf, group, key, enc);
+	g_free(enc);
+}
+
+static GString *load_data(GKeyFile * kf, const char *group, const char *key)
+{
+	gchar *enc = g_key_file_get_string(kf, group, key, NULL);
+	guchar *data;
+	gsize len;
+	GString *str;
+
+	if (enc == NULL)
+		return NULL;
+	data = g_base64_decode(enc, &len);
+	str = g_string_new_len((gchar *) data, len);
+	g_free(data);
+	g_free(enc);
+	return str;
+}
+
+#define SETTINGS_INT_FIELDS \
+	FIELD(uid) FIELD(fd) FIELD(active) FIELD(paused) \
+	FIELD(paused_while_speaking) FIELD(type) FIELD(ssml_mode) \
+	FIELD(symbols_preprocessing) FIELD(priority) \
+	FIELD(msg_settings.rate) FIELD(msg_settings.pitch) \
+	FIELD(msg_settings.pitch_range) FIELD(msg_settings.volume) \
+	FIELD(msg_settings.punctuation_mode) FIELD(msg_settings.spelling_mode) \
+	FIELD(msg_settings.cap_let_recogn) FIELD(msg_settings.voice_type) \
+	FIELD(notification) FIELD(reparted) FIELD(min_delay_progress) \
+	FIELD(pause_context) FIELD(audio_pulse_min_length) FIELD(log_level) \
+	FIELD(hist_cur_uid) FIELD(hist_cur_pos) FIELD(hist_sorted)
+
+#define SETTINGS_STR_FIELDS \
+	FIELD(msg_settings.voice.name) FIELD(msg_settings.voice.language) \
+	FIELD(msg_settings.voice.variant) \
+	FIELD(client_name) FIELD(output_module) FIELD(index_mark) \
+	FIELD(audio_output_method) FIELD(audio_oss_device) \
+	FIELD(audio_alsa_device) FIELD(audio_nas_server) \
+	FIELD(audio_pulse_server) FIELD(audio_pulse_device)
+
+static void save_settings(GKeyFile * kf, const char *group,
+			  const TFDSetElement * set)
+{
+#define FIELD(f) g_key_file_set_integer(kf, group, #f, set->f);
+	SETTINGS_INT_FIELDS
+#undef FIELD
+#define FIELD(f) if (set->f) g_key_file_set_string(kf, group, #f, set->f);
+	SETTINGS_STR_FIELDS
+#undef FIELD
+}
+
+/* Fills in _set_, whose strings must not be allocated */
+static void load_settings(GKeyFile * kf, const char *group,
+			  TFDSetElement * set)
+{
+#define FIELD(f) set->f = g_key_file_get_integer(kf, group, #f, NULL);
+	SETTINGS_INT_FIELDS
+#undef FIELD
+#define FIELD(f) set->f = g_key_file_get_string(kf, group, #f, NULL);
+	SETTINGS_STR_FIELDS
+#undef FIELD
+	set->fd_source = 0;
+}
+
+static void save_client(gpointer key, gpointer value, gpointer user_data)
+{
+	GKeyFile *kf = user_data;
+	TFDSetElement *set = value;
+	TSpeechDSock *sock;
+	gchar *group = g_strdup_printf("client %u", set->uid);
+
+	save_settings(kf, group, set);
+
+	if (set->active && set->fd > 0) {
+		sock = speechd_socket_get_by_fd(set->fd);
+		if (sock != NULL) {
+			g_key_file_set_integer(kf, group, "awaiting_data",
+					       sock->awaiting_data);
+			g_key_file_set_integer(kf, group, "inside_block",
+					       sock->inside_block);
+			save_data(kf, group, "i_buf", sock->i_buf->str,
+				  sock->i_buf->len);
+			if (sock->o_buf != NULL)
+				save_data(kf, group, "o_buf", sock->o_buf->str,
+					  sock->o_bytes);
+		}
+		keep_on_exec(set->fd);
+	}
+	g_free(group);
+}
+
+/* Saves _msg_ in _group_, with what pausing it left for resuming */
+static void save_message(GKeyFile * kf, const char *group,
+			 const TSpeechDMessage * msg)
+{
+	gint *marks;
+	guint i;
+
+	g_key_file_set_int64(kf, group, "time", msg->time);
+	save_data(kf, group, "text", msg->buf, msg->bytes);
+	if (msg->unmarked != NULL && msg->marks != NULL) {
+		save_data(kf, group, "unmarked", msg->unmarked,
+			  strlen(msg->unmarked));
+		marks = g_new(gint, msg->marks->len);
+		for (i = 0; i < msg->marks->len; i++)
+			marks[i] = g_array_index(msg->marks, gsize, i);
+		g_key_file_set_integer_list(kf, group, "marks", marks,
+					    msg->marks->len);
+		g_free(marks);
+	}
+	save_settings(kf, group, &msg->settings);
+}
+
+static void save_queue(GKeyFile * kf, GList * queue, int priority)
+{
+	GList *gl;
+	TSpeechDMessage *msg;
+	gchar *group;
+
+	for (gl = g_list_first(queue); gl != NULL; gl = gl->next) {
+		msg = gl->data;
+		group = g_strdup_printf("message %u", msg->id);
+		g_key_file_set_integer(kf, group, "queue", priority);
+		save_message(kf, group, msg);
+		g_free(group);
+	}
+}
+
+/* Saves the message being spoken, reduced to what is left of it after
+   its last index mark, to be spoken first */
+static void save_interrupted(GKeyFile * kf, TSpeechDMessage * msg)
+{
+	TSpeechDMessage rest = *msg;
+	const char *mark = msg->settings.index_mark;
+	char *text = NULL, *end;
+	gchar *group;
+	int im;
+
+	if (msg->settings.type == SPD_MSGTYPE_TEXT) {
+		im = -1;
+		if (mark != NULL) {
+			im = strtol(mark + SD_MARK_BODY_LEN, &end, 10);
+			if (end == mark + SD_MARK_BODY_LEN)
+				im = -1;
+		}
+		text = index_mark_continuation(msg, im,
+					       msg->settings.ssml_mode);
+		if (text == NULL)
+			return;
+		rest.buf = text;
+		rest.bytes = strlen(text);
+		rest.unmarked = NULL;
+		rest.marks = NULL;
+		rest.settings.index_mark = NULL;
+	}
+	/* Its client got BEGIN already */
+	if (msg->begun != 0)
+		rest.settings.paused_while_speaking = 1;
+
+	group = g_strdup_printf("message %u", msg->id);
+	g_key_file_set_integer(kf, group, "queue", msg->settings.priority);
+	g_key_file_set_boolean(kf, group, "first", TRUE);
+	save_message(kf, group, &rest);
+	g_free(group);
+	g_free(text);
+	MSG(4, "Message %u will be resumed from index mark %s", msg->id,
+	    mark ? mark : "<none>");
+}
+
+static void save_history(GKeyFile * kf)
+{
+	GList *gl;
+	TSpeechDMessage *msg;
+	gchar *group;
+
+	for (gl = history_get_all(); gl != NULL; gl = gl->next) {
+		msg = gl->data;
+		group = g_strdup_printf("history %u", msg->id);
+		save_message(kf, group, msg);
+		g_free(group);
+	}
+}
+
+int handover_exec(int server_socket)
+{
+	GKeyFile *kf = g_key_file_new();
+	gchar *contents, *path, *fd_str;
+	TSpeechDMessage *interrupted;
+	gsize len;
+	int fd;
+
+	/* Only the listening socket, the clients and the state are kept */
+	close_all_on_exec();
+
+	g_key_file_set_integer(kf, "server", "socket", server_socket);
+	g_key_file_set_integer(kf, "server", "max_uid", SpeechdStatus.max_uid);
+	g_key_file_set_integer(kf, "server", "max_gid", SpeechdStatus.max_gid);
+	g_key_file_set_integer(kf, "server", "last_message_id",
+			       last_message_id);
+
+	g_hash_table_foreach(fd_settings, save_client, kf);
+
+	interrupted = speaking_get_interrupted();
+	if (interrupted != NULL)
+		save_interrupted(kf, interrupted);
+
+	/* Queue 0 holds the messages of paused clients */
+	save_queue(kf, MessageQueue->p1, 1);
+	save_queue(kf, MessageQueue->p2, 2);
+	save_queue(kf, MessageQueue->p3, 3);
+	save_queue(kf, MessageQueue->p4, 4);
+	save_queue(kf, MessageQueue->p5, 5);
+	save_queue(kf, MessagePausedList, 0);
+	save_history(kf);
+
+	contents = g_key_file_to_data(kf, &len, NULL);
+	g_key_file_free(kf);
+
+	fd = g_file_open_tmp("speechd-handover-XXXXXX", &path, NULL);
+	if (fd < 0) {
+		MSG(1, "Can't create the restart state file");
+		g_free(contents);
+		return -1;
+	}
+	unlink(path);
+	g_free(path);
+	if (write(fd, contents, len) != (ssize_t) len
+	    || lseek(fd, 0, SEEK_SET) != 0) {
+		MSG(1, "Can't write the restart state: %s", strerror(errno));
+		g_free(contents);
+		close(fd);
+		return -1;
+	}
+	g_free(contents);
+
+	keep_on_exec(fd);
+	keep_on_exec(server_socket);
+	fd_str = g_strdup_printf("%d", fd);
+	g_setenv(HANDOVER_ENV, fd_str, TRUE);
+	g_free(fd_str);
+
+	MSG(2, "Executing %s to take over %d clients", handover_program,
+	    g_hash_table_size(fd_uid));
+	fflush(NULL);
+	execv(handover_program, handover_argv);
+
+	MSG(1, "Can't execute %s: %s", handover_program, strerror(errno));
+	g_unsetenv(HANDOVER_ENV);
+	close(fd);
+	return -1;
+}
+
+static void restore_client(GKeyFile * kf, const char *group)
+{
+	TFDSetElement *set;
+	TSpeechDSock *sock;
+	unsigned int uid;
+	int fd, *p_uid;
+	guint fd_source;
+
+	uid = g_key_file_get_integer(kf, group, "uid", NULL);
+	fd = g_key_file_get_integer(kf, group, "fd", NULL);
+
+	if (g_key_file_get_integer(kf, group, "active", NULL) && fd > 0) {
+		set = speechd_connection_add(fd, uid);
+		if (set == NULL)
+			return;
+		fd_source = set->fd_source;
+		mem_free_fdset(set);
+		load_settings(kf, group, set);
+		set->fd_source = fd_source;
+
+		sock = speechd_socket_get_by_fd(fd);
+		sock->awaiting_data =
+		    g_key_file_get_integer(kf, group, "awaiting_data", NULL);
+		sock->inside_block =
+		    g_key_file_get_integer(kf, group, "inside_block", NULL);
+		g_string_free(sock->i_buf, 1);
+		sock->i_buf = load_data(kf, group, "i_buf");
+		if (sock->i_buf == NULL)
+			sock->i_buf = g_string_new("");
+		/* serve() handled all complete lines */
+		sock->i_scanned = sock->i_buf->len;
+		sock->o_buf = load_data(kf, group, "o_buf");
+		if (sock->o_buf != NULL)
+			sock->o_bytes = sock->o_buf->len;
+	} else {
+		/* Gone, but some of its messages are still queued */
+		set = g_malloc0(sizeof(TFDSetElement));
+		load_settings(kf, group, set);
+		set->fd = -1;
+		set->active = 0;
+		p_uid = g_malloc(sizeof(int));
+		*p_uid = uid;
+		g_hash_table_insert(fd_settings, p_uid, set);
+	}
+	MSG(4, "Restored client %u on fd %d", uid, set->fd);
+}
+
+static TSpeechDMessage *load_message(GKeyFile * kf, const char *group)
+{
+	TSpeechDMessage *msg;
+	GString *text;
+	gint *marks;
+	gsize n, i;
+
+	text = load_data(kf, group, "text");
+	if (text == NULL)
+		return NULL;
+
+	msg = g_malloc0(sizeof(TSpeechDMessage));
+	msg->id = atoi(strchr(group, ' ') + 1);
+	msg->time = g_key_file_get_int64(kf, group, "time", NULL);
+	msg->queued = g_get_monotonic_time();
+	msg->bytes = text->len;
+	msg->buf = g_string_free(text, FALSE);
+	load_settings(kf, group, &msg->settings);
+
+	text = load_data(kf, group, "unmarked");
+	marks = g_key_file_get_integer_list(kf, group, "marks", &n, NULL);
+	if (text != NULL && marks != NULL) {
+		msg->unmarked = g_string_free(text, FALSE);
+		msg->marks = g_array_sized_new(FALSE, FALSE, sizeof(gsize), n);
+		for (i = 0; i < n; i++) {
+			gsize offset = marks[i];
+			g_array_append_val(msg->marks, offset);
+		}
+	} else if (text != NULL) {
+		g_string_free(text, TRUE);
+	}
+	g_free(marks);
+	return msg;
+}
+
+static void restore_message(GKeyFile * kf, const char *group)
+{
+	TSpeechDMessage *msg;
+	GList **queue;
+
+	msg = load_message(kf, group);
+	if (msg == NULL)
+		return;
+
+	switch (g_key_file_get_integer(kf, group, "queue", NULL)) {
+	case 1:
+		queue = &MessageQueue->p1;
+		break;
+	case 2:
+		queue = &MessageQueue->p2;
+		break;
+	case 3:
+		queue = &MessageQueue->p3;
+		break;
+	case 4:
+		queue = &MessageQueue->p4;
+		break;
+	case 5:
+		queue = &MessageQueue->p5;
+		break;
+	default:
+		queue = &MessagePausedList;
+	}
+	if (g_key_file_get_boolean(kf, group, "first", NULL))
+		*queue = g_list_prepend(*queue, msg);
+	else
+		*queue = g_list_append(*queue, msg);
+}
+
+int handover_restore(int fd)
+{
+	GKeyFile *kf = g_key_file_new();
+	GMappedFile *map;
+	gchar **groups;
+	TSpeechDMessage *msg;
+	int server_socket, i, messages = 0;
+
+	map = g_mapped_file_new_from_fd(fd, FALSE, NULL);
+	close(fd);
+	if (map == NULL
+	    || !g_key_file_load_from_data(kf, g_mapped_file_get_contents(map),
+					  g_mapped_file_get_length(map),
+					  G_KEY_FILE_NONE, NULL)) {
+		MSG(1, "Can't read the state of the previous server");
+		if (map != NULL)
+			g_mapped_file_unref(map);
+		g_key_file_free(kf);
+		return -1;
+	}
+	g_mapped_file_unref(map);
+
+	server_socket = g_key_file_get_integer(kf, "server", "socket", NULL);
+	SpeechdStatus.max_uid =
+	    g_key_file_get_integer(kf, "server", "max_uid", NULL);
+	SpeechdStatus.max_gid =
+	    g_key_file_get_integer(kf, "server", "max_gid", NULL);
+	last_message_id =
+	    g_key_file_get_integer(kf, "server", "last_message_id", NULL);
+
+	groups = g_key_file_get_groups(kf, NULL);
+	for (i = 0; groups[i] != NULL; i++) {
+		if (g_str_has_prefix(groups[i], "client ")) {
+			restore_client(kf, groups[i]);
+		} else if (g_str_has_prefix(groups[i], "message ")) {
+			restore_message(kf, groups[i]);
+			messages++;
+		} else if (g_str_has_prefix(groups[i], "history ")) {
+			msg = load_message(kf, groups[i]);
+			if (msg != NULL)
+				history_restore_message(msg);
+		}
+	}
+	g_strfreev(groups);
+	g_key_file_free(kf);
+
+	MSG(2, "Took over %d clients and %d queued messages",
+	    g_hash_table_size(fd_uid), messages);
+	if (messages > 0)
+		speaking_semaphore_post();
+
+	return server_socket;
+}
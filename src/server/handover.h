@@ -0,0 +1,42 @@
+
+/*
+ * handover.h -- Restarting the server without dropping its clients (header)
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HANDOVER_H
+#define HANDOVER_H
+
+/* Remember how we were started, so that we can execute ourselves again.
+   Must be called before anything changes the working directory. */
+void handover_init(char **argv);
+
+/* Return the descriptor holding the state passed by the previous server
+   instance, or -1 if this is a fresh start. */
+int handover_inherited_fd(void);
+
+/* Save the listening socket, the clients with their settings and the
+   message queues, and execute the server binary again to take them over.
+   The speak thread and the output modules must be stopped already. Only
+   returns on failure. */
+int handover_exec(int server_socket);
+
+/* Take over the state saved by handover_exec() in _fd_. Returns the
+   listening socket, or -1 if the state couldn't be restored. */
+int handover_restore(int fd);
+
+#endif /* HANDOVER_H */
@@ -345,6 +345,16 @@ int history_add_message(TSpeechDMessage * msg)
 	return 0;
 }
 
+GList *history_get_all(void)
+{
+	return message_history;
+}
+
+void history_restore_message(TSpeechDMessage * msg)
+{
+	message_history = g_list_append(message_history, msg);
+}
+
 GList *get_messages_by_client(int uid)
 {
 	GList *list = NULL;
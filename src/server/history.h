@@ -40,6 +40,11 @@ char *history_say_id(int fd, int id);
 char *history_get_client_id(int fd);
 char *history_get_message(int uid);
 int history_add_message(TSpeechDMessage * msg);
+/* The messages in history, oldest first */
+GList *history_get_all(void);
+/* Append _msg_ itself to the history, when taking it over from a previous
+   server */
+void history_restore_message(TSpeechDMessage * msg);
 
 /* Internal functions */
 GList *get_messages_by_client(int uid);
@@ -30,6 +30,7 @@
 void insert_index_marks(TSpeechDMessage * msg, SPDDataMode ssml_mode)
 {
 	GString *marked_text;
+	gsize offset;
 	char *pos;
 	char character[6];
 	char character2[6];
@@ -38,16 +39,20 @@ void insert_index_marks(TSpeechDMessage * msg, SPDDataMode ssml_mode)
 	int ret;
 	int inside_tag = 0;
 
-	marked_text = g_string_new("");
-
 	assert(msg != NULL);
 	assert(msg->buf != NULL);
 
+	/* Marks make the text a bit longer, avoid reallocating it */
+	offset = strlen(msg->buf);
+	marked_text = g_string_sized_new(offset + offset / 8 + 32);
+	index_marks_free(msg);
+	msg->marks = g_array_new(FALSE, FALSE, sizeof(gsize));
+
 	MSG2(5, "index_marking", "MSG before index marking: |%s|, ssml_mode=%d",
 	     msg->buf, ssml_mode);
 
 	if (ssml_mode == SPD_DATA_TEXT)
-		g_string_printf(marked_text, "<speak>");
+		g_string_append(marked_text, "<speak>");
 
 	pos = msg->buf;
 	while (pos) {
@@ -59,25 +64,21 @@ void insert_index_marks(TSpeechDMessage * msg, SPDDataMode ssml_mode)
 		if (u_char == '<') {
 			if (ssml_mode == SPD_DATA_SSML) {
 				inside_tag = 1;
-				g_string_append_printf(marked_text, "%s",
-						       character);
+				g_string_append(marked_text, character);
 			} else
-				g_string_append_printf(marked_text, "&lt;");
+				g_string_append(marked_text, "&lt;");
 		} else if (u_char == '>') {
 			if (ssml_mode == SPD_DATA_SSML) {
 				inside_tag = 0;
-				g_string_append_printf(marked_text, "%s",
-						       character);
+				g_string_append(marked_text, character);
 			} else
-				g_string_append_printf(marked_text, "&gt;");
+				g_string_append(marked_text, "&gt;");
 		} else if (u_char == '&') {
 			if (ssml_mode == SPD_DATA_SSML) {
-				g_string_append_printf(marked_text, "%s",
-						       character);
+				g_string_append(marked_text, character);
 			} else {
 				if (!inside_tag)
-					g_string_append_printf(marked_text,
-							       "&amp;");
+					g_string_append(marked_text, "&amp;");
 			}
 		} else
 		    if (((u_char == '.') || (u_char == '?') || (u_char == '!'))
@@ -85,8 +86,7 @@ void insert_index_marks(TSpeechDMessage * msg, SPDDataMode ssml_mode)
 			pos = g_utf8_find_next_char(pos, NULL);
 			ret = spd_utf8_read_char(pos, character2);
 			if ((ret == 0) || (strlen(character2) == 0)) {
-				g_string_append_printf(marked_text, "%s",
-						       character);
+				g_string_append(marked_text, character);
 				MSG2(6, "index_marking", "MSG altering 1: |%s|",
 				     marked_text->str);
 				break;
@@ -98,28 +98,31 @@ void insert_index_marks(TSpeechDMessage * msg, SPDDataMode ssml_mode)
 						       "%s" SD_MARK_HEAD "%d"
 						       SD_MARK_TAIL,
 						       character, n);
+				/* The text after mark n starts here */
+				offset = pos - msg->buf;
+				g_array_append_val(msg->marks, offset);
 				n++;
 				MSG2(6, "index_marking", "MSG altering 2: |%s|",
 				     marked_text->str);
 				continue;
 			} else {
-				g_string_append_printf(marked_text, "%s",
-						       character);
+				g_string_append(marked_text, character);
 				MSG2(6, "index_marking", "MSG altering 3: |%s|",
 				     marked_text->str);
 				continue;
 			}
 		} else {
-			g_string_append_printf(marked_text, "%s", character);
+			g_string_append(marked_text, character);
 		}
 
 		pos = g_utf8_find_next_char(pos, NULL);
 	}
 
 	if (ssml_mode == SPD_DATA_TEXT)
-		g_string_append_printf(marked_text, "</speak>");
+		g_string_append(marked_text, "</speak>");
 
-	g_free(msg->buf);
+	/* Kept for resuming, see index_mark_continuation() */
+	msg->unmarked = msg->buf;
 	msg->buf = marked_text->str;
 
 	g_string_free(marked_text, 0);
@@ -203,3 +206,42 @@ char *strip_index_marks(char *buf, SPDDataMode ssml_mode)
 
 	return strret;
 }
+
+char *index_mark_continuation(TSpeechDMessage * msg, int mark,
+			      SPDDataMode ssml_mode)
+{
+	gsize offset;
+	char *pos;
+
+	if (msg->marks == NULL || msg->unmarked == NULL) {
+		/* Not marked by us, look for the mark in the text */
+		if (mark < 0)
+			pos = msg->buf;
+		else
+			pos = find_index_mark(msg, mark);
+		if (pos == NULL)
+			return NULL;
+		return strip_index_marks(pos, ssml_mode);
+	}
+
+	if (mark < 0)
+		return g_strdup(msg->unmarked);
+	if ((guint) mark >= msg->marks->len)
+		return NULL;
+
+	offset = g_array_index(msg->marks, gsize, mark);
+	MSG(5, "Index mark %d is at offset %lu", mark, (unsigned long)offset);
+	/* The opening tag is behind us, but the closing one is still there */
+	if (ssml_mode == SPD_DATA_SSML)
+		return g_strconcat("<speak>", msg->unmarked + offset, NULL);
+	return g_strdup(msg->unmarked + offset);
+}
+
+void index_marks_free(TSpeechDMessage * msg)
+{
+	g_free(msg->unmarked);
+	msg->unmarked = NULL;
+	if (msg->marks != NULL)
+		g_array_free(msg->marks, TRUE);
+	msg->marks = NULL;
+}
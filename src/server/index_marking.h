@@ -30,7 +30,9 @@
 #define SD_MARK_HEAD "<mark name=\""SD_MARK_BODY
 #define SD_MARK_TAIL "\"/>"
 
-/* Insert index marks into a message. */
+/* Insert index marks into a message. The text without them and the
+   offset at which each mark was inserted into it are kept in the
+   message. */
 void insert_index_marks(TSpeechDMessage * msg, SPDDataMode ssml_mode);
 
 /* Find the index mark specified as _mark_ and return the
@@ -41,4 +43,13 @@ char *find_index_mark(TSpeechDMessage * msg, int mark);
    allocated string. */
 char *strip_index_marks(char *buf, SPDDataMode ssml_mode);
 
+/* Return a newly allocated copy of the text of _msg_ following index
+   mark number _mark_ (all of it if _mark_ is negative), without index
+   marks, or NULL if there is no such mark. */
+char *index_mark_continuation(TSpeechDMessage * msg, int mark,
+			      SPDDataMode ssml_mode);
+
+/* Free what insert_index_marks() kept in _msg_ */
+void index_marks_free(TSpeechDMessage * msg);
+
 #endif /* INDEX_MARKING_H */
@@ -0,0 +1,146 @@
+
+/*
+ * latency.c -- Per-priority latency histograms of spoken messages
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Each priority and stage has a histogram of roughly logarithmic
+ * buckets in milliseconds, which is all there is to keep per message:
+ * recording is a few additions under a mutex, cheap enough to be always
+ * on. The percentiles reported are the upper bounds of the buckets they
+ * fall in, or the maximum for the last, unbounded, one.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "speechd.h"
+#include "latency.h"
+
+/* Upper bounds of the buckets in ms, the last bucket takes the rest */
+static const gint64 bucket_bounds[] = {
+	5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000
+};
+
+#define LATENCY_BUCKETS (G_N_ELEMENTS(bucket_bounds) + 1)
+
+static pthread_mutex_t latency_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+	unsigned long count;
+	gint64 sum, max;	/* In ms */
+	unsigned long buckets[LATENCY_BUCKETS];
+} latency_hist[SPD_PROGRESS + 1][LATENCY_STAGES];
+
+static const char *stage_names[LATENCY_STAGES] = {
+	"queue", "preprocess", "synthesis", "play"
+};
+
+static const char *queue_names[SPD_PROGRESS + 1] = {
+	NULL, "important", "message", "text", "notification", "progress"
+};
+
+void latency_record(int priority, ELatencyStage stage, gint64 usecs)
+{
+	gint64 ms = MAX(usecs, 0) / 1000;
+	int i;
+
+	if (priority < SPD_IMPORTANT || priority > SPD_PROGRESS)
+		return;
+
+	for (i = 0; i < G_N_ELEMENTS(bucket_bounds); i++)
+		if (ms < bucket_bounds[i])
+			break;
+
+	pthread_mutex_lock(&latency_mutex);
+	latency_hist[priority][stage].count++;
+	latency_hist[priority][stage].sum += ms;
+	latency_hist[priority][stage].max =
+	    MAX(latency_hist[priority][stage].max, ms);
+	latency_hist[priority][stage].buckets[i]++;
+	pthread_mutex_unlock(&latency_mutex);
+}
+
+/* The value below which _percent_ % of the histogram of _prio_ and
+   _stage_ falls, with latency_mutex locked */
+static gint64 latency_percentile(int prio, int stage, int percent)
+{
+	unsigned long rank, seen = 0;
+	int i;
+
+	if (latency_hist[prio][stage].count == 0)
+		return 0;
+
+	rank = (latency_hist[prio][stage].count * percent + 99) / 100;
+	for (i = 0; i < G_N_ELEMENTS(bucket_bounds); i++) {
+		seen += latency_hist[prio][stage].buckets[i];
+		if (seen >= rank)
+			return MIN(bucket_bounds[i],
+				   latency_hist[prio][stage].max);
+	}
+	return latency_hist[prio][stage].max;
+}
+
+gchar **latency_describe(void)
+{
+	GPtrArray *lines = g_ptr_array_new();
+	GString *line;
+	int prio, stage, i;
+
+	line = g_string_new("buckets");
+	for (i = 0; i < G_N_ELEMENTS(bucket_bounds); i++)
+		g_string_append_printf(line, " %ld", (long)bucket_bounds[i]);
+	g_ptr_array_add(lines, g_string_free(line, FALSE));
+
+	pthread_mutex_lock(&latency_mutex);
+	for (prio = SPD_IMPORTANT; prio <= SPD_PROGRESS; prio++)
+		for (stage = 0; stage < LATENCY_STAGES; stage++) {
+			line = g_string_new(NULL);
+			g_string_append_printf
+			    (line,
+			     "%s %s count=%lu mean=%ld p50=%ld p95=%ld max=%ld hist=",
+			     queue_names[prio], stage_names[stage],
+			     latency_hist[prio][stage].count,
+			     latency_hist[prio][stage].count ?
+			     (long)(latency_hist[prio][stage].sum /
+				    latency_hist[prio][stage].count) : 0L,
+			     (long)latency_percentile(prio, stage, 50),
+			     (long)latency_percentile(prio, stage, 95),
+			     (long)latency_hist[prio][stage].max);
+			for (i = 0; i < LATENCY_BUCKETS; i++)
+				g_string_append_printf(line, i ? ",%lu" : "%lu",
+						       latency_hist[prio]
+						       [stage].buckets[i]);
+			g_ptr_array_add(lines, g_string_free(line, FALSE));
+		}
+	pthread_mutex_unlock(&latency_mutex);
+
+	g_ptr_array_add(lines, NULL);
+	return (gchar **) g_ptr_array_free(lines, FALSE);
+}
+
+void latency_dump(void)
+{
+	gchar **lines = latency_describe();
+	int i;
+
+	for (i = 0; lines[i] != NULL; i++)
+		MSG(1, "Latency: %s", lines[i]);
+	g_strfreev(lines);
+}
@@ -0,0 +1,46 @@
+
+/*
+ * latency.h -- Per-priority latency histograms of spoken messages (header)
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <glib.h>
+
+/* The stages a message goes through, in this order */
+typedef enum {
+	LATENCY_QUEUE,		/* Queued -> taken out of the queues */
+	LATENCY_PREPROCESS,	/* Taken out -> sent to the output module */
+	LATENCY_SYNTHESIS,	/* Sent to the module -> its BEGIN */
+	LATENCY_PLAY		/* BEGIN -> END */
+} ELatencyStage;
+
+#define LATENCY_STAGES 4
+
+/* Account _usecs_ spent by a message of _priority_ in _stage_ */
+void latency_record(int priority, ELatencyStage stage, gint64 usecs);
+
+/* Describe the histograms, one item per line, for GET LATENCY. Free
+   with g_strfreev(). */
+gchar **latency_describe(void);
+
+/* Write the histograms to the log */
+void latency_dump(void);
+
+#endif /* LATENCY_H */
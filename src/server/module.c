@@ -27,6 +27,9 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <dirent.h>
@@ -37,6 +40,7 @@
 #include <spd_utils.h>
 #include "output.h"
 #include "module.h"
+#include "placement.h"
 
 static char *spd_get_path(const char *filename, const char *startdir)
 {
@@ -59,6 +63,8 @@ void destroy_module(OutputModule * module)
 	g_free(module->name);
 	g_free(module->filename);
 	g_free(module->configfilename);
+	if (module->read_buffer != NULL)
+		g_string_free(module->read_buffer, TRUE);
 	g_free(module);
 }
 
@@ -270,6 +276,139 @@ GList *detect_output_modules(const char *dirname, const char *config_dirname)
 	return modules;
 }
 
+/* Connects to the zygote listening on _path_, returns the socket or -1 */
+static int zygote_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int sock;
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/* Starts the zygote of _module_ detached from the server, so that it
+   survives it and serves the next server instance as well. */
+static void zygote_start(OutputModule * module, const char *path)
+{
+	char *argv[5] = { module->filename, "--zygote", (char *)path,
+		module->configfilename, NULL
+	};
+	pid_t pid;
+	int fd, max_fd;
+
+	pid = fork();
+	if (pid == -1)
+		return;
+	if (pid == 0) {
+		setsid();
+		if (fork() != 0)
+			_exit(0);
+
+		fd = open("/dev/null", O_RDWR);
+		dup2(fd, 0);
+		dup2(fd, 1);
+		dup2(fd, 2);
+		max_fd = sysconf(_SC_OPEN_MAX);
+		for (fd = 3; fd < max_fd; fd++)
+			close(fd);
+
+		execvp(argv[0], argv);
+		_exit(1);
+	}
+	waitpid(pid, NULL, 0);
+}
+
+/* Has the zygote of _module_ fork a module process using the given pipes
+   and log file, starting the zygote first if there is none running yet.
+   Returns the pid of the new module or -1 so that the caller falls back
+   to fork() and exec(). */
+static pid_t zygote_fork_module(OutputModule * module)
+{
+	struct stat prog_st, conf_st;
+	char *path;
+	int sock = -1, i;
+	char byte = 0;
+	int fds[3];
+	struct iovec iov = { &byte, 1 };
+	union {
+		char buf[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	pid_t pid = -1;
+
+	if (SpeechdOptions.runtime_speechd_dir == NULL
+	    || stat(module->filename, &prog_st) != 0)
+		return -1;
+	if (module->configfilename == NULL
+	    || stat(module->configfilename, &conf_st) != 0)
+		conf_st.st_mtime = 0;
+
+	/* A new binary or configuration gets a new zygote, the old one
+	   exits once it is idle */
+	path = g_strdup_printf("%s/zygote-%s-%lx-%lx",
+			       SpeechdOptions.runtime_speechd_dir, module->name,
+			       (long)prog_st.st_mtime, (long)conf_st.st_mtime);
+	if (strlen(path) >= sizeof(((struct sockaddr_un *) 0)->sun_path)) {
+		MSG(3, "Zygote socket path %s too long", path);
+		g_free(path);
+		return -1;
+	}
+
+	sock = zygote_connect(path);
+	if (sock < 0) {
+		MSG(3, "Starting the zygote of module %s", module->name);
+		zygote_start(module, path);
+		/* It only has to load its configuration */
+		for (i = 0; i < 200 && sock < 0; i++) {
+			usleep(10 * 1000);
+			sock = zygote_connect(path);
+		}
+	}
+	g_free(path);
+	if (sock < 0) {
+		MSG(2, "Can't reach the zygote of module %s", module->name);
+		return -1;
+	}
+
+	fds[0] = module->pipe_in[0];
+	fds[1] = module->pipe_out[1];
+	fds[2] = module->stderr_redirect >= 0 ? module->stderr_redirect : 2;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	if (sendmsg(sock, &msg, MSG_NOSIGNAL) != 1
+	    || read(sock, &pid, sizeof(pid)) != sizeof(pid))
+		pid = -1;
+	close(sock);
+
+	if (pid <= 0) {
+		MSG(2, "The zygote of module %s failed to fork it",
+		    module->name);
+		return -1;
+	}
+	return pid;
+}
+
 OutputModule *load_output_module(char *mod_name, char *mod_prog,
 				 char *mod_cfgfile, char *mod_dbgfile)
 {
@@ -283,11 +422,14 @@ OutputModule *load_output_module(char *mod_name, char *mod_prog,
 	size_t n = 0;
 	char s;
 	GString *reply;
+	TPlacementPlan placement;
 
 	if (mod_name == NULL)
 		return NULL;
 
 	module = (OutputModule *) g_malloc(sizeof(OutputModule));
+	module->read_buffer = NULL;
+	module->read_pos = 0;
 
 	module->name = (char *)g_strdup(mod_name);
 	module->filename = (char *)spd_get_path(mod_prog, SpeechdOptions.module_dir);
@@ -304,6 +446,8 @@ OutputModule *load_output_module(char *mod_name, char *mod_prog,
 	else
 		module->debugfilename = NULL;
 
+	module->zygote_child = 0;
+
 	if (!strcmp(mod_name, "testing")) {
 		module->pipe_in[1] = 1;	/* redirect to stdin */
 		module->pipe_out[0] = 0;	/* redirect to stdout */
@@ -345,9 +489,25 @@ OutputModule *load_output_module(char *mod_name, char *mod_prog,
 		MSG(3,
 		    "Output module is logging to standard error output (stderr)");
 
+	placement_plan_module(module->name, &placement);
+
+	if (SpeechdOptions.module_zygote) {
+		fr = zygote_fork_module(module);
+		if (fr > 0) {
+			module->zygote_child = 1;
+			MSG(3, "Module %s forked by its zygote as pid %d",
+			    module->name, fr);
+			if (placement_plan_apply_pid(&placement, fr) != 0)
+				MSG(2, "Can't apply the configured placement of module %s: %s",
+				    module->name, strerror(errno));
+			goto forked;
+		}
+	}
+
 	fr = fork();
 	if (fr == -1) {
 		printf("Can't fork, error! Module not loaded.");
+		placement_plan_release(&placement);
 		return NULL;
 	}
 
@@ -365,6 +525,10 @@ OutputModule *load_output_module(char *mod_name, char *mod_prog,
 			ret = dup2(module->stderr_redirect, 2);
 		}
 
+		if (placement_plan_apply(&placement) != 0)
+			MSG(2, "Can't apply the configured placement of module %s: %s",
+			    module->name, strerror(errno));
+
 		execvp(argv[0], argv);
 		MSG(1,
 		    "Exec of module \"%s\" with config \"%s\" failed with error %d: %s",
@@ -373,13 +537,19 @@ OutputModule *load_output_module(char *mod_name, char *mod_prog,
 		exit(1);
 	}
 
+forked:
 	module->pid = fr;
+	placement_plan_release(&placement);
 	close(module->pipe_in[0]);
 	close(module->pipe_out[1]);
 
-	usleep(100);		/* So that the other child has at least time to fail
+	if (module->zygote_child)
+		ret = 0;	/* Already running the module code */
+	else {
+		usleep(100);	/* So that the other child has at least time to fail
 				   with the execlp */
-	ret = waitpid(module->pid, NULL, WNOHANG);
+		ret = waitpid(module->pid, NULL, WNOHANG);
+	}
 	if (ret != 0) {
 		MSG(2,
 		    "ERROR: Can't load output module %s with binary %s. Bad filename in configuration?",
@@ -391,15 +561,9 @@ OutputModule *load_output_module(char *mod_name, char *mod_prog,
 	module->working = 1;
 	MSG(2, "Module %s loaded.", module->name);
 
-	/* Create a stream from the socket */
-	module->stream_out = fdopen(module->pipe_out[0], "r");
-	if (!module->stream_out)
-		FATAL("Can't create a stream for socket, fdopen() failed.");
-
-	/* Switch to line buffering mode */
-	ret = setvbuf(module->stream_out, NULL, _IONBF, 4096);
-	if (ret)
-		FATAL("Can't set line buffering, setvbuf failed.");
+	/* What the module sends is read in blocks, see output_read_line() */
+	module->read_buffer = g_string_sized_new(OUTPUT_READ_BLOCK);
+	module->read_pos = 0;
 
 	MSG(4, "Trying to initialize %s.", module->name);
 	if (output_send_data("INIT\n", module, 0) != 0) {
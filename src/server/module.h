@@ -33,9 +33,11 @@ typedef struct {
 	char *debugfilename;
 	int pipe_in[2];
 	int pipe_out[2];
-	FILE *stream_out;
+	GString *read_buffer;	/* Read from pipe_out[0], not handled yet */
+	gsize read_pos;		/* Where what is not handled yet starts */
 	int stderr_redirect;
 	pid_t pid;
+	int zygote_child;	/* Forked by its zygote, not our child */
 	int working;
 } OutputModule;
 
@@ -86,6 +86,8 @@
 
 #define OK_PITCH_RANGE_SET				"263 OK PITCH RANGE SET" NEWLINE
 
+#define OK_OVERLOAD_SET					"264 OK OVERLOAD SET" NEWLINE
+
 #define OK_NOT_IMPLEMENTED				"299 OK BUT NOT IMPLEMENTED -- DOES NOTHING" NEWLINE
 
 #define ERR_NO_CLIENT					"401 ERR NO CLIENT" NEWLINE
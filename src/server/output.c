@@ -28,6 +28,7 @@
 #include <spd_utils.h>
 #include "output.h"
 #include "parse.h"
+#include "sem_functions.h"
 
 #ifndef HAVE_STRNDUP
 /*
@@ -161,12 +162,66 @@ static output_unlock(void)
 	{  output_unlock(); \
 		return (value); }
 
+/* Returns the next line the module sent, newline included, newly
+   allocated, or NULL if the pipe broke. The module output is read in
+   blocks into its read_buffer, so that the events it sent together are
+   read with one syscall and handled one after the other from there. */
+static char *output_read_line(OutputModule * output)
+{
+	GString *buf = output->read_buffer;
+	char block[OUTPUT_READ_BLOCK];
+	char *start, *nl;
+	char *line;
+	ssize_t bytes;
+
+	while ((nl = memchr(buf->str + output->read_pos, '\n',
+			    buf->len - output->read_pos)) == NULL) {
+		if (output->read_pos > 0) {
+			g_string_erase(buf, 0, output->read_pos);
+			output->read_pos = 0;
+		}
+		bytes = safe_read(output->pipe_out[0], block, sizeof(block));
+		if (bytes <= 0)
+			return NULL;
+		g_string_append_len(buf, block, bytes);
+	}
+
+	start = buf->str + output->read_pos;
+	line = g_strndup(start, nl + 1 - start);
+	output->read_pos = nl + 1 - buf->str;
+	if (output->read_pos == buf->len) {
+		g_string_truncate(buf, 0);
+		output->read_pos = 0;
+	}
+	return line;
+}
+
+static int output_has_buffered_line(OutputModule * output)
+{
+	return output->read_buffer != NULL
+	    && memchr(output->read_buffer->str + output->read_pos, '\n',
+		      output->read_buffer->len - output->read_pos) != NULL;
+}
+
+/* Whether the module sent lines which were read already but not handled
+   yet. The speak thread only polls the module pipe, so it has to check
+   this too. */
+int output_module_has_buffered_reply(OutputModule * output)
+{
+	int ret;
+
+	if (output == NULL)
+		return 0;
+	output_lock();
+	ret = output_has_buffered_line(output);
+	output_unlock();
+	return ret;
+}
+
 GString *output_read_reply(OutputModule * output)
 {
 	GString *rstr;
-	int bytes;
 	char *line = NULL;
-	size_t N = 0;
 	gboolean errors = FALSE;
 
 	rstr = g_string_new("");
@@ -174,27 +229,31 @@ GString *output_read_reply(OutputModule * output)
 	/* Wait for activity on the socket, when there is some,
 	   read all the message line by line */
 	do {
-		bytes = spd_getline(&line, &N, output->stream_out);
-		if (bytes == -1) {
+		g_free(line);
+		line = output_read_line(output);
+		if (line == NULL) {
 			MSG(2, "Error: Broken pipe to module.");
 			output->working = 0;
 			speaking_module = NULL;
 			output_check_module(output);
 			errors = TRUE;	/* Broken pipe */
 		} else {
-			MSG(5, "Got %d bytes from output module over socket",
-			    bytes);
+			MSG(5, "Got %ld bytes from output module over socket",
+			    (long)strlen(line));
 			g_string_append(rstr, line);
 		}
 		/* terminate if we reached the last line (without '-' after numcode) */
 	} while (!errors && !((strlen(line) < 4) || (line[3] == ' ')));
 
-	if (line != NULL)
-		g_free(line);
+	g_free(line);
 
 	if (errors) {
 		g_string_free(rstr, TRUE);
 		rstr = NULL;
+	} else if (output_has_buffered_line(output)) {
+		/* Events came along with the reply, have the speak thread
+		   handle them, it will not see them by polling */
+		speaking_semaphore_post();
 	}
 
 	return rstr;
@@ -739,7 +798,8 @@ int output_is_speaking(char **index_mark)
 
 /* Wait until the child _pid_ returns with timeout. Calls waitpid() each 100ms
  until timeout is exceeded. This is not exact and you should not rely on the
- exact time waited. */
+ exact time waited. Modules forked by a zygote are not our children, for
+ them we can only check that the process is gone. */
 int
 waitpid_with_timeout(pid_t pid, int *status_ptr, int options, size_t timeout)
 {
@@ -749,7 +809,10 @@ waitpid_with_timeout(pid_t pid, int *status_ptr, int options, size_t timeout)
 		ret = waitpid(pid, status_ptr, options | WNOHANG);
 		if (ret > 0)
 			return ret;
-		if (ret < 0)
+		if (ret < 0 && errno == ECHILD) {
+			if (kill(pid, 0) != 0 && errno == ESRCH)
+				return pid;
+		} else if (ret < 0)
 			return ret;
 		usleep(100 * 1000);	/* Sleep 100 ms */
 	}
@@ -805,11 +868,58 @@ int output_close(OutputModule * module)
 #undef SEND_CMD
 #undef SEND_DATA
 
+/* Start a dead module again in place, so that the OutputModule pointers
+   held in output_modules and elsewhere stay valid */
+int output_respawn(OutputModule * module)
+{
+	OutputModule *new_module;
+
+	assert(module != NULL);
+	if (module->working)
+		return 0;
+
+	MSG(3, "Restarting output module %s", module->name);
+	new_module = load_output_module(module->name, module->filename,
+					module->configfilename,
+					module->debugfilename);
+	if (new_module == NULL)
+		return -1;
+
+	/* Reap the dead process */
+	output_close(module);
+
+	output_lock();
+	close(module->pipe_in[1]);
+	close(module->pipe_out[0]);
+	if (module->stderr_redirect >= 0)
+		close(module->stderr_redirect);
+
+	module->pipe_in[0] = new_module->pipe_in[0];
+	module->pipe_in[1] = new_module->pipe_in[1];
+	module->pipe_out[0] = new_module->pipe_out[0];
+	module->pipe_out[1] = new_module->pipe_out[1];
+	/* What the dead one sent is of no use any more */
+	if (module->read_buffer != NULL)
+		g_string_free(module->read_buffer, TRUE);
+	module->read_buffer = new_module->read_buffer;
+	module->read_pos = new_module->read_pos;
+	new_module->read_buffer = NULL;
+	module->stderr_redirect = new_module->stderr_redirect;
+	module->pid = new_module->pid;
+	module->zygote_child = new_module->zygote_child;
+	module->working = new_module->working;
+	output_unlock();
+
+	g_free(new_module->debugfilename);
+	destroy_module(new_module);
+	return 0;
+}
+
 int output_check_module(OutputModule * output)
 {
 	int ret;
 	int err;
-	int status;
+	int status = 0;
 
 	if (output == NULL)
 		return -1;
@@ -820,7 +930,8 @@ int output_check_module(OutputModule * output)
 	if (output->working == 0) {
 		/* Investigate on why it crashed */
 		ret = waitpid(output->pid, &status, WNOHANG);
-		if (ret == 0) {
+		if (ret == 0 || (ret < 0 && errno == ECHILD
+				 && kill(output->pid, 0) == 0)) {
 			MSG(2, "Output module not running.");
 			return 0;
 		}
@@ -31,11 +31,16 @@ int output_is_speaking(char **index_mark);
 int output_send_debug(OutputModule * output, int flag, char *logfile_path);
 
 int output_check_module(OutputModule * output);
+int output_respawn(OutputModule * module);
 
 char *escape_dot(char *otext);
 
+/* Size of the blocks read from modules */
+#define OUTPUT_READ_BLOCK 4096
+
 void output_set_speaking_monitor(TSpeechDMessage * msg, OutputModule * output);
 GString *output_read_reply(OutputModule * output);
+int output_module_has_buffered_reply(OutputModule * output);
 int output_send_data(char *cmd, OutputModule * output, int wfr);
 int output_send_settings(TSpeechDMessage * msg, OutputModule * output);
 int output_send_audio_settings(OutputModule * output);
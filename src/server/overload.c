@@ -0,0 +1,177 @@
+
+/*
+ * overload.c -- Degrading message processing when the queues grow
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The load is the number of queued messages relative to
+ * OverloadQueueLength, or the time the oldest of them has been waiting
+ * relative to OverloadQueueDelay, whichever is higher. Step n of
+ * EOverloadStep switches on when the load reaches n, and off again only
+ * when it drops below n - 0.5, so that the steps don't flap.  With
+ * SET ALL OVERLOAD OFF the load is still measured but taken as 0.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "speechd.h"
+#include "overload.h"
+#include "sem_functions.h"
+
+static pthread_mutex_t overload_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int overload_enabled = 1;
+static int overload_level;
+static double overload_load;
+
+static struct {
+	unsigned long activations;	/* Times it was switched on */
+	unsigned long applied;	/* Messages it was applied to */
+} overload_steps[OVERLOAD_STEPS + 1];
+
+static struct {
+	unsigned int depth, max_depth;
+	gint64 wait, max_wait;	/* Of the oldest message, in ms */
+} overload_queues[SPD_PROGRESS + 1];
+
+static const char *step_names[OVERLOAD_STEPS + 1] = {
+	NULL, "symbols", "collapse_notifications", "index_marks"
+};
+
+static const char *queue_names[SPD_PROGRESS + 1] = {
+	NULL, "important", "message", "text", "notification", "progress"
+};
+
+void overload_update(void)
+{
+	gint64 now = g_get_monotonic_time();
+	gint64 oldest = 0;
+	unsigned int total = 0;
+	double load = 0;
+	GList *queue;
+	TSpeechDMessage *msg;
+	int prio, level;
+
+	check_locked(&element_free_mutex);
+	pthread_mutex_lock(&overload_mutex);
+
+	for (prio = SPD_IMPORTANT; prio <= SPD_PROGRESS; prio++) {
+		queue = speaking_get_queue(prio);
+		overload_queues[prio].depth = g_list_length(queue);
+		overload_queues[prio].wait = 0;
+		if (queue != NULL) {
+			/* Messages are appended, the first one waits longest */
+			msg = queue->data;
+			overload_queues[prio].wait = (now - msg->queued) / 1000;
+		}
+		overload_queues[prio].max_depth =
+		    MAX(overload_queues[prio].max_depth,
+			overload_queues[prio].depth);
+		overload_queues[prio].max_wait =
+		    MAX(overload_queues[prio].max_wait,
+			overload_queues[prio].wait);
+		total += overload_queues[prio].depth;
+		oldest = MAX(oldest, overload_queues[prio].wait);
+	}
+
+	if (SpeechdOptions.overload_queue_length > 0)
+		load = MAX(load,
+			   (double)total / SpeechdOptions.overload_queue_length);
+	if (SpeechdOptions.overload_queue_delay > 0)
+		load = MAX(load,
+			   (double)oldest / SpeechdOptions.overload_queue_delay);
+	overload_load = load;
+	if (!overload_enabled)
+		load = 0;
+
+	level = overload_level;
+	while (level < OVERLOAD_STEPS && load >= level + 1) {
+		level++;
+		overload_steps[level].activations++;
+		MSG(2, "Overload: %s step on (load %.2f, %u queued, oldest %ld ms)",
+		    step_names[level], load, total, (long)oldest);
+	}
+	while (level > 0 && load < level - 0.5) {
+		MSG(2, "Overload: %s step off (load %.2f)", step_names[level],
+		    load);
+		level--;
+	}
+	overload_level = level;
+
+	pthread_mutex_unlock(&overload_mutex);
+}
+
+void overload_set_enabled(int enabled)
+{
+	pthread_mutex_lock(&overload_mutex);
+	overload_enabled = enabled;
+	pthread_mutex_unlock(&overload_mutex);
+	MSG(3, "Overload degradation %s", enabled ? "enabled" : "disabled");
+	/* Let the speak thread switch the steps off */
+	speaking_semaphore_post();
+}
+
+int overload_active(EOverloadStep step)
+{
+	int ret;
+
+	pthread_mutex_lock(&overload_mutex);
+	ret = overload_level >= step;
+	pthread_mutex_unlock(&overload_mutex);
+	return ret;
+}
+
+void overload_count(EOverloadStep step, int n)
+{
+	pthread_mutex_lock(&overload_mutex);
+	overload_steps[step].applied += n;
+	pthread_mutex_unlock(&overload_mutex);
+}
+
+gchar **overload_describe(void)
+{
+	GPtrArray *lines = g_ptr_array_new();
+	int i;
+
+	pthread_mutex_lock(&overload_mutex);
+	g_ptr_array_add(lines,
+			g_strdup_printf("state level=%d load=%.2f degradation=%s",
+					overload_level, overload_load,
+					overload_enabled ? "on" : "off"));
+	for (i = 1; i <= OVERLOAD_STEPS; i++)
+		g_ptr_array_add(lines,
+				g_strdup_printf
+				("step %s %s activations=%lu applied=%lu",
+				 step_names[i], overload_level >= i ? "on" : "off",
+				 overload_steps[i].activations,
+				 overload_steps[i].applied));
+	for (i = SPD_IMPORTANT; i <= SPD_PROGRESS; i++)
+		g_ptr_array_add(lines,
+				g_strdup_printf
+				("queue %s depth=%u max_depth=%u wait=%ld max_wait=%ld",
+				 queue_names[i], overload_queues[i].depth,
+				 overload_queues[i].max_depth,
+				 (long)overload_queues[i].wait,
+				 (long)overload_queues[i].max_wait));
+	pthread_mutex_unlock(&overload_mutex);
+
+	g_ptr_array_add(lines, NULL);
+	return (gchar **) g_ptr_array_free(lines, FALSE);
+}
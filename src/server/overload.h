@@ -0,0 +1,56 @@
+
+/*
+ * overload.h -- Degrading message processing when the queues grow (header)
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OVERLOAD_H
+#define OVERLOAD_H
+
+#include <glib.h>
+
+/* Degradation steps, switched on in this order as the load grows */
+typedef enum {
+	OVERLOAD_SKIP_SYMBOLS = 1,	/* No symbols preprocessing of PROGRESS
+					   and NOTIFICATION messages */
+	OVERLOAD_COLLAPSE_NOTIFICATIONS = 2,	/* Only the newest NOTIFICATION
+						   is kept, even within blocks */
+	OVERLOAD_SKIP_INDEX_MARKS = 3	/* No index marks inserted into PROGRESS
+					   and NOTIFICATION messages */
+} EOverloadStep;
+
+#define OVERLOAD_STEPS 3
+
+/* Measure the queues and switch the degradation steps accordingly.
+   Called by the speak thread with element_free_mutex locked. */
+void overload_update(void);
+
+/* Let the degradation steps switch on, or keep them off whatever the
+   load, for SET ALL OVERLOAD */
+void overload_set_enabled(int enabled);
+
+/* Whether degradation _step_ is currently on */
+int overload_active(EOverloadStep step);
+
+/* Count _n_ messages _step_ was applied to */
+void overload_count(EOverloadStep step, int n);
+
+/* Describe the state, steps and queues, one item per line, for
+   GET OVERLOAD. Free with g_strfreev(). */
+gchar **overload_describe(void);
+
+#endif /* OVERLOAD_H */
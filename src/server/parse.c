@@ -34,6 +34,9 @@
 #include "sem_functions.h"
 #include "output.h"
 #include "fdsetconv.h"
+#include "placement.h"
+#include "overload.h"
+#include "latency.h"
 
 /*
   Parse() receives input data and parses them. It can
@@ -177,7 +180,7 @@ enddata:
 
 			new =
 			    (TSpeechDMessage *)
-			    g_malloc(sizeof(TSpeechDMessage));
+			    g_malloc0(sizeof(TSpeechDMessage));
 			new->bytes = speechd_socket->o_bytes;
 			assert(speechd_socket->o_buf != NULL);
 			new->buf =
@@ -641,6 +644,25 @@ char *parse_set(const char *buf, const int bytes, const int fd,
 		if (ret)
 			return g_strdup(ERR_COULDNT_SET_CAP_LET_RECOG);
 		return g_strdup(OK_CAP_LET_RECOGN_SET);
+	} else if (TEST_CMD(set_sub, "overload")) {
+		char *helper_s;
+		int overload;
+
+		/* The degradation is server wide */
+		if (who != 2)
+			return g_strdup(ERR_PARAMETER_INVALID);
+		GET_PARAM_STR(helper_s, 3, CONV_DOWN);
+		if (TEST_CMD(helper_s, "on"))
+			overload = 1;
+		else if (TEST_CMD(helper_s, "off"))
+			overload = 0;
+		else {
+			g_free(helper_s);
+			return g_strdup(ERR_PARAMETER_NOT_ON_OFF);
+		}
+		g_free(helper_s);
+		overload_set_enabled(overload);
+		return g_strdup(OK_OVERLOAD_SET);
 	} else if (TEST_CMD(set_sub, "pause_context")) {
 		int pause_context;
 		GET_PARAM_INT(pause_context, 3);
@@ -868,7 +890,7 @@ char *parse_general_event(const char *buf, const int bytes, const int fd,
 		return g_strdup(ERR_INVALID_ENCODING);
 	}
 
-	msg = (TSpeechDMessage *) g_malloc(sizeof(TSpeechDMessage));
+	msg = (TSpeechDMessage *) g_malloc0(sizeof(TSpeechDMessage));
 	msg->bytes = strlen(param);
 	msg->buf = g_strdup(param);
 
@@ -1060,6 +1082,44 @@ char *parse_get(const char *buf, const int bytes, const int fd,
 		g_string_append_printf(result, C_OK_GET "-%s" NEWLINE OK_GET,
 				       punct);
 		g_free(punct);
+	} else if (TEST_CMD(get_type, "placement")) {
+		OutputModule *mod;
+		GList *l;
+
+		helper = placement_describe(0);
+		g_string_append_printf(result, C_OK_GET "-speak_thread %s" NEWLINE,
+				       helper);
+		g_free(helper);
+		for (l = output_modules; l != NULL; l = l->next) {
+			mod = l->data;
+			/* The testing module talks on our own stdio */
+			if (!strcmp(mod->name, "testing") || !mod->working)
+				continue;
+			helper = placement_describe(mod->pid);
+			g_string_append_printf(result,
+					       C_OK_GET "-%s pid=%d %s" NEWLINE,
+					       mod->name, (int)mod->pid, helper);
+			g_free(helper);
+		}
+		g_string_append(result, OK_GET);
+	} else if (TEST_CMD(get_type, "overload")) {
+		gchar **lines = overload_describe();
+		int i;
+
+		for (i = 0; lines[i] != NULL; i++)
+			g_string_append_printf(result, C_OK_GET "-%s" NEWLINE,
+					       lines[i]);
+		g_strfreev(lines);
+		g_string_append(result, OK_GET);
+	} else if (TEST_CMD(get_type, "latency")) {
+		gchar **lines = latency_describe();
+		int i;
+
+		for (i = 0; lines[i] != NULL; i++)
+			g_string_append_printf(result, C_OK_GET "-%s" NEWLINE,
+					       lines[i]);
+		g_strfreev(lines);
+		g_string_append(result, OK_GET);
 	} else {
 		g_free(get_type);
 		g_string_append(result, ERR_PARAMETER_INVALID);
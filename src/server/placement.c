@@ -0,0 +1,312 @@
+
+/*
+ * placement.c -- CPU affinity, nice level and cgroup placement of
+ *                output modules and the speak thread
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "speechd.h"
+#include "placement.h"
+
+TPlacement module_placement_default;
+TPlacement speak_thread_placement;
+
+static GHashTable *module_placements;
+static pid_t speak_thread_tid;
+
+TPlacement *placement_get_module(const char *name, int create)
+{
+	TPlacement *placement;
+
+	if (name == NULL)
+		return &module_placement_default;
+
+	if (module_placements == NULL) {
+		if (!create)
+			return NULL;
+		module_placements =
+		    g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					  g_free);
+	}
+
+	placement = g_hash_table_lookup(module_placements, name);
+	if (placement == NULL && create) {
+		placement = g_malloc0(sizeof(TPlacement));
+		g_hash_table_insert(module_placements, g_strdup(name),
+				    placement);
+	}
+	return placement;
+}
+
+int placement_parse_cpus(const char *list, cpu_set_t * set)
+{
+	const char *p = list;
+	char *end;
+	long first, last, cpu;
+
+	CPU_ZERO(set);
+	while (*p) {
+		first = strtol(p, &end, 10);
+		if (end == p || first < 0)
+			return -1;
+		last = first;
+		p = end;
+		if (*p == '-') {
+			p++;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first)
+				return -1;
+			p = end;
+		}
+		if (last >= CPU_SETSIZE)
+			return -1;
+		for (cpu = first; cpu <= last; cpu++)
+			CPU_SET(cpu, set);
+		if (*p == ',')
+			p++;
+		else if (*p != '\0')
+			return -1;
+	}
+	return CPU_COUNT(set) ? 0 : -1;
+}
+
+static int write_cgroup_file(const char *dir, const char *file,
+			     const char *value)
+{
+	char *path = g_strdup_printf("%s/%s", dir, file);
+	int fd, ret = 0;
+
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0 || write(fd, value, strlen(value)) < 0) {
+		MSG(2, "Can't write %s to %s: %s", value, path,
+		    strerror(errno));
+		ret = -1;
+	}
+	if (fd >= 0)
+		close(fd);
+	g_free(path);
+	return ret;
+}
+
+static int open_module_cgroup(const char *parent, const char *name,
+			      int cpu_weight, const char *memory_max)
+{
+	char *dir = g_strdup_printf("%s/%s", parent, name);
+	char *path;
+	int fd;
+
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		MSG(2, "Can't create cgroup %s for module %s: %s", dir, name,
+		    strerror(errno));
+		g_free(dir);
+		return -1;
+	}
+
+	if (cpu_weight > 0) {
+		char *value = g_strdup_printf("%d", cpu_weight);
+		write_cgroup_file(dir, "cpu.weight", value);
+		g_free(value);
+	}
+	if (memory_max != NULL)
+		write_cgroup_file(dir, "memory.max", memory_max);
+
+	path = g_strdup_printf("%s/cgroup.procs", dir);
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		MSG(2, "Can't open %s: %s", path, strerror(errno));
+	g_free(path);
+	g_free(dir);
+	return fd;
+}
+
+void placement_plan_module(const char *name, TPlacementPlan * plan)
+{
+	TPlacement *own = placement_get_module(name, 0);
+	TPlacement *def = &module_placement_default;
+	const char *cpus, *cgroup, *memory_max;
+	int cpu_weight;
+
+	memset(plan, 0, sizeof(*plan));
+	plan->cgroup_procs_fd = -1;
+
+#define PICK(field) (own && own->field ? own->field : def->field)
+	cpus = PICK(cpus);
+	cgroup = PICK(cgroup);
+	cpu_weight = PICK(cpu_weight);
+	memory_max = PICK(memory_max);
+#undef PICK
+
+	if (own && own->nice_set) {
+		plan->nice_set = 1;
+		plan->nice = own->nice;
+	} else if (def->nice_set) {
+		plan->nice_set = 1;
+		plan->nice = def->nice;
+	}
+
+	if (cpus != NULL) {
+		if (placement_parse_cpus(cpus, &plan->cpus) == 0)
+			plan->cpus_set = 1;
+		else
+			MSG(2, "Invalid CPU list \"%s\" for module %s", cpus,
+			    name);
+	}
+
+	if (cgroup != NULL)
+		plan->cgroup_procs_fd =
+		    open_module_cgroup(cgroup, name, cpu_weight, memory_max);
+}
+
+int placement_plan_apply(const TPlacementPlan * plan)
+{
+	int ret = 0;
+
+	if (plan->cgroup_procs_fd >= 0
+	    && write(plan->cgroup_procs_fd, "0", 1) != 1)
+		ret = -1;
+	if (plan->cpus_set
+	    && sched_setaffinity(0, sizeof(plan->cpus), &plan->cpus) != 0)
+		ret = -1;
+	/* Linux keeps the nice value per thread */
+	if (plan->nice_set
+	    && setpriority(PRIO_PROCESS, syscall(SYS_gettid), plan->nice) != 0)
+		ret = -1;
+	return ret;
+}
+
+int placement_plan_apply_pid(const TPlacementPlan * plan, pid_t pid)
+{
+	char buf[16];
+	int ret = 0;
+
+	if (plan->cgroup_procs_fd >= 0) {
+		snprintf(buf, sizeof(buf), "%d", (int)pid);
+		if (write(plan->cgroup_procs_fd, buf, strlen(buf)) < 0)
+			ret = -1;
+	}
+	if (plan->cpus_set
+	    && sched_setaffinity(pid, sizeof(plan->cpus), &plan->cpus) != 0)
+		ret = -1;
+	/* The process is still single-threaded, its threads inherit this */
+	if (plan->nice_set && setpriority(PRIO_PROCESS, pid, plan->nice) != 0)
+		ret = -1;
+	return ret;
+}
+
+void placement_plan_release(TPlacementPlan * plan)
+{
+	if (plan->cgroup_procs_fd >= 0)
+		close(plan->cgroup_procs_fd);
+	plan->cgroup_procs_fd = -1;
+}
+
+void placement_apply_speak_thread(void)
+{
+	TPlacementPlan plan;
+
+	speak_thread_tid = syscall(SYS_gettid);
+
+	memset(&plan, 0, sizeof(plan));
+	plan.cgroup_procs_fd = -1;
+	if (speak_thread_placement.cpus != NULL) {
+		if (placement_parse_cpus(speak_thread_placement.cpus,
+					 &plan.cpus) == 0)
+			plan.cpus_set = 1;
+		else
+			MSG(2, "Invalid CPU list \"%s\" for the speak thread",
+			    speak_thread_placement.cpus);
+	}
+	plan.nice_set = speak_thread_placement.nice_set;
+	plan.nice = speak_thread_placement.nice;
+
+	if (placement_plan_apply(&plan) != 0)
+		MSG(2, "Can't apply the configured speak thread placement: %s",
+		    strerror(errno));
+}
+
+static void describe_cpus(GString * str, const cpu_set_t * set)
+{
+	int cpu, first = -1, sep = 0;
+
+	for (cpu = 0; cpu <= CPU_SETSIZE; cpu++) {
+		if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, set)) {
+			if (first < 0)
+				first = cpu;
+			continue;
+		}
+		if (first < 0)
+			continue;
+		g_string_append_printf(str, "%s%d", sep ? "," : "", first);
+		if (cpu - 1 > first)
+			g_string_append_printf(str, "-%d", cpu - 1);
+		sep = 1;
+		first = -1;
+	}
+}
+
+char *placement_describe(pid_t tid)
+{
+	GString *str = g_string_new("");
+	cpu_set_t set;
+	char *path, *contents, *line;
+	int nice;
+
+	if (tid == 0)
+		tid = speak_thread_tid;
+
+	g_string_append(str, "cpus=");
+	if (tid > 0 && sched_getaffinity(tid, sizeof(set), &set) == 0)
+		describe_cpus(str, &set);
+	else
+		g_string_append(str, "unknown");
+
+	errno = 0;
+	nice = getpriority(PRIO_PROCESS, tid);
+	if (tid > 0 && errno == 0)
+		g_string_append_printf(str, " nice=%d", nice);
+	else
+		g_string_append(str, " nice=unknown");
+
+	/* The unified hierarchy is the "0::" line */
+	path = g_strdup_printf("/proc/%d/cgroup", (int)tid);
+	if (tid > 0 && g_file_get_contents(path, &contents, NULL, NULL)) {
+		line = strstr(contents, "0::");
+		if (line != NULL && (line == contents || line[-1] == '\n')) {
+			line += 3;
+			line[strcspn(line, "\n")] = '\0';
+			g_string_append_printf(str, " cgroup=%s", line);
+		}
+		g_free(contents);
+	}
+	g_free(path);
+
+	return g_string_free(str, FALSE);
+}
@@ -0,0 +1,82 @@
+
+/*
+ * placement.h -- CPU affinity, nice level and cgroup placement of
+ *                output modules and the speak thread (header)
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <sched.h>
+#include <sys/types.h>
+
+/* Placement as configured in speechd.conf. Unset values are inherited
+   from the default placement, and then from the server itself. */
+typedef struct {
+	char *cpus;		/* CPU list such as "2-3,6", NULL if unset */
+	int nice;
+	int nice_set;
+	char *cgroup;		/* cgroup v2 directory to create modules in */
+	int cpu_weight;		/* cpu.weight of the module cgroup, 0 if unset */
+	char *memory_max;	/* memory.max of the module cgroup, NULL if unset */
+} TPlacement;
+
+/* Placement resolved before fork(), so that the child only has to
+   issue system calls before it executes the module binary. */
+typedef struct {
+	int cpus_set;
+	cpu_set_t cpus;
+	int nice_set;
+	int nice;
+	int cgroup_procs_fd;	/* cgroup.procs of the module cgroup or -1 */
+} TPlacementPlan;
+
+/* Placement of all modules and of the speak thread */
+extern TPlacement module_placement_default;
+extern TPlacement speak_thread_placement;
+
+/* Return the placement configured for module _name_, creating an empty
+   one if _create_ is set. NULL _name_ returns the default placement. */
+TPlacement *placement_get_module(const char *name, int create);
+
+/* Parse a CPU list such as "0-3,6" into _set_. Returns 0 on success. */
+int placement_parse_cpus(const char *list, cpu_set_t * set);
+
+/* Resolve the placement of module _name_ into _plan_, creating and
+   configuring its cgroup if one is configured. */
+void placement_plan_module(const char *name, TPlacementPlan * plan);
+
+/* Apply _plan_ to the calling thread (and its cgroup to the calling
+   process). Only issues system calls, so it is safe after fork(). */
+int placement_plan_apply(const TPlacementPlan * plan);
+
+/* Apply _plan_ to the single-threaded process _pid_, for modules forked by
+   their zygote rather than by the server. */
+int placement_plan_apply_pid(const TPlacementPlan * plan, pid_t pid);
+
+void placement_plan_release(TPlacementPlan * plan);
+
+/* Apply the configured placement to the calling speak thread. */
+void placement_apply_speak_thread(void);
+
+/* Describe the effective placement of thread or process _tid_ in the
+   form "cpus=0-3 nice=5 cgroup=/speech-dispatcher/espeak-ng".
+   Passing 0 describes the speak thread. */
+char *placement_describe(pid_t tid);
+
+#endif /* PLACEMENT_H */
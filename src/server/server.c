@@ -140,6 +140,8 @@ queue_message(TSpeechDMessage * new, int fd, int history_flag,
 		pthread_mutex_unlock(&element_free_mutex);
 	}
 
+	new->queued = g_get_monotonic_time();
+
 	pthread_mutex_lock(&element_free_mutex);
 	/* Put the element new to queue according to it's priority. */
 	check_locked(&element_free_mutex);
@@ -223,46 +225,17 @@ void server_data_off(int fd)
 	return;
 }
 
-/* Serve the client on _fd_ if we got some activity. */
-int serve(int fd)
+/* Parse one complete line from the client on _fd_ and send the reply.
+ * Returns 1 if the client went away while parsing, 0 on success and -1
+ * on a write error. */
+static int serve_line(int fd, char *buf, size_t bytes)
 {
 	char *reply;		/* Reply to the client */
 	int ret;
 
-	{
-		size_t bytes = 0;	/* Number of bytes we got */
-		int buflen = BUF_SIZE;
-		char *buf = (char *)g_malloc(buflen + 1);
-
-		/* Read data from socket */
-		/* Read exactly one complete line, the `parse' routine relies on it */
-		{
-			while (1) {
-				int n = read(fd, buf + bytes, 1);
-				if (n <= 0) {
-					g_free(buf);
-					return -1;
-				}
-				/* Note, bytes is a 0-based index into buf. */
-				if ((buf[bytes] == '\n')
-				    && (bytes >= 1) && (buf[bytes - 1] == '\r')) {
-					buf[++bytes] = '\0';
-					break;
-				}
-				if (buf[bytes] == '\0')
-					buf[bytes] = '?';
-				if ((++bytes) == buflen) {
-					buflen *= 2;
-					buf = g_realloc(buf, buflen + 1);
-				}
-			}
-		}
-
-		/* Parse the data and read the reply */
-		MSG2(5, "protocol", "%d:DATA:|%s| (%lu)", fd, buf, (unsigned long) bytes);
-		reply = parse(buf, bytes, fd);
-		g_free(buf);
-	}
+	/* Parse the data and read the reply */
+	MSG2(5, "protocol", "%d:DATA:|%s| (%lu)", fd, buf, (unsigned long) bytes);
+	reply = parse(buf, bytes, fd);
 
 	if (reply == NULL)
 		FATAL("Internal error, reply from parse() is NULL!");
@@ -283,8 +256,72 @@ int serve(int fd)
 			return -1;
 		}
 	} else {
+		/* The connection is already destroyed, see parse() */
+		ret = !strcmp(reply, "999 CLIENT GONE");
 		g_free(reply);
+		if (ret)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Serve the client on _fd_ if we got some activity.
+ *
+ * Clients may pipeline several commands in one write (e.g. SET SELF
+ * PRIORITY, SPEAK, the data and the terminating dot), so we read
+ * everything available and parse every complete line we got before
+ * returning to the main loop. An incomplete last line is kept in the
+ * socket's input buffer until the rest of it arrives. */
+int serve(int fd)
+{
+	TSpeechDSock *speechd_socket = speechd_socket_get_by_fd(fd);
+	GString *i_buf;
+	char rbuf[READ_BUF_SIZE];
+	size_t start, pos;
+	int n, ret;
+
+	assert(speechd_socket);
+	i_buf = speechd_socket->i_buf;
+
+	n = read(fd, rbuf, sizeof(rbuf));
+	if (n <= 0)
+		return -1;
+	g_string_append_len(i_buf, rbuf, n);
+
+	start = 0;
+	/* Lines are terminated by \r\n, the `parse' routine relies on it */
+	pos = speechd_socket->i_scanned > 0 ? speechd_socket->i_scanned : 1;
+	while (pos < i_buf->len) {
+		char *eol = memchr(i_buf->str + pos, '\n', i_buf->len - pos);
+		char *line;
+		size_t bytes, i;
+
+		if (eol == NULL)
+			break;
+		pos = eol - i_buf->str + 1;
+		if (eol[-1] != '\r' || eol - 1 < i_buf->str + start)
+			continue;
+
+		bytes = pos - start;
+		line = g_strndup(i_buf->str + start, bytes);
+		for (i = 0; i < bytes; i++)
+			if (line[i] == '\0')
+				line[i] = '?';
+		start = pos;
+		pos++;
+
+		ret = serve_line(fd, line, bytes);
+		g_free(line);
+		if (ret == 1)
+			/* speechd_socket is gone together with the client */
+			return 0;
+		if (ret == -1)
+			return -1;
 	}
 
+	g_string_erase(i_buf, 0, start);
+	speechd_socket->i_scanned = i_buf->len;
+
 	return 0;
 }
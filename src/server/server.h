@@ -30,6 +30,9 @@ int serve(int fd);
 void server_data_on(int fd);
 void server_data_off(int fd);
 
+/* Id of the last queued message */
+extern int last_message_id;
+
 /* Put a message into Dispatcher's queue */
 int queue_message(TSpeechDMessage * new, int fd, int history_flag,
 		  SPDMessageType type, int reparted);
@@ -39,6 +39,9 @@
 #include "output.h"
 #include "speaking.h"
 #include "sem_functions.h"
+#include "placement.h"
+#include "overload.h"
+#include "latency.h"
 
 TSpeechDMessage *current_message = NULL;
 static SPDPriority highest_priority = 0;
@@ -56,11 +59,32 @@ int pause_requested_fd;
 int pause_requested_uid;
 int resume_requested;
 
+/* Message resumed after a crash of its module, and how many times */
+static guint crashed_message_id;
+static int crashed_message_retries;
+
+static void speaking_module_crashed(OutputModule * output,
+				    TSpeechDMessage * msg);
+
 /*
   Speak() is responsible for getting right text from right
   queue in right time and saying it loud through the corresponding
   synthetiser.  This runs in a separate thread.
 */
+/* Whether more output from the module is already waiting to be handled,
+   either read already in its buffer or still in the pipe. */
+static int module_has_pending_events(OutputModule * output, int fd)
+{
+	struct pollfd pfd;
+
+	if (output_module_has_buffered_reply(output))
+		return 1;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
 void *speak(void *data)
 {
 	TSpeechDMessage *message = NULL;
@@ -73,6 +97,7 @@ void *speak(void *data)
 
 	/* Block all signals and set thread states */
 	set_speak_thread_attributes();
+	placement_apply_speak_thread();
 
 	poll_fds = g_malloc(2 * sizeof(struct pollfd));
 
@@ -89,7 +114,10 @@ void *speak(void *data)
 	poll_count = 1;
 
 	while (1) {
-		ret = poll(poll_fds, poll_count, -1);
+		/* Events read along with a reply are not seen by poll */
+		ret = poll(poll_fds, poll_count, poll_count > 1
+			   && output_module_has_buffered_reply(speaking_module)
+			   ? 0 : -1);
 		MSG(5,
 		    "Poll in speak() returned socket activity, main_pfd revents=%d, poll_pfd revents=%d",
 		    poll_fds[0].revents, poll_fds[1].revents);
@@ -106,18 +134,34 @@ void *speak(void *data)
 			}
 		}
 		if (poll_count > 1) {
-			if ((revents = poll_fds[1].revents)) {
-				if (revents & POLLHUP) {
-					// FIXME: We should handle this more gracefully
-					FATAL
-					    ("wait_for_poll: output_module disconnected");
+			revents = poll_fds[1].revents;
+			if (output_module_has_buffered_reply(speaking_module))
+				revents |= POLLIN;
+			if (revents) {
+				if ((revents & POLLHUP) && !(revents & POLLIN)) {
+					/* Everything it sent was read already */
+					MSG(2,
+					    "wait_for_poll: output_module disconnected");
+					if (speaking_module != NULL)
+						speaking_module_crashed
+						    (speaking_module,
+						     current_message);
+					else
+						poll_count = 1;
 				} else if ((revents & POLLIN)
 					   || (revents & POLLPRI)) {
 					MSG(5,
 					    "wait_for_poll: activity on output_module");
 					/* Check if sb is speaking or they are all silent.
-					 * If some synthesizer is speaking, we must wait. */
-					is_sb_speaking();
+					 * If some synthesizer is speaking, we must wait.
+					 * Handle all the events the module sent at once
+					 * before going back to the queues. */
+					do {
+						is_sb_speaking();
+					} while (poll_count > 1
+						 && module_has_pending_events
+						 (speaking_module,
+						  poll_fds[1].fd));
 				}
 			}
 		}
@@ -182,6 +226,7 @@ void *speak(void *data)
 
 		MSG(5, "Locking element_free_mutex in speak()");
 		pthread_mutex_lock(&element_free_mutex);
+		overload_update();
 		/* Handle postponed priority progress message */
 		check_locked(&element_free_mutex);
 		if ((g_list_length(last_p5_block) != 0)
@@ -228,6 +273,11 @@ void *speak(void *data)
 			continue;
 		}
 
+		message->dispatched = g_get_monotonic_time();
+		message->begun = 0;
+		latency_record(message->settings.priority, LATENCY_QUEUE,
+			       message->dispatched - message->queued);
+
 		/* Choose the output module */
 		output = get_output_module(message);
 		if (output == NULL) {
@@ -262,13 +312,25 @@ void *speak(void *data)
 				MSG(5, "text: Normalized '%s' to '%s'", message->buf, normalized);
 			}
 			message->buf = normalized;
-			insert_symbols(message, punct_missing);
+			if ((message->settings.priority == SPD_NOTIFICATION
+			     || message->settings.priority == SPD_PROGRESS)
+			    && overload_active(OVERLOAD_SKIP_SYMBOLS))
+				overload_count(OVERLOAD_SKIP_SYMBOLS, 1);
+			else
+				insert_symbols(message, punct_missing);
 		}
 
-		/* Insert index marks into textual messages */
+		/* Insert index marks into textual messages. Only notifications
+		   and progress can do without them, pausing and client marks
+		   rely on them for the rest. */
 		if (message->settings.type == SPD_MSGTYPE_TEXT) {
-			insert_index_marks(message,
-					   message->settings.ssml_mode);
+			if ((message->settings.priority == SPD_NOTIFICATION
+			     || message->settings.priority == SPD_PROGRESS)
+			    && overload_active(OVERLOAD_SKIP_INDEX_MARKS))
+				overload_count(OVERLOAD_SKIP_INDEX_MARKS, 1);
+			else
+				insert_index_marks(message,
+						   message->settings.ssml_mode);
 		}
 
 		/* Write the message to the output layer. */
@@ -279,6 +341,8 @@ void *speak(void *data)
 			MSG(2, "Error: Output module failed");
 			output_check_module(output);
 			pthread_mutex_unlock(&element_free_mutex);
+			if (!output->working)
+				speaking_module_crashed(output, message);
 			continue;
 		}
 		if (ret != 0) {
@@ -288,6 +352,9 @@ void *speak(void *data)
 			pthread_mutex_unlock(&element_free_mutex);
 			continue;
 		}
+		message->sent = g_get_monotonic_time();
+		latency_record(message->settings.priority, LATENCY_PREPROCESS,
+			       message->sent - message->dispatched);
 		SPEAKING = 1;
 
 		if (speaking_module != NULL) {
@@ -351,11 +418,77 @@ void *speak(void *data)
 	}
 }
 
+/* The module _output_ died while speaking _msg_ (or when it was sent to
+   it). Start the module again, or let get_output_module() fall back to
+   another one, and queue the rest of the message from its last index mark
+   unless it already crashed the module ModuleCrashRetries times. */
+static void speaking_module_crashed(OutputModule * output,
+				    TSpeechDMessage * msg)
+{
+	SPEAKING = 0;
+	poll_count = 1;
+	speaking_module = NULL;
+
+	MSG(2, "Output module %s died while speaking", output->name);
+	output->working = 0;
+	if (output_respawn(output) != 0)
+		MSG(2, "Can't restart output module %s, using another one",
+		    output->name);
+
+	if (msg == NULL)
+		return;
+
+	if (msg->id == crashed_message_id) {
+		crashed_message_retries++;
+	} else {
+		crashed_message_id = msg->id;
+		crashed_message_retries = 1;
+	}
+
+	/* Only text can be resumed from an index mark */
+	if (msg->settings.type != SPD_MSGTYPE_TEXT
+	    || crashed_message_retries > SpeechdOptions.module_crash_retries) {
+		MSG(2, "Giving up message %d after the crash", msg->id);
+		if (msg->settings.notification & SPD_CANCEL)
+			report_cancel(msg);
+		if (current_message == msg)
+			current_message = NULL;
+		mem_free_message(msg);
+		return;
+	}
+
+	MSG(3, "Resuming message %d from index mark %s (retry %d)", msg->id,
+	    msg->settings.index_mark ? msg->settings.index_mark : "<none>",
+	    crashed_message_retries);
+	/* Without a mark, the whole message is queued as it is, but speak()
+	   will insert the index marks again */
+	if (msg->settings.index_mark == NULL) {
+		char *text = index_mark_continuation(msg, -1,
+						     msg->settings.ssml_mode);
+		if (text != NULL) {
+			g_free(msg->buf);
+			index_marks_free(msg);
+			msg->buf = text;
+			msg->bytes = strlen(text);
+		}
+	}
+	/* If the client already got BEGIN, in this or an earlier try, it
+	   will get RESUME instead */
+	if (msg->begun != 0)
+		msg->settings.paused_while_speaking = 1;
+	/* The message is requeued (or freed) by reload_message(), speak()
+	   must not free it as the previous message */
+	if (current_message == msg)
+		current_message = NULL;
+	if (reload_message(msg) != 0)
+		MSG(2, "Can't resume message after the crash");
+	speaking_semaphore_post();
+}
+
 int reload_message(TSpeechDMessage * msg)
 {
 	TFDSetElement *client_settings;
 	int im;
-	char *pos;
 	char *newtext;
 	char *tptr;
 
@@ -364,9 +497,17 @@ int reload_message(TSpeechDMessage * msg)
 		return -1;
 	}
 
+	/* The client may have disconnected meanwhile */
+	client_settings = get_client_settings_by_uid(msg->settings.uid);
+	if (client_settings == NULL) {
+		MSG(4, "Client %d is gone, message %d not reloaded",
+		    msg->settings.uid, msg->id);
+		mem_free_message(msg);
+		return -1;
+	}
+
 	if (msg->settings.index_mark != NULL) {
 		MSG(5, "Recovering index mark %s", msg->settings.index_mark);
-		client_settings = get_client_settings_by_uid(msg->settings.uid);
 		/* Scroll back to provide context, if required */
 		/* WARNING: This relies on ordered SD_MARK_BODY index marks! */
 		MSG(5, "Recovering index mark (number)");
@@ -386,20 +527,12 @@ int reload_message(TSpeechDMessage * msg)
 		MSG2(5, "index_marking",
 		     "Requested index mark (with context) is %d (%s+%d)", im,
 		     msg->settings.index_mark, client_settings->pause_context);
-		if (im < 0) {
-			im = 0;
-			pos = msg->buf;
-		} else {
-			pos = find_index_mark(msg, im);
-			if (pos == NULL)
-				return -1;
-		}
-
-		newtext = strip_index_marks(pos, client_settings->ssml_mode);
-		g_free(msg->buf);
-
+		newtext = index_mark_continuation(msg, im,
+						  client_settings->ssml_mode);
 		if (newtext == NULL)
 			return -1;
+		g_free(msg->buf);
+		index_marks_free(msg);
 		msg->buf = newtext;
 		msg->bytes = strlen(msg->buf);
 
@@ -430,6 +563,11 @@ int reload_message(TSpeechDMessage * msg)
 	return 0;
 }
 
+TSpeechDMessage *speaking_get_interrupted(void)
+{
+	return SPEAKING ? current_message : NULL;
+}
+
 void speaking_stop(int uid)
 {
 	TSpeechDMessage *msg;
@@ -709,6 +847,7 @@ int is_sb_speaking(void)
 {
 	char *index_mark;
 	TFDSetElement *settings;
+	OutputModule *output;
 
 	MSG(5, "is_sb_speaking(), SPEAKING=%d", SPEAKING);
 
@@ -720,10 +859,15 @@ int is_sb_speaking(void)
 			return -1;
 		}
 		settings = &(current_message->settings);
+		output = speaking_module;
 
 		output_is_speaking(&index_mark);
-		if (index_mark == NULL)
+		if (index_mark == NULL) {
+			if (!output->working)
+				speaking_module_crashed(output,
+							current_message);
 			return SPEAKING = 0;
+		}
 
 		if (!strcmp(index_mark, "no")) {
 			g_free(index_mark);
@@ -734,6 +878,10 @@ int is_sb_speaking(void)
 
 		if (!strcmp(index_mark, SD_MARK_BODY "begin")) {
 			SPEAKING = 1;
+			current_message->begun = g_get_monotonic_time();
+			latency_record(settings->priority, LATENCY_SYNTHESIS,
+				       current_message->begun -
+				       current_message->sent);
 			if (!settings->paused_while_speaking) {
 				if (settings->notification & SPD_BEGIN)
 					report_begin(current_message);
@@ -745,6 +893,10 @@ int is_sb_speaking(void)
 		} else if (!strcmp(index_mark, SD_MARK_BODY "end")) {
 			SPEAKING = 0;
 			poll_count = 1;
+			if (current_message->begun)
+				latency_record(settings->priority, LATENCY_PLAY,
+					       g_get_monotonic_time() -
+					       current_message->begun);
 			if (settings->notification & SPD_END)
 				report_end(current_message);
 			speaking_semaphore_post();
@@ -1005,6 +1157,24 @@ void stop_priority_except_first(SPDPriority priority)
 	return;
 }
 
+/* Keep only the newest queued notification, even if older ones belong
+   to another block */
+static void collapse_notifications(void)
+{
+	GList *last;
+	int dropped;
+
+	check_locked(&element_free_mutex);
+	last = g_list_last(MessageQueue->p4);
+	if (last == NULL)
+		return;
+	MessageQueue->p4 = g_list_remove_link(MessageQueue->p4, last);
+	dropped = g_list_length(MessageQueue->p4);
+	MessageQueue->p4 = empty_queue(MessageQueue->p4);
+	MessageQueue->p4 = last;
+	overload_count(OVERLOAD_COLLAPSE_NOTIFICATIONS, dropped);
+}
+
 void resolve_priorities(SPDPriority priority)
 {
 	if (priority == SPD_IMPORTANT) {
@@ -1030,7 +1200,10 @@ void resolve_priorities(SPDPriority priority)
 	}
 
 	if (priority == SPD_NOTIFICATION) {
-		stop_priority_except_first(SPD_NOTIFICATION);
+		if (overload_active(OVERLOAD_COLLAPSE_NOTIFICATIONS))
+			collapse_notifications();
+		else
+			stop_priority_except_first(SPD_NOTIFICATION);
 		if (SPEAKING && highest_priority != SPD_NOTIFICATION)
 			stop_priority(SPD_NOTIFICATION);
 	}
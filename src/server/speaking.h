@@ -36,6 +36,10 @@ extern int pause_requested_fd;
 extern int pause_requested_uid;
 extern int resume_requested;
 
+/* The message which was being spoken when the speak thread was stopped,
+   or NULL */
+TSpeechDMessage *speaking_get_interrupted(void);
+
 /* Speak() is responsible for getting right text from right
  * queue in right time and saying it loud through corresponding
  * synthetiser. (Note that there can be a big problem with synchronization).
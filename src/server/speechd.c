@@ -47,6 +47,8 @@
 #include "set.h"
 #include "options.h"
 #include "server.h"
+#include "handover.h"
+#include "latency.h"
 
 #include <i18n.h>
 
@@ -63,6 +65,9 @@ int server_socket;
 GMainLoop *main_loop = NULL;
 gint server_timeout_source = -1;
 
+/* Set when the main loop was quit to execute ourselves again */
+static int restart_requested = 0;
+
 int client_count = 0;
 
 struct SpeechdOptions SpeechdOptions;
@@ -102,6 +107,8 @@ static gboolean speechd_client_terminate(gpointer key, gpointer value, gpointer
 static gboolean speechd_reload_dead_modules(gpointer user_data);
 static gboolean speechd_load_configuration(gpointer user_data);
 static gboolean speechd_quit(gpointer user_data);
+static gboolean speechd_restart(gpointer user_data);
+static gboolean speechd_dump_latency(gpointer user_data);
 
 static gboolean server_process_incoming (gint          fd,
 				  GIOCondition  condition,
@@ -337,6 +344,8 @@ int speechd_socket_register(int fd)
 	speechd_socket = g_malloc(sizeof(TSpeechDSock));
 	speechd_socket->o_buf = NULL;
 	speechd_socket->o_bytes = 0;
+	speechd_socket->i_buf = g_string_new("");
+	speechd_socket->i_scanned = 0;
 	speechd_socket->awaiting_data = 0;
 	speechd_socket->inside_block = 0;
 	fd_key = g_malloc(sizeof(int));
@@ -350,6 +359,8 @@ void speechd_socket_free(TSpeechDSock * speechd_socket)
 {
 	if (speechd_socket->o_buf)
 		g_string_free(speechd_socket->o_buf, 1);
+	if (speechd_socket->i_buf)
+		g_string_free(speechd_socket->i_buf, 1);
 	g_free(speechd_socket);
 }
 
@@ -368,11 +379,9 @@ TSpeechDSock *speechd_socket_get_by_fd(int fd)
 /* activity is on server_socket (request for a new connection) */
 int speechd_connection_new(int server_socket)
 {
-	TFDSetElement *new_fd_set;
 	struct sockaddr_in client_address;
 	unsigned int client_len = sizeof(client_address);
 	int client_socket;
-	int *p_client_socket, *p_client_uid, *p_client_uid2;
 
 	client_socket =
 	    accept(server_socket, (struct sockaddr *)&client_address,
@@ -384,6 +393,20 @@ int speechd_connection_new(int server_socket)
 		return -1;
 	}
 
+	if (speechd_connection_add(client_socket, ++SpeechdStatus.max_uid) ==
+	    NULL)
+		return -1;
+
+	return 0;
+}
+
+/* Set up the structures of client _uid_ connected on _client_socket_ and
+   start watching it. Returns its settings with defaults filled in. */
+TFDSetElement *speechd_connection_add(int client_socket, unsigned int uid)
+{
+	TFDSetElement *new_fd_set;
+	int *p_client_socket, *p_client_uid, *p_client_uid2;
+
 	/* We add the associated client_socket to the descriptor set. */
 	if (client_socket > SpeechdStatus.max_fd)
 		SpeechdStatus.max_fd = client_socket;
@@ -398,16 +421,16 @@ int speechd_connection_new(int server_socket)
 		    "Error: Failed to create a record in fd_settings for the new client");
 		if (SpeechdStatus.max_fd == client_socket)
 			SpeechdStatus.max_fd--;
-		return -1;
+		return NULL;
 	}
 	new_fd_set->fd = client_socket;
-	new_fd_set->uid = ++SpeechdStatus.max_uid;
+	new_fd_set->uid = uid;
 	p_client_socket = (int *)g_malloc(sizeof(int));
 	p_client_uid = (int *)g_malloc(sizeof(int));
 	p_client_uid2 = (int *)g_malloc(sizeof(int));
 	*p_client_socket = client_socket;
-	*p_client_uid = SpeechdStatus.max_uid;
-	*p_client_uid2 = SpeechdStatus.max_uid;
+	*p_client_uid = uid;
+	*p_client_uid2 = uid;
 
 	g_hash_table_insert(fd_settings, p_client_uid, new_fd_set);
 	g_hash_table_insert(fd_uid, p_client_socket, p_client_uid2);
@@ -419,8 +442,7 @@ int speechd_connection_new(int server_socket)
 	client_count++;
 	check_client_count();
 
-	return 0;
-
+	return new_fd_set;
 }
 
 int speechd_connection_destroy(int fd)
@@ -763,6 +785,20 @@ static gboolean speechd_quit(gpointer user_data)
 	return FALSE;
 }
 
+static gboolean speechd_restart(gpointer user_data)
+{
+	MSG(1, "Restart requested");
+	restart_requested = 1;
+	g_main_loop_quit(main_loop);
+	return FALSE;
+}
+
+static gboolean speechd_dump_latency(gpointer user_data)
+{
+	latency_dump();
+	return TRUE;
+}
+
 /* --- PID FILES --- */
 
 int create_pid_file()
@@ -999,6 +1035,7 @@ void check_client_count(void)
 int main(int argc, char *argv[])
 {
 	int ret;
+	int handover_fd;
 	/* Autospawn helper variables */
 	char *spawn_communication_method = NULL;
 	int spawn_port = 0;
@@ -1007,6 +1044,9 @@ int main(int argc, char *argv[])
 	/* Strip all permisions for 'others' from the files created */
 	umask(007);
 
+	handover_init(argv);
+	handover_fd = handover_inherited_fd();
+
 	/* Initialize logging */
 	logfile = stdout;
 	SpeechdOptions.log_level = 1;
@@ -1220,7 +1260,13 @@ int main(int argc, char *argv[])
 		g_free(spawn_socket_path);
 	}
 
-	if (!strcmp(SpeechdOptions.communication_method, "inet_socket")) {
+	if (handover_fd >= 0) {
+		/* Restarted by a previous instance, take over its socket,
+		   clients and queues */
+		server_socket = handover_restore(handover_fd);
+		if (server_socket < 0)
+			FATAL("Can't take over from the previous server");
+	} else if (!strcmp(SpeechdOptions.communication_method, "inet_socket")) {
 		MSG(4, "Speech Dispatcher will use inet port %d",
 		    SpeechdOptions.port);
 		/* Connect and start listening on inet socket */
@@ -1240,8 +1286,8 @@ int main(int argc, char *argv[])
 		FATAL("Unknown communication method");
 	}
 
-	/* Fork, set uid, chdir, etc. */
-	if (spd_mode == SPD_MODE_DAEMON) {
+	/* Fork, set uid, chdir, etc. A restarted server is already a daemon */
+	if (spd_mode == SPD_MODE_DAEMON && handover_fd < 0) {
 		if (daemon(0, 0)) {
 			FATAL("Can't fork child process");
 		}
@@ -1257,6 +1303,11 @@ int main(int argc, char *argv[])
 	g_unix_signal_add(SIGTERM, speechd_quit, NULL);
 	g_unix_signal_add(SIGHUP, speechd_load_configuration, NULL);
 	g_unix_signal_add(SIGUSR1, speechd_reload_dead_modules, NULL);
+	g_unix_signal_add(SIGUSR2, speechd_restart, NULL);
+#if GLIB_CHECK_VERSION(2, 54, 0)
+	/* The only one left that GLib lets us handle in the main loop */
+	g_unix_signal_add(SIGWINCH, speechd_dump_latency, NULL);
+#endif
 	(void)signal(SIGPIPE, SIG_IGN);
 
 	MSG(4, "Creating new thread for speak()");
@@ -1264,7 +1315,8 @@ int main(int argc, char *argv[])
 	if (ret != 0)
 		FATAL("Speak thread failed!\n");
 
-	SpeechdStatus.max_fd = server_socket;
+	if (server_socket > SpeechdStatus.max_fd)
+		SpeechdStatus.max_fd = server_socket;
 
 	g_unix_fd_add(server_socket, G_IO_IN,
 		      server_process_incoming, NULL);
@@ -1278,12 +1330,8 @@ int main(int argc, char *argv[])
 
 	MSG(1, "Terminating...");
 
-	MSG(2, "Closing open connections...");
-	/* We will browse through all the connections and close them. */
-	g_hash_table_foreach_remove(fd_settings, speechd_client_terminate,
-				    NULL);
-	g_hash_table_destroy(fd_settings);
-
+	/* Stop speaking before the clients and queues go away, or are
+	   handed over */
 	MSG(4, "Closing speak() thread...");
 	ret = pthread_cancel(speak_thread);
 	if (ret != 0)
@@ -1298,6 +1346,18 @@ int main(int argc, char *argv[])
 	g_list_foreach(output_modules, speechd_modules_terminate, NULL);
 	g_list_free(output_modules);
 
+	if (restart_requested) {
+		/* Only returns on failure, then we just terminate */
+		handover_exec(server_socket);
+		MSG(1, "Restart failed, terminating");
+	}
+
+	MSG(2, "Closing open connections...");
+	/* We will browse through all the connections and close them. */
+	g_hash_table_foreach_remove(fd_settings, speechd_client_terminate,
+				    NULL);
+	g_hash_table_destroy(fd_settings);
+
 	MSG(2, "Closing server connection...");
 	if (close(server_socket) == -1)
 		MSG(2, "close() failed: %s", strerror(errno));
@@ -117,6 +117,8 @@ typedef struct {
 
 /* Size of the buffer for socket communication */
 #define BUF_SIZE 128
+/* How much we try to read from a client socket at once */
+#define READ_BUF_SIZE 4096
 
 /* Mode of speechd execution */
 typedef enum {
@@ -141,8 +143,14 @@ typedef struct {
 typedef struct {
 	guint id;		/* unique id */
 	time_t time;		/* when was this message received */
+	gint64 queued;		/* g_get_monotonic_time() when it was queued */
+	gint64 dispatched;	/* ... taken out of the queues */
+	gint64 sent;		/* ... sent to the output module */
+	gint64 begun;		/* ... reported to have begun, 0 if not yet */
 	char *buf;		/* the actual text */
 	int bytes;		/* number of bytes in buf */
+	char *unmarked;		/* buf before index marks were inserted */
+	GArray *marks;		/* offsets in unmarked after each index mark */
 	TFDSetElement settings;	/* settings of the client when queueing this message */
 } TSpeechDMessage;
 
@@ -171,6 +179,10 @@ extern struct SpeechdOptions {
 	int max_history_messages;	/* Maximum of messages in history before they expire */
 	int server_timeout;
 	int server_timeout_set;
+	int module_zygote;	/* Fork modules from a pre-started zygote */
+	int module_crash_retries;	/* Resumptions of a message crashing its module */
+	int overload_queue_length;	/* Queued messages making load 1, 0 to ignore */
+	int overload_queue_delay;	/* Wait in ms making load 1, 0 to ignore */
 } SpeechdOptions;
 
 extern struct SpeechdStatus {
@@ -220,6 +232,8 @@ typedef struct {
 	int inside_block;
 	size_t o_bytes;
 	GString *o_buf;
+	GString *i_buf;		/* Bytes read from the socket but not parsed yet */
+	size_t i_scanned;	/* How much of i_buf is known not to hold a line end */
 } TSpeechDSock;
 int speechd_sockets_status_init(void);
 int speechd_socket_register(int fd);
@@ -249,6 +263,7 @@ int isanum(const char *str);
 
 /* Functions used in speechd.c only */
 int speechd_connection_new(int server_socket);
+TFDSetElement *speechd_connection_add(int client_socket, unsigned int uid);
 int speechd_connection_destroy(int fd);
 void speechd_modules_terminate(gpointer data, gpointer user_data);
 void speechd_modules_reload(gpointer data, gpointer user_data);
@@ -0,0 +1,234 @@
+
+/*
+ * audio_failover.c - Test of recovering from a failing audio output
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Needs the faulty audio output: copy .libs/spd_faulty.so into the
+ * directory of the audio plugins and set in speechd.conf:
+ *
+ *   AudioOutputMethod "faulty,faulty"
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "speechd_types.h"
+#include <libspeechd.h>
+
+#include "faulty_audio.h"
+
+/* Only the index marks of the client are reported to it, so they are
+   sent in SSML */
+#define MARK(n) "<mark name=\"" #n "\"/> "
+#define TEXT "<speak>One." MARK(1) "Two." MARK(2) "Three." MARK(3) \
+	"Four." MARK(4) "Five." MARK(5) "Six." MARK(6) "Seven." MARK(7) \
+	"Eight." MARK(8) "Nine." MARK(9) "Ten." MARK(10) "</speak>"
+#define TEXT_MARKS 10
+/* Index marks to wait for before breaking the output */
+#define MARKS_BEFORE_FAULT 3
+/* How long to wait for a single event, in seconds */
+#define EVENT_TIMEOUT 30
+/* Longest acceptable extra time taken by the message because of the
+   failures, in ms */
+#define MAX_RECOVERY 1000
+/* How much faster than without failures the message may be, in ms: if
+   it is faster, some of its audio was dropped instead of played */
+#define MAX_EARLY 100
+
+static pthread_mutex_t event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t event_cond = PTHREAD_COND_INITIALIZER;
+static SPDNotificationType last_event = -1;
+static int marks;
+
+static long now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+static void event_cb(size_t msg_id, size_t client_id, SPDNotificationType type)
+{
+	pthread_mutex_lock(&event_mutex);
+	last_event = type;
+	pthread_cond_signal(&event_cond);
+	pthread_mutex_unlock(&event_mutex);
+}
+
+static void mark_cb(size_t msg_id, size_t client_id, SPDNotificationType type,
+		    char *index_mark)
+{
+	pthread_mutex_lock(&event_mutex);
+	marks++;
+	pthread_cond_signal(&event_cond);
+	pthread_mutex_unlock(&event_mutex);
+}
+
+/* Wait for event _type_, or for _count_ index marks if _type_ is
+   SPD_EVENT_INDEX_MARK, return 0 on success */
+static int wait_event(SPDNotificationType type, int count)
+{
+	struct timespec deadline;
+	int ret = 0, done;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += EVENT_TIMEOUT;
+	pthread_mutex_lock(&event_mutex);
+	while (!(done = type == SPD_EVENT_INDEX_MARK ? marks >= count
+		 : last_event == type) && last_event != SPD_EVENT_CANCEL
+	       && ret == 0)
+		ret = pthread_cond_timedwait(&event_cond, &event_mutex,
+					     &deadline);
+	pthread_mutex_unlock(&event_mutex);
+	return done ? 0 : -1;
+}
+
+static void reset_events(void)
+{
+	pthread_mutex_lock(&event_mutex);
+	last_event = -1;
+	marks = 0;
+	pthread_mutex_unlock(&event_mutex);
+}
+
+/* Make the next _writes_ writes and _opens_ opens of the output fail */
+static void set_faults(int writes, int opens)
+{
+	FILE *f = fopen(FAULTY_CONTROL, "w");
+
+	if (f == NULL) {
+		perror(FAULTY_CONTROL);
+		exit(1);
+	}
+	fprintf(f, "%d %d\n", writes, opens);
+	fclose(f);
+}
+
+/* Speak TEXT, breaking the output with _writes_ and _opens_ failures
+   after MARKS_BEFORE_FAULT marks, return how long it took in ms */
+static long speak(SPDConnection * conn, int writes, int opens, int *num_marks)
+{
+	long start;
+
+	set_faults(0, 0);
+	reset_events();
+	start = now_ms();
+	if (spd_say(conn, SPD_TEXT, TEXT) == -1) {
+		printf("Message failed\n");
+		exit(1);
+	}
+	if (writes || opens) {
+		if (wait_event(SPD_EVENT_INDEX_MARK, MARKS_BEFORE_FAULT) != 0) {
+			printf("Message did not get to mark %d\n",
+			       MARKS_BEFORE_FAULT);
+			exit(1);
+		}
+		set_faults(writes, opens);
+	}
+	if (wait_event(SPD_EVENT_END, 0) != 0) {
+		printf("Message did not end\n");
+		exit(1);
+	}
+	pthread_mutex_lock(&event_mutex);
+	*num_marks = marks;
+	pthread_mutex_unlock(&event_mutex);
+	return now_ms() - start;
+}
+
+int main(int argc, char *argv[])
+{
+	SPDConnection *conn;
+	long normal, elapsed, max_extra = 0;
+	int normal_marks, num_marks, ret = 0;
+	/* Failing writes and opens */
+	static const int faults[][2] = {
+		{1, 0},		/* A transient failure */
+		{3, 0},		/* The output needs reopening */
+		{3, 1},		/* It does not come back, use the next one */
+		{5, 0},		/* Writes fail again right after reopening */
+		{3, 3},		/* No output opens for a while */
+	};
+	int i;
+
+	conn = spd_open("test", "audio_failover", NULL, SPD_MODE_THREADED);
+	if (conn == NULL) {
+		printf("Speech Dispatcher failed\n");
+		exit(1);
+	}
+
+	printf("Audio failover test\n\n");
+	printf("The audio output fails in the middle of a message, which must\n");
+	printf("still be played until its end with all its index marks, taking\n");
+	printf("at most %d ms more than without failures, and at most %d ms\n",
+	       MAX_RECOVERY, MAX_EARLY);
+	printf("less, since none of its audio may be dropped.\n");
+	fflush(stdout);
+
+	conn->callback_end = event_cb;
+	conn->callback_cancel = event_cb;
+	conn->callback_im = mark_cb;
+	if (spd_set_notification_on(conn, SPD_END) == -1
+	    || spd_set_notification_on(conn, SPD_CANCEL) == -1
+	    || spd_set_notification_on(conn, SPD_INDEX_MARKS) == -1) {
+		printf("Can't set notifications\n");
+		exit(1);
+	}
+	if (spd_set_data_mode(conn, SPD_DATA_SSML) == -1) {
+		printf("Can't switch to SSML\n");
+		exit(1);
+	}
+
+	normal = speak(conn, 0, 0, &normal_marks);
+	printf("Without failures: %ld ms, %d index marks\n", normal,
+	       normal_marks);
+	if (normal_marks != TEXT_MARKS) {
+		printf("Expected %d index marks\n", TEXT_MARKS);
+		exit(1);
+	}
+
+	for (i = 0; i < sizeof(faults) / sizeof(faults[0]); i++) {
+		elapsed = speak(conn, faults[i][0], faults[i][1], &num_marks);
+		printf("%d failed writes, %d failed opens: %ld ms, "
+		       "%d index marks\n", faults[i][0], faults[i][1], elapsed,
+		       num_marks);
+		if (num_marks != normal_marks) {
+			printf("Index marks were lost\n");
+			ret = 1;
+		}
+		if (elapsed < normal - MAX_EARLY) {
+			printf("Audio was dropped\n");
+			ret = 1;
+		}
+		if (elapsed - normal > max_extra)
+			max_extra = elapsed - normal;
+	}
+
+	set_faults(0, 0);
+	spd_close(conn);
+
+	printf("Failures took at most %ld ms more\n", max_extra);
+	exit(ret == 0 && max_extra <= MAX_RECOVERY ? 0 : 1);
+}
@@ -0,0 +1,120 @@
+
+/*
+ * audio_format_switch.c - Test of the cost of switching audio formats
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: audio_format_switch [output]
+ *
+ * Runs sd_ibmtts of the build tree over the fake IBM TTS library, so no
+ * server and no TTS engine are needed, but a real audio output: the
+ * default is libao. The fake speaks French at 16000 Hz and English at
+ * 22050 Hz, so alternating the two alternates the sample rate of the
+ * audio, like a synthesizer and sound icons of another rate. Once both
+ * formats were played, a message of the other format must not take
+ * longer beyond its own duration than a message of the same format as
+ * the previous one. The test is skipped if the output can't be opened or
+ * doesn't play.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fake_ibmeci.h"
+#include "fake_ibmtts.h"
+
+#define ROUNDS 10
+#define TEXT "Switching formats."
+/* Longest acceptable extra time to play a message of the other format
+   on average, in ms */
+#define MAX_SWITCH 20
+/* After which the whole test is considered stuck, in seconds */
+#define TEST_TIMEOUT 60
+
+/* Speaks TEXT, in _language_ first if it is not NULL, returns how much
+   longer than its duration it took */
+static long speak(TFakeModule * module, const char *language)
+{
+	char settings[64];
+
+	if (language != NULL) {
+		snprintf(settings, sizeof(settings), "language=%s\n",
+			 language);
+		fake_ibmtts_set(module, settings);
+	}
+	return fake_ibmtts_speak(module, TEXT)
+	    - (long)strlen(TEXT) * FAKE_IBMECI_MS_PER_CHAR;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *output = argc > 1 ? argv[1] : "libao";
+	const char *languages[2] = { "en-US", "fr-FR" };
+	TFakeModule module;
+	char audio[64];
+	long same = 0, switched = 0, max_switched = 0, elapsed;
+	int i;
+
+	alarm(TEST_TIMEOUT);
+
+	printf("Audio format switch test\n\n");
+	printf("Messages played on %s switching between 16000 and 22050 Hz\n",
+	       output);
+	printf("must take at most %d ms longer on average than messages\n",
+	       MAX_SWITCH);
+	printf("keeping the rate.\n\n");
+	fflush(stdout);
+
+	snprintf(audio, sizeof(audio), "audio_output_method=%s\n", output);
+	if (fake_ibmtts_start(&module, "", NULL, audio) != 0) {
+		printf("Skipped: the %s output can't be opened\n", output);
+		exit(77);
+	}
+
+	/* Get both formats played once. An output which doesn't get to
+	   play ends messages right away. */
+	elapsed = speak(&module, languages[0]);
+	speak(&module, languages[1]);
+	if (elapsed < -(long)strlen(TEXT) * FAKE_IBMECI_MS_PER_CHAR / 2) {
+		printf("Skipped: the %s output doesn't play\n", output);
+		fake_ibmtts_quit(&module);
+		exit(77);
+	}
+
+	for (i = 0; i < ROUNDS; i++) {
+		same += speak(&module, NULL);
+		elapsed = speak(&module, languages[i % 2]);
+		switched += elapsed;
+		if (elapsed > max_switched)
+			max_switched = elapsed;
+	}
+
+	fake_ibmtts_quit(&module);
+
+	printf("Same format: %ld ms longer than the message on average\n",
+	       same / ROUNDS);
+	printf("Switched format: %ld ms longer on average, %ld ms at most\n",
+	       switched / ROUNDS, max_switched);
+	exit((switched - same) / ROUNDS <= MAX_SWITCH ? 0 : 1);
+}
@@ -0,0 +1,215 @@
+
+/*
+ * audio_stop.c - Test of how fast an audio output stops playing
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: audio_stop [output [device]]
+ *
+ * Runs sd_ibmtts of the build tree over the fake IBM TTS library, so no
+ * server and no TTS engine are needed, but a real audio output: the
+ * default is oss on /dev/dsp. The device is the NAS server for nas.
+ * Messages are stopped while they play, and the module must report
+ * them stopped within MAX_STOP ms. A short message is played after each
+ * stop, which must end at most MAX_AFTER_STOP ms later than its duration:
+ * the output either reuses what it had set up for playing, like the NAS
+ * flow, or sets it up again. Before that, a whole message is played to
+ * report how many times per second the threads of the module wake up and
+ * how much CPU it takes while playing, which must stay within
+ * MAX_WAKEUPS and MAX_CPU. The test is skipped if the output can't be
+ * opened or doesn't play. E.g. with a NAS server on the local display:
+ *
+ *   audio_stop nas :0
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "fake_ibmeci.h"
+#include "fake_ibmtts.h"
+
+#define ROUNDS 5
+/* About 3 s long */
+#define TEXT "This message is long enough to be still playing when it gets " \
+	"stopped, so the audio output must drop what it was given and " \
+	"return right away, instead of waiting until the sound device has " \
+	"played it all. The time it takes is measured from the stop request " \
+	"to the report from the module that the message was stopped."
+/* How long to let the message play before stopping it, in ms */
+#define PLAY_BEFORE_STOP 500
+/* Longest acceptable time from STOP to the module reporting it, in ms */
+#define MAX_STOP 100
+#define SHORT_TEXT "Played after the stop."
+/* Longest acceptable extra time to play SHORT_TEXT after a stop, in ms */
+#define MAX_AFTER_STOP 200
+/* Most context switches per second of all the module threads while
+   playing */
+#define MAX_WAKEUPS 200
+/* Most CPU the module may take while playing, in percent */
+#define MAX_CPU 10
+/* After which the whole test is considered stuck, in seconds */
+#define TEST_TIMEOUT 60
+
+/* Context switches of all the threads of process _pid_ so far */
+static long wakeups(pid_t pid)
+{
+	char path[128], line[256];
+	struct dirent *entry;
+	long n, total = 0;
+	DIR *dir;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/%d/task", (int)pid);
+	dir = opendir(path);
+	if (dir == NULL)
+		return 0;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "/proc/%d/task/%s/status",
+			 (int)pid, entry->d_name);
+		f = fopen(path, "r");
+		if (f == NULL)
+			continue;	/* The thread is gone */
+		while (fgets(line, sizeof(line), f) != NULL)
+			if (sscanf(line, "voluntary_ctxt_switches: %ld", &n) == 1
+			    || sscanf(line, "nonvoluntary_ctxt_switches: %ld",
+				      &n) == 1)
+				total += n;
+		fclose(f);
+	}
+	closedir(dir);
+	return total;
+}
+
+/* CPU time taken so far by process _pid_, in ms */
+static long process_cpu_ms(pid_t pid)
+{
+	char path[64], buf[1024];
+	unsigned long utime, stime;
+	char *p;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	f = fopen(path, "r");
+	if (f == NULL || fgets(buf, sizeof(buf), f) == NULL) {
+		printf("Can't read %s\n", path);
+		exit(1);
+	}
+	fclose(f);
+	/* The fields after the name, which may contain spaces */
+	p = strrchr(buf, ')');
+	if (p == NULL
+	    || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+		      &utime, &stime) != 2) {
+		printf("Can't parse %s\n", path);
+		exit(1);
+	}
+	return (utime + stime) * 1000 / sysconf(_SC_CLK_TCK);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *output = argc > 1 ? argv[1] : "oss";
+	const char *device = argc > 2 ? argv[2] : NULL;
+	const char *parameter = "audio_oss_device";
+	TFakeModule module;
+	char audio[256];
+	long start, stopped, elapsed, max_stop = 0, max_after = 0;
+	long duration, woken, cpu;
+	int i, ret;
+
+	alarm(TEST_TIMEOUT);
+
+	if (!strcmp(output, "oss") && device == NULL)
+		device = "/dev/dsp";
+	if (!strcmp(output, "alsa"))
+		parameter = "audio_alsa_device";
+	else if (!strcmp(output, "nas"))
+		parameter = "audio_nas_server";
+	else if (!strcmp(output, "pulse"))
+		parameter = "audio_pulse_device";
+
+	printf("Audio stop test\n\n");
+	printf("Messages played on %s must be reported stopped within %d ms\n",
+	       output, MAX_STOP);
+	printf("of being stopped, and a message played next at most %d ms\n",
+	       MAX_AFTER_STOP);
+	printf("longer than its duration. While playing, it must wake up at\n");
+	printf("most %d times per second and take at most %d%% CPU.\n\n",
+	       MAX_WAKEUPS, MAX_CPU);
+	fflush(stdout);
+
+	snprintf(audio, sizeof(audio), "audio_output_method=%s\n%s=%s\n",
+		 output, parameter, device != NULL ? device : "NULL");
+	if (fake_ibmtts_start(&module, "", NULL, audio) != 0) {
+		printf("Skipped: the %s output can't be opened\n", output);
+		exit(77);
+	}
+
+	/* An output which doesn't get to play ends messages right away */
+	duration = (long)strlen(TEXT) * FAKE_IBMECI_MS_PER_CHAR;
+	woken = wakeups(module.pid);
+	cpu = process_cpu_ms(module.pid);
+	elapsed = fake_ibmtts_speak(&module, TEXT);
+	woken = wakeups(module.pid) - woken;
+	cpu = process_cpu_ms(module.pid) - cpu;
+	if (elapsed < duration / 2) {
+		printf("Skipped: the %s output played %ld ms of audio in "
+		       "%ld ms\n", output, duration, elapsed);
+		fake_ibmtts_quit(&module);
+		exit(77);
+	}
+	printf("Playing: %ld wakeups per second, %.1f%% CPU\n",
+	       woken * 1000 / elapsed, 100.0 * cpu / elapsed);
+	ret = woken * 1000 / elapsed <= MAX_WAKEUPS
+	    && cpu * 100 <= MAX_CPU * elapsed;
+
+	for (i = 0; i < ROUNDS; i++) {
+		fake_ibmtts_command(&module, "SPEAK\n", "202");
+		fake_ibmtts_command(&module, TEXT "\n.\n", "200");
+		fake_ibmtts_command(&module, NULL, "701");
+		usleep(PLAY_BEFORE_STOP * 1000);
+
+		start = fake_ibmtts_now();
+		fake_ibmtts_command(&module, "STOP\n", "703");
+		stopped = fake_ibmtts_now() - start;
+		if (stopped > max_stop)
+			max_stop = stopped;
+
+		elapsed = fake_ibmtts_speak(&module, SHORT_TEXT)
+		    - (long)strlen(SHORT_TEXT) * FAKE_IBMECI_MS_PER_CHAR;
+		printf("Stopped in %ld ms, next message %ld ms longer than "
+		       "its duration\n", stopped, elapsed);
+		if (elapsed > max_after)
+			max_after = elapsed;
+	}
+
+	fake_ibmtts_quit(&module);
+
+	printf("At most %ld ms to stop, %ld ms longer for the next message\n",
+	       max_stop, max_after);
+	exit(ret && max_stop <= MAX_STOP && max_after <= MAX_AFTER_STOP ? 0 : 1);
+}
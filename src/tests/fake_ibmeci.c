@@ -0,0 +1,362 @@
+/*
+ * fake_ibmeci.c -- A fake IBM TTS library, for testing sd_ibmtts
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1, or (at your option) any later
+ * version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Unlike the shim in src/modules, which only lets the module link, this
+ * one runs: instances keep their parameters, and synthesizing a message
+ * produces FAKE_IBMECI_MS_PER_CHAR ms of silence per character of its
+ * text, with the replies to its index marks in between.  French is
+ * spoken at 16000 Hz and the other languages at 22050 Hz, so that
+ * switching languages also switches the audio format.  How many
+ * instances were created, how many times a dialect was loaded into one,
+ * the dialect of the last message, and how many voice parameters were
+ * set, and of those to the value they already had, are written to
+ * FAKE_IBMECI_STATS each time they change.  The module only calls in from one thread at a
+ * time, so this is not locked.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "eci.h"
+
+#include "fake_ibmeci.h"
+
+#define MAX_VOICES 9
+#define MAX_INDEXES 256
+
+typedef struct {
+	int params[eciNumParams];
+	int voices[MAX_VOICES][eciNumVoiceParams];
+	ECICallback callback;
+	void *data;
+	short *buffer;
+	int buffer_size;
+	ECIDictHand dict;
+	/* The index marks inserted, each with the samples of the text
+	   added before it */
+	struct {
+		int index;
+		long samples;
+	} indexes[MAX_INDEXES];
+	int num_indexes;
+	long samples;		/* Of the text added after the last mark */
+} fake_engine_t;
+
+static enum ECILanguageDialect fake_languages[] = {
+	eciGeneralAmericanEnglish,
+	eciStandardFrench,
+	eciStandardGerman,
+	eciStandardItalian,
+};
+
+static int fake_instances;
+static int fake_loads;
+static int fake_synthesized;
+static int fake_voice_params;
+static int fake_redundant_voice_params;
+
+static int fake_dict;
+
+static void fake_write_stats(void)
+{
+	FILE *f;
+
+	f = fopen(FAKE_IBMECI_STATS, "w");
+	if (f == NULL)
+		return;
+	fprintf(f, "%d %d %x %d %d\n", fake_instances, fake_loads,
+		fake_synthesized, fake_voice_params, fake_redundant_voice_params);
+	fclose(f);
+}
+
+ECIHand ECIFNDECLARE eciNew(void)
+{
+	fake_engine_t *engine = calloc(1, sizeof(*engine));
+	int i;
+
+	if (engine == NULL)
+		return NULL_ECI_HAND;
+	engine->params[eciSampleRate] = 2;
+	engine->params[eciLanguageDialect] = eciGeneralAmericanEnglish;
+	for (i = 0; i < MAX_VOICES; i++) {
+		engine->voices[i][eciGender] = i == 2 || i == 6 || i == 7;
+		engine->voices[i][eciHeadSize] = 50;
+		engine->voices[i][eciPitchBaseline] = 65;
+		engine->voices[i][eciPitchFluctuation] = 30;
+		engine->voices[i][eciSpeed] = 50;
+		engine->voices[i][eciVolume] = 90;
+	}
+
+	fake_instances++;
+	fake_write_stats();
+	return engine;
+}
+
+int ECIFNDECLARE eciGetAvailableLanguages(enum ECILanguageDialect *aLanguages, int *nLanguages)
+{
+	int n = sizeof(fake_languages) / sizeof(fake_languages[0]);
+
+	if (*nLanguages < n)
+		n = *nLanguages;
+	memcpy(aLanguages, fake_languages, n * sizeof(fake_languages[0]));
+	*nLanguages = n;
+	return 0;
+}
+
+ECIHand ECIFNDECLARE eciDelete(ECIHand hEngine)
+{
+	free(hEngine);
+	return NULL_ECI_HAND;
+}
+
+void ECIFNDECLARE eciVersion(char *pBuffer)
+{
+	strcpy(pBuffer, "6.7.4 fake");
+}
+
+void ECIFNDECLARE eciErrorMessage(ECIHand hEngine, void* buffer)
+{
+	strcpy(buffer, "No error");
+}
+
+int ECIFNDECLARE eciGetParam(ECIHand hEngine, enum ECIParam Param)
+{
+	fake_engine_t *engine = hEngine;
+
+	if (Param < 0 || Param >= eciNumParams)
+		return -1;
+	return engine->params[Param];
+}
+
+/* Returns the previous value, like the real one */
+int ECIFNDECLARE eciSetParam(ECIHand hEngine, enum ECIParam Param, int iValue)
+{
+	fake_engine_t *engine = hEngine;
+	int old;
+
+	if (Param < 0 || Param >= eciNumParams)
+		return -1;
+	old = engine->params[Param];
+	engine->params[Param] = iValue;
+	if (Param == eciLanguageDialect) {
+		engine->params[eciSampleRate] =
+		    iValue == eciStandardFrench ? 3 : 2;
+		fake_loads++;
+		fake_write_stats();
+	}
+	return old;
+}
+
+Boolean ECIFNDECLARE eciGetVoiceName(ECIHand hEngine, int iVoice, void *pBuffer)
+{
+	if (iVoice < 0 || iVoice >= MAX_VOICES)
+		return 0;
+	sprintf(pBuffer, "Fake %d", iVoice);
+	return 1;
+}
+
+Boolean ECIFNDECLARE eciCopyVoice(ECIHand hEngine, int iVoiceFrom, int iVoiceTo)
+{
+	fake_engine_t *engine = hEngine;
+
+	if (iVoiceFrom < 0 || iVoiceFrom >= MAX_VOICES
+	    || iVoiceTo < 0 || iVoiceTo >= MAX_VOICES)
+		return 0;
+	memcpy(engine->voices[iVoiceTo], engine->voices[iVoiceFrom],
+	       sizeof(engine->voices[0]));
+	return 1;
+}
+
+int ECIFNDECLARE eciGetVoiceParam(ECIHand hEngine, int iVoice, enum ECIVoiceParam Param)
+{
+	fake_engine_t *engine = hEngine;
+
+	if (iVoice < 0 || iVoice >= MAX_VOICES
+	    || Param < 0 || Param >= eciNumVoiceParams)
+		return -1;
+	return engine->voices[iVoice][Param];
+}
+
+int ECIFNDECLARE eciSetVoiceParam(ECIHand hEngine, int iVoice, enum ECIVoiceParam Param, int iValue)
+{
+	fake_engine_t *engine = hEngine;
+	int old;
+
+	if (iVoice < 0 || iVoice >= MAX_VOICES
+	    || Param < 0 || Param >= eciNumVoiceParams)
+		return -1;
+	old = engine->voices[iVoice][Param];
+	engine->voices[iVoice][Param] = iValue;
+	fake_voice_params++;
+	if (old == iValue)
+		fake_redundant_voice_params++;
+	fake_write_stats();
+	return old;
+}
+
+static int fake_sample_rate(fake_engine_t * engine)
+{
+	switch (engine->params[eciSampleRate]) {
+	case 0:
+		return 8000;
+	case 1:
+		return 11025;
+	case 3:
+		return 16000;
+	default:
+		return 22050;
+	}
+}
+
+/* Annotations, which start with a backquote, are not spoken */
+Boolean ECIFNDECLARE eciAddText(ECIHand hEngine, ECIInputText pText)
+{
+	fake_engine_t *engine = hEngine;
+
+	if (strchr(pText, '`') == NULL)
+		engine->samples += (long)strlen(pText)
+		    * FAKE_IBMECI_MS_PER_CHAR * fake_sample_rate(engine) / 1000;
+	return 1;
+}
+
+Boolean ECIFNDECLARE eciInsertIndex(ECIHand hEngine, int iIndex)
+{
+	fake_engine_t *engine = hEngine;
+
+	if (engine->num_indexes == MAX_INDEXES)
+		return 0;
+	engine->indexes[engine->num_indexes].index = iIndex;
+	engine->indexes[engine->num_indexes].samples = engine->samples;
+	engine->num_indexes++;
+	engine->samples = 0;
+	return 1;
+}
+
+Boolean ECIFNDECLARE eciSynthesize(ECIHand hEngine)
+{
+	fake_engine_t *engine = hEngine;
+
+	fake_synthesized = engine->params[eciLanguageDialect];
+	fake_write_stats();
+	return 1;
+}
+
+Boolean ECIFNDECLARE eciStop(ECIHand hEngine)
+{
+	fake_engine_t *engine = hEngine;
+
+	engine->num_indexes = 0;
+	engine->samples = 0;
+	return 1;
+}
+
+/* Hands _samples_ of silence to the callback, as many at a time as the
+   output buffer holds, returns whether the callback asked to abort */
+static int fake_synthesize(fake_engine_t * engine, long samples)
+{
+	int n;
+
+	while (samples > 0 && engine->buffer != NULL) {
+		n = samples < engine->buffer_size ? samples : engine->buffer_size;
+		memset(engine->buffer, 0, n * sizeof(short));
+		if (engine->callback(engine, eciWaveformBuffer, n,
+				     engine->data) == eciDataAbort)
+			return 1;
+		samples -= n;
+	}
+	return 0;
+}
+
+/* Synthesizing takes no time, the output is all produced right away */
+Boolean ECIFNDECLARE eciSynchronize(ECIHand hEngine)
+{
+	fake_engine_t *engine = hEngine;
+	int i;
+
+	if (engine->callback != NULL) {
+		for (i = 0; i < engine->num_indexes; i++)
+			if (fake_synthesize(engine, engine->indexes[i].samples)
+			    || engine->callback(hEngine, eciIndexReply,
+						engine->indexes[i].index,
+						engine->data) == eciDataAbort)
+				break;
+		if (i == engine->num_indexes)
+			fake_synthesize(engine, engine->samples);
+	}
+	engine->num_indexes = 0;
+	engine->samples = 0;
+	return 1;
+}
+
+Boolean ECIFNDECLARE eciSetOutputBuffer(ECIHand hEngine, int iSize, short *psBuffer)
+{
+	fake_engine_t *engine = hEngine;
+
+	engine->buffer = psBuffer;
+	engine->buffer_size = iSize;
+	return 1;
+}
+
+void ECIFNDECLARE eciRegisterCallback(ECIHand hEngine, ECICallback Callback, void *pData)
+{
+	fake_engine_t *engine = hEngine;
+
+	engine->callback = Callback;
+	engine->data = pData;
+}
+
+ECIDictHand ECIFNDECLARE eciNewDict(ECIHand hEngine)
+{
+	return &fake_dict;
+}
+
+ECIDictHand ECIFNDECLARE eciGetDict(ECIHand hEngine)
+{
+	fake_engine_t *engine = hEngine;
+
+	return engine->dict;
+}
+
+enum ECIDictError ECIFNDECLARE eciSetDict(ECIHand hEngine, ECIDictHand hDict)
+{
+	fake_engine_t *engine = hEngine;
+
+	engine->dict = hDict;
+	return DictNoError;
+}
+
+ECIDictHand ECIFNDECLARE eciDeleteDict(ECIHand hEngine, ECIDictHand hDict)
+{
+	fake_engine_t *engine = hEngine;
+
+	if (engine->dict == hDict)
+		engine->dict = NULL;
+	return NULL;
+}
+
+enum ECIDictError ECIFNDECLARE eciLoadDict(ECIHand hEngine, ECIDictHand hDict, enum ECIDictVolume DictVol, ECIInputText pFilename)
+{
+	return DictNoError;
+}
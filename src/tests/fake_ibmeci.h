@@ -0,0 +1,31 @@
+/*
+ * fake_ibmeci.h -- What the fake IBM TTS library reports to the tests
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1, or (at your option) any later
+ * version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FAKE_IBMECI_H
+#define __FAKE_IBMECI_H
+
+/* "<instances created> <dialects loaded> <dialect last synthesized>
+   <voice parameters set> <of which to the value they had>", the dialect
+   in hexadecimal */
+#define FAKE_IBMECI_STATS "/tmp/spd-fake-ibmeci"
+
+/* How long the fake speaks each character */
+#define FAKE_IBMECI_MS_PER_CHAR 10
+
+#endif /* #ifndef __FAKE_IBMECI_H */
@@ -0,0 +1,176 @@
+
+/*
+ * fake_ibmtts.c - Running sd_ibmtts over the fake IBM TTS library
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The module is pointed to the fake library and to the faulty audio
+ * output through the library paths of the dynamic linker and of libltdl,
+ * both are in the .libs directory of the tests.  Nothing but starting it
+ * is specific to sd_ibmtts, so other modules run over a fake engine
+ * library the same way.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "fake_ibmtts.h"
+
+long fake_ibmtts_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+void fake_ibmtts_command(TFakeModule * module, const char *cmd,
+			 const char *code)
+{
+	char line[1024];
+
+	if (cmd != NULL) {
+		fputs(cmd, module->to);
+		fflush(module->to);
+	}
+	while (fgets(line, sizeof(line), module->from) != NULL) {
+		if (!strncmp(line, code, strlen(code)))
+			return;
+		if (line[0] == '3' || line[0] == '4') {
+			printf("%s answered %s", cmd ? cmd : "The module", line);
+			exit(1);
+		}
+	}
+	printf("The module went away waiting for %s\n", code);
+	exit(1);
+}
+
+int fake_module_start(TFakeModule * module, const char *name,
+		      const char *preload, const char *config,
+		      const char *log, const char *audio)
+{
+	char path[256];
+	int to[2], from[2], err;
+	char line[1024];
+	FILE *f;
+
+	snprintf(module->config, sizeof(module->config),
+		 "/tmp/fake_%s-%d.conf", name, (int)getpid());
+	f = fopen(module->config, "w");
+	if (f == NULL) {
+		perror(module->config);
+		exit(1);
+	}
+	fputs(config, f);
+	fclose(f);
+
+	if (pipe(to) != 0 || pipe(from) != 0) {
+		perror("pipe");
+		exit(1);
+	}
+
+	module->pid = fork();
+	if (module->pid == -1) {
+		perror("fork");
+		exit(1);
+	}
+	if (module->pid == 0) {
+		dup2(to[0], 0);
+		dup2(from[1], 1);
+		if (log != NULL)
+			err = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		else
+			err = open("/dev/null", O_WRONLY);
+		dup2(err, 2);
+		close(to[1]);
+		close(from[0]);
+		/* The module may have been linked with the run path of a
+		   real library, preloading takes over its symbols anyway.
+		   Shims it was linked with are in the modules directory. */
+		setenv("LD_LIBRARY_PATH", TESTLIBSDIR ":" MODULEBUILDDIR, 1);
+		snprintf(path, sizeof(path), TESTLIBSDIR "/%s", preload);
+		setenv("LD_PRELOAD", path, 1);
+		setenv("LTDL_LIBRARY_PATH", TESTLIBSDIR, 1);
+		snprintf(path, sizeof(path), MODULEBUILDDIR "/sd_%s", name);
+		execl(path, path, module->config, (char *)NULL);
+		_exit(127);
+	}
+
+	close(to[0]);
+	close(from[1]);
+	module->to = fdopen(to[1], "w");
+	module->from = fdopen(from[0], "r");
+
+	fake_ibmtts_command(module, "INIT\n", "299 ");
+
+	fake_ibmtts_command(module, "AUDIO\n", "207");
+	fprintf(module->to, "%s.\n",
+		audio != NULL ? audio : "audio_output_method=faulty\n");
+	fflush(module->to);
+	while (fgets(line, sizeof(line), module->from) != NULL) {
+		if (!strncmp(line, "203", 3))
+			return 0;
+		if (!strncmp(line, "300 ", 4))
+			return -1;
+	}
+	printf("The module went away opening the audio output\n");
+	exit(1);
+}
+
+int fake_ibmtts_start(TFakeModule * module, const char *config,
+		      const char *log, const char *audio)
+{
+	return fake_module_start(module, "ibmtts", "libibmeci.so", config, log,
+				 audio);
+}
+
+void fake_ibmtts_set(TFakeModule * module, const char *settings)
+{
+	fake_ibmtts_command(module, "SET\n", "203");
+	fputs(settings, module->to);
+	fake_ibmtts_command(module, ".\n", "203");
+}
+
+long fake_ibmtts_speak(TFakeModule * module, const char *text)
+{
+	long start = fake_ibmtts_now();
+
+	fake_ibmtts_command(module, "SPEAK\n", "202");
+	fputs(text, module->to);
+	fake_ibmtts_command(module, "\n.\n", "200");
+	fake_ibmtts_command(module, NULL, "702");
+	return fake_ibmtts_now() - start;
+}
+
+void fake_ibmtts_quit(TFakeModule * module)
+{
+	fake_ibmtts_command(module, "QUIT\n", "210");
+	fclose(module->to);
+	waitpid(module->pid, NULL, 0);
+	fclose(module->from);
+	unlink(module->config);
+}
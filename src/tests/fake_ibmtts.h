@@ -0,0 +1,64 @@
+/*
+ * fake_ibmtts.h - Running sd_ibmtts over the fake IBM TTS library
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FAKE_IBMTTS_H
+#define __FAKE_IBMTTS_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+typedef struct {
+	pid_t pid;
+	FILE *to, *from;
+	char config[64];
+} TFakeModule;
+
+/* Starts sd_ibmtts of the build tree over the fake library with the
+   configuration lines _config_, its standard error going to the file
+   _log_ if it is not NULL, then initializes it and its audio output with
+   the settings lines _audio_. If _audio_ is NULL, the faulty output of
+   the tests is used, which fails only on request. Returns -1 if the audio
+   output can't be opened, exits on other errors. */
+int fake_ibmtts_start(TFakeModule * module, const char *config,
+		      const char *log, const char *audio);
+
+/* The same for sd__name_ over the fake library _preload_, which is
+   in the .libs directory of the tests, e.g. "kali", "libfakekali.so" */
+int fake_module_start(TFakeModule * module, const char *name,
+		      const char *preload, const char *config,
+		      const char *log, const char *audio);
+
+/* Sends _cmd_ unless it is NULL, then waits for the first line starting
+   with _code_, skipping events. Exits if the module answers with an
+   error or goes away. */
+void fake_ibmtts_command(TFakeModule * module, const char *cmd,
+			 const char *code);
+
+/* Sets the settings lines _settings_, e.g. "language=fr-FR\n" */
+void fake_ibmtts_set(TFakeModule * module, const char *settings);
+
+/* Speaks _text_, returns how long it took until END in ms */
+long fake_ibmtts_speak(TFakeModule * module, const char *text);
+
+void fake_ibmtts_quit(TFakeModule * module);
+
+/* Current time in ms */
+long fake_ibmtts_now(void);
+
+#endif /* #ifndef __FAKE_IBMTTS_H */
@@ -0,0 +1,222 @@
+/*
+ * fake_kali.cpp -- A fake Kali library, for testing sd_kali
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1, or (at your option) any later
+ * version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Unlike the shims in src/modules, which only let the module link, this
+ * one runs, in place of all of the Kali libraries at once: MessageKali
+ * takes FAKE_KALI_SYNTH_MS ms and produces FAKE_KALI_MS_PER_CHAR ms of
+ * silence per character of its text, at FAKE_KALI_SAMPLE_RATE.  How many
+ * chunks were synthesized and how many samples they made are written to
+ * FAKE_KALI_STATS each time.  There is a single voice, Patrick, speaking
+ * French.  The module only calls in from one thread at a time, so this
+ * is not locked.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <kali/Kali/kali.h>
+
+extern "C" {
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include "fake_kali.h"
+}
+
+static AudioTrackKali fake_track;
+static signed short *fake_buffer;
+static long fake_buffer_size;
+
+static int fake_chunks;
+static long fake_samples;
+
+static void fake_write_stats(void)
+{
+	FILE *f;
+
+	f = fopen(FAKE_KALI_STATS, "w");
+	if (f == NULL)
+		return;
+	fprintf(f, "%d %ld\n", fake_chunks, fake_samples);
+	fclose(f);
+}
+
+extern "C" {
+
+bool initGlobal(void) {
+	return true;
+}
+
+bool initParle(void) {
+	return true;
+}
+
+bool initTrans(void) {
+	return true;
+}
+
+bool initAnalyse(void) {
+	return true;
+}
+
+bool initKali(void) {
+	return true;
+}
+
+const AudioTrackKali *GetBufMultiKaliStd(short nK) {
+	return &fake_track;
+}
+
+void SetSortieBufMultiKaliStd(short nK, bool sortieBuf) {
+}
+
+void SetSortieSonMultiKaliStd(short nK, bool sortieSon) {
+}
+
+
+short GetDebitDefautKaliStd(void) {
+	return 70;
+}
+
+short GetDebitMinKaliStd(void) {
+	return 20;
+}
+
+short GetDebitMaxKaliStd(void) {
+	return 250;
+}
+
+void SetDebitKali(short debit) {
+}
+
+
+short GetVolumeDefautKaliStd(void) {
+	return 10;
+}
+
+short GetVolumeMinKaliStd(void) {
+	return 0;
+}
+
+short GetVolumeMaxKaliStd(void) {
+	return 20;
+}
+
+void SetVolumeKali(short volume) {
+}
+
+
+short GetHauteurDefautKaliStd(void) {
+	return 6;
+}
+
+short GetHauteurMinKaliStd(void) {
+	return 0;
+}
+
+short GetHauteurMaxKaliStd(void) {
+	return 15;
+}
+
+void SetHauteurKali(short hauteur) {
+}
+
+
+void SetModeLectureKali(short modeLecture) {
+}
+
+
+short GetNLangueVoixKaliStd(short nVoix) {
+	return 1;
+}
+
+char *GetNomLangueKali(short nLangue, char *nomLangue) {
+	strcpy(nomLangue, "fr");
+	return nomLangue;
+}
+
+void SetLangueKali(short nLangue) {
+}
+
+short GetNbVoixKali(void) {
+	return 1;
+}
+
+char *GetNomVoixKali(short nVoix, char *nomVoix) {
+	strcpy(nomVoix, "Patrick");
+	return nomVoix;
+}
+
+void SetVoixKali(short nVoix) {
+}
+
+
+/* Synthesizes the whole chunk right away, so there is no index left for
+   QueryIndexKali to wait for */
+short MessageKali(unsigned char *texte) {
+	long samples = (long)strlen((char *)texte)
+	    * FAKE_KALI_MS_PER_CHAR * FAKE_KALI_SAMPLE_RATE / 1000;
+
+	if (samples > fake_buffer_size) {
+		free(fake_buffer);
+		fake_buffer = (signed short *)calloc(samples, sizeof(short));
+		if (fake_buffer == NULL) {
+			fake_buffer_size = 0;
+			return -1;
+		}
+		fake_buffer_size = samples;
+	}
+	usleep(FAKE_KALI_SYNTH_MS * 1000);
+
+	fake_track.bits = 16;
+	fake_track.num_channels = 1;
+	fake_track.sample_rate = FAKE_KALI_SAMPLE_RATE;
+	fake_track.num_samples = samples;
+	fake_track.samples = fake_buffer;
+
+	fake_chunks++;
+	fake_samples += samples;
+	fake_write_stats();
+	return 0;
+}
+
+short QueryIndexKali(void) {
+	return 0;
+}
+
+
+bool quitteGlobal(void) {
+	return true;
+}
+
+bool quitteParle(void) {
+	return true;
+}
+
+bool quitteTrans(void) {
+	return true;
+}
+
+bool quitteAnalyse(void) {
+	return true;
+}
+
+}
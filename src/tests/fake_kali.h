@@ -0,0 +1,34 @@
+/*
+ * fake_kali.h - A fake Kali library, for testing sd_kali
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1, or (at your option) any later
+ * version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FAKE_KALI_H
+#define __FAKE_KALI_H
+
+/* "<chunks synthesized> <samples produced>" */
+#define FAKE_KALI_STATS "/tmp/spd-fake-kali"
+
+/* How long the fake speaks each character */
+#define FAKE_KALI_MS_PER_CHAR 10
+
+/* How long synthesizing a chunk takes, whatever its length */
+#define FAKE_KALI_SYNTH_MS 100
+
+#define FAKE_KALI_SAMPLE_RATE 22050
+
+#endif /* #ifndef __FAKE_KALI_H */
@@ -0,0 +1,251 @@
+
+/*
+ * faulty_audio.c -- An audio output which fails on request, for testing
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1, or (at your option) any later
+ * version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The sound is not played anywhere, playing just takes as long as the
+ * track lasts.  FAULTY_CONTROL holds two numbers: how many of the next
+ * writes are to fail and how many of the next attempts at opening the
+ * output.  They are counted down in the file itself, since the plugin
+ * is unloaded when the output is closed.
+ *
+ * A stream begun with begin() behaves like a device buffer: feeding it
+ * returns FAULTY_OVERLAP before the audio fed so far is played, delay()
+ * tells how much is left, and a stream which ran out of audio before it
+ * was ended is logged to FAULTY_UNDERRUNS, like an ALSA underrun.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <unistd.h>
+#include <glib.h>
+
+#define SPD_AUDIO_PLUGIN_ENTRY spd_faulty_LTX_spd_audio_plugin_get
+#include <spd_audio_plugin.h>
+
+#include "faulty_audio.h"
+
+typedef struct {
+	AudioID id;
+	volatile int stop_requested;
+	int sample_rate;	/* Of the stream begun, 0 if none */
+	gint64 played_until;	/* When the audio fed to it will be played */
+} spd_faulty_id_t;
+
+/* How long before the end of the audio fed a feed returns, in us */
+#define FAULTY_OVERLAP (20 * 1000)
+/* How long a stream may be out of audio before it counts, in us */
+#define FAULTY_UNDERRUN_SLACK (10 * 1000)
+
+static int faulty_log_level;
+
+/* Counts down entry _which_ of FAULTY_CONTROL, returns whether it was
+   not 0 yet */
+static int faulty_fail(int which)
+{
+	int counts[2] = { 0, 0 };
+	FILE *f;
+	int ret = 0;
+
+	f = fopen(FAULTY_CONTROL, "r+");
+	if (f == NULL)
+		return 0;
+	if (fscanf(f, "%d %d", &counts[0], &counts[1]) >= 1
+	    && counts[which] > 0) {
+		counts[which]--;
+		rewind(f);
+		fprintf(f, "%d %d\n", counts[0], counts[1]);
+		ret = 1;
+	}
+	fclose(f);
+	return ret;
+}
+
+static AudioID *faulty_open(void **pars)
+{
+	spd_faulty_id_t *faulty_id;
+
+	if (faulty_fail(1)) {
+		if (faulty_log_level)
+			fprintf(stderr, "Faulty: failing to open\n");
+		return NULL;
+	}
+
+	faulty_id = g_malloc0(sizeof(spd_faulty_id_t));
+	return (AudioID *) faulty_id;
+}
+
+static int faulty_play(AudioID * id, AudioTrack track)
+{
+	spd_faulty_id_t *faulty_id = (spd_faulty_id_t *) id;
+	gint64 end;
+
+	if (faulty_fail(0)) {
+		if (faulty_log_level)
+			fprintf(stderr, "Faulty: failing to write\n");
+		return -1;
+	}
+	if (track.sample_rate <= 0)
+		return 0;
+
+	faulty_id->stop_requested = 0;
+	end = g_get_monotonic_time() + (gint64) track.num_samples
+	    * G_USEC_PER_SEC / track.sample_rate;
+	while (!faulty_id->stop_requested && g_get_monotonic_time() < end)
+		g_usleep(5000);
+	return 0;
+}
+
+/* Waits until monotonic time _until_ or a stop */
+static void faulty_wait(spd_faulty_id_t * faulty_id, gint64 until)
+{
+	while (!faulty_id->stop_requested && g_get_monotonic_time() < until)
+		g_usleep(5000);
+}
+
+/* Logs an underrun if the stream ran out of audio before _now_ */
+static void faulty_check_underrun(spd_faulty_id_t * faulty_id, gint64 now)
+{
+	FILE *f;
+
+	if (faulty_id->played_until == 0 || faulty_id->stop_requested
+	    || now <= faulty_id->played_until + FAULTY_UNDERRUN_SLACK)
+		return;
+
+	if (faulty_log_level)
+		fprintf(stderr, "Faulty: underrun\n");
+	f = fopen(FAULTY_UNDERRUNS, "a");
+	if (f != NULL) {
+		fprintf(f, "%ld ms\n",
+			(long)((now - faulty_id->played_until) / 1000));
+		fclose(f);
+	}
+}
+
+static int faulty_begin(AudioID * id, AudioTrack track)
+{
+	spd_faulty_id_t *faulty_id = (spd_faulty_id_t *) id;
+
+	faulty_id->stop_requested = 0;
+	faulty_id->sample_rate = track.sample_rate;
+	faulty_id->played_until = 0;
+	return 0;
+}
+
+static int faulty_feed_sync_overlap(AudioID * id, AudioTrack track)
+{
+	spd_faulty_id_t *faulty_id = (spd_faulty_id_t *) id;
+	gint64 now;
+
+	if (faulty_fail(0)) {
+		if (faulty_log_level)
+			fprintf(stderr, "Faulty: failing to write\n");
+		return -1;
+	}
+	if (track.sample_rate <= 0)
+		return 0;
+
+	faulty_id->stop_requested = 0;
+	now = g_get_monotonic_time();
+	faulty_check_underrun(faulty_id, now);
+	faulty_id->played_until = MAX(now, faulty_id->played_until)
+	    + (gint64) track.num_samples * G_USEC_PER_SEC / track.sample_rate;
+	faulty_wait(faulty_id, faulty_id->played_until - FAULTY_OVERLAP);
+	return 0;
+}
+
+static int faulty_end(AudioID * id)
+{
+	spd_faulty_id_t *faulty_id = (spd_faulty_id_t *) id;
+
+	faulty_check_underrun(faulty_id, g_get_monotonic_time());
+	faulty_wait(faulty_id, faulty_id->played_until);
+	faulty_id->sample_rate = 0;
+	faulty_id->played_until = 0;
+	return 0;
+}
+
+static long faulty_delay(AudioID * id)
+{
+	spd_faulty_id_t *faulty_id = (spd_faulty_id_t *) id;
+	gint64 left;
+
+	if (faulty_id->sample_rate <= 0)
+		return 0;
+	left = faulty_id->played_until - g_get_monotonic_time();
+	if (left <= 0)
+		return 0;
+	return left * faulty_id->sample_rate / G_USEC_PER_SEC;
+}
+
+static int faulty_stop(AudioID * id)
+{
+	spd_faulty_id_t *faulty_id = (spd_faulty_id_t *) id;
+
+	faulty_id->stop_requested = 1;
+	return 0;
+}
+
+static int faulty_close(AudioID * id)
+{
+	g_free(id);
+	return 0;
+}
+
+static int faulty_set_volume(AudioID * id, int volume)
+{
+	return 0;
+}
+
+static void faulty_set_loglevel(int level)
+{
+	faulty_log_level = level;
+}
+
+static char const *faulty_get_playcmd(void)
+{
+	return NULL;
+}
+
+static spd_audio_plugin_t faulty_functions = {
+	"faulty",
+	faulty_open,
+	faulty_play,
+	faulty_stop,
+	faulty_close,
+	faulty_set_volume,
+	faulty_set_loglevel,
+	faulty_get_playcmd,
+	faulty_begin,
+	NULL,
+	faulty_feed_sync_overlap,
+	faulty_end,
+	faulty_delay,
+};
+
+spd_audio_plugin_t *faulty_plugin_get(void)
+{
+	return &faulty_functions;
+}
+
+spd_audio_plugin_t *SPD_AUDIO_PLUGIN_ENTRY(void)
+    __attribute__ ((weak, alias("faulty_plugin_get")));
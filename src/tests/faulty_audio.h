@@ -0,0 +1,28 @@
+/*
+ * faulty_audio.h -- Control of the faulty audio output used by audio_failover
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1, or (at your option) any later
+ * version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FAULTY_AUDIO_H
+#define __FAULTY_AUDIO_H
+
+/* "<failing writes> <failing opens>" */
+#define FAULTY_CONTROL "/tmp/spd-faulty-audio"
+/* A line for each time a stream ran out of audio while it was open */
+#define FAULTY_UNDERRUNS "/tmp/spd-faulty-underruns"
+
+#endif /* #ifndef __FAULTY_AUDIO_H */
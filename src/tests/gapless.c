@@ -0,0 +1,131 @@
+
+/*
+ * gapless.c - Test of messages played back to back on an open audio stream
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: gapless
+ *
+ * Runs sd_ibmtts of the build tree over the fake IBM TTS library and the
+ * faulty audio output, no server and no sound device are needed. Messages
+ * are sent as soon as the previous one ended, like the server does. With
+ * GaplessTimeout, each of them must be appended to the stream left open
+ * by the previous one, at most MAX_GAP ms after the previous one was
+ * played, as the module logs it. With GaplessTimeout 0 none may be.
+ * The faulty output behaves like a device buffer which must never run out
+ * of audio while the stream is open, whether lingering or not.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fake_ibmtts.h"
+#include "faulty_audio.h"
+
+#define MESSAGES 5
+#define TEXT "Played right after the previous message."
+/* Longest acceptable silence between two messages, in ms */
+#define MAX_GAP 50
+/* After which the whole test is considered stuck, in seconds */
+#define TEST_TIMEOUT 60
+
+/* Speaks MESSAGES messages with GaplessTimeout _timeout_, returns how
+   many reused the stream, the longest gap in _max_gap_ and how many times
+   the output ran out of audio in _underruns_ */
+static int run(int timeout, long *max_gap, int *underruns)
+{
+	TFakeModule module;
+	char config[64], log[64], line[1024], *p;
+	int i, reused = 0;
+	long gap;
+	FILE *f;
+
+	snprintf(config, sizeof(config), "GaplessTimeout %d\nDebug 1\n",
+		 timeout);
+	snprintf(log, sizeof(log), "/tmp/gapless-%d.log", (int)getpid());
+	unlink(FAULTY_UNDERRUNS);
+	if (fake_ibmtts_start(&module, config, log, NULL) != 0) {
+		printf("The faulty audio output can't be opened\n");
+		exit(1);
+	}
+	for (i = 0; i < MESSAGES; i++)
+		fake_ibmtts_speak(&module, TEXT);
+	fake_ibmtts_quit(&module);
+
+	*max_gap = 0;
+	f = fopen(log, "r");
+	if (f == NULL) {
+		perror(log);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		p = strstr(line, "Gapless: ");
+		if (p == NULL || sscanf(p, "Gapless: %ld ms", &gap) != 1)
+			continue;
+		reused++;
+		if (gap > *max_gap)
+			*max_gap = gap;
+	}
+	fclose(f);
+	unlink(log);
+
+	*underruns = 0;
+	f = fopen(FAULTY_UNDERRUNS, "r");
+	if (f != NULL) {
+		while (fgets(line, sizeof(line), f) != NULL)
+			(*underruns)++;
+		fclose(f);
+		unlink(FAULTY_UNDERRUNS);
+	}
+
+	printf("GaplessTimeout %d: %d of %d messages reused the stream, "
+	       "%ld ms apart at most, %d underruns\n", timeout, reused,
+	       MESSAGES - 1, *max_gap, *underruns);
+	return reused;
+}
+
+int main(int argc, char *argv[])
+{
+	long max_gap;
+	int underruns;
+	int errors = 0;
+
+	alarm(TEST_TIMEOUT);
+
+	printf("Gapless playback test\n\n");
+	printf("With GaplessTimeout, each of %d messages after the first must\n",
+	       MESSAGES - 1);
+	printf("be played on the stream of the previous one, at most %d ms\n",
+	       MAX_GAP);
+	printf("after it, and the output must never run out of audio.\n\n");
+	fflush(stdout);
+
+	if (run(0, &max_gap, &underruns) != 0 || underruns)
+		errors++;
+	if (run(250, &max_gap, &underruns) != MESSAGES - 1 || max_gap > MAX_GAP
+	    || underruns)
+		errors++;
+
+	exit(errors ? 1 : 0);
+}
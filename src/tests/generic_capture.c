@@ -0,0 +1,193 @@
+
+/*
+ * generic_capture.c - Test of the generic module playing captured sound
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Needs the generic-wav output module, see generic-wav.conf.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "speechd_types.h"
+#include <libspeechd.h>
+
+#define MODULE "generic-wav"
+/* Only the marks of the client are reported to it, not the ones the
+   server inserts itself */
+#define MARKED_TEXT "<speak>Hello.<mark name=\"one\"/> This is a test." \
+	"<mark name=\"two\"/> Goodbye.</speak>"
+#define MARKED_TEXT_MARKS 2
+#define LONG_TEXT_SIZE 4000
+/* How long to wait for a single event, in seconds */
+#define EVENT_TIMEOUT 30
+/* Longest acceptable time from cancelling to the CANCEL event, in ms */
+#define MAX_STOP_LATENCY 300
+
+static pthread_mutex_t event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t event_cond = PTHREAD_COND_INITIALIZER;
+static SPDNotificationType last_event = -1;
+static int marks;
+
+static long now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+static void event_cb(size_t msg_id, size_t client_id, SPDNotificationType type)
+{
+	pthread_mutex_lock(&event_mutex);
+	last_event = type;
+	pthread_cond_signal(&event_cond);
+	pthread_mutex_unlock(&event_mutex);
+}
+
+static void mark_cb(size_t msg_id, size_t client_id, SPDNotificationType type,
+		    char *index_mark)
+{
+	pthread_mutex_lock(&event_mutex);
+	marks++;
+	pthread_mutex_unlock(&event_mutex);
+}
+
+/* Wait for event _type_, return 0 on success */
+static int wait_event(SPDNotificationType type)
+{
+	struct timespec deadline;
+	int ret = 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += EVENT_TIMEOUT;
+	pthread_mutex_lock(&event_mutex);
+	while (last_event != type && ret == 0)
+		ret = pthread_cond_timedwait(&event_cond, &event_mutex,
+					     &deadline);
+	pthread_mutex_unlock(&event_mutex);
+	return last_event == type ? 0 : -1;
+}
+
+static void reset_event(void)
+{
+	pthread_mutex_lock(&event_mutex);
+	last_event = -1;
+	pthread_mutex_unlock(&event_mutex);
+}
+
+int main(int argc, char *argv[])
+{
+	SPDConnection *conn;
+	char *text;
+	const char *sentence = "This sentence is synthesized by a shell script. ";
+	size_t len, slen = strlen(sentence);
+	long start, elapsed;
+
+	conn = spd_open("test", "generic_capture", NULL, SPD_MODE_THREADED);
+	if (conn == NULL) {
+		printf("Speech Dispatcher failed\n");
+		exit(1);
+	}
+
+	printf("Generic module sound capture test\n\n");
+	printf("The " MODULE " module plays the WAV written by generic_wav.sh\n");
+	printf("through its own audio output. A short message must end with\n");
+	printf("its index marks reported, and a long one must be cancelled\n");
+	printf("within %d ms.\n", MAX_STOP_LATENCY);
+	fflush(stdout);
+
+	if (spd_set_output_module(conn, MODULE) == -1) {
+		printf("Can't select the " MODULE " module\n");
+		exit(1);
+	}
+
+	conn->callback_begin = event_cb;
+	conn->callback_end = event_cb;
+	conn->callback_cancel = event_cb;
+	conn->callback_im = mark_cb;
+	if (spd_set_notification_on(conn, SPD_BEGIN) == -1
+	    || spd_set_notification_on(conn, SPD_END) == -1
+	    || spd_set_notification_on(conn, SPD_CANCEL) == -1
+	    || spd_set_notification_on(conn, SPD_INDEX_MARKS) == -1) {
+		printf("Can't set notifications\n");
+		exit(1);
+	}
+
+	if (spd_set_data_mode(conn, SPD_DATA_SSML) == -1) {
+		printf("Can't switch to SSML\n");
+		exit(1);
+	}
+	reset_event();
+	start = now_ms();
+	if (spd_say(conn, SPD_TEXT, MARKED_TEXT) == -1) {
+		printf("Message failed\n");
+		exit(1);
+	}
+	if (wait_event(SPD_EVENT_END) != 0) {
+		printf("Short message did not end\n");
+		exit(1);
+	}
+	pthread_mutex_lock(&event_mutex);
+	printf("Short message took %ld ms, %d index marks reported\n",
+	       now_ms() - start, marks);
+	if (marks != MARKED_TEXT_MARKS) {
+		printf("Expected %d index marks\n", MARKED_TEXT_MARKS);
+		exit(1);
+	}
+	pthread_mutex_unlock(&event_mutex);
+	spd_set_data_mode(conn, SPD_DATA_TEXT);
+
+	text = malloc(LONG_TEXT_SIZE + 1);
+	for (len = 0; len + slen <= LONG_TEXT_SIZE; len += slen)
+		memcpy(text + len, sentence, slen);
+	text[len] = '\0';
+
+	reset_event();
+	if (spd_say(conn, SPD_TEXT, text) == -1) {
+		printf("Message failed\n");
+		exit(1);
+	}
+	free(text);
+	if (wait_event(SPD_EVENT_BEGIN) != 0) {
+		printf("Long message not started\n");
+		exit(1);
+	}
+
+	sleep(1);
+	reset_event();
+	start = now_ms();
+	spd_cancel(conn);
+	if (wait_event(SPD_EVENT_CANCEL) != 0) {
+		printf("Long message not cancelled\n");
+		exit(1);
+	}
+	elapsed = now_ms() - start;
+	printf("Cancelling took %ld ms\n", elapsed);
+
+	spd_close(conn);
+	exit(elapsed <= MAX_STOP_LATENCY ? 0 : 1);
+}
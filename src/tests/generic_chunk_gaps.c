@@ -0,0 +1,168 @@
+
+/*
+ * generic_chunk_gaps.c - Test of the silence between the pieces of text
+ * synthesized by the generic module
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Needs the generic-slow output module, see generic-slow.conf.
+ *
+ * Every sentence gets an index mark at its end, and generic_wav.sh makes
+ * 60 ms of sound per character, so the time between two marks is the
+ * length of the sentence plus the silence before it. The marks are sent
+ * in SSML, only those of the client are reported to it.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "speechd_types.h"
+#include <libspeechd.h>
+
+#define MODULE "generic-slow"
+#define SENTENCE "This sentence takes a while to say."
+#define MARK "<mark name=\"s%d\"/> "
+#define SENTENCES 8
+#define MS_PER_CHAR 60
+/* How long to wait for the message to end, in seconds */
+#define END_TIMEOUT 60
+/* Longest acceptable silence between two sentences, in ms */
+#define MAX_GAP 250
+
+static pthread_mutex_t event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t event_cond = PTHREAD_COND_INITIALIZER;
+static int ended;
+static long mark_times[SENTENCES];
+static int marks;
+
+static long now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+static void end_cb(size_t msg_id, size_t client_id, SPDNotificationType type)
+{
+	pthread_mutex_lock(&event_mutex);
+	ended = 1;
+	pthread_cond_signal(&event_cond);
+	pthread_mutex_unlock(&event_mutex);
+}
+
+static void mark_cb(size_t msg_id, size_t client_id, SPDNotificationType type,
+		    char *index_mark)
+{
+	pthread_mutex_lock(&event_mutex);
+	if (marks < SENTENCES)
+		mark_times[marks++] = now_ms();
+	pthread_mutex_unlock(&event_mutex);
+}
+
+int main(int argc, char *argv[])
+{
+	SPDConnection *conn;
+	struct timespec deadline;
+	char text[SENTENCES * (sizeof(SENTENCE) + sizeof(MARK) + 8) + 32];
+	size_t len;
+	long sentence_ms, gap, total = 0, max = 0;
+	int i, ret = 0;
+
+	conn = spd_open("test", "generic_chunk_gaps", NULL, SPD_MODE_THREADED);
+	if (conn == NULL) {
+		printf("Speech Dispatcher failed\n");
+		exit(1);
+	}
+
+	printf("Generic module chunk gap test\n\n");
+	printf("The " MODULE " module takes three seconds to synthesize each of\n");
+	printf("%d sentences, the silence between two of them must stay\n",
+	       SENTENCES);
+	printf("under %d ms.\n", MAX_GAP);
+	fflush(stdout);
+
+	if (spd_set_output_module(conn, MODULE) == -1) {
+		printf("Can't select the " MODULE " module\n");
+		exit(1);
+	}
+
+	conn->callback_end = end_cb;
+	conn->callback_im = mark_cb;
+	if (spd_set_notification_on(conn, SPD_END) == -1
+	    || spd_set_notification_on(conn, SPD_INDEX_MARKS) == -1) {
+		printf("Can't set notifications\n");
+		exit(1);
+	}
+
+	len = snprintf(text, sizeof(text), "<speak>");
+	for (i = 0; i < SENTENCES; i++)
+		len += snprintf(text + len, sizeof(text) - len,
+				SENTENCE MARK, i + 1);
+	snprintf(text + len, sizeof(text) - len, "</speak>");
+
+	if (spd_set_data_mode(conn, SPD_DATA_SSML) == -1) {
+		printf("Can't switch to SSML\n");
+		exit(1);
+	}
+	if (spd_say(conn, SPD_TEXT, text) == -1) {
+		printf("Message failed\n");
+		exit(1);
+	}
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += END_TIMEOUT;
+	pthread_mutex_lock(&event_mutex);
+	while (!ended && ret == 0)
+		ret = pthread_cond_timedwait(&event_cond, &event_mutex,
+					     &deadline);
+	pthread_mutex_unlock(&event_mutex);
+	if (!ended) {
+		printf("Message did not end\n");
+		exit(1);
+	}
+	if (marks != SENTENCES) {
+		printf("%d index marks reported instead of %d\n", marks,
+		       SENTENCES);
+		exit(1);
+	}
+
+	/* The sentences after the first one start with a space */
+	sentence_ms = (strlen(SENTENCE) + 1) * MS_PER_CHAR;
+	for (i = 1; i < marks; i++) {
+		gap = mark_times[i] - mark_times[i - 1] - sentence_ms;
+		if (gap < 0)
+			gap = 0;
+		printf("Silence before sentence %d: %ld ms\n", i + 1, gap);
+		total += gap;
+		if (gap > max)
+			max = gap;
+	}
+	printf("Silence between sentences: %ld ms on average, %ld ms at most\n",
+	       total / (marks - 1), max);
+
+	spd_close(conn);
+	exit(max <= MAX_GAP ? 0 : 1);
+}
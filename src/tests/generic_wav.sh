@@ -0,0 +1,78 @@
+#!/bin/sh
+
+# Copyright (C) 2024 Brailcom, o.p.s
+#
+# This program is free software; you can redistribute it and/or modify it under
+# the terms of the GNU General Public License as published by the Free Software
+# Foundation; either version 2 of the License, or (at your option) any later
+# version.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT ANY
+# WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+# PARTICULAR PURPOSE.  See the GNU General Public License for more details (file
+# COPYING in the root directory).
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#  A dummy synthesizer for the generic module, see generic-wav.conf
+#
+#  printf %s 'text' | ./generic_wav.sh [delay] > out.wav
+#
+#  Writes to its standard output a streamed WAV file (with a data size of
+#  0, as synthesizers writing to a pipe do) holding a 400 Hz tone of 60 ms
+#  per character read on its standard input, after sleeping _delay_
+#  seconds to pretend it takes time to synthesize.
+
+RATE=16000
+MS_PER_CHAR=60
+
+le16() {
+	printf "\\$(printf %o $(($1 & 255)))\\$(printf %o $(($1 >> 8 & 255)))"
+}
+
+le32() {
+	le16 $(($1 & 65535))
+	le16 $(($1 >> 16 & 65535))
+}
+
+chars=$(wc -c)
+samples=$((chars * MS_PER_CHAR * RATE / 1000))
+
+if [ -n "$1" ]; then
+	sleep "$1"
+fi
+
+printf "RIFF"
+le32 0
+printf "WAVEfmt "
+le32 16
+le16 1			# PCM
+le16 1			# mono
+le32 $RATE
+le32 $((RATE * 2))
+le16 2
+le16 16
+printf "data"
+le32 0
+
+# A square wave period: 20 samples at +3000, 20 at -3000
+high=$(le16 3000)
+low=$(le16 $((65536 - 3000)))
+period=""
+i=0
+while [ $i -lt 20 ]; do
+	period="$period$high"
+	i=$((i + 1))
+done
+i=0
+while [ $i -lt 20 ]; do
+	period="$period$low"
+	i=$((i + 1))
+done
+
+i=0
+while [ $i -lt $((samples / 40)) ]; do
+	printf "%s" "$period"
+	i=$((i + 1))
+done
@@ -0,0 +1,141 @@
+
+/*
+ * ibmtts_pool.c - Test of the language instance pool of the ibmtts module
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: ibmtts_pool
+ *
+ * Runs sd_ibmtts of the build tree over the fake IBM TTS library built
+ * along with the tests, no server and no TTS engine are needed. Messages
+ * switching languages are spoken with IbmttsLanguagePoolSize 1 and 2,
+ * and after each one the instances created and dialects loaded, as
+ * counted by the fake library, are checked against what the pool should
+ * have done.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "eci.h"
+
+#include "fake_ibmeci.h"
+#include "fake_ibmtts.h"
+
+/* After which the whole test is considered stuck, in seconds */
+#define TEST_TIMEOUT 60
+
+/* What is expected after each message */
+static const struct {
+	const char *language;
+	enum ECILanguageDialect dialect;
+	/* With a pool of 1, then of 2 instances */
+	int instances[2];
+	int loads[2];
+} steps[] = {
+	{ "en-US", eciGeneralAmericanEnglish, { 1, 1 }, { 1, 1 } },
+	{ "fr-FR", eciStandardFrench, { 1, 2 }, { 2, 2 } },
+	/* Both are kept with 2 instances */
+	{ "en-US", eciGeneralAmericanEnglish, { 1, 2 }, { 3, 2 } },
+	{ "fr-FR", eciStandardFrench, { 1, 2 }, { 4, 2 } },
+	/* en-US is the least recently used one */
+	{ "de-DE", eciStandardGerman, { 1, 2 }, { 5, 3 } },
+	{ "en-US", eciGeneralAmericanEnglish, { 1, 2 }, { 6, 4 } },
+	{ "de-DE", eciStandardGerman, { 1, 2 }, { 7, 4 } },
+	{ "fr-FR", eciStandardFrench, { 1, 2 }, { 8, 5 } },
+};
+
+static void read_stats(int *instances, int *loads, unsigned *dialect)
+{
+	FILE *f;
+
+	f = fopen(FAKE_IBMECI_STATS, "r");
+	if (f == NULL || fscanf(f, "%d %d %x", instances, loads, dialect) != 3) {
+		printf("The fake IBM TTS library was not used\n");
+		exit(1);
+	}
+	fclose(f);
+}
+
+/* Speak the messages of steps with a pool of _size_ instances, return
+   the number of steps which went wrong */
+static int run(int size)
+{
+	TFakeModule module;
+	char line[64];
+	int instances, loads;
+	unsigned dialect, i;
+	int errors = 0;
+
+	unlink(FAKE_IBMECI_STATS);
+
+	printf("With IbmttsLanguagePoolSize %d:\n", size);
+	snprintf(line, sizeof(line), "IbmttsLanguagePoolSize %d\n", size);
+	if (fake_ibmtts_start(&module, line, NULL, NULL) != 0) {
+		printf("The faulty audio output can't be opened\n");
+		exit(1);
+	}
+
+	for (i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+		snprintf(line, sizeof(line), "language=%s\n",
+			 steps[i].language);
+		fake_ibmtts_set(&module, line);
+		fake_ibmtts_speak(&module, "Switching languages.");
+
+		read_stats(&instances, &loads, &dialect);
+		printf("%s: %d instances, %d loads, spoken in 0x%08x\n",
+		       steps[i].language, instances, loads, dialect);
+		if (instances != steps[i].instances[size - 1]
+		    || loads != steps[i].loads[size - 1]
+		    || dialect != (unsigned)steps[i].dialect) {
+			printf("  expected %d instances, %d loads, 0x%08x\n",
+			       steps[i].instances[size - 1],
+			       steps[i].loads[size - 1], steps[i].dialect);
+			errors++;
+		}
+	}
+
+	fake_ibmtts_quit(&module);
+	printf("\n");
+	return errors;
+}
+
+int main(int argc, char *argv[])
+{
+	int errors;
+
+	alarm(TEST_TIMEOUT);
+
+	printf("ibmtts language pool test\n\n");
+	fflush(stdout);
+
+	errors = run(1);
+	errors += run(2);
+
+	unlink(FAKE_IBMECI_STATS);
+
+	if (errors)
+		printf("%d messages did not use the expected instance\n",
+		       errors);
+	exit(errors ? 1 : 0);
+}
@@ -0,0 +1,135 @@
+
+/*
+ * ibmtts_voice_switch.c - Test of the engine work of a voice switch in ibmtts
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: ibmtts_voice_switch
+ *
+ * Runs sd_ibmtts of the build tree over the fake IBM TTS library, with a
+ * single engine instance so that each language switch has to load a
+ * dialect. Messages which switch the language, voice type and rate in a
+ * single SET alternate with messages with unchanged settings. As counted
+ * by the fake library, a switch must load exactly one dialect and never
+ * set a voice parameter to the value it already has, and unchanged
+ * settings must not touch the engine at all.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fake_ibmeci.h"
+#include "fake_ibmtts.h"
+
+#define ROUNDS 10
+/* After which the whole test is considered stuck, in seconds */
+#define TEST_TIMEOUT 60
+
+static const char *switches[2] = {
+	"language=fr-FR\nvoice=female1\nrate=50\n",
+	"language=en-US\nvoice=male1\nrate=0\n",
+};
+
+typedef struct {
+	int loads;
+	int voice_params;
+	int redundant;
+} TStats;
+
+static void read_stats(TStats * stats)
+{
+	FILE *f;
+	int instances;
+	unsigned dialect;
+
+	f = fopen(FAKE_IBMECI_STATS, "r");
+	if (f == NULL
+	    || fscanf(f, "%d %d %x %d %d", &instances, &stats->loads, &dialect,
+		      &stats->voice_params, &stats->redundant) != 5) {
+		printf("The fake IBM TTS library was not used\n");
+		exit(1);
+	}
+	fclose(f);
+}
+
+/* Speaks a message after the settings _settings_ if it is not NULL,
+   returns how many steps went wrong */
+static int speak(TFakeModule * module, const char *settings)
+{
+	TStats before, after;
+	int loads, voice_params, redundant;
+
+	read_stats(&before);
+	if (settings != NULL)
+		fake_ibmtts_set(module, settings);
+	fake_ibmtts_speak(module, "Switch.");
+	read_stats(&after);
+
+	loads = after.loads - before.loads;
+	voice_params = after.voice_params - before.voice_params;
+	redundant = after.redundant - before.redundant;
+	printf("%s: %d dialect loads, %d voice parameters set, %d of them "
+	       "redundant\n", settings != NULL ? "Switched" : "Unchanged",
+	       loads, voice_params, redundant);
+
+	if (settings != NULL)
+		return (loads != 1) + (redundant != 0);
+	return (loads != 0) + (voice_params != 0);
+}
+
+int main(int argc, char *argv[])
+{
+	TFakeModule module;
+	int errors = 0;
+	int i;
+
+	alarm(TEST_TIMEOUT);
+
+	printf("ibmtts voice switch test\n\n");
+	printf("Switching the language, voice type and rate must load one\n");
+	printf("dialect and set no voice parameter to the value it has.\n\n");
+	fflush(stdout);
+
+	unlink(FAKE_IBMECI_STATS);
+	if (fake_ibmtts_start(&module, "IbmttsLanguagePoolSize 1\n", NULL,
+			      NULL) != 0) {
+		printf("The faulty audio output can't be opened\n");
+		exit(1);
+	}
+
+	/* Get the first dialect loaded */
+	fake_ibmtts_set(&module, switches[1]);
+	fake_ibmtts_speak(&module, "Switch.");
+
+	for (i = 0; i < ROUNDS; i++) {
+		errors += speak(&module, NULL);
+		errors += speak(&module, switches[i % 2]);
+	}
+
+	fake_ibmtts_quit(&module);
+	unlink(FAKE_IBMECI_STATS);
+
+	if (errors)
+		printf("%d steps did more engine work than needed\n", errors);
+	exit(errors ? 1 : 0);
+}
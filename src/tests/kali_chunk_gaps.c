@@ -0,0 +1,151 @@
+
+/*
+ * kali_chunk_gaps.c - Test of the gaps between the chunks spoken by Kali
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: kali_chunk_gaps
+ *
+ * Runs sd_kali of the build tree over the fake Kali library, which takes
+ * FAKE_KALI_SYNTH_MS ms to synthesize each chunk, with the faulty audio
+ * output, which takes as long to play a track as it lasts. A message cut
+ * into chunks must then only take the synthesis of its first chunk more
+ * than its audio lasts, the others being synthesized while the previous
+ * ones play: what it takes more is reported as the gap between chunks.
+ * Messages sent while one is playing must all be accepted and spoken, and
+ * a message must be reported stopped within MAX_STOP ms.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fake_kali.h"
+#include "fake_ibmtts.h"
+
+#define CONFIG "KaliMaxChunkLength 100\nKaliDelimiters \".\"\n"
+/* Eight chunks of about 60 characters */
+#define TEXT "The first sentence is spoken while the second one is made. " \
+	"The second sentence is spoken while the third one is made. " \
+	"The third sentence is spoken while the fourth one is made. " \
+	"The fourth sentence is spoken while the fifth one is made. " \
+	"The fifth sentence is spoken while the sixth one is made. " \
+	"The sixth sentence is spoken while the seventh one is made. " \
+	"The seventh sentence is spoken while the last one is made. " \
+	"The last sentence ends the message, nothing comes after it."
+#define BURST 3
+#define BURST_TEXT "Sent while the previous message is still playing. " \
+	"It must be spoken after it, not rejected."
+/* Longest acceptable average gap between two chunks, in ms */
+#define MAX_GAP 20
+/* Longest acceptable time from STOP to the module reporting it, in ms */
+#define MAX_STOP (FAKE_KALI_SYNTH_MS + 100)
+/* After which the whole test is considered stuck, in seconds */
+#define TEST_TIMEOUT 60
+
+/* Reads the chunks synthesized and the samples they made so far */
+static void read_stats(int *chunks, long *samples)
+{
+	FILE *f = fopen(FAKE_KALI_STATS, "r");
+
+	*chunks = 0;
+	*samples = 0;
+	if (f == NULL)
+		return;
+	if (fscanf(f, "%d %ld", chunks, samples) != 2) {
+		*chunks = 0;
+		*samples = 0;
+	}
+	fclose(f);
+}
+
+int main(int argc, char *argv[])
+{
+	TFakeModule module;
+	long elapsed, audio, gap, start, stopped;
+	long samples_before, samples;
+	int chunks_before, chunks;
+	int i, ret = 0;
+
+	alarm(TEST_TIMEOUT);
+
+	printf("Kali chunk gaps test\n\n");
+	printf("Chunks are synthesized in %d ms while the previous ones play,\n",
+	       FAKE_KALI_SYNTH_MS);
+	printf("they must follow each other with gaps of at most %d ms.\n\n",
+	       MAX_GAP);
+	fflush(stdout);
+
+	unlink(FAKE_KALI_STATS);
+	if (fake_module_start(&module, "kali", "libfakekali.so", CONFIG, NULL,
+			      NULL) != 0) {
+		printf("The faulty audio output can't be opened\n");
+		exit(1);
+	}
+
+	read_stats(&chunks_before, &samples_before);
+	elapsed = fake_ibmtts_speak(&module, TEXT);
+	read_stats(&chunks, &samples);
+	chunks -= chunks_before;
+	samples -= samples_before;
+	audio = samples * 1000 / FAKE_KALI_SAMPLE_RATE;
+	if (chunks < 2) {
+		printf("The message was spoken in %d chunks, expected more\n",
+		       chunks);
+		exit(1);
+	}
+	gap = (elapsed - audio - FAKE_KALI_SYNTH_MS) / (chunks - 1);
+	printf("%d chunks, %ld ms of audio played in %ld ms: %ld ms between "
+	       "chunks\n", chunks, audio, elapsed, gap);
+	if (gap > MAX_GAP) {
+		printf("Chunks are not synthesized while the previous ones "
+		       "play\n");
+		ret = 1;
+	}
+
+	/* Each gets its 200 right away, whatever is playing */
+	for (i = 0; i < BURST; i++) {
+		fake_ibmtts_command(&module, "SPEAK\n", "202");
+		fake_ibmtts_command(&module, BURST_TEXT "\n.\n", "200");
+	}
+	for (i = 0; i < BURST; i++)
+		fake_ibmtts_command(&module, NULL, "702");
+	printf("%d messages sent during playback were all spoken\n", BURST);
+
+	fake_ibmtts_command(&module, "SPEAK\n", "202");
+	fake_ibmtts_command(&module, TEXT "\n.\n", "200");
+	fake_ibmtts_command(&module, NULL, "701");
+	usleep(3 * FAKE_KALI_SYNTH_MS * 1000);
+	start = fake_ibmtts_now();
+	fake_ibmtts_command(&module, "STOP\n", "703");
+	stopped = fake_ibmtts_now() - start;
+	printf("Stopped in %ld ms\n", stopped);
+	if (stopped > MAX_STOP) {
+		printf("Expected at most %d ms\n", MAX_STOP);
+		ret = 1;
+	}
+
+	fake_ibmtts_quit(&module);
+	unlink(FAKE_KALI_STATS);
+	exit(ret);
+}
@@ -0,0 +1,186 @@
+
+/*
+ * latency_histogram.c - Test of the latency histograms of the server
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "speechd_types.h"
+#include <libspeechd.h>
+
+#define SHORT_TEXT "Short."
+#define LONG_TEXT "This message is long enough to keep the next one waiting " \
+	"in the queue for well over a second. It goes on with another " \
+	"sentence, and then with one more, just to be sure."
+/* How long to wait for a single event, in seconds */
+#define EVENT_TIMEOUT 60
+/* Buckets of GET LATENCY, and the first one starting at 1000 ms */
+#define BUCKETS 11
+#define SLOW_BUCKET 8
+
+typedef struct {
+	unsigned long count;
+	unsigned long buckets[BUCKETS];
+} THist;
+
+static pthread_mutex_t event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t event_cond = PTHREAD_COND_INITIALIZER;
+static size_t last_end = 0;
+
+static void end_cb(size_t msg_id, size_t client_id, SPDNotificationType type)
+{
+	pthread_mutex_lock(&event_mutex);
+	last_end = msg_id;
+	pthread_cond_signal(&event_cond);
+	pthread_mutex_unlock(&event_mutex);
+}
+
+/* Wait for the end of message _msg_id_, return 0 on success */
+static int wait_end(int msg_id)
+{
+	struct timespec deadline;
+	int ret = 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += EVENT_TIMEOUT;
+	pthread_mutex_lock(&event_mutex);
+	while (last_end != msg_id && ret == 0)
+		ret = pthread_cond_timedwait(&event_cond, &event_mutex,
+					     &deadline);
+	ret = last_end == msg_id ? 0 : -1;
+	pthread_mutex_unlock(&event_mutex);
+	return ret;
+}
+
+/* Read the histogram of _queue_ and _stage_ from GET LATENCY */
+static void get_hist(SPDConnection * conn, const char *queue,
+		     const char *stage, THist * hist)
+{
+	char *reply = NULL, *line, *p;
+	char prefix[64];
+	int i;
+
+	if (spd_execute_command_with_reply(conn, "GET LATENCY", &reply) != 0) {
+		printf("GET LATENCY failed\n");
+		exit(1);
+	}
+	snprintf(prefix, sizeof(prefix), "251-%s %s ", queue, stage);
+	line = strstr(reply, prefix);
+	if (line == NULL || (p = strstr(line, "count=")) == NULL) {
+		printf("No %s %s histogram in:\n%s", queue, stage, reply);
+		exit(1);
+	}
+	hist->count = strtoul(p + strlen("count="), NULL, 10);
+	p = strstr(line, "hist=");
+	for (i = 0, p += strlen("hist="); i < BUCKETS; i++, p++)
+		hist->buckets[i] = strtoul(p, &p, 10);
+	free(reply);
+}
+
+static unsigned long slow(const THist * hist)
+{
+	unsigned long n = 0;
+	int i;
+
+	for (i = SLOW_BUCKET; i < BUCKETS; i++)
+		n += hist->buckets[i];
+	return n;
+}
+
+static int say(SPDConnection * conn, const char *text)
+{
+	int msg_id = spd_say(conn, SPD_TEXT, text);
+
+	if (msg_id == -1) {
+		printf("Message failed\n");
+		exit(1);
+	}
+	return msg_id;
+}
+
+static int check(const char *what, unsigned long value, unsigned long expected,
+		 int at_least)
+{
+	int ok = at_least ? value >= expected : value == expected;
+
+	printf("%s: %lu, expected %s%lu%s\n", what, value,
+	       at_least ? "at least " : "", expected, ok ? "" : " FAILED");
+	return ok ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+	SPDConnection *conn;
+	THist queue[3], play[3];
+	int msg_id, ret = 0;
+
+	conn = spd_open("test", "latency_histogram", NULL, SPD_MODE_THREADED);
+	if (conn == NULL) {
+		printf("Speech Dispatcher failed\n");
+		exit(1);
+	}
+
+	printf("Latency histogram test\n\n");
+	printf("A message spoken alone must be accounted as not waiting in the\n");
+	printf("queue, one spoken after a long message as waiting over a second.\n\n");
+	fflush(stdout);
+
+	conn->callback_end = end_cb;
+	if (spd_set_notification_on(conn, SPD_END) == -1) {
+		printf("Can't set notifications\n");
+		exit(1);
+	}
+
+	get_hist(conn, "text", "queue", &queue[0]);
+	get_hist(conn, "text", "play", &play[0]);
+
+	if (wait_end(say(conn, SHORT_TEXT)) != 0) {
+		printf("Message did not end\n");
+		exit(1);
+	}
+	get_hist(conn, "text", "queue", &queue[1]);
+	get_hist(conn, "text", "play", &play[1]);
+	ret |= check("Queued alone", queue[1].count - queue[0].count, 1, 0);
+	ret |= check("Queued alone, over a second",
+		     slow(&queue[1]) - slow(&queue[0]), 0, 0);
+	ret |= check("Played alone", play[1].count - play[0].count, 1, 0);
+
+	say(conn, LONG_TEXT);
+	msg_id = say(conn, SHORT_TEXT);
+	if (wait_end(msg_id) != 0) {
+		printf("Messages did not end\n");
+		exit(1);
+	}
+	get_hist(conn, "text", "queue", &queue[2]);
+	get_hist(conn, "text", "play", &play[2]);
+	ret |= check("Queued behind", queue[2].count - queue[1].count, 2, 0);
+	ret |= check("Queued behind, over a second",
+		     slow(&queue[2]) - slow(&queue[1]), 1, 1);
+	ret |= check("Played long, over a second",
+		     slow(&play[2]) - slow(&play[1]), 1, 1);
+
+	spd_close(conn);
+	exit(ret);
+}
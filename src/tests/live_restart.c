@@ -0,0 +1,238 @@
+
+/*
+ * live_restart.c - Test of restarting the server under running clients
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <dirent.h>
+#include "speechd_types.h"
+#include <libspeechd.h>
+
+#define CLIENTS 4
+#define ROUNDS 200
+
+/* Restart the server at these rounds */
+#define RESTART_1 50
+#define RESTART_2 120
+
+#define LONG_TEXT "This message is being spoken while the server restarts. " \
+	"It must be resumed afterwards instead of being lost, so it goes on " \
+	"for a few sentences. Here is one more of them, and this is the last."
+/* How long to wait for a single event, in seconds */
+#define EVENT_TIMEOUT 30
+/* How many more descriptors the server may have after the restarts */
+#define MAX_FD_GROWTH 2
+
+static pthread_mutex_t event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t event_cond = PTHREAD_COND_INITIALIZER;
+static SPDNotificationType last_event = -1;
+
+static void event_cb(size_t msg_id, size_t client_id, SPDNotificationType type)
+{
+	pthread_mutex_lock(&event_mutex);
+	last_event = type;
+	pthread_cond_signal(&event_cond);
+	pthread_mutex_unlock(&event_mutex);
+}
+
+/* Wait for event _type_, return 0 on success */
+static int wait_event(SPDNotificationType type)
+{
+	struct timespec deadline;
+	int ret = 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += EVENT_TIMEOUT;
+	pthread_mutex_lock(&event_mutex);
+	while (last_event != type && ret == 0)
+		ret = pthread_cond_timedwait(&event_cond, &event_mutex,
+					     &deadline);
+	ret = last_event == type ? 0 : -1;
+	pthread_mutex_unlock(&event_mutex);
+	return ret;
+}
+
+static pid_t read_server_pid(const char *pid_path)
+{
+	FILE *f;
+	int pid = 0;
+
+	f = fopen(pid_path, "r");
+	if (f == NULL)
+		return 0;
+	if (fscanf(f, "%d", &pid) != 1)
+		pid = 0;
+	fclose(f);
+	return pid;
+}
+
+/* Count the open descriptors of process _pid_, -1 if they can't be read */
+static int count_fds(pid_t pid)
+{
+	char path[64];
+	struct dirent *entry;
+	DIR *dir;
+	int count = 0;
+
+	snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+	dir = opendir(path);
+	if (dir == NULL)
+		return -1;
+	while ((entry = readdir(dir)) != NULL)
+		if (entry->d_name[0] != '.')
+			count++;
+	closedir(dir);
+	return count;
+}
+
+int main(int argc, char *argv[])
+{
+	SPDConnection *conn[CLIENTS];
+	char pid_path[1024];
+	char text[64];
+	const char *runtime_dir;
+	pid_t pid;
+	int fds_before, fds_after;
+	int i, c, ret;
+	int failures = 0;
+
+	if (argc > 1) {
+		snprintf(pid_path, sizeof(pid_path), "%s", argv[1]);
+	} else {
+		runtime_dir = getenv("XDG_RUNTIME_DIR");
+		if (runtime_dir == NULL) {
+			printf("Usage: %s <server pid file>\n", argv[0]);
+			exit(1);
+		}
+		snprintf(pid_path, sizeof(pid_path),
+			 "%s/speech-dispatcher/pid/speech-dispatcher.pid",
+			 runtime_dir);
+	}
+
+	printf("Live restart test\n\n");
+	printf("%d clients keep sending messages while the server is\n",
+	       CLIENTS);
+	printf("restarted twice with SIGUSR2. No message may fail.\n");
+	printf("A message spoken during a third restart must be resumed.\n");
+	printf("The restarts may not leak descriptors.\n");
+	fflush(stdout);
+
+	for (c = 0; c < CLIENTS; c++) {
+		conn[c] = spd_open("test", "live_restart", NULL,
+				   SPD_MODE_THREADED);
+		if (conn[c] == NULL) {
+			printf("Speech Dispatcher failed\n");
+			exit(1);
+		}
+		spd_set_data_mode(conn[c], SPD_DATA_TEXT);
+	}
+
+	pid = read_server_pid(pid_path);
+	if (pid <= 0) {
+		printf("Can't read the server pid from %s\n", pid_path);
+		exit(1);
+	}
+	fds_before = count_fds(pid);
+
+	for (i = 0; i < ROUNDS; i++) {
+		if (i == RESTART_1 || i == RESTART_2) {
+			printf("Restarting server %d\n", (int)pid);
+			if (kill(pid, SIGUSR2) != 0) {
+				printf("Can't signal the server\n");
+				exit(1);
+			}
+		}
+
+		for (c = 0; c < CLIENTS; c++) {
+			snprintf(text, sizeof(text), "Client %d message %d", c,
+				 i);
+			ret = spd_say(conn[c], SPD_MESSAGE, text);
+			if (ret == -1) {
+				printf("%s failed\n", text);
+				failures++;
+			}
+		}
+		usleep(10000);
+	}
+
+	/* The server keeps its process when restarting */
+	if (read_server_pid(pid_path) != pid) {
+		printf("The server changed its pid\n");
+		failures++;
+	}
+
+	fds_after = count_fds(pid);
+	if (fds_before < 0 || fds_after < 0) {
+		printf("Can't count the descriptors of the server\n");
+	} else {
+		printf("The server had %d descriptors, %d after the restarts\n",
+		       fds_before, fds_after);
+		if (fds_after > fds_before + MAX_FD_GROWTH) {
+			printf("The restarts leaked descriptors\n");
+			failures++;
+		}
+	}
+
+	for (c = 0; c < CLIENTS; c++)
+		spd_cancel(conn[c]);
+
+	conn[0]->callback_begin = event_cb;
+	conn[0]->callback_resume = event_cb;
+	conn[0]->callback_end = event_cb;
+	if (spd_set_notification_on(conn[0], SPD_BEGIN) == -1
+	    || spd_set_notification_on(conn[0], SPD_RESUME) == -1
+	    || spd_set_notification_on(conn[0], SPD_END) == -1) {
+		printf("Can't set notifications\n");
+		exit(1);
+	}
+	if (spd_say(conn[0], SPD_TEXT, LONG_TEXT) == -1
+	    || wait_event(SPD_EVENT_BEGIN) != 0) {
+		printf("The long message did not begin\n");
+		failures++;
+	} else {
+		printf("Restarting server %d while speaking\n", (int)pid);
+		if (kill(pid, SIGUSR2) != 0) {
+			printf("Can't signal the server\n");
+			exit(1);
+		}
+		if (wait_event(SPD_EVENT_RESUME) != 0) {
+			printf("The long message was not resumed\n");
+			failures++;
+		} else if (wait_event(SPD_EVENT_END) != 0) {
+			printf("The resumed message did not end\n");
+			failures++;
+		}
+	}
+
+	for (c = 0; c < CLIENTS; c++) {
+		spd_cancel(conn[c]);
+		spd_close(conn[c]);
+	}
+
+	printf("%d messages failed\n", failures);
+	exit(failures == 0 ? 0 : 1);
+}
@@ -0,0 +1,192 @@
+
+/*
+ * lock_audio_memory.c - Test of the page faults taken while playing with LockAudioMemory
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: lock_audio_memory [output [device]]
+ *
+ * Runs sd_ibmtts of the build tree over the fake IBM TTS library, with
+ * LockAudioMemory off and then on. With it on, the module must hold
+ * locked memory, and once the first message has been played the
+ * playback thread must not take page faults any more, as its debugging
+ * output reports after each message. By default the faulty output of
+ * the tests is used, which does not play anything: to cover the path
+ * through a real audio backend as well, give it, e.g.
+ *
+ *   lock_audio_memory alsa default
+ *
+ * The test is skipped if the output can't be opened.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "fake_ibmtts.h"
+
+#define MESSAGES 5
+#define TEXT "Playing from locked memory, which must not take page faults."
+/* Most minor page faults acceptable for the playback thread during a
+   message other than the first one, from what is not locked, e.g. the
+   debugging output itself */
+#define MAX_MINOR_FAULTS 8
+/* Locked memory needed by the module, in kB */
+#define MIN_MEMLOCK 128
+/* After which the whole test is considered stuck, in seconds */
+#define TEST_TIMEOUT 60
+
+/* Returns the locked memory of process _pid_ in kB */
+static long locked_kb(pid_t pid)
+{
+	char path[64], line[256];
+	long kb = -1;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), f) != NULL)
+		if (sscanf(line, "VmLck: %ld", &kb) == 1)
+			break;
+	fclose(f);
+	return kb;
+}
+
+/* Speaks MESSAGES messages with LockAudioMemory _lock_ on the output
+   set up by the settings lines _audio_, debugging into _log_, returns the
+   locked memory of the module in kB */
+static long run(int lock, const char *audio, const char *log)
+{
+	TFakeModule module;
+	char config[64];
+	long kb = 0;
+	int i;
+
+	snprintf(config, sizeof(config), "LockAudioMemory %d\nDebug 1\n",
+		 lock);
+	if (fake_ibmtts_start(&module, config, log, audio) != 0) {
+		printf("Skipped: the audio output can't be opened\n");
+		exit(77);
+	}
+	for (i = 0; i < MESSAGES; i++) {
+		fake_ibmtts_speak(&module, TEXT);
+		if (i == 0)
+			kb = locked_kb(module.pid);
+	}
+	fake_ibmtts_quit(&module);
+	return kb;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *output = argc > 1 ? argv[1] : NULL;
+	const char *device = argc > 2 ? argv[2] : "NULL";
+	const char *parameter = "audio_oss_device";
+	char audio[256], log[64], line[1024], *faults;
+	long kb, minor, major, last_minor = 0, last_major = 0;
+	struct rlimit limit;
+	FILE *f;
+	int reports = 0, errors = 0, all_locked = 0;
+
+	alarm(TEST_TIMEOUT);
+
+	if (output != NULL) {
+		if (!strcmp(output, "alsa"))
+			parameter = "audio_alsa_device";
+		else if (!strcmp(output, "nas"))
+			parameter = "audio_nas_server";
+		else if (!strcmp(output, "pulse"))
+			parameter = "audio_pulse_device";
+		snprintf(audio, sizeof(audio), "audio_output_method=%s\n%s=%s\n",
+			 output, parameter, device);
+	}
+
+	printf("LockAudioMemory test\n\n");
+	printf("With LockAudioMemory, the module must hold locked memory, and\n");
+	printf("take no major and at most %d minor page faults while playing\n",
+	       MAX_MINOR_FAULTS);
+	printf("each message after the first one.\n\n");
+	fflush(stdout);
+
+	/* The module inherits the limit */
+	if (getrlimit(RLIMIT_MEMLOCK, &limit) == 0
+	    && limit.rlim_max != RLIM_INFINITY
+	    && limit.rlim_max < MIN_MEMLOCK * 1024) {
+		printf("Skipped: at most %lu kB of memory can be locked\n",
+		       (unsigned long)limit.rlim_max / 1024);
+		exit(77);
+	}
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_MEMLOCK, &limit);
+
+	snprintf(log, sizeof(log), "/tmp/lock_audio_memory-%d.log",
+		 (int)getpid());
+
+	kb = run(0, output != NULL ? audio : NULL, log);
+	printf("Without LockAudioMemory: %ld kB locked\n", kb);
+	if (kb != 0)
+		errors++;
+
+	kb = run(1, output != NULL ? audio : NULL, log);
+	printf("With LockAudioMemory: %ld kB locked\n", kb);
+	if (kb <= 0)
+		errors++;
+
+	f = fopen(log, "r");
+	if (f == NULL) {
+		perror(log);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (strstr(line, "Locked all of the module memory") != NULL)
+			all_locked = 1;
+		faults = strstr(line, "Playback thread page faults: ");
+		if (faults == NULL
+		    || sscanf(faults, "Playback thread page faults: %ld minor, "
+			      "%ld major", &minor, &major) != 2)
+			continue;
+		reports++;
+		printf("Message %d: %ld minor, %ld major page faults\n",
+		       reports, minor - last_minor, major - last_major);
+		if (reports > 1 && (major > last_major
+				    || minor - last_minor > MAX_MINOR_FAULTS))
+			errors++;
+		last_minor = minor;
+		last_major = major;
+	}
+	fclose(f);
+	unlink(log);
+
+	printf("%s was locked\n", all_locked ? "All of the module memory"
+	       : "Only the audio buffers and the playback stack");
+
+	if (reports != MESSAGES) {
+		printf("The page faults were reported for %d of %d messages\n",
+		       reports, MESSAGES);
+		errors++;
+	}
+	exit(errors ? 1 : 0);
+}
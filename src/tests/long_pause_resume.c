@@ -0,0 +1,163 @@
+
+/*
+ * long_pause_resume.c - Test of pausing and resuming a very long message
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "speechd_types.h"
+#include <libspeechd.h>
+
+#define TEXT_SIZE (5 * 1024 * 1024)
+#define CYCLES 20
+/* Longest acceptable time from a resume request to the RESUME event,
+   in ms */
+#define MAX_RESUME 500
+/* How long to wait for a single event, in seconds */
+#define EVENT_TIMEOUT 30
+
+static pthread_mutex_t event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t event_cond = PTHREAD_COND_INITIALIZER;
+static SPDNotificationType last_event = -1;
+
+static long now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+static void event_cb(size_t msg_id, size_t client_id, SPDNotificationType type)
+{
+	pthread_mutex_lock(&event_mutex);
+	last_event = type;
+	pthread_cond_signal(&event_cond);
+	pthread_mutex_unlock(&event_mutex);
+}
+
+/* Wait for event _type_, return 0 on success */
+static int wait_event(SPDNotificationType type)
+{
+	struct timespec deadline;
+	int ret = 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += EVENT_TIMEOUT;
+	pthread_mutex_lock(&event_mutex);
+	while (last_event != type && ret == 0)
+		ret = pthread_cond_timedwait(&event_cond, &event_mutex,
+					     &deadline);
+	pthread_mutex_unlock(&event_mutex);
+	return last_event == type ? 0 : -1;
+}
+
+static void reset_event(void)
+{
+	pthread_mutex_lock(&event_mutex);
+	last_event = -1;
+	pthread_mutex_unlock(&event_mutex);
+}
+
+int main(int argc, char *argv[])
+{
+	SPDConnection *conn;
+	char *text;
+	const char *sentence = "This is one of the many sentences of a book. ";
+	size_t len, slen = strlen(sentence);
+	long start, elapsed, total = 0, max = 0;
+	int i;
+
+	conn = spd_open("test", "long_pause_resume", NULL, SPD_MODE_THREADED);
+	if (conn == NULL) {
+		printf("Speech Dispatcher failed\n");
+		exit(1);
+	}
+
+	printf("Long message pause/resume test\n\n");
+	printf("A %d MB message is paused and resumed %d times, the time\n",
+	       TEXT_SIZE / (1024 * 1024), CYCLES);
+	printf("from each resume request to the RESUME event must be at most\n");
+	printf("%d ms.\n", MAX_RESUME);
+	fflush(stdout);
+
+	conn->callback_begin = event_cb;
+	conn->callback_pause = event_cb;
+	conn->callback_resume = event_cb;
+	if (spd_set_notification_on(conn, SPD_BEGIN) == -1
+	    || spd_set_notification_on(conn, SPD_PAUSE) == -1
+	    || spd_set_notification_on(conn, SPD_RESUME) == -1) {
+		printf("Can't set notifications\n");
+		exit(1);
+	}
+
+	text = malloc(TEXT_SIZE + 1);
+	for (len = 0; len + slen <= TEXT_SIZE; len += slen)
+		memcpy(text + len, sentence, slen);
+	text[len] = '\0';
+
+	reset_event();
+	start = now_ms();
+	if (spd_say(conn, SPD_TEXT, text) == -1) {
+		printf("Message failed\n");
+		exit(1);
+	}
+	free(text);
+	if (wait_event(SPD_EVENT_BEGIN) != 0) {
+		printf("Message not started\n");
+		exit(1);
+	}
+	printf("Message started after %ld ms\n", now_ms() - start);
+
+	for (i = 0; i < CYCLES; i++) {
+		usleep(500000);
+		reset_event();
+		spd_pause(conn);
+		if (wait_event(SPD_EVENT_PAUSE) != 0) {
+			printf("Pause %d not reported\n", i);
+			exit(1);
+		}
+
+		reset_event();
+		start = now_ms();
+		spd_resume(conn);
+		if (wait_event(SPD_EVENT_RESUME) != 0) {
+			printf("Resume %d not reported\n", i);
+			exit(1);
+		}
+		elapsed = now_ms() - start;
+		total += elapsed;
+		if (elapsed > max)
+			max = elapsed;
+	}
+
+	printf("Resuming took %ld ms on average, %ld ms at most\n",
+	       total / CYCLES, max);
+
+	spd_cancel(conn);
+	spd_close(conn);
+	exit(max <= MAX_RESUME ? 0 : 1);
+}
@@ -0,0 +1,175 @@
+
+/*
+ * mark_batching.c - Benchmark of the index marks sent by modules
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: mark_batching
+ *
+ * Runs sd_ibmtts of the build tree over the fake IBM TTS library, which
+ * gives a mark every FAKE_IBMECI_MS_PER_CHAR ms for a text made of one
+ * letter words each followed by a mark. What the module sends is read in
+ * blocks like the server does, counting the reads it takes, and the CPU
+ * time taken by the module and by reading its output is reported for
+ * the marks per second it gets to.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "fake_ibmeci.h"
+#include "fake_ibmtts.h"
+
+#define MARKS 500
+/* Fewest marks which have to come in a single read on average */
+#define MIN_MARKS_PER_READ 2
+/* After which the whole test is considered stuck, in seconds */
+#define TEST_TIMEOUT 60
+
+/* CPU time taken so far by process _pid_, in ms */
+static long process_cpu_ms(pid_t pid)
+{
+	char path[64], buf[1024];
+	unsigned long utime, stime;
+	char *p;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	f = fopen(path, "r");
+	if (f == NULL || fgets(buf, sizeof(buf), f) == NULL) {
+		printf("Can't read %s\n", path);
+		exit(1);
+	}
+	fclose(f);
+	/* The fields after the name, which may contain spaces */
+	p = strrchr(buf, ')');
+	if (p == NULL
+	    || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+		      &utime, &stime) != 2) {
+		printf("Can't parse %s\n", path);
+		exit(1);
+	}
+	return (utime + stime) * 1000 / sysconf(_SC_CLK_TCK);
+}
+
+static long self_cpu_ms(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec * 1000L + usage.ru_utime.tv_usec / 1000
+	    + usage.ru_stime.tv_sec * 1000L + usage.ru_stime.tv_usec / 1000;
+}
+
+int main(int argc, char *argv[])
+{
+	TFakeModule module;
+	static char text[MARKS * 24 + 32];
+	char buf[8192];
+	size_t len = 0, n;
+	char *line, *nl;
+	long start, elapsed, module_cpu, reader_cpu;
+	int fd, reads = 0, marks = 0, expected = 0, ended = 0;
+	ssize_t bytes;
+	int i;
+
+	alarm(TEST_TIMEOUT);
+
+	printf("Index mark batching benchmark\n\n");
+	fflush(stdout);
+
+	if (fake_ibmtts_start(&module, "", NULL, NULL) != 0) {
+		printf("The faulty audio output can't be opened\n");
+		exit(1);
+	}
+
+	n = sprintf(text, "<speak>");
+	for (i = 0; i < MARKS; i++)
+		n += sprintf(text + n, "x<mark name=\"m%d\"/>", i);
+	strcpy(text + n, "</speak>");
+
+	/* Nothing is left in the stream buffer after starting, from now on
+	   everything is read directly */
+	fd = fileno(module.from);
+	module_cpu = process_cpu_ms(module.pid);
+	reader_cpu = self_cpu_ms();
+	start = fake_ibmtts_now();
+
+	fprintf(module.to, "SPEAK\n%s\n.\n", text);
+	fflush(module.to);
+	while (!ended) {
+		bytes = read(fd, buf + len, sizeof(buf) - len);
+		if (bytes <= 0) {
+			printf("The module went away\n");
+			exit(1);
+		}
+		reads++;
+		len += bytes;
+		line = buf;
+		while ((nl = memchr(line, '\n', buf + len - line))) {
+			*nl = '\0';
+			if (!strncmp(line, "700-", 4)) {
+				if (strtol(line + 5, NULL, 10) != expected) {
+					printf("Got mark %s instead of m%d\n",
+					       line + 4, expected);
+					exit(1);
+				}
+				expected++;
+				marks++;
+			} else if (!strncmp(line, "702", 3)) {
+				ended = 1;
+			} else if (line[0] == '3' || line[0] == '4') {
+				printf("The module answered %s\n", line);
+				exit(1);
+			}
+			line = nl + 1;
+		}
+		len -= line - buf;
+		memmove(buf, line, len);
+	}
+
+	elapsed = fake_ibmtts_now() - start;
+	module_cpu = process_cpu_ms(module.pid) - module_cpu;
+	reader_cpu = self_cpu_ms() - reader_cpu;
+	fake_ibmtts_quit(&module);
+
+	printf("%d marks in %ld ms: %.0f marks/s\n", marks, elapsed,
+	       elapsed > 0 ? marks * 1000.0 / elapsed : 0);
+	printf("%d reads, %.1f marks per read\n", reads,
+	       (double)marks / reads);
+	printf("CPU time: module %ld ms, reading its output %ld ms\n",
+	       module_cpu, reader_cpu);
+
+	if (marks != MARKS) {
+		printf("Expected %d marks\n", MARKS);
+		exit(1);
+	}
+	if (marks < MIN_MARKS_PER_READ * reads) {
+		printf("Expected at least %d marks per read\n",
+		       MIN_MARKS_PER_READ);
+		exit(1);
+	}
+	exit(0);
+}
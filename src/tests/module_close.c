@@ -0,0 +1,538 @@
+
+/*
+ * module_close.c - Test of the time output modules take to start and close
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: module_close [--zygote] [module [configuration]]
+ *
+ * Talks the output module protocol to the module itself, no server is
+ * needed, with the faulty audio output. By default each sd_* module of
+ * the build tree is tried in turn, ibmtts and kali over their fake
+ * engine libraries when they were built, and those which don't answer
+ * INIT without their engine are reported skipped. A single module can
+ * be given instead with its configuration, e.g. sd_generic with
+ * generic-wav.conf, it then has to start. With --zygote, the module is
+ * started once as a zygote, and each module is forked from it like with
+ * the ModuleZygote server option.
+ *
+ * The proportional set size of INSTANCES modules running at once, like
+ * for that many servers, is then reported. With --zygote it includes the
+ * zygote, and is compared with the same modules executed each on their
+ * own.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define ROUNDS 5
+/* Longest acceptable time from starting a module to its answer to INIT,
+   in ms */
+#define MAX_START 2000
+/* Longest acceptable time from QUIT to the module exiting, in ms */
+#define MAX_CLOSE 500
+/* After which the test of a module is considered stuck, in seconds */
+#define TEST_TIMEOUT 60
+/* How many modules run at once to measure their memory */
+#define INSTANCES 4
+
+/* Fake engine libraries of the test directory, preloaded into the
+   modules which would need the real engine */
+static const struct {
+	const char *module;
+	const char *library;
+} fake_engines[] = {
+	{"sd_ibmtts", "libibmeci.so"},
+	{"sd_kali", "libfakekali.so"},
+};
+
+typedef struct {
+	pid_t pid;
+	FILE *to, *from;
+	int forked;		/* By the zygote, not our child */
+} TModule;
+
+static char zygote_path[64];
+
+static long now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+/* In the child about to execute the module _path_, points it to the test
+   libraries, the faulty audio output and its fake engine if there is one */
+static void module_environment(const char *path)
+{
+	const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	char preload[256];
+	int i;
+
+	setenv("LD_LIBRARY_PATH", TESTLIBSDIR ":" MODULEBUILDDIR, 1);
+	setenv("LTDL_LIBRARY_PATH", TESTLIBSDIR, 1);
+	for (i = 0; i < sizeof(fake_engines) / sizeof(fake_engines[0]); i++) {
+		if (strcmp(name, fake_engines[i].module))
+			continue;
+		snprintf(preload, sizeof(preload), TESTLIBSDIR "/%s",
+			 fake_engines[i].library);
+		if (access(preload, R_OK) == 0)
+			setenv("LD_PRELOAD", preload, 1);
+	}
+}
+
+static void start_module(TModule * module, const char *path,
+			 const char *config)
+{
+	int to[2], from[2], null;
+
+	if (pipe(to) != 0 || pipe(from) != 0) {
+		perror("pipe");
+		exit(1);
+	}
+
+	module->pid = fork();
+	if (module->pid == -1) {
+		perror("fork");
+		exit(1);
+	}
+	if (module->pid == 0) {
+		dup2(to[0], 0);
+		dup2(from[1], 1);
+		null = open("/dev/null", O_WRONLY);
+		dup2(null, 2);
+		close(to[1]);
+		close(from[0]);
+		module_environment(path);
+		execl(path, path, config, (char *)NULL);
+		_exit(127);
+	}
+
+	close(to[0]);
+	close(from[1]);
+	module->to = fdopen(to[1], "w");
+	module->from = fdopen(from[0], "r");
+	module->forked = 0;
+}
+
+/* Start the module as a zygote listening on zygote_path, return its pid,
+   or -1 if it didn't start listening */
+static pid_t start_zygote(const char *path, const char *config)
+{
+	pid_t pid;
+	int i;
+
+	snprintf(zygote_path, sizeof(zygote_path), "/tmp/module_close-%d",
+		 (int)getpid());
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0) {
+		module_environment(path);
+		execl(path, path, "--zygote", zygote_path, config,
+		      (char *)NULL);
+		_exit(127);
+	}
+
+	for (i = 0; i < 100 && access(zygote_path, F_OK) != 0; i++) {
+		if (waitpid(pid, NULL, WNOHANG) == pid)
+			return -1;
+		usleep(50000);
+	}
+	if (i == 100) {
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		return -1;
+	}
+	return pid;
+}
+
+/* Have the zygote fork a module, like the server does */
+static void fork_module(TModule * module)
+{
+	struct sockaddr_un addr;
+	int to[2], from[2], null, sock, fds[3];
+	char byte = 0;
+	struct iovec iov = { &byte, 1 };
+	union {
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+
+	if (pipe(to) != 0 || pipe(from) != 0) {
+		perror("pipe");
+		exit(1);
+	}
+	null = open("/dev/null", O_WRONLY);
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, zygote_path);
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		perror("connect to the zygote");
+		exit(1);
+	}
+
+	fds[0] = to[0];
+	fds[1] = from[1];
+	fds[2] = null;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, 3 * sizeof(int));
+	if (sendmsg(sock, &msg, 0) != 1
+	    || read(sock, &module->pid, sizeof(module->pid)) !=
+	    sizeof(module->pid) || module->pid <= 0) {
+		printf("The zygote didn't fork a module\n");
+		exit(1);
+	}
+	close(sock);
+
+	close(to[0]);
+	close(from[1]);
+	close(null);
+	module->to = fdopen(to[1], "w");
+	module->from = fdopen(from[0], "r");
+	module->forked = 1;
+}
+
+/* Send _cmd_, return the first reply line starting with _code_ or exit
+   if the module answers with an error or goes away. Event lines the
+   module sends meanwhile are skipped. */
+static void command(TModule * module, const char *cmd, const char *code)
+{
+	char line[1024];
+
+	fputs(cmd, module->to);
+	fflush(module->to);
+	while (fgets(line, sizeof(line), module->from) != NULL) {
+		if (!strncmp(line, code, strlen(code)))
+			return;
+		if (line[0] == '3' || line[0] == '4') {
+			printf("%s answered %s", cmd, line);
+			exit(1);
+		}
+	}
+	printf("The module went away after %s", cmd);
+	exit(1);
+}
+
+/* Send INIT to a module which may not run without its engine, return 0
+   once it answered 299 within MAX_START ms, -1 otherwise. Its output is
+   read without buffering, nothing follows the answer to INIT. */
+static int try_init(TModule * module)
+{
+	struct pollfd pfd;
+	char buf[1024];
+	size_t len = 0;
+	ssize_t ret;
+	char *line, *nl;
+	long deadline = now_ms() + MAX_START;
+
+	fputs("INIT\n", module->to);
+	fflush(module->to);
+	pfd.fd = fileno(module->from);
+	pfd.events = POLLIN;
+	while (now_ms() < deadline) {
+		if (poll(&pfd, 1, deadline - now_ms()) <= 0)
+			continue;
+		ret = read(pfd.fd, buf + len, 1);
+		if (ret <= 0)
+			return -1;
+		len += ret;
+		if (buf[len - 1] != '\n' && len < sizeof(buf) - 1)
+			continue;
+		buf[len] = '\0';
+		for (line = buf; (nl = strchr(line, '\n')); line = nl + 1)
+			if (!strncmp(line, "299 ", 4))
+				return 0;
+			else if (line[0] == '3' || line[0] == '4')
+				return -1;
+		len = 0;
+	}
+	return -1;
+}
+
+/* Get rid of a module which didn't start */
+static void abandon_module(TModule * module)
+{
+	if (!module->forked) {
+		kill(module->pid, SIGKILL);
+		waitpid(module->pid, NULL, 0);
+	}
+	fclose(module->to);
+	fclose(module->from);
+}
+
+/* Quit the module, return how long it took to exit in ms */
+static long quit_module(TModule * module)
+{
+	long start = now_ms();
+	int status;
+
+	char line[1024];
+
+	command(module, "QUIT\n", "210");
+	fclose(module->to);
+	if (module->forked)
+		/* Not our child, it is gone once its output is closed */
+		while (fgets(line, sizeof(line), module->from) != NULL) ;
+	else
+		waitpid(module->pid, &status, 0);
+	fclose(module->from);
+	return now_ms() - start;
+}
+
+/* Proportional set size of process _pid_ in KB, -1 if it can't be read */
+static long pss_kb(pid_t pid)
+{
+	char path[64], line[256];
+	long kb, total = 0;
+	FILE *f;
+
+	/* smaps_rollup sums smaps, which older kernels only have */
+	snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", (int)pid);
+	f = fopen(path, "r");
+	if (f == NULL) {
+		snprintf(path, sizeof(path), "/proc/%d/smaps", (int)pid);
+		f = fopen(path, "r");
+	}
+	if (f == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), f) != NULL)
+		if (sscanf(line, "Pss: %ld kB", &kb) == 1)
+			total += kb;
+	fclose(f);
+	return total;
+}
+
+/* Start INSTANCES modules at once, forked from the zygote _zygote_pid_
+   if not 0, and report how much memory they take with it */
+static void measure_pss(const char *path, const char *config,
+			pid_t zygote_pid)
+{
+	TModule modules[INSTANCES];
+	long kb, total = 0;
+	int i, unknown = 0;
+
+	for (i = 0; i < INSTANCES; i++) {
+		if (zygote_pid)
+			fork_module(&modules[i]);
+		else
+			start_module(&modules[i], path, config);
+		command(&modules[i], "INIT\n", "299 ");
+		command(&modules[i], "AUDIO\naudio_output_method=faulty\n.\n",
+			"203");
+	}
+
+	for (i = 0; i < INSTANCES; i++) {
+		kb = pss_kb(modules[i].pid);
+		if (kb < 0)
+			unknown = 1;
+		total += kb;
+	}
+	if (zygote_pid) {
+		kb = pss_kb(zygote_pid);
+		if (kb < 0)
+			unknown = 1;
+		total += kb;
+	}
+
+	for (i = 0; i < INSTANCES; i++)
+		quit_module(&modules[i]);
+
+	if (unknown)
+		printf("  Can't read the memory of the modules\n");
+	else
+		printf("  %d modules %s: %ld KB PSS%s, %ld KB each\n",
+		       INSTANCES, zygote_pid ? "forked" : "executed", total,
+		       zygote_pid ? " with the zygote" : "",
+		       total / INSTANCES);
+}
+
+/* Starts and closes module _path_ ROUNDS times idle and as many times
+   speaking. Returns 0 if it was always fast enough, 1 if not, -1 if it
+   didn't start. */
+static int test_module(const char *path, const char *config, int zygote)
+{
+	pid_t zygote_pid = 0;
+	TModule module;
+	long start, started, elapsed;
+	long max_start = 0, max_idle = 0, max_speaking = 0;
+	int i;
+
+	alarm(TEST_TIMEOUT);
+
+	if (zygote) {
+		zygote_pid = start_zygote(path, config);
+		if (zygote_pid == -1)
+			return -1;
+	}
+
+	for (i = 0; i < 2 * ROUNDS; i++) {
+		start = now_ms();
+		if (zygote)
+			fork_module(&module);
+		else
+			start_module(&module, path, config);
+		if (i == 0) {
+			if (try_init(&module) != 0) {
+				abandon_module(&module);
+				if (zygote) {
+					kill(zygote_pid, SIGKILL);
+					waitpid(zygote_pid, NULL, 0);
+					unlink(zygote_path);
+				}
+				return -1;
+			}
+		} else {
+			command(&module, "INIT\n", "299 ");
+		}
+		started = now_ms() - start;
+		if (started > max_start)
+			max_start = started;
+		command(&module, "AUDIO\naudio_output_method=faulty\n.\n",
+			"203");
+
+		if (i % 2) {
+			command(&module, "SPEAK\n", "202");
+			command(&module, "Closing while this is spoken.\n.\n",
+				"200");
+			elapsed = quit_module(&module);
+			printf("  Started in %ld ms, closed while speaking in "
+			       "%ld ms\n", started, elapsed);
+			if (elapsed > max_speaking)
+				max_speaking = elapsed;
+		} else {
+			elapsed = quit_module(&module);
+			printf("  Started in %ld ms, closed idle in %ld ms\n",
+			       started, elapsed);
+			if (elapsed > max_idle)
+				max_idle = elapsed;
+		}
+		fflush(stdout);
+	}
+
+	if (zygote)
+		measure_pss(path, config, 0);
+	measure_pss(path, config, zygote_pid);
+
+	if (zygote) {
+		kill(zygote_pid, SIGTERM);
+		waitpid(zygote_pid, NULL, 0);
+		unlink(zygote_path);
+	}
+
+	printf("  At most %ld ms to start, %ld ms to close idle, %ld ms to "
+	       "close while speaking\n", max_start, max_idle, max_speaking);
+	return max_start <= MAX_START && max_idle <= MAX_CLOSE
+	    && max_speaking <= MAX_CLOSE ? 0 : 1;
+}
+
+static int is_module(const struct dirent *entry)
+{
+	char path[512];
+	struct stat st;
+
+	if (strncmp(entry->d_name, "sd_", 3) || strchr(entry->d_name, '.'))
+		return 0;
+	snprintf(path, sizeof(path), MODULEBUILDDIR "/%s", entry->d_name);
+	return stat(path, &st) == 0 && S_ISREG(st.st_mode)
+	    && access(path, X_OK) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int zygote = argc > 1 && !strcmp(argv[1], "--zygote");
+	const char *config = argc > 2 + zygote ? argv[2 + zygote] : NULL;
+	struct dirent **modules;
+	char path[512];
+	int n, i, ret;
+	int tested = 0, skipped = 0, failed = 0;
+
+	printf("Module start and close test\n\n");
+	printf("Modules must answer INIT within %d ms, and exit within %d ms\n",
+	       MAX_START, MAX_CLOSE);
+	printf("of QUIT, whether idle or speaking.\n");
+	if (zygote)
+		printf("The modules are forked from a zygote.\n");
+	printf("\n");
+	fflush(stdout);
+
+	if (argc > 1 + zygote) {
+		printf("%s:\n", argv[1 + zygote]);
+		fflush(stdout);
+		ret = test_module(argv[1 + zygote], config, zygote);
+		if (ret == -1)
+			printf("  Didn't start\n");
+		exit(ret == 0 ? 0 : 1);
+	}
+
+	n = scandir(MODULEBUILDDIR, &modules, is_module, alphasort);
+	if (n < 0) {
+		perror(MODULEBUILDDIR);
+		exit(1);
+	}
+	for (i = 0; i < n; i++) {
+		snprintf(path, sizeof(path), MODULEBUILDDIR "/%s",
+			 modules[i]->d_name);
+		printf("%s:\n", modules[i]->d_name);
+		fflush(stdout);
+		ret = test_module(path, NULL, zygote);
+		if (ret == -1) {
+			printf("  Skipped, doesn't start without its engine\n");
+			skipped++;
+		} else {
+			tested++;
+			failed += ret;
+		}
+		free(modules[i]);
+	}
+	free(modules);
+
+	printf("\n%d modules tested, %d too slow, %d skipped\n", tested,
+	       failed, skipped);
+	exit(tested > 0 && failed == 0 ? 0 : 1);
+}
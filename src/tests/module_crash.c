@@ -0,0 +1,193 @@
+
+/*
+ * module_crash.c - Test of recovery from output module crashes
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "speechd_types.h"
+#include <libspeechd.h>
+
+#define MESSAGES 20
+#define KILLS 6
+#define TEST_WAIT_COUNT 300
+
+static pthread_mutex_t count_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int ended, cancelled, resumed;
+
+static void notification_cb(size_t msg_id, size_t client_id,
+			    SPDNotificationType type)
+{
+	pthread_mutex_lock(&count_mutex);
+	if (type == SPD_EVENT_END) {
+		ended++;
+	} else if (type == SPD_EVENT_CANCEL) {
+		cancelled++;
+	} else if (type == SPD_EVENT_RESUME) {
+		resumed++;
+	}
+	pthread_mutex_unlock(&count_mutex);
+}
+
+/* Kill one of our running output modules (but not a zygote), picked at
+   random. Returns its pid, or 0 if none is running. */
+static pid_t kill_random_module(void)
+{
+	pid_t pids[64];
+	int n = 0;
+	DIR *proc;
+	struct dirent *entry;
+	struct stat st;
+	char path[300], buf[256];
+	FILE *f;
+	size_t len;
+
+	proc = opendir("/proc");
+	if (proc == NULL)
+		return 0;
+	while ((entry = readdir(proc)) != NULL && n < 64) {
+		if (atoi(entry->d_name) <= 0)
+			continue;
+		snprintf(path, sizeof(path), "/proc/%s", entry->d_name);
+		if (stat(path, &st) != 0 || st.st_uid != getuid())
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/%s/cmdline", entry->d_name);
+		f = fopen(path, "r");
+		if (f == NULL)
+			continue;
+		len = fread(buf, 1, sizeof(buf) - 1, f);
+		fclose(f);
+		buf[len] = '\0';
+		/* Arguments are separated by NULs, the first is the binary */
+		if (strncmp(strrchr(buf, '/') ? strrchr(buf, '/') + 1 : buf,
+			    "sd_", 3) != 0)
+			continue;
+		if (strlen(buf) + 1 < len
+		    && strcmp(buf + strlen(buf) + 1, "--zygote") == 0)
+			continue;
+		pids[n++] = atoi(entry->d_name);
+	}
+	closedir(proc);
+
+	if (n == 0)
+		return 0;
+	n = pids[rand() % n];
+	kill(n, SIGKILL);
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	SPDConnection *conn;
+	char text[256];
+	int i, count, done, before;
+	pid_t pid;
+
+	conn = spd_open("test", "module_crash", NULL, SPD_MODE_THREADED);
+	if (conn == NULL) {
+		printf("Speech Dispatcher failed\n");
+		exit(1);
+	}
+
+	printf("Module crash recovery test\n\n");
+	printf("%d messages are queued while output modules are killed\n",
+	       MESSAGES);
+	printf("%d times at random points. Every message must end or be\n",
+	       KILLS);
+	printf("given up, and speech must go on afterwards.\n");
+	fflush(stdout);
+
+	conn->callback_end = notification_cb;
+	conn->callback_cancel = notification_cb;
+	conn->callback_resume = notification_cb;
+	if (spd_set_notification_on(conn, SPD_END) == -1
+	    || spd_set_notification_on(conn, SPD_CANCEL) == -1
+	    || spd_set_notification_on(conn, SPD_RESUME) == -1) {
+		printf("Can't set notifications\n");
+		exit(1);
+	}
+
+	srand(getpid());
+	for (i = 0; i < MESSAGES; i++) {
+		snprintf(text, sizeof(text),
+			 "This is message number %d. It has several sentences. "
+			 "The module may die while saying any of them. "
+			 "Speech should then go on from the last one.", i);
+		if (spd_say(conn, SPD_TEXT, text) == -1) {
+			printf("Message %d failed\n", i);
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < KILLS; i++) {
+		usleep(500000 + rand() % 2000000);
+		pid = kill_random_module();
+		printf("Killed module %d\n", (int)pid);
+		fflush(stdout);
+	}
+
+	count = 0;
+	do {
+		sleep(1);
+		pthread_mutex_lock(&count_mutex);
+		done = ended + cancelled;
+		pthread_mutex_unlock(&count_mutex);
+		if (count++ == TEST_WAIT_COUNT) {
+			printf("Only %d of %d messages finished\n", done,
+			       MESSAGES);
+			exit(1);
+		}
+	} while (done < MESSAGES);
+
+	printf("%d messages ended, %d given up, %d resumed\n", ended,
+	       cancelled, resumed);
+
+	/* Speech goes on after the crashes */
+	pthread_mutex_lock(&count_mutex);
+	before = ended;
+	pthread_mutex_unlock(&count_mutex);
+	if (spd_say(conn, SPD_TEXT, "Still speaking") == -1) {
+		printf("Final message failed\n");
+		exit(1);
+	}
+	count = 0;
+	do {
+		sleep(1);
+		pthread_mutex_lock(&count_mutex);
+		done = ended > before;
+		pthread_mutex_unlock(&count_mutex);
+		if (count++ == TEST_WAIT_COUNT) {
+			printf("Final message not spoken\n");
+			exit(1);
+		}
+	} while (!done);
+
+	spd_close(conn);
+	exit(ended > 0 ? 0 : 1);
+}
@@ -0,0 +1,268 @@
+
+/*
+ * overload_flood.c - Test of message latency while the server is flooded
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The degradation is off by default, the server should be run with
+ * e.g. OverloadQueueLength 50 and OverloadQueueDelay 3000.
+ *
+ * Two clients flood the server with blocks of TEXT and NOTIFICATION
+ * messages, which are all kept in the queues since they belong to a
+ * block, while another one sends IMPORTANT messages, which do not cancel
+ * the queued TEXT. This is done once with SET ALL OVERLOAD OFF as a
+ * reference and once with the degradation on. With it on, GET OVERLOAD
+ * must report that its steps switched on, and the IMPORTANT messages
+ * must start being spoken within MAX_LATENCY ms, and not later on
+ * average than without the degradation.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "speechd_types.h"
+#include <libspeechd.h>
+
+#define FLOOD_MESSAGES 1000
+#define PROBES 10
+/* Longest acceptable time from sending a probe to its BEGIN, in ms */
+#define MAX_LATENCY 3000
+/* How much later than without the degradation the probes may begin on
+   average, in ms */
+#define MAX_WORSE 100
+
+typedef struct {
+	SPDConnection *conn;
+	const char *priority;
+} TFlooder;
+
+typedef struct {
+	long average, max;
+	unsigned long activations;
+} TRun;
+
+static pthread_mutex_t probe_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t probe_cond = PTHREAD_COND_INITIALIZER;
+static int probe_begun;
+
+static long now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+static void begin_cb(size_t msg_id, size_t client_id, SPDNotificationType type)
+{
+	pthread_mutex_lock(&probe_mutex);
+	probe_begun = 1;
+	pthread_cond_signal(&probe_cond);
+	pthread_mutex_unlock(&probe_mutex);
+}
+
+static void command(SPDConnection * conn, char *cmd)
+{
+	if (spd_execute_command(conn, cmd) != 0) {
+		printf("%s failed\n", cmd);
+		exit(1);
+	}
+}
+
+/* Sends FLOOD_MESSAGES in a single block, where the priority can't be
+   set by spd_say() */
+static void *flood(void *arg)
+{
+	TFlooder *flooder = arg;
+	char cmd[64], text[128];
+	char *reply;
+	int i;
+
+	snprintf(cmd, sizeof(cmd), "SET SELF PRIORITY %s", flooder->priority);
+	command(flooder->conn, cmd);
+	command(flooder->conn, "BLOCK BEGIN");
+	for (i = 0; i < FLOOD_MESSAGES; i++) {
+		snprintf(text, sizeof(text),
+			 "Flood %s number %d: 1+1=2, (a|b) & c, 50%% off!\r\n.\r\n",
+			 flooder->priority, i);
+		command(flooder->conn, "SPEAK");
+		reply = spd_send_data(flooder->conn, text, SPD_WAIT_REPLY);
+		if (reply == NULL) {
+			printf("Flood message %d failed\n", i);
+			exit(1);
+		}
+		free(reply);
+	}
+	command(flooder->conn, "BLOCK END");
+	return NULL;
+}
+
+/* Total of the times the degradation steps were switched on */
+static unsigned long activations(SPDConnection * conn)
+{
+	char *reply = NULL, *p;
+	unsigned long total = 0;
+
+	if (spd_execute_command_with_reply(conn, "GET OVERLOAD", &reply) != 0) {
+		printf("GET OVERLOAD failed\n");
+		exit(1);
+	}
+	for (p = reply; (p = strstr(p, "activations=")) != NULL; p++)
+		total += strtoul(p + strlen("activations="), NULL, 10);
+	free(reply);
+	return total;
+}
+
+/* Floods the server while sending the probes, with the degradation
+   _enabled_ or not */
+static void run(TFlooder * flooders, SPDConnection * probe, int enabled,
+		TRun * result)
+{
+	pthread_t threads[2];
+	struct timespec deadline;
+	char text[64];
+	long sent, latency, total = 0;
+	unsigned long before;
+	int i, ret;
+
+	command(probe, enabled ? "SET ALL OVERLOAD ON" : "SET ALL OVERLOAD OFF");
+	before = activations(probe);
+	printf("\nDegradation %s:\n", enabled ? "on" : "off");
+
+	for (i = 0; i < 2; i++)
+		pthread_create(&threads[i], NULL, flood, &flooders[i]);
+
+	result->max = 0;
+	for (i = 0; i < PROBES; i++) {
+		usleep(300000);
+		snprintf(text, sizeof(text), "Message %d", i);
+
+		pthread_mutex_lock(&probe_mutex);
+		probe_begun = 0;
+		pthread_mutex_unlock(&probe_mutex);
+
+		sent = now_ms();
+		if (spd_say(probe, SPD_IMPORTANT, text) == -1) {
+			printf("%s failed\n", text);
+			exit(1);
+		}
+
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += 2 * MAX_LATENCY / 1000;
+		ret = 0;
+		pthread_mutex_lock(&probe_mutex);
+		while (!probe_begun && ret == 0)
+			ret = pthread_cond_timedwait(&probe_cond, &probe_mutex,
+						     &deadline);
+		pthread_mutex_unlock(&probe_mutex);
+
+		latency = now_ms() - sent;
+		printf("%s started after %ld ms\n", text, latency);
+		total += latency;
+		if (latency > result->max)
+			result->max = latency;
+	}
+	result->average = total / PROBES;
+
+	for (i = 0; i < 2; i++)
+		pthread_join(threads[i], NULL);
+	result->activations = activations(probe) - before;
+
+	for (i = 0; i < 2; i++)
+		spd_cancel(flooders[i].conn);
+	spd_cancel(probe);
+	/* Let the canceled messages go */
+	sleep(1);
+
+	printf("Average latency %ld ms, at most %ld ms, %lu steps switched "
+	       "on\n", result->average, result->max, result->activations);
+}
+
+int main(int argc, char *argv[])
+{
+	TFlooder flooders[2] = {
+		{NULL, "text"},
+		{NULL, "notification"},
+	};
+	SPDConnection *probe;
+	TRun off, on;
+	int ret = 0;
+
+	flooders[0].conn = spd_open("test", "overload_flood", "text_flooder",
+				    SPD_MODE_THREADED);
+	flooders[1].conn = spd_open("test", "overload_flood",
+				    "notification_flooder", SPD_MODE_THREADED);
+	probe = spd_open("test", "overload_flood", "probe", SPD_MODE_THREADED);
+	if (flooders[0].conn == NULL || flooders[1].conn == NULL
+	    || probe == NULL) {
+		printf("Speech Dispatcher failed\n");
+		exit(1);
+	}
+
+	printf("Overload test\n\n");
+	printf("Two clients flood the server with blocks of %d messages while\n",
+	       FLOOD_MESSAGES);
+	printf("another one sends %d IMPORTANT messages, each of which must\n",
+	       PROBES);
+	printf("start being spoken within %d ms with the degradation on, and\n",
+	       MAX_LATENCY);
+	printf("at most %d ms later on average than with it off.\n", MAX_WORSE);
+	fflush(stdout);
+
+	probe->callback_begin = begin_cb;
+	if (spd_set_notification_on(probe, SPD_BEGIN) == -1) {
+		printf("Can't set notifications\n");
+		exit(1);
+	}
+
+	run(flooders, probe, 0, &off);
+	run(flooders, probe, 1, &on);
+
+	spd_close(flooders[0].conn);
+	spd_close(flooders[1].conn);
+	spd_close(probe);
+
+	printf("\n");
+	if (off.activations != 0) {
+		printf("Degradation steps switched on while it was off\n");
+		ret = 1;
+	}
+	if (on.activations == 0) {
+		printf("No degradation step switched on, run the server with "
+		       "e.g. OverloadQueueLength 50\n");
+		ret = 1;
+	}
+	if (on.max > MAX_LATENCY) {
+		printf("Maximum latency %ld ms with the degradation on\n",
+		       on.max);
+		ret = 1;
+	}
+	if (on.average > off.average + MAX_WORSE) {
+		printf("Average latency %ld ms with the degradation on, %ld ms "
+		       "without\n", on.average, off.average);
+		ret = 1;
+	}
+	exit(ret);
+}
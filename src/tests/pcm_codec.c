@@ -0,0 +1,210 @@
+
+/*
+ * pcm_codec.c - Test of the codecs for cached sound of the modules
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: pcm_codec
+ *
+ * Packs and unpacks silence, a mix of tones, full-scale square waves and
+ * full-scale random noise, which takes the escape of the Rice codes, in
+ * lengths which are and are not multiples of the lossless blocks. The
+ * lossless codec must give the samples back exactly in no more space than
+ * raw, which it falls back to for the noise. The ADPCM one must keep the
+ * signal to noise ratio above what is given for each kind of sound once
+ * it had ADPCM_SETTLED samples to adapt. The packed size and the time
+ * taken to unpack a second of sound are reported for each.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+
+#include "module_utils_pcm.h"
+
+#define SAMPLE_RATE 22050
+/* Lengths around the 256 samples blocks of the lossless codec */
+static const int lengths[] = { 0, 1, 255, 256, 257, 1000, SAMPLE_RATE + 3 };
+
+/* ADPCM needs some samples to adapt to the sound, shorter ones are not
+   checked for their signal to noise ratio, unless it must be exact */
+#define ADPCM_SETTLED 1000
+
+/* How many times one second of sound is unpacked to time it */
+#define DECODE_ROUNDS 20
+/* Most time unpacking one second of sound may take, in ms */
+#define MAX_DECODE_MS 10.0
+
+/* The modules' debugging output, which is off */
+int Debug = 0;
+FILE *CustomDebugFile = NULL;
+
+typedef struct {
+	const char *name;
+	/* Lowest acceptable ADPCM signal to noise ratio, in dB */
+	double min_snr;
+} TSignal;
+
+static const TSignal signals[] = {
+	{"silence", INFINITY},
+	{"tones", 20.0},
+	{"square", 6.0},
+	{"noise", 10.0},
+};
+
+static void generate(int which, short *samples, int num_samples)
+{
+	int i;
+
+	srand(1);
+	for (i = 0; i < num_samples; i++) {
+		switch (which) {
+		case 0:
+			samples[i] = 0;
+			break;
+		case 1:
+			samples[i] = 8000 * sin(2 * M_PI * 220 * i / SAMPLE_RATE)
+			    + 4000 * sin(2 * M_PI * 660 * i / SAMPLE_RATE)
+			    + 2000 * sin(2 * M_PI * 1800 * i / SAMPLE_RATE);
+			break;
+		case 2:
+			/* 441 Hz */
+			samples[i] = (i / 25) % 2 ? -32768 : 32767;
+			break;
+		default:
+			samples[i] = (rand() & 0xffff) - 32768;
+		}
+	}
+}
+
+/* Signal to noise ratio of _decoded_ in dB, infinite if exact */
+static double snr(const short *samples, const short *decoded, int num_samples)
+{
+	double signal = 0, noise = 0, d;
+	int i;
+
+	for (i = 0; i < num_samples; i++) {
+		d = (double)samples[i] - decoded[i];
+		signal += (double)samples[i] * samples[i];
+		noise += d * d;
+	}
+	if (noise == 0)
+		return INFINITY;
+	return 10 * log10(signal / noise);
+}
+
+/* Packs and unpacks _samples_ with _codec_, returns 0 if fine */
+static int check(int which, const short *samples, int num_samples,
+		 EPcmCodec codec)
+{
+	static const char *codec_names[] = { "raw", "lossless", "adpcm" };
+	TPcmCacheStats stats;
+	TPcmPacked *packed;
+	short *decoded;
+	double ratio, cost, quality;
+	int i, rounds, ret = 0;
+
+	packed = module_pcm_pack(samples, num_samples, SAMPLE_RATE, codec);
+	if ((packed->codec != codec
+	     && !(codec == PCM_CODEC_LOSSLESS && packed->codec == PCM_CODEC_RAW))
+	    || packed->num_samples != num_samples) {
+		printf("%s %s: packed as %s with %d samples\n",
+		       signals[which].name, codec_names[codec],
+		       codec_names[packed->codec], packed->num_samples);
+		module_pcm_free(packed);
+		return 1;
+	}
+
+	/* Long enough sounds are unpacked several times to time them */
+	rounds = num_samples >= SAMPLE_RATE ? DECODE_ROUNDS : 1;
+	memset(&stats, 0, sizeof(stats));
+	decoded = NULL;
+	for (i = 0; i < rounds; i++) {
+		g_free(decoded);
+		decoded = module_pcm_unpack(packed, &stats);
+	}
+
+	quality = snr(samples, decoded, num_samples);
+	ratio = num_samples ? 100.0 * packed->size
+	    / (num_samples * sizeof(short)) : 0;
+	cost = stats.audio_seconds > 0
+	    ? 1000.0 * stats.decode_seconds / stats.audio_seconds : 0;
+	printf("%-8s %6d samples %-8s %5.1f%% of raw, %6.3f ms per second, "
+	       "SNR %.1f dB%s\n", signals[which].name, num_samples,
+	       codec_names[codec], ratio, cost, quality,
+	       packed->codec != codec ? ", kept raw" : "");
+
+	if (packed->size > num_samples * sizeof(short)) {
+		printf("  packed bigger than raw\n");
+		ret = 1;
+	}
+	if (codec != PCM_CODEC_ADPCM) {
+		if (num_samples
+		    && memcmp(samples, decoded, num_samples * sizeof(short))) {
+			printf("  the samples did not come back as they were\n");
+			ret = 1;
+		}
+	} else if ((num_samples >= ADPCM_SETTLED
+		    || isinf(signals[which].min_snr))
+		   && quality < signals[which].min_snr) {
+		printf("  expected an SNR of at least %.1f dB\n",
+		       signals[which].min_snr);
+		ret = 1;
+	}
+	if (rounds > 1 && cost > MAX_DECODE_MS) {
+		printf("  expected at most %.1f ms per second\n",
+		       MAX_DECODE_MS);
+		ret = 1;
+	}
+
+	g_free(decoded);
+	module_pcm_free(packed);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	short *samples;
+	int which, length, codec;
+	int errors = 0;
+
+	printf("PCM codecs test\n\n");
+	fflush(stdout);
+
+	for (which = 0; which < sizeof(signals) / sizeof(signals[0]); which++)
+		for (length = 0; length < sizeof(lengths) / sizeof(lengths[0]);
+		     length++) {
+			samples = g_new(short, lengths[length] + 1);
+			generate(which, samples, lengths[length]);
+			for (codec = PCM_CODEC_RAW; codec <= PCM_CODEC_ADPCM;
+			     codec++)
+				errors += check(which, samples,
+						lengths[length], codec);
+			g_free(samples);
+		}
+
+	if (errors)
+		printf("\n%d checks failed\n", errors);
+	exit(errors ? 1 : 0);
+}
@@ -0,0 +1,377 @@
+
+/*
+ * placement.c - Test of the CPU affinity and nice level of output modules
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: placement [module [cpus nice [module log]]]
+ *
+ * The server must run with the placement given in speechd.conf, by
+ * default the one of its examples:
+ *
+ *   ModuleCPUAffinity "2-3"
+ *   ModuleNice 5
+ *
+ * The module, espeak-ng by default, must be reported by GET PLACEMENT
+ * with that CPU list and nice level, and all of its threads, which are
+ * started after it was placed, must actually have them.
+ *
+ * A long message is then spoken on a quiet host, with a CPU hog on each
+ * online CPU the module is not placed on, and with one on each CPU it is
+ * placed on. The underruns the ALSA output logs meanwhile in the module
+ * log, by default the one in $XDG_RUNTIME_DIR/speech-dispatcher/log/, are
+ * counted for each. Keeping the module away from the hogs must keep it
+ * from getting more underruns than on the quiet host, the last run shows
+ * what happens without that. If the log can't be read, the runs are
+ * skipped.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "speechd_types.h"
+#include <libspeechd.h>
+
+#define STRESS_SENTENCE "This message keeps the output module busy while " \
+	"other programs take all the processor time they can get. "
+#define STRESS_TEXT STRESS_SENTENCE STRESS_SENTENCE STRESS_SENTENCE \
+	STRESS_SENTENCE STRESS_SENTENCE STRESS_SENTENCE STRESS_SENTENCE
+/* What the ALSA output logs for each underrun */
+#define UNDERRUN_LINE "ALSA: underrun "
+/* How long to wait for the message to be spoken, in seconds */
+#define EVENT_TIMEOUT 60
+
+static pthread_mutex_t event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t event_cond = PTHREAD_COND_INITIALIZER;
+static int ended;
+
+static void end_cb(size_t msg_id, size_t client_id, SPDNotificationType type)
+{
+	pthread_mutex_lock(&event_mutex);
+	ended = 1;
+	pthread_cond_signal(&event_cond);
+	pthread_mutex_unlock(&event_mutex);
+}
+
+/* Check thread _tid_ of _pid_, return 0 if it is placed on _cpus_ with
+   _nice_ */
+static int check_thread(int pid, const char *tid, const char *cpus, int nice)
+{
+	char path[128], line[1024], *p;
+	char thread_cpus[256] = "";
+	int thread_nice = 0, found = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/%d/task/%s/status", pid, tid);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return 0;	/* The thread is gone */
+	while (fgets(line, sizeof(line), f) != NULL)
+		if (sscanf(line, "Cpus_allowed_list: %255s", thread_cpus) == 1)
+			break;
+	fclose(f);
+
+	/* The nice level is the 19th field, the name before may have
+	   spaces */
+	snprintf(path, sizeof(path), "/proc/%d/task/%s/stat", pid, tid);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return 0;
+	if (fgets(line, sizeof(line), f) != NULL
+	    && (p = strrchr(line, ')')) != NULL
+	    && sscanf(p + 1, " %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s "
+		      "%*s %*s %*s %*s %*s %d", &thread_nice) == 1)
+		found = 1;
+	fclose(f);
+
+	printf("  thread %s: cpus=%s nice=%d\n", tid, thread_cpus,
+	       thread_nice);
+	return found && !strcmp(thread_cpus, cpus) && thread_nice == nice
+	    ? 0 : 1;
+}
+
+/* Parse a CPU list like "2-3" or "0,2", return 0 on success */
+static int parse_cpus(const char *list, cpu_set_t * set)
+{
+	const char *p = list;
+	char *end;
+	long first, last, cpu;
+
+	CPU_ZERO(set);
+	while (*p) {
+		first = strtol(p, &end, 10);
+		if (end == p || first < 0)
+			return -1;
+		last = first;
+		p = end;
+		if (*p == '-') {
+			p++;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first)
+				return -1;
+			p = end;
+		}
+		for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+			CPU_SET(cpu, set);
+		if (*p == ',')
+			p++;
+		else if (*p != '\0')
+			return -1;
+	}
+	return 0;
+}
+
+/* Count the underruns logged in _log_path_ so far, -1 if it can't be
+   read */
+static int count_underruns(const char *log_path)
+{
+	char line[1024];
+	int count = 0;
+	FILE *f;
+
+	f = fopen(log_path, "r");
+	if (f == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), f) != NULL)
+		if (strstr(line, UNDERRUN_LINE) != NULL)
+			count++;
+	fclose(f);
+	return count;
+}
+
+/* Start a busy loop on each online CPU of _cpus_, return how many */
+static int start_hogs(const cpu_set_t * cpus, pid_t * hogs)
+{
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+	cpu_set_t one;
+	int cpu, n = 0;
+
+	for (cpu = 0; cpu < online && cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, cpus))
+			continue;
+		hogs[n] = fork();
+		if (hogs[n] == -1) {
+			perror("fork");
+			exit(1);
+		}
+		if (hogs[n] == 0) {
+			CPU_ZERO(&one);
+			CPU_SET(cpu, &one);
+			sched_setaffinity(0, sizeof(one), &one);
+			for (;;) ;
+		}
+		n++;
+	}
+	return n;
+}
+
+static void stop_hogs(pid_t * hogs, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		kill(hogs[i], SIGKILL);
+		waitpid(hogs[i], NULL, 0);
+	}
+}
+
+/* Speak the stress text with hogs on _hog_cpus_ if not NULL, return the
+   underruns logged meanwhile */
+static int stress_run(SPDConnection * conn, const char *log_path,
+		      const char *what, const cpu_set_t * hog_cpus)
+{
+	static pid_t hogs[CPU_SETSIZE];
+	struct timespec deadline;
+	int n = 0, before, after;
+
+	before = count_underruns(log_path);
+	if (hog_cpus != NULL)
+		n = start_hogs(hog_cpus, hogs);
+
+	pthread_mutex_lock(&event_mutex);
+	ended = 0;
+	pthread_mutex_unlock(&event_mutex);
+	if (spd_say(conn, SPD_TEXT, STRESS_TEXT) == -1) {
+		stop_hogs(hogs, n);
+		printf("Can't speak\n");
+		exit(1);
+	}
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += EVENT_TIMEOUT;
+	pthread_mutex_lock(&event_mutex);
+	while (!ended && pthread_cond_timedwait(&event_cond, &event_mutex,
+						&deadline) == 0) ;
+	pthread_mutex_unlock(&event_mutex);
+
+	stop_hogs(hogs, n);
+	if (!ended) {
+		printf("The message was not spoken within %d s\n",
+		       EVENT_TIMEOUT);
+		exit(1);
+	}
+	/* Let the module write out the end of the playback */
+	sleep(1);
+	after = count_underruns(log_path);
+	printf("%s, %d CPU hogs: %d underruns\n", what, n, after - before);
+	return after - before;
+}
+
+/* Compare the underruns with and without CPU hogs, return 0 if the
+   placement keeps the module from getting more of them */
+static int stress(const char *module, const char *cpus,
+		  const char *log_path)
+{
+	SPDConnection *conn;
+	cpu_set_t module_cpus, other_cpus;
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+	int cpu, quiet, away, along;
+
+	printf("\nUnderruns logged in %s:\n", log_path);
+	if (count_underruns(log_path) == -1) {
+		printf("Can't read it, underruns not compared\n");
+		return 0;
+	}
+	if (parse_cpus(cpus, &module_cpus) != 0) {
+		printf("Bad CPU list %s\n", cpus);
+		return 1;
+	}
+	CPU_ZERO(&other_cpus);
+	for (cpu = 0; cpu < online && cpu < CPU_SETSIZE; cpu++)
+		if (!CPU_ISSET(cpu, &module_cpus))
+			CPU_SET(cpu, &other_cpus);
+
+	conn = spd_open("test", "placement", NULL, SPD_MODE_THREADED);
+	if (conn == NULL) {
+		printf("Speech Dispatcher failed\n");
+		exit(1);
+	}
+	conn->callback_end = end_cb;
+	conn->callback_cancel = end_cb;
+	if (spd_set_output_module(conn, module) == -1
+	    || spd_set_notification_on(conn, SPD_END) == -1
+	    || spd_set_notification_on(conn, SPD_CANCEL) == -1) {
+		printf("Can't set up the connection\n");
+		exit(1);
+	}
+
+	quiet = stress_run(conn, log_path, "Quiet host", NULL);
+	away = CPU_COUNT(&other_cpus)
+	    ? stress_run(conn, log_path, "Hogs on the other CPUs",
+			 &other_cpus) : quiet;
+	along = stress_run(conn, log_path, "Hogs on the module CPUs",
+			   &module_cpus);
+	spd_close(conn);
+
+	if (!CPU_COUNT(&other_cpus))
+		printf("The module may run on every CPU, nothing keeps it "
+		       "away from hogs\n");
+	else if (along > away)
+		printf("The placement saved %d underruns\n", along - away);
+	if (away > quiet) {
+		printf("Expected at most %d underruns with the hogs away\n",
+		       quiet);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	SPDConnection *conn;
+	const char *module = argc > 1 ? argv[1] : "espeak-ng";
+	const char *cpus = argc > 3 ? argv[2] : "2-3";
+	int nice = argc > 3 ? atoi(argv[3]) : 5;
+	char *reply = NULL, *line, prefix[64], reported_cpus[256];
+	char path[64], log_path[1024];
+	const char *runtime_dir;
+	int pid, reported_nice, errors = 0;
+	struct dirent *entry;
+	DIR *dir;
+
+	printf("Module placement test\n\n");
+	printf("%s and all its threads must run on CPUs %s with nice %d.\n\n",
+	       module, cpus, nice);
+	fflush(stdout);
+
+	conn = spd_open("test", "placement", NULL, SPD_MODE_SINGLE);
+	if (conn == NULL) {
+		printf("Speech Dispatcher failed\n");
+		exit(1);
+	}
+	if (spd_set_output_module(conn, module) == -1
+	    || spd_say(conn, SPD_TEXT, "Placement.") == -1) {
+		printf("Can't use module %s\n", module);
+		exit(1);
+	}
+	/* Let the module get the message and start its threads */
+	sleep(1);
+
+	if (spd_execute_command_with_reply(conn, "GET PLACEMENT", &reply) != 0) {
+		printf("GET PLACEMENT failed\n");
+		exit(1);
+	}
+	snprintf(prefix, sizeof(prefix), "251-%s pid=", module);
+	line = strstr(reply, prefix);
+	if (line == NULL
+	    || sscanf(line + strlen(prefix), "%d cpus=%255s nice=%d", &pid,
+		      reported_cpus, &reported_nice) != 3) {
+		printf("%s is not in:\n%s", module, reply);
+		exit(1);
+	}
+	free(reply);
+	spd_close(conn);
+
+	printf("Reported: pid=%d cpus=%s nice=%d\n", pid, reported_cpus,
+	       reported_nice);
+	if (strcmp(reported_cpus, cpus) || reported_nice != nice)
+		errors++;
+
+	snprintf(path, sizeof(path), "/proc/%d/task", pid);
+	dir = opendir(path);
+	if (dir == NULL) {
+		perror(path);
+		exit(1);
+	}
+	while ((entry = readdir(dir)) != NULL)
+		if (entry->d_name[0] != '.')
+			errors += check_thread(pid, entry->d_name, cpus, nice);
+	closedir(dir);
+
+	if (argc > 4) {
+		snprintf(log_path, sizeof(log_path), "%s", argv[4]);
+	} else {
+		runtime_dir = getenv("XDG_RUNTIME_DIR");
+		snprintf(log_path, sizeof(log_path),
+			 "%s/speech-dispatcher/log/%s.log",
+			 runtime_dir ? runtime_dir : "/tmp", module);
+	}
+	errors += stress(module, cpus, log_path);
+
+	exit(errors ? 1 : 0);
+}
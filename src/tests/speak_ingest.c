@@ -0,0 +1,224 @@
+
+/*
+ * speak_ingest.c - Benchmark of the reading of SPEAK commands by modules
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: speak_ingest [module [configuration]]
+ *
+ * Talks the output module protocol to the module itself, no server is
+ * needed, like module_close. The default is the dummy module of the build
+ * tree. Texts from 1 KB to 1 MB, with some lines escaped with a dot, are
+ * sent with SPEAK. The module has read all but what the pipe holds when
+ * the terminating dot line is sent, the time from then to the module
+ * answering 200, i.e. module_speak() having returned, is what finding the
+ * end of the text and handing it over costs. It is reported for each size
+ * with the throughput of the whole command.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define ROUNDS 5
+#define MIN_SIZE 1024
+#define MAX_SIZE (1024 * 1024)
+/* Longest acceptable time from the end of SPEAK to its 200, in ms */
+#define MAX_LATENCY 100
+/* After which the whole test is considered stuck, in seconds */
+#define TEST_TIMEOUT 120
+
+/* 64 bytes each */
+#define LINE "Text sent to the module in a single SPEAK command, to measure.\n"
+#define ESCAPED_LINE "..\n"
+/* Every how many lines one is escaped */
+#define ESCAPE_EVERY 32
+
+typedef struct {
+	pid_t pid;
+	FILE *to, *from;
+} TModule;
+
+static double now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void start_module(TModule * module, const char *path,
+			 const char *config)
+{
+	int to[2], from[2], null;
+
+	if (pipe(to) != 0 || pipe(from) != 0) {
+		perror("pipe");
+		exit(1);
+	}
+
+	module->pid = fork();
+	if (module->pid == -1) {
+		perror("fork");
+		exit(1);
+	}
+	if (module->pid == 0) {
+		dup2(to[0], 0);
+		dup2(from[1], 1);
+		null = open("/dev/null", O_WRONLY);
+		dup2(null, 2);
+		close(to[1]);
+		close(from[0]);
+		execl(path, path, config, (char *)NULL);
+		_exit(127);
+	}
+
+	close(to[0]);
+	close(from[1]);
+	module->to = fdopen(to[1], "w");
+	module->from = fdopen(from[0], "r");
+}
+
+/* Send _cmd_ if not NULL, wait for a reply line starting with one of the
+   codes in _codes_ and return which one, or exit if the module answers
+   with an error or goes away. Other event lines the module sends
+   meanwhile are skipped. */
+static int command(TModule * module, const char *cmd, const char *codes)
+{
+	char line[1024];
+	const char *code;
+	int which;
+
+	if (cmd != NULL) {
+		fputs(cmd, module->to);
+		fflush(module->to);
+	}
+	while (fgets(line, sizeof(line), module->from) != NULL) {
+		for (code = codes, which = 0; *code;
+		     code += strlen(code) + 1, which++)
+			if (!strncmp(line, code, strlen(code)))
+				return which;
+		if (line[0] == '3' || line[0] == '4') {
+			printf("%s answered %s", cmd ? cmd : "SPEAK", line);
+			exit(1);
+		}
+	}
+	printf("The module went away after %s", cmd ? cmd : "SPEAK");
+	exit(1);
+}
+
+/* Fill _text_ with _size_ bytes of whole lines */
+static void make_text(char *text, size_t size)
+{
+	size_t len = 0;
+	int i;
+
+	for (i = 0; len + strlen(LINE) <= size; i++) {
+		if (i % ESCAPE_EVERY == ESCAPE_EVERY - 1) {
+			strcpy(text + len, ESCAPED_LINE);
+			len += strlen(ESCAPED_LINE);
+		} else {
+			strcpy(text + len, LINE);
+			len += strlen(LINE);
+		}
+	}
+	text[len] = '\0';
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = argc > 1 ? argv[1] : MODULEBUILDDIR "/sd_dummy";
+	const char *config = argc > 2 ? argv[2] : NULL;
+	TModule module;
+	char *text;
+	double start, end, latency, total, sum, max, max_all = 0;
+	size_t size, len;
+	int i;
+
+	alarm(TEST_TIMEOUT);
+
+	printf("SPEAK ingest benchmark\n\n");
+	printf("%s must answer a SPEAK of up to %d KB within %d ms of\n",
+	       path, MAX_SIZE / 1024, MAX_LATENCY);
+	printf("the end of its text.\n\n");
+	fflush(stdout);
+
+	text = malloc(MAX_SIZE + 1);
+	if (text == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+
+	start_module(&module, path, config);
+	command(&module, "INIT\n", "299 \0");
+
+	for (size = MIN_SIZE; size <= MAX_SIZE; size *= 4) {
+		make_text(text, size);
+		len = strlen(text);
+		sum = 0;
+		max = 0;
+		total = 0;
+		for (i = 0; i < ROUNDS; i++) {
+			start = now_ms();
+			command(&module, "SPEAK\n", "202\0");
+			/* Blocks until the module has read all but what the
+			   pipe holds */
+			fwrite(text, 1, len, module.to);
+			fflush(module.to);
+			end = now_ms();
+			command(&module, ".\n", "200\0");
+			latency = now_ms() - end;
+			total += now_ms() - start;
+			sum += latency;
+			if (latency > max)
+				max = latency;
+
+			/* The module takes the next message once done with
+			   this one, which may have ended by itself already */
+			if (command(&module, NULL, "701\0" "702\0" "703\0") == 0)
+				command(&module, "STOP\n", "702\0" "703\0");
+		}
+		printf("%7zu bytes: %7.3f ms on average, %7.3f ms at most "
+		       "from the end of SPEAK to 200, %6.1f MB/s\n", len,
+		       sum / ROUNDS, max, total > 0
+		       ? ROUNDS * len / 1024.0 / 1024.0 / (total / 1000.0) : 0);
+		fflush(stdout);
+		if (max > max_all)
+			max_all = max;
+	}
+
+	command(&module, "QUIT\n", "210\0");
+	fclose(module.to);
+	waitpid(module.pid, NULL, 0);
+	fclose(module.from);
+	free(text);
+
+	if (max_all > MAX_LATENCY) {
+		printf("Expected at most %d ms\n", MAX_LATENCY);
+		exit(1);
+	}
+	exit(0);
+}
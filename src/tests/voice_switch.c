@@ -0,0 +1,178 @@
+
+/*
+ * voice_switch.c - Benchmark of switching the language, voice and rate
+ *
+ * Copyright (C) 2024 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: voice_switch [module [language1 language2]]
+ *
+ * The default is espeak-ng switching between en and fr. With debugging
+ * of the module on, its log shows each time it selects a voice. For
+ * ibmtts, ibmtts_voice_switch checks the engine work of the same switch
+ * over the fake IBM TTS library, without a server.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#include "speechd_types.h"
+#include <libspeechd.h>
+
+#define ROUNDS 10
+/* How long to wait for a single event, in seconds */
+#define EVENT_TIMEOUT 30
+/* Longest acceptable extra time to the BEGIN of a message which switches
+   the language, voice and rate, in ms */
+#define MAX_SWITCH 500
+
+static pthread_mutex_t event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t event_cond = PTHREAD_COND_INITIALIZER;
+static SPDNotificationType last_event = -1;
+
+static long now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+static void event_cb(size_t msg_id, size_t client_id, SPDNotificationType type)
+{
+	pthread_mutex_lock(&event_mutex);
+	last_event = type;
+	pthread_cond_signal(&event_cond);
+	pthread_mutex_unlock(&event_mutex);
+}
+
+/* Wait for event _type_, return 0 on success */
+static int wait_event(SPDNotificationType type)
+{
+	struct timespec deadline;
+	int ret = 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += EVENT_TIMEOUT;
+	pthread_mutex_lock(&event_mutex);
+	while (last_event != type && ret == 0)
+		ret = pthread_cond_timedwait(&event_cond, &event_mutex,
+					     &deadline);
+	ret = last_event == type ? 0 : -1;
+	pthread_mutex_unlock(&event_mutex);
+	return ret;
+}
+
+/* Speak a message, switching to _language_, _voice_ and _rate_ first
+   if _language_ is not NULL, return how long it took to begin in ms */
+static long speak(SPDConnection * conn, const char *language,
+		  SPDVoiceType voice, int rate)
+{
+	long start, begun;
+
+	pthread_mutex_lock(&event_mutex);
+	last_event = -1;
+	pthread_mutex_unlock(&event_mutex);
+
+	start = now_ms();
+	if (language != NULL
+	    && (spd_set_language(conn, language) == -1
+		|| spd_set_voice_type(conn, voice) == -1
+		|| spd_set_voice_rate(conn, rate) == -1)) {
+		printf("Can't switch to %s\n", language);
+		exit(1);
+	}
+	if (spd_say(conn, SPD_TEXT, "Switch.") == -1) {
+		printf("Message failed\n");
+		exit(1);
+	}
+	if (wait_event(SPD_EVENT_BEGIN) != 0) {
+		printf("Message did not begin\n");
+		exit(1);
+	}
+	begun = now_ms() - start;
+	if (wait_event(SPD_EVENT_END) != 0) {
+		printf("Message did not end\n");
+		exit(1);
+	}
+	return begun;
+}
+
+int main(int argc, char *argv[])
+{
+	SPDConnection *conn;
+	const char *module = argc > 1 ? argv[1] : "espeak-ng";
+	const char *languages[2] = {
+		argc > 3 ? argv[2] : "en",
+		argc > 3 ? argv[3] : "fr"
+	};
+	long same = 0, switched = 0, max_switched = 0, elapsed;
+	int i;
+
+	conn = spd_open("test", "voice_switch", NULL, SPD_MODE_THREADED);
+	if (conn == NULL) {
+		printf("Speech Dispatcher failed\n");
+		exit(1);
+	}
+
+	printf("Voice switch benchmark\n\n");
+	printf("Messages on %s switching between %s and %s together with\n",
+	       module, languages[0], languages[1]);
+	printf("the voice type and rate must begin at most %d ms later on\n",
+	       MAX_SWITCH);
+	printf("average than messages with unchanged settings.\n\n");
+	fflush(stdout);
+
+	conn->callback_begin = event_cb;
+	conn->callback_end = event_cb;
+	if (spd_set_notification_on(conn, SPD_BEGIN) == -1
+	    || spd_set_notification_on(conn, SPD_END) == -1) {
+		printf("Can't set notifications\n");
+		exit(1);
+	}
+	if (spd_set_output_module(conn, module) == -1) {
+		printf("Can't use module %s\n", module);
+		exit(1);
+	}
+
+	/* Get the module started and the first voice loaded */
+	speak(conn, languages[0], SPD_MALE1, 0);
+
+	for (i = 0; i < ROUNDS; i++) {
+		same += speak(conn, NULL, SPD_MALE1, 0);
+		elapsed = speak(conn, languages[(i + 1) % 2],
+				i % 2 ? SPD_MALE1 : SPD_FEMALE1,
+				i % 2 ? 0 : 50);
+		switched += elapsed;
+		if (elapsed > max_switched)
+			max_switched = elapsed;
+	}
+
+	spd_close(conn);
+
+	printf("Unchanged settings: %ld ms to begin on average\n",
+	       same / ROUNDS);
+	printf("Switched settings: %ld ms to begin on average, %ld ms at most\n",
+	       switched / ROUNDS, max_switched);
+	exit((switched - same) / ROUNDS <= MAX_SWITCH ? 0 : 1);
+}